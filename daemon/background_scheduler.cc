@@ -0,0 +1,182 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include "config.h"
+#include "background_scheduler.h"
+
+#include <stdexcept>
+#include <string>
+#include <time.h>
+
+/**
+ * Get the CPU time used by the calling thread (in usec), or 0 if it isn't
+ * supported on the platform
+ */
+static uint64_t get_thread_cputime() {
+#ifdef CLOCK_THREAD_CPUTIME_ID
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+        return uint64_t(ts.tv_sec) * 1000000 + uint64_t(ts.tv_nsec) / 1000;
+    }
+#endif
+    return 0;
+}
+
+BackgroundScheduler::BackgroundScheduler(size_t nthreads)
+    : nextId(1),
+      shutdown(false) {
+    if (nthreads == 0) {
+        throw std::invalid_argument(
+            "BackgroundScheduler: number of threads must be non-zero");
+    }
+
+    threads.reserve(nthreads);
+    for (size_t ii = 0; ii < nthreads; ++ii) {
+        cb_thread_t tid;
+        const std::string name = "mc:background_" + std::to_string(ii);
+        if (cb_create_named_thread(&tid, threadMain, this, 0,
+                                   name.c_str()) != 0) {
+            if (threads.empty()) {
+                throw std::runtime_error(
+                    "BackgroundScheduler: Failed to create thread");
+            }
+            // Make do with the ones we've got
+            break;
+        }
+        threads.push_back(tid);
+    }
+}
+
+BackgroundScheduler::~BackgroundScheduler() {
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        shutdown = true;
+        cond.notify_all();
+    }
+
+    for (auto& tid : threads) {
+        cb_join_thread(tid);
+    }
+}
+
+uint64_t BackgroundScheduler::schedule(const std::string& name,
+                                       Callback callback,
+                                       std::chrono::milliseconds delay,
+                                       std::chrono::milliseconds period) {
+    std::shared_ptr<Task> task(new Task);
+    task->name = name;
+    task->callback = std::move(callback);
+    task->period = period;
+
+    std::lock_guard<std::mutex> guard(mutex);
+    task->id = nextId++;
+    tasks[task->id] = task;
+    timeline.emplace(Clock::now() + delay, task->id);
+    cond.notify_one();
+    return task->id;
+}
+
+bool BackgroundScheduler::cancel(uint64_t id) {
+    std::unique_lock<std::mutex> lock(mutex);
+    bool found = tasks.erase(id) > 0;
+
+    auto iter = running.find(id);
+    if (iter != running.end() && iter->second == cb_thread_self()) {
+        // The task is cancelling itself
+        return true;
+    }
+
+    while (running.count(id) > 0) {
+        found = true;
+        done.wait(lock);
+    }
+
+    return found;
+}
+
+std::map<std::string, BackgroundScheduler::TaskStats>
+BackgroundScheduler::getStats() const {
+    std::lock_guard<std::mutex> guard(mutex);
+    return stats;
+}
+
+size_t BackgroundScheduler::getNumScheduled() const {
+    std::lock_guard<std::mutex> guard(mutex);
+    return tasks.size();
+}
+
+void BackgroundScheduler::threadMain(void* arg) {
+    reinterpret_cast<BackgroundScheduler*>(arg)->run();
+}
+
+void BackgroundScheduler::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!shutdown) {
+        if (timeline.empty()) {
+            cond.wait(lock);
+            continue;
+        }
+
+        const auto next = timeline.top();
+        if (next.first > Clock::now()) {
+            cond.wait_until(lock, next.first);
+            continue;
+        }
+        timeline.pop();
+
+        auto iter = tasks.find(next.second);
+        if (iter == tasks.end()) {
+            // Cancelled
+            continue;
+        }
+
+        auto task = iter->second;
+        running[task->id] = cb_thread_self();
+        lock.unlock();
+
+        const auto start = Clock::now();
+        const auto cpustart = get_thread_cputime();
+        bool again;
+        try {
+            again = task->callback();
+        } catch (...) {
+            again = false;
+        }
+        const auto cputime = get_thread_cputime() - cpustart;
+        const auto runtime = std::chrono::duration_cast<
+            std::chrono::microseconds>(Clock::now() - start).count();
+
+        lock.lock();
+        running.erase(task->id);
+
+        auto& st = stats[task->name];
+        st.runs++;
+        st.runtime += uint64_t(runtime);
+        st.cputime += cputime;
+        if (uint64_t(runtime) > st.max_runtime) {
+            st.max_runtime = uint64_t(runtime);
+        }
+
+        if (tasks.count(task->id) > 0) {
+            if (again) {
+                timeline.emplace(Clock::now() + task->period, task->id);
+            } else {
+                tasks.erase(task->id);
+            }
+        }
+        done.notify_all();
+    }
+}
@@ -0,0 +1,176 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * The BackgroundScheduler runs the daemon's (and the engines') background
+ * jobs on a fixed set of threads, instead of having each job create (and
+ * tear down) its own thread. Tasks may run once, or periodically for as
+ * long as the task asks to be run again.
+ *
+ * The scheduler keeps track of the number of runs and the time spent
+ * in each task (by name) so that the CPU used by background work is
+ * visible through "stats background".
+ */
+#pragma once
+
+#include <platform/platform.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class BackgroundScheduler {
+public:
+    /**
+     * The task to run. Returns true if the task should be run again
+     * (after the period it was scheduled with), false if it is done.
+     */
+    typedef std::function<bool()> Callback;
+
+    /**
+     * The accumulated statistics for all tasks with the same name
+     */
+    struct TaskStats {
+        TaskStats()
+            : runs(0),
+              runtime(0),
+              cputime(0),
+              max_runtime(0) {
+        }
+
+        /** The number of times the task was run */
+        uint64_t runs;
+        /** The wall clock time spent running the task (usec) */
+        uint64_t runtime;
+        /** The CPU time used by the task (usec) */
+        uint64_t cputime;
+        /** The longest run (usec) */
+        uint64_t max_runtime;
+    };
+
+    /**
+     * Create the scheduler and start its threads
+     *
+     * @param threads the number of threads to run the tasks on
+     */
+    BackgroundScheduler(size_t threads);
+
+    BackgroundScheduler(const BackgroundScheduler&) = delete;
+
+    /**
+     * Stop the threads. Tasks which aren't running are dropped, and
+     * the running ones are waited for.
+     */
+    ~BackgroundScheduler();
+
+    /**
+     * Schedule a task
+     *
+     * @param name the name of the task (used in the stats)
+     * @param callback the task to run
+     * @param delay the time to wait before the first run
+     * @param period the time to wait between the runs (when the callback
+     *               returns true)
+     * @return the id of the task (never 0)
+     */
+    uint64_t schedule(const std::string& name,
+                      Callback callback,
+                      std::chrono::milliseconds delay,
+                      std::chrono::milliseconds period);
+
+    /**
+     * Cancel a task. If the task is running on another thread we wait
+     * for it to return (so that the caller may release the resources
+     * used by the task when cancel returns).
+     *
+     * @param id the id returned from schedule
+     * @return true if the task was scheduled (or running)
+     */
+    bool cancel(uint64_t id);
+
+    /**
+     * Get the statistics for the tasks
+     */
+    std::map<std::string, TaskStats> getStats() const;
+
+    /**
+     * Get the number of tasks waiting to be run
+     */
+    size_t getNumScheduled() const;
+
+    /**
+     * Get the number of threads running the tasks
+     */
+    size_t getNumThreads() const {
+        return threads.size();
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Task {
+        uint64_t id;
+        std::string name;
+        Callback callback;
+        std::chrono::milliseconds period;
+    };
+
+    /**
+     * The main loop for the threads
+     */
+    void run();
+
+    static void threadMain(void* arg);
+
+    /** Protects all of the members below (and the stats) */
+    mutable std::mutex mutex;
+
+    /** Signalled when a task is scheduled, or shutdown is requested */
+    std::condition_variable cond;
+
+    /** Signalled when a task returns (for cancel()) */
+    std::condition_variable done;
+
+    /** All of the scheduled tasks, by id */
+    std::unordered_map<uint64_t, std::shared_ptr<Task>> tasks;
+
+    /**
+     * The time each task should run next. Cancelled tasks are removed
+     * from "tasks" and skipped when they reach the head of the queue.
+     */
+    typedef std::pair<Clock::time_point, uint64_t> Entry;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> timeline;
+
+    /** The tasks being run (and the thread running them) */
+    std::unordered_map<uint64_t, cb_thread_t> running;
+
+    /** The next id to hand out */
+    uint64_t nextId;
+
+    bool shutdown;
+
+    std::map<std::string, TaskStats> stats;
+
+    std::vector<cb_thread_t> threads;
+};
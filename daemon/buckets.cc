@@ -32,6 +32,9 @@ Bucket::Bucket(const Bucket& other)
     stats = other.stats;
     timings = other.timings;
     subjson_operation_times = other.subjson_operation_times;
+    weight = other.weight.load();
+    sched_delay = other.sched_delay;
+    rate_limiter = other.rate_limiter;
     topkeys = other.topkeys;
 
     cb_mutex_exit(&other.mutex);
@@ -23,9 +23,11 @@
 #include <platform/thread.h>
 
 #include "connection.h"
+#include "settings.h"
 #include "cookie.h"
 #include "function_chain.h"
 #include "mcbp_validators.h"
+#include "rate_limiter.h"
 #include "timings.h"
 #include "topkeys.h"
 #include "task.h"
@@ -90,6 +92,8 @@ public:
           state(BucketState::None),
           type(BucketType::Unknown),
           stats(nullptr),
+          weight(Settings::default_bucket_weight),
+          rate_limiter(nullptr),
           topkeys(nullptr)
     {
         std::memset(name, 0, sizeof(name));
@@ -179,6 +183,24 @@ public:
      */
     TimingHistogram subjson_operation_times;
 
+    /**
+     * The weight of the bucket when the worker threads share their time
+     * between the buckets (from the "bucket_weights" setting).
+     */
+    std::atomic<uint32_t> weight;
+
+    /**
+     * The time connections bound to the bucket spent waiting to be
+     * served by their worker thread after they yielded or their pending
+     * io completed.
+     */
+    TimingHistogram sched_delay;
+
+    /**
+     * The rate limits for the bucket (from the "bucket_limits" setting)
+     */
+    RateLimiter* rate_limiter;
+
     /**
      * Topkeys
      */
@@ -0,0 +1,309 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include "config.h"
+#include "compression.h"
+#include "settings.h"
+
+#include <array>
+#include <cstring>
+#include <list>
+#include <memcached/protocol_binary.h>
+#include <mutex>
+#include <snappy-c.h>
+#include <unordered_map>
+#include <utility>
+
+#ifdef HAVE_LIBLZ4
+#include <lz4.h>
+#endif
+
+const char* to_string(const CompressionCodec codec) {
+    switch (codec) {
+    case CompressionCodec::None:
+        return "none";
+    case CompressionCodec::Snappy:
+        return "snappy";
+    case CompressionCodec::Lz4:
+        return "lz4";
+    }
+    return "unknown";
+}
+
+bool compression_codec_supported(const CompressionCodec codec) {
+    switch (codec) {
+    case CompressionCodec::None:
+        return false;
+    case CompressionCodec::Snappy:
+        return true;
+    case CompressionCodec::Lz4:
+#ifdef HAVE_LIBLZ4
+        return true;
+#else
+        return false;
+#endif
+    }
+    return false;
+}
+
+bool compression_deflate(const CompressionCodec codec, const char* data,
+                         size_t nbytes, std::string& out) {
+    try {
+        switch (codec) {
+        case CompressionCodec::None:
+            return false;
+
+        case CompressionCodec::Snappy: {
+            size_t length = snappy_max_compressed_length(nbytes);
+            out.resize(length);
+            if (snappy_compress(data, nbytes, &out[0], &length) != SNAPPY_OK) {
+                return false;
+            }
+            out.resize(length);
+            return true;
+        }
+
+        case CompressionCodec::Lz4: {
+#ifdef HAVE_LIBLZ4
+            if (nbytes > size_t(LZ4_MAX_INPUT_SIZE)) {
+                return false;
+            }
+            const int bound = LZ4_compressBound(int(nbytes));
+            const uint32_t length = htonl(uint32_t(nbytes));
+            out.resize(sizeof(length) + size_t(bound));
+            memcpy(&out[0], &length, sizeof(length));
+            const int nw = LZ4_compress_default(data, &out[sizeof(length)],
+                                                int(nbytes), bound);
+            if (nw <= 0) {
+                return false;
+            }
+            out.resize(sizeof(length) + size_t(nw));
+            return true;
+#else
+            return false;
+#endif
+        }
+        }
+    } catch (const std::bad_alloc&) {
+    }
+    return false;
+}
+
+bool compression_inflate(const CompressionCodec codec, const char* data,
+                         size_t nbytes, std::string& out) {
+    try {
+        switch (codec) {
+        case CompressionCodec::None:
+            return false;
+
+        case CompressionCodec::Snappy: {
+            size_t length;
+            if (snappy_uncompressed_length(data, nbytes,
+                                           &length) != SNAPPY_OK) {
+                return false;
+            }
+            out.resize(length);
+            if (snappy_uncompress(data, nbytes, &out[0],
+                                  &length) != SNAPPY_OK) {
+                return false;
+            }
+            out.resize(length);
+            return true;
+        }
+
+        case CompressionCodec::Lz4: {
+#ifdef HAVE_LIBLZ4
+            uint32_t length;
+            if (nbytes < sizeof(length)) {
+                return false;
+            }
+            memcpy(&length, data, sizeof(length));
+            length = ntohl(length);
+            if (length > uint32_t(LZ4_MAX_INPUT_SIZE)) {
+                return false;
+            }
+            out.resize(length);
+            const int nr = LZ4_decompress_safe(data + sizeof(length), &out[0],
+                                               int(nbytes - sizeof(length)),
+                                               int(length));
+            return nr >= 0 && uint32_t(nr) == length;
+#else
+            return false;
+#endif
+        }
+        }
+    } catch (const std::bad_alloc&) {
+    }
+    return false;
+}
+
+namespace {
+/**
+ * One shard of the cache: a map from the identity of the value to its
+ * position in the LRU list (most recently used first)
+ */
+class CompressionCacheShard {
+public:
+    CompressionCacheShard()
+        : bytes(0) {
+    }
+
+    bool lookup(const std::string& key, CompressedValue& value) {
+        std::lock_guard<std::mutex> guard(mutex);
+        auto iter = index.find(key);
+        if (iter == index.end()) {
+            return false;
+        }
+        lru.splice(lru.begin(), lru, iter->second);
+        value = iter->second->second;
+        return true;
+    }
+
+    void insert(const std::string& key, CompressedValue value, size_t limit) {
+        const size_t size = entrySize(key, value);
+        if (size > limit) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> guard(mutex);
+        if (index.find(key) != index.end()) {
+            // Another thread compressed the same value
+            return;
+        }
+
+        lru.emplace_front(key, std::move(value));
+        index[key] = lru.begin();
+        bytes += size;
+
+        while (bytes > limit) {
+            auto& victim = lru.back();
+            bytes -= entrySize(victim.first, victim.second);
+            index.erase(victim.first);
+            lru.pop_back();
+        }
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> guard(mutex);
+        index.clear();
+        lru.clear();
+        bytes = 0;
+    }
+
+    void getStats(size_t& nitems, size_t& nbytes) {
+        std::lock_guard<std::mutex> guard(mutex);
+        nitems += index.size();
+        nbytes += bytes;
+    }
+
+private:
+    static size_t entrySize(const std::string& key,
+                            const CompressedValue& value) {
+        // Account for the list node and the hash table entry as well
+        static const size_t overhead = 64;
+        return overhead + 2 * key.size() + (value ? value->size() : 0);
+    }
+
+    typedef std::list<std::pair<std::string, CompressedValue>> LruList;
+
+    std::mutex mutex;
+    LruList lru;
+    std::unordered_map<std::string, LruList::iterator> index;
+    size_t bytes;
+};
+
+const size_t nshards = 16;
+std::array<CompressionCacheShard, nshards> shards;
+}
+
+CompressedValue compression_get_value(int bucket, const CompressionCodec codec,
+                                      const item_info& info, bool& cached) {
+    cached = false;
+    const size_t limit = settings.getCompressionCacheSize() / nshards;
+    const char* data = static_cast<const char*>(info.value[0].iov_base);
+    size_t nbytes = info.value[0].iov_len;
+
+    std::string key;
+    CompressionCacheShard* shard = nullptr;
+    // The cache relies on the CAS changing on every mutation. Engines
+    // which don't use CAS (the default engine with use_cas=false) return
+    // 0 for all items, so their values are compressed every time.
+    if (limit > 0 && info.cas != 0) {
+        const uint8_t c = uint8_t(codec);
+        key.reserve(sizeof(bucket) + sizeof(c) + sizeof(info.cas) + info.nkey);
+        key.append(reinterpret_cast<const char*>(&bucket), sizeof(bucket));
+        key.append(reinterpret_cast<const char*>(&c), sizeof(c));
+        key.append(reinterpret_cast<const char*>(&info.cas), sizeof(info.cas));
+        key.append(static_cast<const char*>(info.key), info.nkey);
+
+        shard = &shards[std::hash<std::string>()(key) % nshards];
+        CompressedValue value;
+        if (shard->lookup(key, value)) {
+            cached = true;
+            return value;
+        }
+    }
+
+    const bool snappy = (info.datatype & PROTOCOL_BINARY_DATATYPE_COMPRESSED) ==
+                        PROTOCOL_BINARY_DATATYPE_COMPRESSED;
+    std::string inflated;
+    if (snappy) {
+        if (!compression_inflate(CompressionCodec::Snappy, data, nbytes,
+                                 inflated)) {
+            return CompressedValue();
+        }
+        data = inflated.data();
+        nbytes = inflated.size();
+    }
+
+    std::shared_ptr<std::string> out;
+    try {
+        out = std::make_shared<std::string>();
+    } catch (const std::bad_alloc&) {
+        return CompressedValue();
+    }
+    if (!compression_deflate(codec, data, nbytes, *out)) {
+        return CompressedValue();
+    }
+
+    CompressedValue ret;
+    if (snappy || out->size() < info.value[0].iov_len) {
+        ret = std::move(out);
+    }
+
+    if (shard != nullptr) {
+        try {
+            shard->insert(key, ret, limit);
+        } catch (const std::bad_alloc&) {
+            // The value just won't be cached
+        }
+    }
+    return ret;
+}
+
+void compression_cache_clear() {
+    for (auto& shard : shards) {
+        shard.clear();
+    }
+}
+
+void compression_cache_get_stats(size_t& items, size_t& bytes) {
+    items = 0;
+    bytes = 0;
+    for (auto& shard : shards) {
+        shard.getStats(items, bytes);
+    }
+}
@@ -0,0 +1,116 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Compression of the values sent to clients which asked for it in HELLO
+ * (PROTOCOL_BINARY_FEATURE_COMPRESSION_SNAPPY or _LZ4).
+ *
+ * The items are owned by the engines, so the compressed values are kept
+ * in a cache in the core instead. The cache is identified by the bucket,
+ * the codec, the key and the CAS of the item. The CAS changes on every
+ * mutation so a cached value is never sent for another version of the
+ * item; the stale entries are simply evicted as the least recently used
+ * ones once the cache reaches "compression_cache_size" bytes.
+ *
+ * The cache is split in shards (each with its own lock) to avoid
+ * contention between the worker threads.
+ */
+#pragma once
+
+#include <memcached/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+/**
+ * The codecs a client may ask for in HELLO
+ */
+enum class CompressionCodec : uint8_t {
+    None,
+    Snappy,
+    Lz4
+};
+
+const char* to_string(const CompressionCodec codec);
+
+/**
+ * Is the codec available in this build (LZ4 is optional)
+ */
+bool compression_codec_supported(const CompressionCodec codec);
+
+/**
+ * A compressed value, shared by the cache and the connections sending it
+ */
+typedef std::shared_ptr<const std::string> CompressedValue;
+
+/**
+ * Compress the data with the codec. LZ4 blocks don't carry the size of
+ * the data, so they're prefixed with it (32 bits in network byte order).
+ *
+ * @param codec the codec to use
+ * @param data the data to compress
+ * @param nbytes the number of bytes in data
+ * @param out where to store the compressed data
+ * @return true on success
+ */
+bool compression_deflate(const CompressionCodec codec, const char* data,
+                         size_t nbytes, std::string& out);
+
+/**
+ * Inflate data compressed with compression_deflate (or a snappy
+ * compressed value stored by a client)
+ *
+ * @param codec the codec the data is compressed with
+ * @param data the compressed data
+ * @param nbytes the number of bytes in data
+ * @param out where to store the inflated data
+ * @return true on success, false if the data is corrupt
+ */
+bool compression_inflate(const CompressionCodec codec, const char* data,
+                         size_t nbytes, std::string& out);
+
+/**
+ * Get the value of the item in the codec, from the cache if it is there.
+ *
+ * A value stored compressed by the client is snappy compressed, and is
+ * inflated before it is compressed with the codec (it should be sent as
+ * it is to clients using snappy). Items with a CAS of 0 (from an engine
+ * not using CAS) bypass the cache.
+ *
+ * @param bucket the index of the bucket the item belongs to
+ * @param codec the codec to use
+ * @param info the key, CAS, datatype and value of the item
+ * @param cached set to true if the value was found in the cache
+ * @return the compressed value, or an empty pointer if compression
+ *         doesn't make a value which isn't compressed any smaller (which
+ *         is cached as well) or if a compressed value is corrupt
+ */
+CompressedValue compression_get_value(int bucket, const CompressionCodec codec,
+                                      const item_info& info, bool& cached);
+
+/**
+ * Drop all of the values in the cache (used when the cache is resized
+ * and when a bucket is deleted)
+ */
+void compression_cache_clear();
+
+/**
+ * Get the number of values and bytes in the cache
+ */
+void compression_cache_get_stats(size_t& items, size_t& bytes);
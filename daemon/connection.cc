@@ -19,11 +19,17 @@
 #include "runtime.h"
 #include "statemachine_mcbp.h"
 
+#include <cstddef>
+#include <cstring>
 #include <exception>
 #include <utilities/protocol2text.h>
 #include <platform/checked_snprintf.h>
 #include <platform/strerror.h>
 
+#ifndef WIN32
+#include <sys/un.h>
+#endif
+
 const char* to_string(const Connection::Priority& priority) {
     switch (priority) {
     case Connection::Priority::High:
@@ -61,9 +67,11 @@ Connection::Connection(SOCKET sfd, event_base* b)
       username("unknown"),
       nodelay(false),
       refcount(0),
-      engine_storage(nullptr),
       next(nullptr),
+      pending_io(false),
+      pending_next(nullptr),
       thread(nullptr),
+      migrating(false),
       parent_port(0),
       bucketIndex(0),
       bucketEngine(nullptr),
@@ -80,8 +88,14 @@ Connection::Connection(SOCKET sock,
                        const struct listening_port& interface)
     : Connection(sock, b) {
     parent_port = interface.port;
+    parent_path = interface.path;
     resolveConnectionName(false);
-    setTcpNoDelay(interface.tcp_nodelay);
+    if (!isUnixSocket()) {
+        setTcpNoDelay(interface.tcp_nodelay);
+        if (interface.busy_poll != 0) {
+            setBusyPoll(interface.busy_poll);
+        }
+    }
 }
 
 Connection::~Connection() {
@@ -104,6 +118,19 @@ Connection::~Connection() {
  */
 static std::string sockaddr_to_string(const struct sockaddr_storage* addr,
                                       socklen_t addr_len) {
+#ifndef WIN32
+    if (addr->ss_family == AF_UNIX) {
+        // The client end of a Unix domain socket is normally unnamed
+        const auto* un = reinterpret_cast<const struct sockaddr_un*>(addr);
+        const size_t offset = offsetof(struct sockaddr_un, sun_path);
+        if (addr_len <= offset || un->sun_path[0] == '\0') {
+            return "unix:";
+        }
+        return "unix:" + std::string(un->sun_path,
+                                     strnlen(un->sun_path, addr_len - offset));
+    }
+#endif
+
     char host[50];
     char port[50];
 
@@ -160,6 +187,13 @@ void Connection::resolveConnectionName(bool listening) {
 }
 
 bool Connection::setTcpNoDelay(bool enable) {
+    if (isUnixSocket()) {
+        // There is no Nagle on Unix domain sockets, small writes are
+        // always sent immediately
+        nodelay = enable;
+        return true;
+    }
+
     int flags = enable ? 1 : 0;
 
 #if defined(WIN32)
@@ -184,6 +218,22 @@ bool Connection::setTcpNoDelay(bool enable) {
     return true;
 }
 
+bool Connection::setBusyPoll(uint32_t usec) {
+#ifdef SO_BUSY_POLL
+    int value = int(usec);
+    int error = setsockopt(socketDescriptor, SOL_SOCKET, SO_BUSY_POLL,
+                           reinterpret_cast<void*>(&value), sizeof(value));
+    if (error != 0) {
+        std::string errmsg = cb_strerror(GetLastNetworkError());
+        LOG_WARNING(this, "setsockopt(SO_BUSY_POLL): %s", errmsg.c_str());
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
 /* cJSON uses double for all numbers, so only has 53 bits of precision.
  * Therefore encode 64bit integers as string.
  */
@@ -245,6 +295,9 @@ cJSON* Connection::toJSON() const {
         cJSON_AddStringToObject(obj, "peername", getPeername().c_str());
         cJSON_AddStringToObject(obj, "sockname", getSockname().c_str());
         cJSON_AddNumberToObject(obj, "parent_port", parent_port);
+        if (!parent_path.empty()) {
+            cJSON_AddStringToObject(obj, "parent_path", parent_path.c_str());
+        }
         cJSON_AddNumberToObject(obj, "bucket_index", bucketIndex);
         json_add_bool_to_object(obj, "admin", isAdmin());
         if (authenticated) {
@@ -265,8 +318,6 @@ cJSON* Connection::toJSON() const {
 
         cJSON_AddItemToObject(obj, "features", features);
 
-        json_add_uintptr_to_object(obj, "engine_storage",
-                                   (uintptr_t)engine_storage);
         json_add_uintptr_to_object(obj, "next", (uintptr_t)next);
         json_add_uintptr_to_object(obj, "thread", (uintptr_t)thread.load(
             std::memory_order::memory_order_relaxed));
@@ -170,6 +170,16 @@ public:
      */
     bool setTcpNoDelay(bool enable);
 
+    /**
+     * Let the kernel busy poll the device queue for up to the given
+     * number of microseconds when reading from the socket and no data
+     * is available (SO_BUSY_POLL).
+     *
+     * @param usec the number of microseconds to busy poll
+     * @return true if the option was set, false otherwise
+     */
+    bool setBusyPoll(uint32_t usec);
+
     /**
      * Get the username this connection is authenticated as
      *
@@ -206,6 +216,32 @@ public:
         Connection::next = next;
     }
 
+    /**
+     * Mark the connection as being queued in the pending io list of
+     * the thread serving it.
+     *
+     * @return true if the connection was already queued
+     */
+    bool setPendingIo() {
+        return pending_io.exchange(true);
+    }
+
+    void clearPendingIo() {
+        pending_io.store(false);
+    }
+
+    bool isPendingIo() const {
+        return pending_io.load();
+    }
+
+    Connection* getPendingNext() const {
+        return pending_next;
+    }
+
+    void setPendingNext(Connection* next) {
+        pending_next = next;
+    }
+
     LIBEVENT_THREAD* getThread() const {
         return thread.load(std::memory_order_relaxed);
     }
@@ -215,6 +251,18 @@ public:
                                  std::memory_order::memory_order_relaxed);
     }
 
+    /**
+     * Is the connection on its way over to another worker thread (queued
+     * in the new connection queue of the thread it is bound to)?
+     */
+    bool isMigrating() const {
+        return migrating.load();
+    }
+
+    void setMigrating(bool migrating) {
+        Connection::migrating.store(migrating);
+    }
+
     /**
      * @todo this should be pushed down to MCBP, doesn't apply to everyone else
      */
@@ -222,6 +270,14 @@ public:
         return false;
     }
 
+    /**
+     * Is the connection using the shared memory transport (see
+     * connection_shm.h)?
+     */
+    virtual bool isShmConnection() {
+        return false;
+    }
+
     /**
      * @todo this should be pushed down to MCBP, doesn't apply to everyone else
      */
@@ -244,6 +300,21 @@ public:
         Connection::parent_port = parent_port;
     }
 
+    /**
+     * Get the path of the Unix domain socket the connection was accepted
+     * on (empty for TCP connections)
+     */
+    const std::string& getParentPath() const {
+        return parent_path;
+    }
+
+    /**
+     * Is the connection using a Unix domain socket?
+     */
+    bool isUnixSocket() const {
+        return !parent_path.empty();
+    }
+
     virtual bool isTAP() const {
         return false;
     }
@@ -282,14 +353,6 @@ public:
         Connection::bucketEngine = bucketEngine;
     };
 
-    void* getEngineStorage() const {
-        return engine_storage;
-    }
-
-    void setEngineStorage(void* engine_storage) {
-        Connection::engine_storage = engine_storage;
-    }
-
     virtual bool shouldDelete() {
         return false;
     }
@@ -356,22 +419,43 @@ protected:
     /** number of references to the object */
     uint8_t refcount;
 
+    /* Used for generating a list of Connection structures */
+    Connection* next;
+
     /**
-     * Pointer to engine-specific data which the engine has requested the server
-     * to persist for the life of the connection.
-     * See SERVER_COOKIE_API::{get,store}_engine_specific()
+     * Set while the connection is queued in the pending io list of its
+     * thread. The list is modified without holding the thread lock, so
+     * the connection must not be released until it is dequeued.
      */
-    void* engine_storage;
+    std::atomic_bool pending_io;
 
-    /* Used for generating a list of Connection structures */
-    Connection* next;
+    /**
+     * The link in the pending io list. It is kept apart from next so that
+     * the connection may be closed (and unlinked from the other lists)
+     * while it is queued.
+     */
+    Connection* pending_next;
 
     /** Pointer to the thread object serving this connection */
     std::atomic<LIBEVENT_THREAD*> thread;
 
+    /**
+     * Set while the connection is moved to another thread. The connection
+     * is bound to the new thread, but isn't registered in its event base
+     * until the thread picks it up from its queue.
+     */
+    std::atomic_bool migrating;
+
     /** Listening port that creates this connection instance */
     in_port_t parent_port;
 
+    /**
+     * The path of the listening Unix domain socket that creates this
+     * connection instance (the listening port is identified by the
+     * port and the path, and the port is 0 for Unix domain sockets)
+     */
+    std::string parent_path;
+
     /**
      * The index of the connected bucket
      */
@@ -25,11 +25,16 @@
 #include <string>
 #include <memory>
 
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
 ListenConnection::ListenConnection(SOCKET sfd,
                                    event_base* b,
                                    in_port_t port,
                                    sa_family_t fam,
-                                   const interface& interf)
+                                   const interface& interf,
+                                   LIBEVENT_THREAD* worker_thread)
     : Connection(sfd, b),
       registered_in_libevent(false),
       family(fam),
@@ -37,6 +42,7 @@ ListenConnection::ListenConnection(SOCKET sfd,
       ssl(!interf.ssl.cert.empty()),
       management(interf.management),
       protocol(interf.protocol),
+      worker(worker_thread),
       ev(event_new(b, sfd, EV_READ | EV_PERSIST, listen_event_handler,
                    reinterpret_cast<void*>(this))) {
 
@@ -45,6 +51,7 @@ ListenConnection::ListenConnection(SOCKET sfd,
     }
 
     parent_port = port;
+    parent_path = interf.path;
     resolveConnectionName(true);
     // Listen connections should not be associated with a bucket
     setBucketIndex(-1);
@@ -53,7 +60,24 @@ ListenConnection::ListenConnection(SOCKET sfd,
 
 ListenConnection::~ListenConnection() {
     disable();
+    if (!isPrimary() && socketDescriptor != INVALID_SOCKET) {
+        // Close it here, as safe_close would count it as a connection
+        // being closed
+        evutil_closesocket(socketDescriptor);
+        socketDescriptor = INVALID_SOCKET;
+    }
+#ifndef WIN32
+    if (family == AF_UNIX && !parent_path.empty()) {
+        // Don't leave the socket file behind (we unlink stale sockets
+        // when we create it, but the clients would get ECONNREFUSED
+        // until then)
+        unlink(parent_path.c_str());
+    }
+#endif
+}
 
+bool ListenConnection::isPrimary() const {
+    return worker == nullptr || worker->index == 0;
 }
 
 const Protocol ListenConnection::getProtocol() const {
@@ -62,7 +86,7 @@ const Protocol ListenConnection::getProtocol() const {
 }
 
 void ListenConnection::enable() {
-    if (!registered_in_libevent) {
+    if (!registered_in_libevent && ev) {
         if (management || is_server_initialized()) {
             LOG_NOTICE(this, "%u Listen on %s", getId(), getSockname().c_str());
             if (listen(getSocketDescriptor(), backlog) == SOCKET_ERROR) {
@@ -105,6 +129,11 @@ void ListenConnection::disable() {
     }
 }
 
+void ListenConnection::releaseEvent() {
+    disable();
+    ev.reset();
+}
+
 void ListenConnection::runEventLoop(short) {
     try {
         do {
@@ -130,8 +159,11 @@ unique_cJSON_ptr ListenConnection::getDetails() {
     cJSON_AddStringToObject(obj, "protocol", to_string(protocol));
     if (family == AF_INET) {
         cJSON_AddStringToObject(obj, "family", "AF_INET");
-    } else {
+    } else if (family == AF_INET6) {
         cJSON_AddStringToObject(obj, "family", "AF_INET6");
+    } else {
+        cJSON_AddStringToObject(obj, "family", "AF_UNIX");
+        cJSON_AddStringToObject(obj, "path", parent_path.c_str());
     }
 
     cJSON_AddNumberToObject(obj, "port", parent_port);
@@ -36,7 +36,8 @@ public:
                      event_base* b,
                      in_port_t port,
                      sa_family_t fam,
-                     const struct interface &interf);
+                     const struct interface &interf,
+                     LIBEVENT_THREAD* worker_thread);
 
     virtual ~ListenConnection();
 
@@ -54,6 +55,34 @@ public:
         return management;
     }
 
+    /**
+     * Get the worker thread owning this listen connection (used by
+     * interfaces configured with "reuseport"). Clients accepted on the
+     * socket are served directly by the owning worker thread instead of
+     * being dispatched from the listen thread.
+     *
+     * @return the owning thread or nullptr if the connection is run by
+     *         the dispatcher thread
+     */
+    LIBEVENT_THREAD* getWorkerThread() const {
+        return worker;
+    }
+
+    /**
+     * Is this the first socket for the address? An interface using
+     * "reuseport" has one socket per worker thread for each address, but
+     * only the first of them is counted in the connection stats and
+     * reported in the portnumber file.
+     */
+    bool isPrimary() const;
+
+    /**
+     * Remove the connection from libevent and release the event. This
+     * must be called before the event base the connection is bound to
+     * is released.
+     */
+    void releaseEvent();
+
     /**
      * Get the details for this connection to put in the portnumber
      * file so that the test framework may pick up the port numbers
@@ -67,6 +96,7 @@ protected:
     const bool ssl;
     const bool management;
     const Protocol protocol;
+    LIBEVENT_THREAD* const worker;
 
     struct EventDeleter {
         void operator()(struct event* ev) {
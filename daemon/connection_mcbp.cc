@@ -16,11 +16,16 @@
  */
 #include "config.h"
 #include "connections.h"
+#include "ktls.h"
+#include "ssl_handshake_task.h"
+#include "ssl_server_ctx.h"
+#include "mcbp_executors.h"
 #include "memcached.h"
 #include "runtime.h"
 #include "statemachine_mcbp.h"
 #include "mc_time.h"
 
+#include <algorithm>
 #include <exception>
 #include <utilities/protocol2text.h>
 #include <platform/checked_snprintf.h>
@@ -85,7 +90,22 @@ bool McbpConnection::registerEvent() {
     struct timeval tv;
     struct timeval* tp = nullptr;
 
-    if (settings.getConnectionIdleTime() == 0 || isAdmin() || isDCP() || isTAP()) {
+    const uint32_t slow_reader_timeout = settings.getSlowReaderTimeout();
+    ev_slow_reader = false;
+
+    if ((ev_flags & (EV_READ | EV_WRITE)) == EV_WRITE &&
+        slow_reader_timeout != 0 && !isAdmin()) {
+        // We're waiting for the client to read the data we've got for it.
+        // The timeout is restarted every time the socket becomes
+        // writable (EV_PERSIST), so it only fires when the client
+        // stopped reading.
+        tv.tv_sec = slow_reader_timeout;
+        tv.tv_usec = 0;
+        tp = &tv;
+        ev_timeout_enabled = true;
+        ev_timeout = slow_reader_timeout;
+        ev_slow_reader = true;
+    } else if (settings.getConnectionIdleTime() == 0 || isAdmin() || isDCP() || isTAP()) {
         tp = nullptr;
         ev_timeout_enabled = false;
     } else {
@@ -111,7 +131,8 @@ bool McbpConnection::registerEvent() {
 bool McbpConnection::updateEvent(const short new_flags) {
     struct event_base* base = event.ev_base;
 
-    if (ssl.isEnabled() && ssl.isConnected() && (new_flags & EV_READ)) {
+    if (ssl.isEnabled() && ssl.isConnected() && !ssl.isKtlsRx() &&
+        (new_flags & EV_READ)) {
         /*
          * If we want more data and we have SSL, that data might be inside
          * SSL's internal buffers rather than inside the socket buffer. In
@@ -128,6 +149,8 @@ bool McbpConnection::updateEvent(const short new_flags) {
         }
     }
 
+    const short event_flags = prepareToWait(new_flags);
+
     if (ev_flags == new_flags) {
         // We do "cache" the current libevent state (using EV_PERSIST) to avoid
         // having to re-register it when it doesn't change (which it mostly don't).
@@ -135,13 +158,16 @@ bool McbpConnection::updateEvent(const short new_flags) {
         // never update their libevent state we'll forcibly re-enter it half way
         // into the timeout.
 
-        if (ev_timeout_enabled && (isAdmin() || isDCP() || isTAP())) {
+        if (ev_timeout_enabled && !ev_slow_reader &&
+            (isAdmin() || isDCP() || isTAP())) {
             LOG_DEBUG(this,
                       "%u: Forcibly reset the event connection flags to"
                           " disable timeout", getId());
         } else {
             rel_time_t now = mc_time_get_current_time();
-            const int reinsert_time = settings.getConnectionIdleTime() / 2;
+            const int reinsert_time = (ev_slow_reader ?
+                                       ev_timeout :
+                                       settings.getConnectionIdleTime()) / 2;
 
             if ((ev_insert_time + reinsert_time) > now) {
                 return true;
@@ -165,7 +191,7 @@ bool McbpConnection::updateEvent(const short new_flags) {
         return false;
     }
 
-    if (event_assign(&event, base, socketDescriptor, new_flags, event_handler,
+    if (event_assign(&event, base, socketDescriptor, event_flags, event_handler,
               reinterpret_cast<void*>(this)) == -1) {
         LOG_WARNING(this,
                     "Failed to set up event notification. "
@@ -186,6 +212,344 @@ bool McbpConnection::updateEvent(const short new_flags) {
     return true;
 }
 
+bool McbpConnection::isMigratable() {
+    return getState() == conn_read &&
+           registered_in_libevent &&
+           ev_flags == (EV_READ | EV_PERSIST) &&
+           getRefcount() == 1 &&
+           !isDCP() && !isTAP() && !isPipeConnection() &&
+           !isShmConnection() &&
+           !ewouldblock && !isPendingIo() &&
+           parkedCommands.empty() &&
+           commandContext == nullptr &&
+           item == nullptr &&
+           reservedItems.empty() &&
+           write.bytes == 0 &&
+           !havePendingInputData();
+}
+
+bool McbpConnection::moveToEventBase(event_base* b) {
+    if (registered_in_libevent) {
+        LOG_WARNING(this, "McbpConnection::moveToEventBase: Connection is "
+            "registered in libevent");
+        return false;
+    }
+
+    base = b;
+    if (event_assign(&event, base, socketDescriptor, ev_flags, event_handler,
+                     reinterpret_cast<void*>(this)) == -1) {
+        return false;
+    }
+
+    return registerEvent();
+}
+
+/*
+ * The maximum number of commands which may be parked on a connection.
+ * When reached the connection stops reading new commands until one of
+ * the parked commands complete.
+ */
+static const size_t max_parked_commands = 1024;
+
+/**
+ * Commands which only operate on a single document may be executed out
+ * of order on connections using unordered execution. All other commands
+ * act as a barrier; they wait for the parked commands to complete before
+ * they're executed.
+ */
+static bool is_reorderable(uint8_t opcode) {
+    switch (opcode) {
+    case PROTOCOL_BINARY_CMD_GET:
+    case PROTOCOL_BINARY_CMD_GETQ:
+    case PROTOCOL_BINARY_CMD_GETK:
+    case PROTOCOL_BINARY_CMD_GETKQ:
+    case PROTOCOL_BINARY_CMD_SET:
+    case PROTOCOL_BINARY_CMD_SETQ:
+    case PROTOCOL_BINARY_CMD_ADD:
+    case PROTOCOL_BINARY_CMD_ADDQ:
+    case PROTOCOL_BINARY_CMD_REPLACE:
+    case PROTOCOL_BINARY_CMD_REPLACEQ:
+    case PROTOCOL_BINARY_CMD_DELETE:
+    case PROTOCOL_BINARY_CMD_DELETEQ:
+    case PROTOCOL_BINARY_CMD_INCREMENT:
+    case PROTOCOL_BINARY_CMD_INCREMENTQ:
+    case PROTOCOL_BINARY_CMD_DECREMENT:
+    case PROTOCOL_BINARY_CMD_DECREMENTQ:
+    case PROTOCOL_BINARY_CMD_APPEND:
+    case PROTOCOL_BINARY_CMD_APPENDQ:
+    case PROTOCOL_BINARY_CMD_PREPEND:
+    case PROTOCOL_BINARY_CMD_PREPENDQ:
+    case PROTOCOL_BINARY_CMD_TOUCH:
+    case PROTOCOL_BINARY_CMD_GAT:
+    case PROTOCOL_BINARY_CMD_GATQ:
+        return true;
+    default:
+        return false;
+    }
+}
+
+void McbpConnection::setAiostat(const Cookie& c,
+                                const ENGINE_ERROR_CODE& status) {
+    if (&c == &cookie) {
+        aiostat = status;
+        return;
+    }
+
+    // All other cookies we hand out belongs to a command. The status is
+    // published to the worker thread through the notified flag.
+    auto& command = const_cast<McbpCommand&>(
+        static_cast<const McbpCommand&>(c));
+    command.aiostat = status;
+    command.notified.store(true, std::memory_order_release);
+}
+
+void McbpConnection::startCommand() {
+    if (!unordered_execution || isDCP() || isTAP() ||
+        binary_header.request.magic != PROTOCOL_BINARY_REQ ||
+        !is_reorderable(binary_header.request.opcode)) {
+        return;
+    }
+
+    try {
+        if (spareCommands.empty()) {
+            currentCommand.reset(new McbpCommand(this));
+        } else {
+            currentCommand = std::move(spareCommands.back());
+            spareCommands.pop_back();
+        }
+    } catch (std::bad_alloc&) {
+        // Run it as an ordinary command on the connection cookie
+        return;
+    }
+
+    currentCommand->notified.store(false);
+    currentCookie = currentCommand.get();
+}
+
+void McbpConnection::endCommand() {
+    if (currentCommand) {
+        currentCommand->packet.clear();
+        try {
+            if (currentCommand->engine_storage == nullptr) {
+                spareCommands.push_back(std::move(currentCommand));
+            } else {
+                retainedCommands.push_back(std::move(currentCommand));
+            }
+        } catch (std::bad_alloc&) {
+            // Just drop it
+        }
+        currentCommand.reset();
+    }
+    currentCookie = &cookie;
+}
+
+void McbpConnection::resume() {
+    // The continuation may suspend the command again, so move it out
+    // before calling it
+    Continuation cont(std::move(continuation));
+    continuation = nullptr;
+    const ENGINE_ERROR_CODE status = aiostat;
+    aiostat = ENGINE_SUCCESS;
+    ewouldblock = false;
+    cont(this, status);
+}
+
+bool McbpConnection::parkCommand() {
+    if (!currentCommand) {
+        return false;
+    }
+
+    auto& command = *currentCommand;
+    if (command.packet.empty()) {
+        // The packet is located in the read buffer which is reused by
+        // the next command
+        const size_t size = sizeof(binary_header) +
+                            binary_header.request.bodylen;
+        const char* packet = read.curr - size;
+        try {
+            command.packet.assign(packet, packet + size);
+        } catch (std::bad_alloc&) {
+            // The engine still holds the cookie so we have to keep the
+            // command around until it is notified, but we can't resume it
+            LOG_WARNING(this, "%u: Failed to allocate memory to park the "
+                "command, closing connection", getId());
+            setState(conn_closing);
+        }
+    }
+
+    command.binary_header = binary_header;
+    command.cmd = cmd;
+    command.noreply = noreply;
+    command.start = start;
+    command.cas = cas;
+    command.item = item;
+    command.commandContext = commandContext;
+    command.continuation = std::move(continuation);
+    continuation = nullptr;
+    parkedBytes += command.packet.size();
+    if (item != nullptr) {
+        ++parkedItems;
+    }
+    item = nullptr;
+    commandContext = nullptr;
+    ewouldblock = false;
+    start = 0;
+
+    parkedCommands.push_back(std::move(currentCommand));
+    currentCommand.reset();
+    currentCookie = &cookie;
+    return true;
+}
+
+bool McbpConnection::resumeParkedCommand() {
+    auto iter = parkedCommands.begin();
+    while (iter != parkedCommands.end()) {
+        if (!(*iter)->notified.load(std::memory_order_acquire)) {
+            ++iter;
+            continue;
+        }
+
+        currentCommand = std::move(*iter);
+        parkedCommands.erase(iter);
+
+        auto& command = *currentCommand;
+        parkedBytes -= command.packet.size();
+        if (command.item != nullptr) {
+            --parkedItems;
+        }
+        command.notified.store(false);
+        binary_header = command.binary_header;
+        cmd = command.cmd;
+        noreply = command.noreply;
+        start = command.start;
+        cas = command.cas;
+        item = command.item;
+        commandContext = command.commandContext;
+        continuation = std::move(command.continuation);
+        command.continuation = nullptr;
+        aiostat = command.aiostat;
+        command.item = nullptr;
+        command.commandContext = nullptr;
+        ewouldblock = false;
+        currentCookie = &command;
+
+        if (!addMsgHdr(true)) {
+            endCommand();
+            setState(conn_closing);
+            return true;
+        }
+
+        // The executors locate the packet relative to the read pointer
+        char* curr = read.curr;
+        read.curr = command.packet.data() + command.packet.size();
+        mcbp_complete_nread(this);
+        read.curr = curr;
+
+        if (!ewouldblock) {
+            endCommand();
+            return true;
+        }
+
+        // Blocked again, and is moved to the end of the list
+        parkCommand();
+        iter = parkedCommands.begin();
+    }
+
+    return false;
+}
+
+bool McbpConnection::hasReadyCommands() const {
+    for (const auto& command : parkedCommands) {
+        if (command->notified.load(std::memory_order_acquire)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool McbpConnection::hasOutstandingCommands() const {
+    for (const auto& command : parkedCommands) {
+        if (!command->notified.load(std::memory_order_acquire)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void McbpConnection::releaseParkedCommands() {
+    for (auto& command : parkedCommands) {
+        if (command->item != nullptr) {
+            bucket_release_item(this, command->item);
+            command->item = nullptr;
+        }
+        delete command->commandContext;
+        command->commandContext = nullptr;
+        command->continuation = nullptr;
+        if (command->engine_storage != nullptr) {
+            try {
+                retainedCommands.push_back(std::move(command));
+            } catch (std::bad_alloc&) {
+                // Just drop it
+            }
+        }
+    }
+    parkedCommands.clear();
+    parkedBytes = 0;
+    parkedItems = 0;
+}
+
+void McbpConnection::releaseRetainedCommands() {
+    for (auto& command : retainedCommands) {
+        perform_callbacks(ON_DISCONNECT, NULL, command.get());
+    }
+    retainedCommands.clear();
+}
+
+bool McbpConnection::mustWaitForParkedCommands() const {
+    if (parkedCommands.empty()) {
+        return false;
+    }
+
+    if (parkedCommands.size() >= max_parked_commands ||
+        isOverOutputLimits()) {
+        return true;
+    }
+
+    if (read.bytes < sizeof(binary_header)) {
+        // We don't know which command it is yet
+        return false;
+    }
+
+    auto* req = reinterpret_cast<const protocol_binary_request_header*>(read.curr);
+    return req->request.magic != PROTOCOL_BINARY_REQ ||
+           !is_reorderable(req->request.opcode);
+}
+
+size_t McbpConnection::getPendingBytes() const {
+    size_t ret = parkedBytes;
+    for (size_t ii = msgcurr; ii < msglist.size(); ++ii) {
+        const auto& m = msglist[ii];
+        for (size_t jj = 0; jj < size_t(m.msg_iovlen); ++jj) {
+            ret += m.msg_iov[jj].iov_len;
+        }
+    }
+    return ret;
+}
+
+size_t McbpConnection::getPinnedItems() const {
+    return parkedItems + reservedItems.size() + (item == nullptr ? 0 : 1);
+}
+
+bool McbpConnection::isOverOutputLimits() const {
+    const size_t max_items = settings.getMaxPinnedItems();
+    if (max_items != 0 && getPinnedItems() >= max_items) {
+        return true;
+    }
+
+    const size_t max_bytes = settings.getMaxPendingBytes();
+    return max_bytes != 0 && getPendingBytes() >= max_bytes;
+}
+
 bool McbpConnection::reapplyEventmask() {
     return updateEvent(ev_flags);
 }
@@ -256,12 +620,36 @@ void McbpConnection::shrinkBuffers() {
 
 
 int McbpConnection::sslPreConnection() {
-    int r = ssl.accept();
+    return handleSslAcceptResult(ssl.accept());
+}
+
+int McbpConnection::handleSslAcceptResult(int r) {
     if (r == 1) {
         ssl.drainBioSendPipe(socketDescriptor);
         ssl.setConnected();
+        if (ssl.isSessionReused()) {
+            get_thread_stats(this)->ssl_resumptions++;
+            ssl_handshake_timings.resumed.add(ssl.getHandshakeTime());
+        } else {
+            get_thread_stats(this)->ssl_handshakes++;
+            ssl_handshake_timings.full.add(ssl.getHandshakeTime());
+        }
+        if (settings.isSslKtls()) {
+            std::string reason;
+            if (ssl.offloadToKernel(socketDescriptor, reason)) {
+                get_thread_stats(this)->ktls_offloaded++;
+            } else {
+                get_thread_stats(this)->ktls_fallbacks++;
+            }
+            if (!reason.empty()) {
+                LOG_DEBUG(this, "%u: %s: %s", getId(),
+                          ssl.isKtlsRx() ? "Only receive is offloaded to kTLS"
+                                         : "Not using kTLS",
+                          reason.c_str());
+            }
+        }
     } else {
-        if (ssl.getError(r) == SSL_ERROR_WANT_READ) {
+        if (ssl.getAcceptError() == SSL_ERROR_WANT_READ) {
             ssl.drainBioSendPipe(socketDescriptor);
             set_ewouldblock();
             return -1;
@@ -270,14 +658,11 @@ int McbpConnection::sslPreConnection() {
                 std::string errmsg("SSL_accept() returned " +
                                    std::to_string(r) +
                                    " with error " +
-                                   std::to_string(ssl.getError(r)));
-
-                std::vector<char> ssl_err(1024);
-                ERR_error_string_n(ERR_get_error(), ssl_err.data(),
-                                   ssl_err.size());
+                                   std::to_string(ssl.getAcceptError()));
 
                 LOG_WARNING(this, "%u: ERROR: %s\n%s",
-                            getId(), errmsg.c_str(), ssl_err.data());
+                            getId(), errmsg.c_str(),
+                            ssl.getAcceptErrorString().c_str());
             } catch (const std::bad_alloc&) {
                 // unable to print error message; continue.
             }
@@ -290,9 +675,66 @@ int McbpConnection::sslPreConnection() {
     return 0;
 }
 
+bool McbpConnection::isSslHandshakeRunning() const {
+    if (!sslHandshakeTask) {
+        return false;
+    }
+    auto* task = reinterpret_cast<SslHandshakeTask*>(sslHandshakeTask.get());
+    return !task->isComplete();
+}
+
+bool McbpConnection::runSslHandshake() {
+    if (sslHandshakeTask) {
+        auto* task = reinterpret_cast<SslHandshakeTask*>(sslHandshakeTask.get());
+        if (!task->isComplete()) {
+            // Spurious wakeup; wait for the executor to notify us
+            return false;
+        }
+
+        const int r = task->getResult();
+        sslHandshakeTask.reset();
+        setEwouldblock(false);
+
+        if (handleSslAcceptResult(r) == 0) {
+            setState(conn_read);
+            return true;
+        }
+        if (is_blocking(GetLastNetworkError())) {
+            // The handshake needs more data from the client
+            setState(conn_waiting);
+        } else {
+            setState(conn_closing);
+        }
+        return true;
+    }
+
+    ssl.drainBioRecvPipe(socketDescriptor);
+    if (ssl.hasError()) {
+        setState(conn_closing);
+        return true;
+    }
+
+    // Leave the SSL stream alone (don't read from the socket) until the
+    // executor is done with it
+    if (isRegisteredInLibevent()) {
+        if (!unregisterEvent()) {
+            LOG_WARNING(this, "%u: Failed to unregister the event before "
+                        "scheduling the SSL handshake", getId());
+            setState(conn_closing);
+            return true;
+        }
+    }
+
+    sslHandshakeTask = std::make_shared<SslHandshakeTask>(*this);
+    setEwouldblock(true);
+    std::lock_guard<std::mutex> guard(sslHandshakeTask->getMutex());
+    executorPool->schedule(sslHandshakeTask, true);
+    return false;
+}
+
 int McbpConnection::recv(char* dest, size_t nbytes) {
     int res;
-    if (ssl.isEnabled()) {
+    if (ssl.isEnabled() && !ssl.isKtlsRx()) {
         ssl.drainBioRecvPipe(socketDescriptor);
 
         if (ssl.hasError()) {
@@ -323,16 +765,8 @@ int McbpConnection::recv(char* dest, size_t nbytes) {
 
 int McbpConnection::sendmsg(struct msghdr* m) {
     int res = 0;
-    if (ssl.isEnabled()) {
-        for (int ii = 0; ii < int(m->msg_iovlen); ++ii) {
-            int n = sslWrite(reinterpret_cast<char*>(m->msg_iov[ii].iov_base),
-                             m->msg_iov[ii].iov_len);
-            if (n > 0) {
-                res += n;
-            } else {
-                return res > 0 ? res : -1;
-            }
-        }
+    if (ssl.isEnabled() && !ssl.isKtlsTx()) {
+        res = sslSendmsg(m);
 
         /* @todo figure out how to drain the rest of the data if we
          * failed to send all of it...
@@ -364,6 +798,12 @@ McbpConnection::TransmitResult McbpConnection::transmit() {
         auto error = GetLastNetworkError();
         if (res > 0) {
             get_thread_stats(this)->bytes_written += res;
+            if (!isDCP() && !isTAP()) {
+                auto* limiter = all_buckets[getBucketIndex()].rate_limiter;
+                if (limiter != nullptr && limiter->isEnabled()) {
+                    limiter->chargeWrite(getThread()->index, size_t(res));
+                }
+            }
 
             /* We've written some of the data. Remove the completed
                iovec entries from the list of pending writes. */
@@ -421,7 +861,7 @@ McbpConnection::TransmitResult McbpConnection::transmit() {
         setState(conn_closing);
         return TransmitResult::HardError;
     } else {
-        if (ssl.isEnabled()) {
+        if (ssl.isEnabled() && !ssl.isKtlsTx()) {
             ssl.drainBioSendPipe(socketDescriptor);
             if (ssl.morePendingOutput()) {
                 if (!updateEvent(EV_WRITE | EV_PERSIST)) {
@@ -560,6 +1000,82 @@ int McbpConnection::sslRead(char* dest, size_t nbytes) {
     return ret;
 }
 
+/*
+ * Every SSL_write creates (at least) one TLS record with its own header,
+ * MAC and padding, so writing the iovecs one by one would turn a small
+ * response (header, extras, key and value) into 3-4 records. Copy the
+ * small iovecs into the thread's staging buffer and write full records
+ * instead. Data which fills an entire record on its own is written
+ * directly from the iovec.
+ *
+ * A write which fails with SSL_ERROR_WANT_WRITE is retried with the same
+ * data the next time, as the caller only drops the bytes we report as
+ * written from the message (and SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER is
+ * set as the staging buffer belongs to the thread).
+ */
+int McbpConnection::sslSendmsg(struct msghdr* m) {
+    const size_t record_size =
+        std::min(size_t(SSL3_RT_MAX_PLAIN_LENGTH),
+                 std::max(size_t(settings.getBioDrainBufferSize()),
+                          size_t(1)));
+    auto& staging = getThread()->ssl_staging;
+    if (staging.size() < record_size) {
+        try {
+            staging.resize(record_size);
+        } catch (std::bad_alloc&) {
+            LOG_WARNING(this, "%u: Failed to allocate SSL staging buffer",
+                        getId());
+            set_econnreset();
+            return -1;
+        }
+    }
+
+    int res = 0;
+    size_t staged = 0;
+
+    // Write the data, and return false if we should stop (all of the
+    // data wasn't written)
+    auto write = [this, &res](const char* src, size_t nbytes) -> bool {
+        const int n = sslWrite(src, nbytes);
+        if (n > 0) {
+            res += n;
+        }
+        return n == int(nbytes);
+    };
+
+    for (int ii = 0; ii < int(m->msg_iovlen); ++ii) {
+        auto* src = reinterpret_cast<const char*>(m->msg_iov[ii].iov_base);
+        size_t len = m->msg_iov[ii].iov_len;
+        while (len > 0) {
+            if (staged == 0 && len >= record_size) {
+                if (!write(src, len)) {
+                    return res > 0 ? res : -1;
+                }
+                break;
+            }
+
+            const size_t chunk = std::min(len, record_size - staged);
+            memcpy(staging.data() + staged, src, chunk);
+            staged += chunk;
+            src += chunk;
+            len -= chunk;
+
+            if (staged == record_size) {
+                if (!write(staging.data(), staged)) {
+                    return res > 0 ? res : -1;
+                }
+                staged = 0;
+            }
+        }
+    }
+
+    if (staged > 0 && !write(staging.data(), staged)) {
+        return res > 0 ? res : -1;
+    }
+
+    return res;
+}
+
 int McbpConnection::sslWrite(const char* src, size_t nbytes) {
     int ret = 0;
 
@@ -621,22 +1137,19 @@ SslContext::~SslContext() {
 }
 
 bool SslContext::enable(const std::string& cert, const std::string& pkey) {
-    ctx = SSL_CTX_new(SSLv23_server_method());
-    set_ssl_ctx_protocol_mask(ctx);
-
-    /* @todo don't read files, but use in-memory-copies */
-    if (!SSL_CTX_use_certificate_chain_file(ctx, cert.c_str()) ||
-        !SSL_CTX_use_PrivateKey_file(ctx, pkey.c_str(), SSL_FILETYPE_PEM)) {
-        LOG_WARNING(nullptr, "Failed to use SSL cert %s and pkey %s",
-                    cert.c_str(), pkey.c_str());
+    // The context is shared by all of the connections using the same
+    // certificate so that sessions may be resumed
+    SSL_CTX* ctx = ssl_server_ctx_get(cert, pkey);
+    if (ctx == nullptr) {
         return false;
     }
 
-    set_ssl_ctx_cipher_list(ctx);
-
     enabled = true;
     error = false;
     client = NULL;
+    acceptError = SSL_ERROR_NONE;
+    acceptErrorString.clear();
+    handshakeTime = 0;
 
     try {
         in.buffer.resize(settings.getBioDrainBufferSize());
@@ -650,6 +1163,9 @@ bool SslContext::enable(const std::string& cert, const std::string& pkey) {
 
     client = SSL_new(ctx);
     SSL_set_bio(client, application, application);
+    // Responses are written from the staging buffer of the worker thread
+    // serving the connection
+    SSL_set_mode(client, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
 
     return true;
 }
@@ -659,15 +1175,40 @@ void SslContext::disable() {
         BIO_free_all(network);
     }
     if (client != nullptr) {
+        if (connected) {
+            // Most clients just close the socket, and OpenSSL drops the
+            // session from the cache unless it looks like a clean
+            // shutdown (a fatal alert has already dropped it)
+            SSL_set_shutdown(client, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+        }
         SSL_free(client);
     }
     error = false;
-    if (ctx != nullptr) {
-        SSL_CTX_free(ctx);
-    }
     enabled = false;
 }
 
+int SslContext::accept() {
+    const auto start = tsc_clock_now();
+    const int ret = SSL_accept(client);
+    handshakeTime += tsc_clock_now() - start;
+
+    acceptError = SSL_get_error(client, ret);
+    if (acceptError == SSL_ERROR_SSL || acceptError == SSL_ERROR_SYSCALL) {
+        try {
+            std::vector<char> ssl_err(1024);
+            ERR_error_string_n(ERR_get_error(), ssl_err.data(),
+                               ssl_err.size());
+            acceptErrorString.assign(ssl_err.data());
+        } catch (const std::bad_alloc&) {
+            // unable to keep the error message; continue.
+        }
+    }
+    // Don't leave the errors in the queue of the thread (which may be
+    // an executor thread)
+    ERR_clear_error();
+    return ret;
+}
+
 void SslContext::drainBioRecvPipe(SOCKET sfd) {
     int n;
     bool stop = false;
@@ -744,6 +1285,22 @@ void SslContext::drainBioSendPipe(SOCKET sfd) {
     } while (!stop);
 }
 
+bool SslContext::offloadToKernel(SOCKET sfd, std::string& reason) {
+    // The kernel starts at the first record after the handshake, so
+    // OpenSSL can't have anything buffered in either direction
+    if (in.current < in.total || BIO_ctrl_pending(application) > 0 ||
+        SSL_pending(client) > 0) {
+        reason = "the client sent data before the handshake completed";
+        return false;
+    }
+    if (out.total > 0 || BIO_ctrl_pending(network) > 0) {
+        reason = "the handshake isn't sent to the client";
+        return false;
+    }
+
+    return ktls_offload(sfd, client, ktlsRx, ktlsTx, reason);
+}
+
 void SslContext::dumpCipherList(uint32_t id) const {
     LOG_DEBUG(NULL, "%u: Using SSL ciphers:", id);
     int ii = 0;
@@ -761,6 +1318,9 @@ cJSON* SslContext::toJSON() const {
         json_add_bool_to_object(obj, "error", error);
         cJSON_AddNumberToObject(obj, "total_recv", totalRecv);
         cJSON_AddNumberToObject(obj, "total_send", totalSend);
+        cJSON_AddNumberToObject(obj, "records_written", recordsWritten);
+        json_add_bool_to_object(obj, "ktls_rx", ktlsRx);
+        json_add_bool_to_object(obj, "ktls_tx", ktlsTx);
         cJSON_AddNumberToObject(obj, "input_buff_total", in.total);
         cJSON_AddNumberToObject(obj, "input_buff_current", in.current);
         cJSON_AddNumberToObject(obj, "output_buff_total", out.total);
@@ -884,16 +1444,20 @@ McbpConnection::McbpConnection(SOCKET sfd, event_base *b)
       dcp(false),
       max_reqs_per_event(settings.getRequestsPerEventNotification(EventPriority::Default)),
       numEvents(0),
+      sliceEnd(0),
+      runnableSince(0),
+      rejected(false),
       cmd(PROTOCOL_BINARY_CMD_INVALID),
       registered_in_libevent(false),
       ev_flags(0),
       currentEvent(0),
       ev_timeout_enabled(false),
+      ev_slow_reader(false),
       write_and_go(conn_new_cmd),
       ritem(nullptr),
       rlbytes(0),
       item(nullptr),
-      iov(IOV_LIST_INITIAL),
+      iov(),
       iovused(0),
       msglist(),
       msgcurr(0),
@@ -908,13 +1472,18 @@ McbpConnection::McbpConnection(SOCKET sfd, event_base *b)
       commandContext(nullptr),
       totalRecv(0),
       totalSend(0),
-      cookie(this) {
+      cookie(this),
+      currentCookie(&cookie),
+      unordered_execution(false),
+      compressionCodec(CompressionCodec::None),
+      parkedBytes(0),
+      parkedItems(0) {
     memset(&binary_header, 0, sizeof(binary_header));
     memset(&event, 0, sizeof(event));
     memset(&read, 0, sizeof(read));
     memset(&write, 0, sizeof(write));
     memset(&ssl, 0, sizeof(ssl));
-    msglist.reserve(MSG_LIST_INITIAL);
+    initializeBuffers(nullptr);
 
     if (!initializeEvent()) {
         throw std::runtime_error("Failed to initialize event structure");
@@ -923,23 +1492,28 @@ McbpConnection::McbpConnection(SOCKET sfd, event_base *b)
 
 McbpConnection::McbpConnection(SOCKET sfd,
                                event_base* b,
-                               const struct listening_port& ifc)
+                               const struct listening_port& ifc,
+                               ConnectionBuffers* buffers)
     : Connection(sfd, b, ifc),
       stateMachine(new McbpStateMachine(conn_new_cmd)),
       tap_iterator(nullptr),
       dcp(false),
       max_reqs_per_event(settings.getRequestsPerEventNotification(EventPriority::Default)),
       numEvents(0),
+      sliceEnd(0),
+      runnableSince(0),
+      rejected(false),
       cmd(PROTOCOL_BINARY_CMD_INVALID),
       registered_in_libevent(false),
       ev_flags(0),
       currentEvent(0),
       ev_timeout_enabled(false),
+      ev_slow_reader(false),
       write_and_go(conn_new_cmd),
       ritem(nullptr),
       rlbytes(0),
       item(nullptr),
-      iov(IOV_LIST_INITIAL),
+      iov(),
       iovused(0),
       msglist(),
       msgcurr(0),
@@ -954,7 +1528,12 @@ McbpConnection::McbpConnection(SOCKET sfd,
       commandContext(nullptr),
       totalRecv(0),
       totalSend(0),
-      cookie(this) {
+      cookie(this),
+      currentCookie(&cookie),
+      unordered_execution(false),
+      compressionCodec(CompressionCodec::None),
+      parkedBytes(0),
+      parkedItems(0) {
 
     if (ifc.protocol != Protocol::Memcached) {
         throw std::logic_error("Incorrect object for MCBP");
@@ -964,7 +1543,7 @@ McbpConnection::McbpConnection(SOCKET sfd,
     memset(&read, 0, sizeof(read));
     memset(&write, 0, sizeof(write));
     memset(&ssl, 0, sizeof(ssl));
-    msglist.reserve(MSG_LIST_INITIAL);
+    initializeBuffers(buffers);
 
     if (ifc.ssl.enabled) {
         if (!enableSSL(ifc.ssl.cert, ifc.ssl.key)) {
@@ -988,6 +1567,39 @@ McbpConnection::~McbpConnection() {
     }
 }
 
+void McbpConnection::initializeBuffers(ConnectionBuffers* buffers) {
+    if (buffers != nullptr) {
+        iov.swap(buffers->iov);
+        msglist.swap(buffers->msglist);
+        reservedItems.swap(buffers->reservedItems);
+        temp_alloc.swap(buffers->temp_alloc);
+    }
+
+    iov.assign(IOV_LIST_INITIAL, iovec());
+    msglist.clear();
+    msglist.reserve(MSG_LIST_INITIAL);
+    reservedItems.clear();
+    temp_alloc.clear();
+}
+
+void McbpConnection::recycleBuffers(ConnectionBuffers& buffers) {
+    releaseReservedItems();
+    releaseTempAlloc();
+
+    if (iov.capacity() <= IOV_LIST_HIGHWAT) {
+        iov.swap(buffers.iov);
+    }
+    if (msglist.capacity() <= MSG_LIST_HIGHWAT) {
+        msglist.swap(buffers.msglist);
+    }
+    if (reservedItems.capacity() <= ITEM_LIST_INITIAL) {
+        reservedItems.swap(buffers.reservedItems);
+    }
+    if (temp_alloc.capacity() <= TEMP_ALLOC_LIST_INITIAL) {
+        temp_alloc.swap(buffers.temp_alloc);
+    }
+}
+
 void McbpConnection::setState(TaskFunction next_state) {
     stateMachine->setCurrentTask(*this, next_state);
 }
@@ -1080,6 +1692,8 @@ cJSON* McbpConnection::toJSON() const {
             if (ev_timeout_enabled) {
                 cJSON* timeout = cJSON_CreateObject();
                 cJSON_AddNumberToObject(timeout, "value", ev_timeout);
+                json_add_bool_to_object(timeout, "slow_reader",
+                                        ev_slow_reader);
                 cJSON_AddNumberToObject(timeout, "remaining",
                                         ev_insert_time + ev_timeout -
                                         mc_time_get_current_time());
@@ -1156,7 +1770,19 @@ cJSON* McbpConnection::toJSON() const {
         /* @todo we should decode the binary header */
         json_add_uintptr_to_object(obj, "cas", cas);
         cJSON_AddNumberToObject(obj, "aiostat", aiostat);
+        json_add_uintptr_to_object(obj, "engine_storage",
+                                   (uintptr_t)cookie.engine_storage);
         json_add_bool_to_object(obj, "ewouldblock", ewouldblock);
+        json_add_bool_to_object(obj, "unordered_execution",
+                                unordered_execution);
+        cJSON_AddStringToObject(obj, "compression",
+                                to_string(compressionCodec));
+        cJSON_AddNumberToObject(obj, "parked_commands",
+                                (double)parkedCommands.size());
+        cJSON_AddNumberToObject(obj, "pending_bytes",
+                                (double)getPendingBytes());
+        cJSON_AddNumberToObject(obj, "pinned_items",
+                                (double)getPinnedItems());
         cJSON_AddItemToObject(obj, "ssl", ssl.toJSON());
         cJSON_AddNumberToObject(obj, "total_recv", totalRecv);
         cJSON_AddNumberToObject(obj, "total_send", totalSend);
@@ -1261,13 +1887,50 @@ PipeConnection::~PipeConnection() {
 }
 
 bool McbpConnection::shouldDelete() {
-    return getState() == conn_destroyed;
+    // A connection which is queued in the pending io list of its thread
+    // is released when the thread picks it up from the list
+    return getState() == conn_destroyed && !isPendingIo();
 }
 
 void McbpConnection::runEventLoop(short which) {
+    if (getState() == conn_destroyed) {
+        // The connection was closed while it was in the pending io list
+        return;
+    }
+
+    // The connection is disassociated from the thread if it is closed
+    auto* thr = getThread();
+    const hrtime_t start = tsc_clock_now();
+    const auto bucket = getBucketIndex();
+    const hrtime_t slice = hrtime_t(settings.getSchedSlice()) * 1000;
+    const hrtime_t runnable = runnableSince.exchange(0);
+    if (runnable != 0) {
+        const hrtime_t delay = start > runnable ? start - runnable : 0;
+        all_buckets[bucket].sched_delay.add(delay);
+        if (thr != nullptr) {
+            if (slice != 0) {
+                thr->scheduler.recordDelay(start, delay, slice);
+            }
+            if (delay > thr->shed.max_delay) {
+                thr->shed.max_delay = delay;
+            }
+        }
+    }
+
     conn_loan_buffers(this);
     currentEvent = which;
     numEvents = max_reqs_per_event;
+    sliceEnd = 0;
+    if (slice != 0 && thr != nullptr) {
+        // Let the connections of the other buckets on this thread run
+        // if this bucket used more than its share of the thread
+        if (thr->scheduler.isOverShare(bucket, start)) {
+            numEvents = 1;
+            get_thread_stats(this)->sched_throttled++;
+        }
+        sliceEnd = start + thr->scheduler.getSlice(bucket, slice);
+    }
+
     try {
         runStateMachinery();
     } catch (std::exception& e) {
@@ -1292,6 +1955,13 @@ void McbpConnection::runEventLoop(short which) {
     }
 
     conn_return_buffers(this);
+    if (thr != nullptr) {
+        const hrtime_t cost = tsc_clock_now() - start;
+        thr->load.busy_time += cost;
+        if (slice != 0) {
+            thr->scheduler.charge(bucket, start + cost, cost);
+        }
+    }
 }
 
 void McbpConnection::initateShutdown() {
@@ -20,15 +20,21 @@
 
 #include "config.h"
 
+#include "compression.h"
 #include "dynamic_buffer.h"
 #include "log_macros.h"
 #include "net_buf.h"
 #include "settings.h"
 #include "statemachine_mcbp.h"
+#include "tsc_clock.h"
 
+#include <atomic>
 #include <cJSON.h>
 #include <cbsasl/cbsasl.h>
 #include <chrono>
+#include <cstring>
+#include <functional>
+#include <list>
 #include <memcached/openssl.h>
 #include <memory>
 #include <string>
@@ -50,10 +56,14 @@ public:
           error(false),
           application(nullptr),
           network(nullptr),
-          ctx(nullptr),
           client(nullptr),
           totalRecv(0),
-          totalSend(0) {
+          totalSend(0),
+          recordsWritten(0),
+          ktlsRx(false),
+          ktlsTx(false),
+          acceptError(SSL_ERROR_NONE),
+          handshakeTime(0) {
         in.total = 0;
         in.current = 0;
         out.total = 0;
@@ -120,6 +130,31 @@ public:
      */
     void drainBioSendPipe(SOCKET sfd);
 
+    /**
+     * Try to hand the record layer over to the kernel (kTLS) after the
+     * handshake completed. The SSL stream keeps using the BIOs for the
+     * directions which aren't offloaded.
+     *
+     * @param sfd the socket for the connection
+     * @param reason set to the reason why it wasn't (fully) offloaded
+     * @return true if the kernel decrypts the incoming data
+     */
+    bool offloadToKernel(SOCKET sfd, std::string& reason);
+
+    /**
+     * Does the kernel decrypt the data we receive?
+     */
+    bool isKtlsRx() const {
+        return ktlsRx;
+    }
+
+    /**
+     * Does the kernel encrypt the data we send?
+     */
+    bool isKtlsTx() const {
+        return ktlsTx;
+    }
+
     bool moreInputAvailable() const {
         return (in.current < in.total);
     }
@@ -135,8 +170,42 @@ public:
      */
     void dumpCipherList(uint32_t id) const;
 
-    int accept() {
-        return SSL_accept(client);
+    /**
+     * Run SSL_accept() to continue the handshake. May be called by an
+     * executor thread (the error state in OpenSSL is per thread, so the
+     * error is captured here for getAcceptError())
+     *
+     * @return the value returned by SSL_accept()
+     */
+    int accept();
+
+    /**
+     * Get the SSL error code for the last call to accept()
+     */
+    int getAcceptError() const {
+        return acceptError;
+    }
+
+    /**
+     * Get the description of the OpenSSL error for the last call to
+     * accept() which failed
+     */
+    const std::string& getAcceptErrorString() const {
+        return acceptErrorString;
+    }
+
+    /**
+     * Get the total time spent in accept() for this connection
+     */
+    hrtime_t getHandshakeTime() const {
+        return handshakeTime;
+    }
+
+    /**
+     * Did the handshake resume a previous session?
+     */
+    bool isSessionReused() const {
+        return SSL_session_reused(client) != 0;
     }
 
     int getError(int errormask) const {
@@ -148,6 +217,7 @@ public:
     }
 
     int write(const void* buf, int num) {
+        ++recordsWritten;
         return SSL_write(client, buf, num);
     }
 
@@ -166,7 +236,6 @@ protected:
     bool error;
     BIO* application;
     BIO* network;
-    SSL_CTX* ctx;
     SSL* client;
     struct {
         // The data located in the buffer
@@ -181,6 +250,16 @@ protected:
     size_t totalRecv;
     // Total number of bytes sent to the network
     size_t totalSend;
+    // Total number of calls to SSL_write (each creates at least one record)
+    size_t recordsWritten;
+    // The receive and transmit side is offloaded to the kernel
+    bool ktlsRx;
+    bool ktlsTx;
+    // The result of the last call to accept()
+    int acceptError;
+    std::string acceptErrorString;
+    // Total time spent in SSL_accept()
+    hrtime_t handshakeTime;
 };
 
 /**
@@ -197,6 +276,22 @@ public:
     virtual ~CommandContext() { };
 };
 
+class McbpConnection;
+
+/**
+ * A continuation is registered by an executor (see McbpConnection::suspend)
+ * when the engine returns EWOULDBLOCK. Once the engine notifies the
+ * command, the continuation is called with the status passed to
+ * notify_io_complete, and picks up where the executor left off. The
+ * privilege checks, the packet validation and the parsing done by the
+ * executor before it called the engine isn't repeated.
+ *
+ * The packet is moved when the command is parked (unordered execution),
+ * so a continuation must not capture pointers into the packet. Use the
+ * connection passed to the continuation to locate it again.
+ */
+typedef std::function<void(McbpConnection*, ENGINE_ERROR_CODE)> Continuation;
+
 class SaslCommandContext : public CommandContext {
 public:
     SaslCommandContext(std::shared_ptr<Task>& t)
@@ -205,12 +300,73 @@ public:
     std::shared_ptr<Task> task;
 };
 
+/**
+ * An McbpCommand holds the state for a single command on a connection
+ * which enabled unordered execution (PROTOCOL_BINARY_FEATURE_UNORDERED_EXECUTION).
+ *
+ * The command is passed as the cookie to the engine, so that the engine
+ * may notify the individual command instead of the connection. When the
+ * engine returns EWOULDBLOCK the command (and a copy of its packet) is
+ * parked on the connection, and the connection continues to execute the
+ * following commands. The command is resumed (with its state swapped
+ * back into the connection) once the engine notifies it, and the
+ * client use the opaque field to match the responses to its requests.
+ */
+class McbpCommand : public Cookie {
+public:
+    McbpCommand(Connection* conn)
+        : Cookie(conn),
+          cmd(0),
+          noreply(false),
+          start(0),
+          cas(0),
+          item(nullptr),
+          commandContext(nullptr),
+          aiostat(ENGINE_SUCCESS),
+          notified(false) {
+        memset(&binary_header, 0, sizeof(binary_header));
+    }
+
+    ~McbpCommand() {
+        delete commandContext;
+    }
+
+    /** A copy of the packet (header and body) */
+    std::vector<char> packet;
+
+    /** The state of the command while it is parked */
+    protocol_binary_request_header binary_header;
+    uint8_t cmd;
+    bool noreply;
+    hrtime_t start;
+    uint64_t cas;
+    void* item;
+    CommandContext* commandContext;
+    Continuation continuation;
+
+    /** The status from notify_io_complete, valid when notified is set */
+    ENGINE_ERROR_CODE aiostat;
+
+    /**
+     * Set by notify_io_complete (from any thread) when the engine is
+     * done with the operation and the command may be resumed
+     */
+    std::atomic_bool notified;
+};
+
 class McbpConnection : public Connection {
 public:
     McbpConnection() = delete;
     McbpConnection(SOCKET sfd, event_base* b);
 
-    McbpConnection(SOCKET sfd, event_base* b, const struct listening_port& ifc);
+    /**
+     * Create a new connection for a client connected to the given port
+     *
+     * @param buffers the buffers of a released connection to use instead
+     *                of allocating new ones (may be nullptr)
+     */
+    McbpConnection(SOCKET sfd, event_base* b, const struct listening_port& ifc,
+                   ConnectionBuffers* buffers = nullptr);
 
     virtual ~McbpConnection();
 
@@ -311,6 +467,39 @@ public:
         McbpConnection::numEvents = nevents;
     }
 
+    /**
+     * Mark the command being read as rejected by the admission control
+     * (the bucket is over its rate limits or the worker thread is
+     * shedding load). The flag is set when the header is parsed and
+     * consumed when the command is about to be executed.
+     */
+    void setRejected(bool rejected) {
+        McbpConnection::rejected = rejected;
+    }
+
+    bool isRejected() const {
+        return rejected;
+    }
+
+    /**
+     * Check if the connection used up its time slice on the worker
+     * thread (only used when the "sched_slice" setting is enabled).
+     */
+    bool isTimeSliceExhausted() const {
+        return sliceEnd != 0 && tsc_clock_now() >= sliceEnd;
+    }
+
+    /**
+     * Mark the connection as ready to run (because it yielded or because
+     * an engine operation completed). The time until the worker thread
+     * serves the connection is recorded as the scheduling delay for the
+     * bucket. May be called from any thread.
+     */
+    void setRunnable() {
+        hrtime_t expected = 0;
+        runnableSince.compare_exchange_strong(expected, tsc_clock_now());
+    }
+
     /**
      * Get the maximum number of events we should process per invocation
      * for a connection object (to avoid starvation of other connections)
@@ -326,6 +515,19 @@ public:
      */
     bool updateEvent(const short new_flags);
 
+    /**
+     * Called by updateEvent() every time the connection is about to wait
+     * for the given events, to get the events to ask libevent for on the
+     * socket descriptor. Transports where the descriptor isn't the socket
+     * itself use this to arm their notification mechanism.
+     *
+     * @param new_flags the events the connection wants to wait for
+     * @return the events to register in libevent
+     */
+    virtual short prepareToWait(const short new_flags) {
+        return new_flags;
+    }
+
     /**
      * Reapply the event mask (in case of a timeout we might want to do
      * that)
@@ -348,6 +550,30 @@ public:
         return registered_in_libevent;
     }
 
+    /**
+     * Is the connection idle (waiting for the client to send the next
+     * command), and without any data buffered or references held by the
+     * engine so that it may be moved over to another worker thread?
+     */
+    bool isMigratable();
+
+    /**
+     * Move the connection over to another event base and register it
+     * in libevent. The connection must not be registered in libevent
+     * on the current event base.
+     *
+     * @param b the event base of the worker thread taking over
+     * @return true if success, false otherwise
+     */
+    bool moveToEventBase(event_base* b);
+
+    /**
+     * Get the total number of bytes received on this connection
+     */
+    size_t getTotalRecv() const {
+        return totalRecv;
+    }
+
     short getEventFlags() const {
         return ev_flags;
     }
@@ -506,6 +732,7 @@ public:
             bucketEngine->release(handle, this, it);
         }
         reservedItems.clear();
+        reservedValues.clear();
     }
 
     /**
@@ -523,6 +750,21 @@ public:
         }
     }
 
+    /**
+     * Keep a reference to a compressed value being sent until the
+     * reserved items are released
+     *
+     * @return true if success, false otherwise
+     */
+    bool reserveCompressedValue(const CompressedValue& value) {
+        try {
+            reservedValues.push_back(value);
+            return true;
+        } catch (std::bad_alloc) {
+            return false;
+        }
+    }
+
     void releaseTempAlloc() {
         for (auto* ptr : temp_alloc) {
             free(ptr);
@@ -530,6 +772,14 @@ public:
         temp_alloc.resize(0);
     }
 
+    /**
+     * Release the items and temporary allocations held by the connection,
+     * and move its (empty) vectors to buffers so that they may be reused
+     * by another connection. Vectors which have grown beyond their high
+     * watermark are kept by the connection (and freed with it).
+     */
+    void recycleBuffers(ConnectionBuffers& buffers);
+
     bool pushTempAlloc(char* ptr) {
         try {
             temp_alloc.push_back(ptr);
@@ -617,6 +867,33 @@ public:
         McbpConnection::ewouldblock = ewouldblock;
     }
 
+    /**
+     * Suspend the current command. The engine returned EWOULDBLOCK, and
+     * the continuation is called instead of the executor when the engine
+     * notifies the command.
+     *
+     * @param cont the function to call when the command is resumed
+     */
+    void suspend(Continuation cont) {
+        continuation = std::move(cont);
+        ewouldblock = true;
+    }
+
+    /**
+     * Is the current command suspended (waiting to be resumed with its
+     * continuation)?
+     */
+    bool isSuspended() const {
+        return static_cast<bool>(continuation);
+    }
+
+    /**
+     * Resume the suspended command by calling its continuation with the
+     * status from notify_io_complete. The continuation may suspend the
+     * command again.
+     */
+    void resume();
+
     /**
      *  Get the command context stored for this command
      */
@@ -635,13 +912,176 @@ public:
      * Reset the command context
      *
      * Release the allocated resources and set the command context to nullptr
+     * (and drop the continuation if the command was suspended)
      */
     void resetCommandContext() {
         if (commandContext != nullptr) {
             delete commandContext;
             commandContext = nullptr;
         }
+        continuation = nullptr;
+    }
+    bool isUnorderedExecution() const {
+        return unordered_execution;
     }
+
+    void setUnorderedExecution(bool enable) {
+        McbpConnection::unordered_execution = enable;
+    }
+
+    /**
+     * Get the codec the client asked the values in the responses to be
+     * compressed with (through HELLO)
+     */
+    CompressionCodec getCompressionCodec() const {
+        return compressionCodec;
+    }
+
+    void setCompressionCodec(const CompressionCodec codec) {
+        compressionCodec = codec;
+    }
+
+    /**
+     * Set the status of the async io operation for the given cookie
+     * (called from notify_io_complete). The cookie is either the cookie
+     * for the connection, or one of the parked commands.
+     */
+    void setAiostat(const Cookie& cookie, const ENGINE_ERROR_CODE& aiostat);
+
+    /**
+     * Start executing the command just read from the network. If the
+     * connection use unordered execution and the command may be
+     * reordered, a separate cookie is used for the command until it
+     * completes (or is parked).
+     */
+    void startCommand();
+
+    /**
+     * The current command completed (the response is generated), so
+     * the connection cookie is used from now on.
+     */
+    void endCommand();
+
+    /**
+     * Park the current command (which returned EWOULDBLOCK) so that the
+     * connection may continue with the next command.
+     *
+     * @return true if the command was parked, false if the connection
+     *              must block until the command is notified
+     */
+    bool parkCommand();
+
+    /**
+     * Resume the first of the parked commands the engine has notified
+     * by swapping its state back into the connection and executing it.
+     *
+     * @return true if a command was resumed (and completed), false if
+     *              no commands are ready (or the command blocked again)
+     */
+    bool resumeParkedCommand();
+
+    /**
+     * Do we have any parked commands?
+     */
+    bool hasParkedCommands() const {
+        return !parkedCommands.empty();
+    }
+
+    /**
+     * Do we have any parked commands the engine has notified?
+     */
+    bool hasReadyCommands() const;
+
+    /**
+     * Are there any parked commands the engine has not notified yet?
+     */
+    bool hasOutstandingCommands() const;
+
+    /**
+     * Release the resources held by all of the parked commands. All of
+     * them must be notified (the engine must be done with the cookies).
+     */
+    void releaseParkedCommands();
+
+    /**
+     * Let the engine release the engine specific storage still held by
+     * the command cookies (by running the ON_DISCONNECT callbacks for
+     * each of them), and drop the cookies. Called when the connection
+     * is closed.
+     */
+    void releaseRetainedCommands();
+
+    /**
+     * Check if the next command in the input buffer must wait for all of
+     * the parked commands to complete before it may be executed (it isn't
+     * one of the commands which may be reordered).
+     */
+    bool mustWaitForParkedCommands() const;
+
+    /**
+     * Get the number of bytes the connection holds for the client which
+     * isn't sent yet: the data queued for the socket, and the packets of
+     * the parked commands (whose responses are yet to be sent).
+     */
+    size_t getPendingBytes() const;
+
+    /**
+     * Get the number of items the connection holds a reference to (until
+     * they're sent to the client, or the parked command completes)
+     */
+    size_t getPinnedItems() const;
+
+    /**
+     * Is the connection holding more than max_pending_bytes or
+     * max_pinned_items? When it does it stops reading new commands (and
+     * TAP stops adding items to the batch) until the backlog drains.
+     */
+    bool isOverOutputLimits() const;
+
+    /**
+     * Is the current libevent timeout the slow reader timeout (we're
+     * waiting for the client to read data) rather than the idle timeout?
+     */
+    bool isWaitingForSlowReader() const {
+        return ev_timeout_enabled && ev_slow_reader;
+    }
+
+    /**
+     * Should the SSL handshake for this connection run on the executor
+     * pool (in the conn_ssl_handshake state) instead of inline when data
+     * is read?
+     */
+    bool needsSslHandshake() const {
+        return ssl.isEnabled() && !ssl.isConnected() &&
+               settings.isSslHandshakeOffload();
+    }
+
+    /**
+     * Is an executor running the SSL handshake for this connection? The
+     * connection can't be released until it is done.
+     */
+    bool isSslHandshakeRunning() const;
+
+    /**
+     * Drive the SSL handshake for the conn_ssl_handshake state: schedule
+     * SSL_accept on the executor pool, and handle the result when the
+     * executor notifies the connection.
+     *
+     * @return true if the state machine should continue, false if it
+     *         should wait for the executor or more data from the client
+     */
+    bool runSslHandshake();
+
+    /**
+     * Run a step of the SSL handshake (called by the SslHandshakeTask on
+     * the executor thread)
+     *
+     * @return the value returned by SSL_accept()
+     */
+    int sslAccept() {
+        return ssl.accept();
+    }
+
     /**
      * Try to enable SSL for this connection
      *
@@ -693,11 +1133,24 @@ public:
     /** Write buffer */
     struct net_buf write;
 
+    /**
+     * Get the cookie to pass to the engine for the command being executed
+     * (the connection cookie unless it is a parked or reorderable command
+     * on a connection using unordered execution).
+     */
     const void* getCookie() const {
-        return &cookie;
+        return currentCookie;
     }
 
     Cookie& getCookieObject() {
+        return *currentCookie;
+    }
+
+    /**
+     * Get the connection's own cookie (used for all commands which don't
+     * get a cookie of their own)
+     */
+    Cookie& getConnectionCookie() {
         return cookie;
     }
 
@@ -725,6 +1178,12 @@ protected:
      */
     bool initializeEvent();
 
+    /**
+     * Set up iov, msglist, reservedItems and temp_alloc in their initial
+     * state, reusing the vectors in buffers (if provided)
+     */
+    void initializeBuffers(ConnectionBuffers* buffers);
+
     /**
      * The state machine we're currently using
      */
@@ -744,6 +1203,21 @@ protected:
      */
     int numEvents;
 
+    /**
+     * The time the connection must yield the worker thread (0 if it's
+     * only limited by numEvents)
+     */
+    hrtime_t sliceEnd;
+
+    /**
+     * The time the connection became ready to run (0 if it's waiting
+     * for network io)
+     */
+    std::atomic<hrtime_t> runnableSince;
+
+    /** Is the current command rejected by the admission control */
+    bool rejected;
+
     /** current command being processed */
     uint8_t cmd;
 
@@ -763,6 +1237,8 @@ protected:
     bool ev_timeout_enabled;
     /** If ev_timeout_enabled is true, the current timeout in libevent */
     rel_time_t ev_timeout;
+    /** Is the current timeout the slow_reader_timeout */
+    bool ev_slow_reader;
 
     /** which state to go into after finishing current write */
     TaskFunction write_and_go;
@@ -800,6 +1276,12 @@ protected:
      */
     std::vector<void*> reservedItems;
 
+    /**
+     * The compressed values we're sending (released with the reserved
+     * items)
+     */
+    std::vector<CompressedValue> reservedValues;
+
     /**
      * A vector of temporary allocations that should be freed when the
      * the connection is done sending all of the data. Use pushTempAlloc to
@@ -859,6 +1341,11 @@ protected:
      */
     CommandContext* commandContext;
 
+    /**
+     * The continuation of the current command if it is suspended
+     */
+    Continuation continuation;
+
     /**
      * The SSL context used by this connection (if enabled)
      */
@@ -888,18 +1375,73 @@ protected:
      */
     int sslWrite(const char* src, size_t nbytes);
 
+    /**
+     * Write the iovecs in the message over the SSL stream, coalescing
+     * small iovecs into full TLS records
+     *
+     * @param m the message to send
+     * @return the number of bytes written, or -1 on error
+     */
+    int sslSendmsg(struct msghdr* m);
+
     /**
      * Handle the state for the ssl connection before the ssl connection
      * is fully established
      */
     int sslPreConnection();
 
+    /**
+     * Handle the return value from a call to SSL_accept(), and complete
+     * the setup of the connection if the handshake is done
+     *
+     * @param r the value returned by SSL_accept()
+     * @return 0 if the handshake completed, -1 (with the network error
+     *         set) if it needs more data or failed
+     */
+    int handleSslAcceptResult(int r);
+
+    /**
+     * The SSL handshake running on the executor pool (if any)
+     */
+    std::shared_ptr<Task> sslHandshakeTask;
+
     // Total number of bytes received on the network
     size_t totalRecv;
     // Total number of bytes sent to the network
     size_t totalSend;
 
     Cookie cookie;
+
+    /** The cookie for the command being executed */
+    Cookie* currentCookie;
+
+    /** Has the client enabled unordered execution (through HELLO) */
+    bool unordered_execution;
+
+    /** The codec the client asked for (through HELLO) */
+    CompressionCodec compressionCodec;
+
+    /** The command being executed (if it got its own cookie) */
+    std::unique_ptr<McbpCommand> currentCommand;
+
+    /** The commands waiting for the engine to notify them */
+    std::list<std::unique_ptr<McbpCommand>> parkedCommands;
+
+    /** Command objects available for reuse */
+    std::vector<std::unique_ptr<McbpCommand>> spareCommands;
+
+    /**
+     * Command objects the engine left engine specific storage in. They
+     * can't be reused, and are kept until the connection is closed so
+     * that the engine gets a chance to release the storage.
+     */
+    std::vector<std::unique_ptr<McbpCommand>> retainedCommands;
+
+    /** The total size of the packets held by the parked commands */
+    size_t parkedBytes;
+
+    /** The number of parked commands holding an item */
+    size_t parkedItems;
 };
 
 /*
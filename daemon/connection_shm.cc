@@ -0,0 +1,164 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include "config.h"
+#include "connection_shm.h"
+#include "memcached.h"
+
+#include <cstring>
+
+#ifdef HAVE_SHM_TRANSPORT
+#include <unistd.h>
+
+ShmConnection::ShmConnection(SOCKET doorbell, event_base* b, SOCKET control,
+                             int client_doorbell,
+                             std::unique_ptr<ShmRegion> region,
+                             const std::string& parent_path)
+    : McbpConnection(doorbell, b),
+      control(control),
+      clientDoorbell(client_doorbell),
+      region(std::move(region)),
+      requests(this->region->getRequestRing()),
+      responses(this->region->getResponseRing()),
+      controlEventAdded(false),
+      peerClosed(false) {
+    Connection::parent_path = parent_path;
+    peername = "shm";
+    sockname = "shm:" + parent_path;
+    setState(conn_new_cmd);
+
+    // The client may have written its first command before we got here
+    if (!requests.prepareToWaitForData()) {
+        shm_ring_doorbell(socketDescriptor);
+    }
+
+    memset(&controlEvent, 0, sizeof(controlEvent));
+    if (event_assign(&controlEvent, b, control, EV_READ,
+                     control_event_handler, this) == -1 ||
+        event_add(&controlEvent, nullptr) == -1) {
+        // We'll still notice when the client closes the rings, but not
+        // if it crashes
+        LOG_WARNING(this, "%u: Failed to watch the control socket of the "
+                    "shared memory connection", getId());
+    } else {
+        controlEventAdded = true;
+    }
+}
+
+ShmConnection::~ShmConnection() {
+    if (controlEventAdded) {
+        event_del(&controlEvent);
+    }
+
+    // Let the client know that no more responses will arrive
+    responses.close();
+    shm_ring_doorbell(clientDoorbell);
+
+    close(clientDoorbell);
+    close(control);
+}
+
+void ShmConnection::control_event_handler(evutil_socket_t, short, void* arg) {
+    // The client isn't allowed to send anything on the socket once the
+    // transport is set up, so any event means that it is gone
+    auto* c = reinterpret_cast<ShmConnection*>(arg);
+    c->controlEventAdded = false;
+    c->peerClosed = true;
+    if (c->isRegisteredInLibevent()) {
+        event_active(&c->event, EV_READ, 0);
+    }
+}
+
+int ShmConnection::recv(char* dest, size_t nbytes) {
+    const size_t nr = requests.read(dest, nbytes);
+    if (nr > 0) {
+        if (requests.wakeProducer()) {
+            shm_ring_doorbell(clientDoorbell);
+        }
+        return int(nr);
+    }
+
+    if (peerClosed || requests.isClosed()) {
+        return 0;
+    }
+
+    set_ewouldblock();
+    return -1;
+}
+
+int ShmConnection::sendmsg(struct msghdr* m) {
+    if (peerClosed) {
+        set_econnreset();
+        return -1;
+    }
+
+    // The iovecs point straight into the items, so the values are
+    // copied into the ring without any intermediate buffer
+    const size_t nw = responses.write(m->msg_iov, size_t(m->msg_iovlen));
+    if (nw == 0) {
+        set_ewouldblock();
+        return -1;
+    }
+
+    if (responses.wakeConsumer()) {
+        shm_ring_doorbell(clientDoorbell);
+    }
+    return int(nw);
+}
+
+short ShmConnection::prepareToWait(const short new_flags) {
+    // Both conditions are signalled through the doorbell. Reset it, tell
+    // the client what we're waiting for and look again so that we don't
+    // miss an update made before the client saw the flags.
+    shm_drain_doorbell(socketDescriptor);
+
+    bool ready = peerClosed;
+    if ((new_flags & EV_READ) && !requests.prepareToWaitForData()) {
+        ready = true;
+    }
+    if ((new_flags & EV_WRITE) && !responses.prepareToWaitForSpace()) {
+        ready = true;
+    }
+    if (ready) {
+        shm_ring_doorbell(socketDescriptor);
+    }
+
+    return short(EV_READ | (new_flags & EV_PERSIST));
+}
+
+void ShmConnection::runEventLoop(short which) {
+    // The doorbell is only registered for EV_READ, but the state machine
+    // may be waiting for EV_WRITE
+    if (which & EV_READ) {
+        which |= (ev_flags & EV_WRITE);
+    }
+    McbpConnection::runEventLoop(which);
+}
+
+cJSON* ShmConnection::toJSON() const {
+    cJSON* obj = McbpConnection::toJSON();
+    if (obj != nullptr) {
+        cJSON* shm = cJSON_CreateObject();
+        cJSON_AddNumberToObject(shm, "ring_size", region->getRingSize());
+        cJSON_AddNumberToObject(shm, "request_bytes", requests.used());
+        cJSON_AddNumberToObject(shm, "response_bytes", responses.used());
+        cJSON_AddNumberToObject(shm, "control", control);
+        cJSON_AddNumberToObject(shm, "client_doorbell", clientDoorbell);
+        cJSON_AddItemToObject(obj, "shm", shm);
+    }
+    return obj;
+}
+#endif
@@ -0,0 +1,101 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include "connection_mcbp.h"
+#include "shm_ring.h"
+
+#include <memory>
+
+#ifdef HAVE_SHM_TRANSPORT
+/**
+ * A connection using the shared memory transport (see shm_ring.h)
+ * instead of a socket. It runs the same state machine and executors as
+ * a McbpConnection; only recv and sendmsg copy the data through the
+ * rings.
+ *
+ * The socket descriptor of the connection is the eventfd the client
+ * rings to wake us up. We only ever wait for it to be readable: when
+ * the state machine wants to wait for EV_WRITE (there is no room in the
+ * response ring) we ask the client to ring it when it made room.
+ *
+ * The connection keeps a duplicate of the Unix domain socket the client
+ * negotiated the transport on, and shuts down when the client closes it
+ * (or exits).
+ */
+class ShmConnection : public McbpConnection {
+public:
+    ShmConnection() = delete;
+
+    /**
+     * Create a new connection. The connection takes ownership of the
+     * descriptors.
+     *
+     * @param doorbell the eventfd the client rings to wake us up
+     * @param b the event base to use
+     * @param control a duplicate of the Unix domain socket the client
+     *                negotiated the transport on
+     * @param client_doorbell the eventfd we ring to wake up the client
+     * @param region the shared memory with the rings
+     * @param parent_path the path of the Unix domain socket
+     */
+    ShmConnection(SOCKET doorbell, event_base* b, SOCKET control,
+                  int client_doorbell, std::unique_ptr<ShmRegion> region,
+                  const std::string& parent_path);
+
+    ~ShmConnection();
+
+    virtual int sendmsg(struct msghdr* m) override;
+
+    virtual int recv(char* dest, size_t nbytes) override;
+
+    virtual short prepareToWait(const short new_flags) override;
+
+    virtual void runEventLoop(short which) override;
+
+    virtual bool isShmConnection() override {
+        return true;
+    }
+
+    virtual cJSON* toJSON() const override;
+
+protected:
+    static void control_event_handler(evutil_socket_t fd, short which,
+                                      void* arg);
+
+    /** The duplicate of the Unix domain socket */
+    const SOCKET control;
+
+    /** The eventfd we ring to wake up the client */
+    const int clientDoorbell;
+
+    std::unique_ptr<ShmRegion> region;
+
+    /** The requests from the client (we're the consumer) */
+    ShmRing requests;
+
+    /** The responses to the client (we're the producer) */
+    ShmRing responses;
+
+    /** The event fired when the client closes the control socket */
+    struct event controlEvent;
+    bool controlEventAdded;
+
+    /** Set when the client closed the control socket */
+    bool peerClosed;
+};
+#endif
@@ -16,14 +16,24 @@
  */
 
 #include "connections.h"
+#include "connection_shm.h"
 #include "runtime.h"
 #include "utilities/protocol2text.h"
 #include "settings.h"
 #include "stats.h"
 
 #include <cJSON.h>
+#include <cstring>
 #include <list>
 #include <algorithm>
+#include <typeinfo>
+
+#ifdef HAVE_SHM_TRANSPORT
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
 
 /*
  * Free list management for connections.
@@ -52,16 +62,18 @@ static void conn_return_single_buffer(Connection *c, struct net_buf *thread_buf,
 static void conn_destructor(Connection *c);
 static Connection *allocate_connection(SOCKET sfd,
                                        event_base *base,
-                                       const struct listening_port &interface);
+                                       const struct listening_port &interface,
+                                       LIBEVENT_THREAD* thread);
 
 static ListenConnection* allocate_listen_connection(SOCKET sfd,
                                                     event_base* base,
                                                     in_port_t port,
                                                     sa_family_t family,
-                                                    const struct interface& interf);
+                                                    const struct interface& interf,
+                                                    LIBEVENT_THREAD* worker);
 
 static Connection *allocate_pipe_connection(int fd, event_base *base);
-static void release_connection(Connection *c);
+static void release_connection(Connection *c, LIBEVENT_THREAD* thread);
 
 /** External functions *******************************************************/
 int signal_idle_clients(LIBEVENT_THREAD *me, int bucket_idx, bool logging)
@@ -76,6 +88,11 @@ int signal_idle_clients(LIBEVENT_THREAD *me, int bucket_idx, bool logging)
     for (auto* c : connections.conns) {
         if (c->getThread() == me) {
             ++connected;
+            if (c->isMigrating()) {
+                // Not registered in our event base yet; it is signalled
+                // once we've picked it up from the queue
+                continue;
+            }
             if (bucket_idx == -1 || c->getBucketIndex() == bucket_idx) {
                 c->signalIfIdle(logging, me->index);
             }
@@ -85,6 +102,25 @@ int signal_idle_clients(LIBEVENT_THREAD *me, int bucket_idx, bool logging)
     return connected;
 }
 
+McbpConnection* conn_find_migration_candidate(LIBEVENT_THREAD *me) {
+    McbpConnection* ret = nullptr;
+    std::lock_guard<std::mutex> lock(connections.mutex);
+    for (auto* c : connections.conns) {
+        if (c->getThread() != me) {
+            continue;
+        }
+        auto* mcbp = dynamic_cast<McbpConnection*>(c);
+        if (mcbp == nullptr || !mcbp->isMigratable()) {
+            continue;
+        }
+        if (ret == nullptr || mcbp->getTotalRecv() > ret->getTotalRecv()) {
+            ret = mcbp;
+        }
+    }
+
+    return ret;
+}
+
 void assert_no_associations(int bucket_idx)
 {
     std::lock_guard<std::mutex> lock(connections.mutex);
@@ -149,19 +185,29 @@ void close_all_connections(void)
     } while (!done);
 }
 
-void run_event_loop(Connection* c, short which) {
+void run_event_loop(Connection* c, short which, LIBEVENT_THREAD* thread) {
     c->runEventLoop(which);
     if (c->shouldDelete()) {
-        release_connection(c);
+        release_connection(c, thread);
+    }
+}
+
+void conn_pool_cleanup(LIBEVENT_THREAD* thread) {
+    for (auto& entry : thread->conn_pool.free) {
+        ::operator delete(entry.memory);
     }
+    thread->conn_pool.free.clear();
+    thread->conn_pool.size = 0;
 }
 
 ListenConnection* conn_new_server(const SOCKET sfd,
                                   in_port_t parent_port,
                                   sa_family_t family,
                                   const struct interface& interf,
-                                  struct event_base* base) {
-    auto* c = allocate_listen_connection(sfd, base, parent_port, family, interf);
+                                  struct event_base* base,
+                                  LIBEVENT_THREAD* worker) {
+    auto* c = allocate_listen_connection(sfd, base, parent_port, family,
+                                         interf, worker);
     if (c == nullptr) {
         return nullptr;
     }
@@ -175,14 +221,16 @@ ListenConnection* conn_new_server(const SOCKET sfd,
 }
 
 Connection* conn_new(const SOCKET sfd, in_port_t parent_port,
+                     const std::string& parent_path,
                      struct event_base* base,
                      LIBEVENT_THREAD* thread) {
 
     Connection *c = nullptr;
 
     for (auto& interface : stats.listening_ports) {
-        if (parent_port == interface.port) {
-            c = allocate_connection(sfd, base, interface);
+        if (parent_port == interface.port &&
+            parent_path == interface.path) {
+            c = allocate_connection(sfd, base, interface, thread);
             if (c == nullptr) {
                 return nullptr;
             }
@@ -233,6 +281,150 @@ Connection* conn_pipe_new(const int fd,
 
 }
 
+#ifdef HAVE_SHM_TRANSPORT
+/**
+ * Send the response to SHM_CONNECT with the descriptors for the transport
+ * attached
+ */
+static bool send_shm_descriptors(SOCKET sfd, uint32_t opaque,
+                                 const int* fds, size_t nfds) {
+    protocol_binary_response_shm_connect response;
+    memset(&response, 0, sizeof(response));
+    response.message.header.response.magic = PROTOCOL_BINARY_RES;
+    response.message.header.response.opcode = PROTOCOL_BINARY_CMD_SHM_CONNECT;
+    response.message.header.response.datatype = PROTOCOL_BINARY_RAW_BYTES;
+    response.message.header.response.status =
+        htons(PROTOCOL_BINARY_RESPONSE_SUCCESS);
+    response.message.header.response.opaque = opaque;
+
+    struct iovec iov;
+    iov.iov_base = response.bytes;
+    iov.iov_len = sizeof(response.bytes);
+
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+    } control;
+    cb_assert(nfds <= 3);
+    memset(&control, 0, sizeof(control));
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+
+    // The connection had no pending output, so the (tiny) response fits
+    // in the socket buffer
+    ssize_t nw;
+    do {
+        nw = ::sendmsg(sfd, &msg, MSG_NOSIGNAL);
+    } while (nw == -1 && errno == EINTR);
+
+    return nw == ssize_t(sizeof(response.bytes));
+}
+
+ENGINE_ERROR_CODE conn_new_shm(McbpConnection* c, uint32_t opaque) {
+    std::unique_ptr<ShmRegion> region;
+    try {
+        region = ShmRegion::create(settings.getShmRingSize());
+    } catch (std::exception& e) {
+        LOG_WARNING(c, "%u: Failed to create the shared memory rings: %s",
+                    c->getId(), e.what());
+        return ENGINE_TMPFAIL;
+    }
+
+    const int doorbell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    const int client_doorbell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    const int control = fcntl(c->getSocketDescriptor(), F_DUPFD_CLOEXEC, 0);
+    if (doorbell == -1 || client_doorbell == -1 || control == -1) {
+        LOG_WARNING(c, "%u: Failed to create the shared memory doorbells: %s",
+                    c->getId(), strerror(errno));
+        for (int fd : {doorbell, client_doorbell, control}) {
+            if (fd != -1) {
+                close(fd);
+            }
+        }
+        return ENGINE_TMPFAIL;
+    }
+
+    const int fds[3] = {region->getDescriptor(), doorbell, client_doorbell};
+    if (!send_shm_descriptors(c->getSocketDescriptor(), opaque, fds, 3)) {
+        LOG_WARNING(c, "%u: Failed to send the shared memory descriptors: %s",
+                    c->getId(), strerror(errno));
+        close(doorbell);
+        close(client_doorbell);
+        close(control);
+        return ENGINE_DISCONNECT;
+    }
+
+    // The client is ours now; if we fail from here on it sees the socket
+    // close
+    auto* thread = c->getThread();
+    stats.curr_conns.fetch_add(1, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> guard(stats_mutex);
+        auto* port_instance = get_listening_port_instance(c->getParentPort(),
+                                                          c->getParentPath());
+        cb_assert(port_instance);
+        ++port_instance->curr_conns;
+    }
+
+    ShmConnection* ret = nullptr;
+    try {
+        ret = new ShmConnection(doorbell, thread->base, control,
+                                client_doorbell, std::move(region),
+                                c->getParentPath());
+
+        std::lock_guard<std::mutex> lock(connections.mutex);
+        connections.conns.push_back(ret);
+        stats.conn_structs++;
+    } catch (std::exception& error) {
+        LOG_WARNING(c, "%u: Failed to create the shared memory connection: %s",
+                    c->getId(), error.what());
+        if (ret == nullptr) {
+            // safe_close updates curr_conns like it does for the sockets
+            // we fail to create a connection for
+            safe_close(doorbell);
+            close(client_doorbell);
+            close(control);
+        } else {
+            // The doorbell (and the other descriptors) are closed, and
+            // curr_conns updated, when the connection object is destroyed
+            ret->unregisterEvent();
+            delete ret;
+        }
+        std::lock_guard<std::mutex> guard(stats_mutex);
+        auto* port_instance = get_listening_port_instance(c->getParentPort(),
+                                                          c->getParentPath());
+        --port_instance->curr_conns;
+        return ENGINE_DISCONNECT;
+    }
+
+    stats.total_conns++;
+    ret->incrementRefcount();
+    ret->setThread(thread);
+    thread->load.connections++;
+    associate_initial_bucket(ret);
+    MEMCACHED_CONN_ALLOCATE(ret->getId());
+
+    LOG_INFO(c, "%u: Moved to the shared memory connection %u",
+             c->getId(), ret->getId());
+    return ENGINE_SUCCESS;
+}
+#else
+ENGINE_ERROR_CODE conn_new_shm(McbpConnection*, uint32_t) {
+    return ENGINE_ENOTSUP;
+}
+#endif
+
 void conn_cleanup_engine_allocations(McbpConnection * c) {
     ENGINE_HANDLE* handle = reinterpret_cast<ENGINE_HANDLE*>(c->getBucketEngine());
     if (c->getItem() != nullptr) {
@@ -268,9 +460,13 @@ static void conn_cleanup(Connection *c) {
     conn_return_buffers(c);
     if (mcbpc != nullptr) {
         mcbpc->clearDynamicBuffer();
+        mcbpc->getConnectionCookie().engine_storage = nullptr;
     }
-    c->setEngineStorage(nullptr);
 
+    auto* thread = c->getThread();
+    if (thread != nullptr) {
+        thread->load.connections--;
+    }
     c->setThread(nullptr);
     cb_assert(c->getNext() == nullptr);
     c->setSocketDescriptor(INVALID_SOCKET);
@@ -297,12 +493,14 @@ void conn_close(McbpConnection *c) {
     if (thread == nullptr) {
         std::logic_error("conn_close: unable to obtain non-NULL thread from connection");
     }
-    /* remove from pending-io list */
-    if (settings.getVerbose() > 1 && list_contains(thread->pending_io, c)) {
-        LOG_WARNING(c,
-                    "Current connection was in the pending-io list.. Nuking it");
+    /*
+     * The connection can't be removed from the pending-io list, so it
+     * is released when the thread picks it up from the list
+     */
+    if (settings.getVerbose() > 1 && c->isPendingIo()) {
+        LOG_WARNING(c, "Current connection is in the pending-io list.. "
+                    "Deferring release");
     }
-    thread->pending_io = list_remove(thread->pending_io, c);
 
     conn_cleanup(c);
 
@@ -312,9 +510,10 @@ void conn_close(McbpConnection *c) {
     c->setState(conn_destroyed);
 }
 
-struct listening_port *get_listening_port_instance(const in_port_t port) {
+struct listening_port *get_listening_port_instance(const in_port_t port,
+                                                   const std::string& path) {
     for (auto &instance : stats.listening_ports) {
-        if (instance.port == port) {
+        if (instance.port == port && instance.path == path) {
             return &instance;
         }
     }
@@ -422,19 +621,102 @@ static void conn_destructor(Connection *c) {
     stats.conn_structs--;
 }
 
+/**
+ * Free the connections in the pool beyond the limit (the pool may have
+ * been shrunk by a configuration change)
+ */
+static void trim_connection_pool(std::vector<PooledConnection>& pool,
+                                 size_t limit) {
+    while (pool.size() > limit) {
+        ::operator delete(pool.back().memory);
+        pool.pop_back();
+    }
+}
+
+/**
+ * Create a McbpConnection, reusing the memory and buffers of a connection
+ * in the thread's connection pool if there is one.
+ */
+static McbpConnection* new_mcbp_connection(SOCKET sfd,
+                                           event_base* base,
+                                           const struct listening_port& interface,
+                                           LIBEVENT_THREAD* thread) {
+    if (thread == nullptr) {
+        return new McbpConnection(sfd, base, interface);
+    }
+
+    auto& pool = thread->conn_pool;
+    trim_connection_pool(pool.free, settings.getConnectionPoolSize());
+    pool.size = pool.free.size();
+    if (pool.free.empty()) {
+        pool.misses++;
+        return new McbpConnection(sfd, base, interface);
+    }
+
+    auto entry = std::move(pool.free.back());
+    pool.free.pop_back();
+    pool.size = pool.free.size();
+    try {
+        auto* ret = new (entry.memory) McbpConnection(sfd, base, interface,
+                                                      &entry.buffers);
+        pool.hits++;
+        return ret;
+    } catch (...) {
+        ::operator delete(entry.memory);
+        throw;
+    }
+}
+
+/**
+ * Destroy a McbpConnection and keep its memory and buffers in the thread's
+ * connection pool if there is room for it.
+ *
+ * @return true if the connection was put in the pool, false if the caller
+ *         should delete it
+ */
+static bool pool_mcbp_connection(Connection* c, LIBEVENT_THREAD* thread) {
+    // Only exact McbpConnection objects fit in the memory we hand out
+    if (thread == nullptr || typeid(*c) != typeid(McbpConnection)) {
+        return false;
+    }
+
+    auto& pool = thread->conn_pool;
+    const size_t limit = settings.getConnectionPoolSize();
+    trim_connection_pool(pool.free, limit);
+    pool.size = pool.free.size();
+    if (pool.free.size() == limit) {
+        return false;
+    }
+
+    try {
+        pool.free.emplace_back();
+    } catch (std::bad_alloc&) {
+        return false;
+    }
+
+    auto* mcbp = static_cast<McbpConnection*>(c);
+    auto& entry = pool.free.back();
+    mcbp->recycleBuffers(entry.buffers);
+    mcbp->~McbpConnection();
+    entry.memory = mcbp;
+    pool.size = pool.free.size();
+    return true;
+}
+
 /** Allocate a connection, creating memory and adding it to the conections
  *  list. Returns a pointer to the newly-allocated connection if successful,
  *  else NULL.
  */
 static Connection *allocate_connection(SOCKET sfd,
                                        event_base *base,
-                                       const struct listening_port &interface) {
+                                       const struct listening_port &interface,
+                                       LIBEVENT_THREAD* thread) {
     Connection *ret = nullptr;
 
     try {
         switch (interface.protocol) {
         case Protocol::Memcached:
-            ret = new McbpConnection(sfd, base, interface);
+            ret = new_mcbp_connection(sfd, base, interface, thread);
             break;
         case Protocol::Greenstack:
             ret = new GreenstackConnection(sfd, base, interface);
@@ -460,11 +742,12 @@ static ListenConnection* allocate_listen_connection(SOCKET sfd,
                                                     event_base* base,
                                                     in_port_t port,
                                                     sa_family_t family,
-                                                    const struct interface& interf) {
+                                                    const struct interface& interf,
+                                                    LIBEVENT_THREAD* worker) {
     ListenConnection *ret = nullptr;
 
     try {
-        ret = new ListenConnection(sfd, base, port, family, interf);
+        ret = new ListenConnection(sfd, base, port, family, interf, worker);
         std::lock_guard<std::mutex> lock(connections.mutex);
         connections.conns.push_back(ret);
         stats.conn_structs++;
@@ -510,9 +793,10 @@ static Connection *allocate_pipe_connection(int fd, event_base *base) {
 }
 
 /** Release a connection; removing it from the connection list management
- *  and freeing the Connection object.
+ *  and freeing the Connection object (or putting it in the connection pool
+ *  of the thread).
  */
-static void release_connection(Connection *c) {
+static void release_connection(Connection *c, LIBEVENT_THREAD* thread) {
     {
         std::lock_guard<std::mutex> lock(connections.mutex);
         auto iter = std::find(connections.conns.begin(), connections.conns.end(), c);
@@ -521,6 +805,11 @@ static void release_connection(Connection *c) {
         connections.conns.erase(iter);
     }
 
+    if (pool_mcbp_connection(c, thread)) {
+        stats.conn_structs--;
+        return;
+    }
+
     // Finally free it
     conn_destructor(c);
 }
@@ -36,8 +36,16 @@ void destroy_connections(void);
 /* Run through all the connections and close them */
 void close_all_connections(void);
 
-/* Run the connection event loop; until an event handler returns false. */
-void run_event_loop(Connection* c, short which);
+/*
+ * Run the connection event loop; until an event handler returns false.
+ * thread is the worker thread running the connection (nullptr if it isn't
+ * run by a worker thread), which gets the connection object for its
+ * connection pool if the connection is released.
+ */
+void run_event_loop(Connection* c, short which, LIBEVENT_THREAD* thread);
+
+/* Free the connection objects in the thread's connection pool */
+void conn_pool_cleanup(LIBEVENT_THREAD* thread);
 
 /**
  * If the connection doesn't already have read/write buffers, ensure that it
@@ -68,12 +76,15 @@ void conn_return_buffers(Connection *c);
  *
  * @param sfd the socket descriptor
  * @param parent_port the port number the client connected to
+ * @param parent_path the path of the Unix domain socket the client
+ *                    connected to (empty for TCP)
  * @param base the event base to bind the client to
  * @param thread the libevent thread object to bind the client to
  * @return a connection object on success, nullptr otherwise
  */
 Connection* conn_new(const SOCKET sfd,
                      in_port_t parent_port,
+                     const std::string& parent_path,
                      struct event_base* base,
                      LIBEVENT_THREAD* thread);
 
@@ -85,12 +96,15 @@ Connection* conn_new(const SOCKET sfd,
  * @param family the address family used for the port
  * @param interf the interface description
  * @param base the event base to use for the socket
+ * @param worker the worker thread owning the socket, or nullptr if
+ *               the socket is served by the dispatcher thread
  */
 ListenConnection* conn_new_server(const SOCKET sfd,
                                   in_port_t parent_port,
                                   sa_family_t family,
                                   const struct interface& interf,
-                                  struct event_base* base);
+                                  struct event_base* base,
+                                  LIBEVENT_THREAD* worker);
 
 /*
  * Creates a new connection to a pipe, e.g. stdin.
@@ -99,6 +113,23 @@ Connection *conn_pipe_new(const int fd,
                           struct event_base *base,
                           LIBEVENT_THREAD* thread);
 
+/**
+ * Move a client connected to a Unix domain socket over to the shared
+ * memory transport (SHM_CONNECT). The rings and the doorbells are created
+ * and sent to the client in the response (written directly to the
+ * socket), and a ShmConnection is created on the same worker thread.
+ * None of the state of c (authentication, bucket or HELLO features) is
+ * carried over; the new connection starts out like any new connection.
+ *
+ * @param c the connection the client sent SHM_CONNECT on
+ * @param opaque the opaque from the request
+ * @return ENGINE_SUCCESS if the client was moved over to the new
+ *         connection, ENGINE_DISCONNECT if the client was lost while
+ *         doing so (in both cases the caller must close c), or an error
+ *         to return to the client (nothing was sent)
+ */
+ENGINE_ERROR_CODE conn_new_shm(McbpConnection* c, uint32_t opaque);
+
 /*
  * Closes a connection. Afterwards the connection is invalid (can no longer
  * be used), but it's memory is still allocated. See conn_destructor() to
@@ -108,9 +139,11 @@ void conn_close(McbpConnection *c);
 
 /**
  * Return the TCP or domain socket listening_port structure that
- * has a given port number
+ * has a given port number (and path for Unix domain sockets, which
+ * all use port 0)
  */
-struct listening_port *get_listening_port_instance(const in_port_t port);
+struct listening_port *get_listening_port_instance(const in_port_t port,
+                                                   const std::string& path = std::string());
 
 /* Dump stats for the connection with the given fd number, or all connections
  * if fd is -1.
@@ -136,6 +169,18 @@ void conn_cleanup_engine_allocations(McbpConnection * c);
  */
 int signal_idle_clients(LIBEVENT_THREAD *me, int bucket_idx, bool logging);
 
+/**
+ * Find the idle connection bound to the given thread which is the best
+ * candidate to move over to another worker thread. We pick the one which
+ * has received the most data, as it is the one most likely to generate
+ * load on the thread serving it.
+ *
+ * @param me the thread to inspect
+ * @return the connection to move, or nullptr if none of the connections
+ *         may be moved
+ */
+McbpConnection* conn_find_migration_candidate(LIBEVENT_THREAD *me);
+
 /**
  * Assert that none of the connections is assciated with
  * the given bucket (debug function).
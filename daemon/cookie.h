@@ -39,12 +39,14 @@ public:
     Cookie(Command* cmd)
         : magic(0xdeadcafe),
           connection(nullptr),
-          command(cmd) { }
+          command(cmd),
+          engine_storage(nullptr) { }
 
     Cookie(Connection* conn)
         : magic(0xdeadcafe),
           connection(conn),
-          command(nullptr) { }
+          command(nullptr),
+          engine_storage(nullptr) { }
 
     void validate() const {
         if (magic != 0xdeadcafe) {
@@ -65,4 +67,15 @@ public:
     uint64_t magic;
     Connection* const connection;
     Command* const command;
+
+    /**
+     * Pointer to engine-specific data which the engine has requested the
+     * server to persist for the life of the cookie.
+     * See SERVER_COOKIE_API::{get,store}_engine_specific()
+     *
+     * It lives in the cookie (and not the connection) as a connection
+     * using unordered execution may have multiple commands (each with
+     * its own cookie) blocked in the engine at the same time.
+     */
+    void* engine_storage;
 };
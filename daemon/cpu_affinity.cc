@@ -0,0 +1,178 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include "config.h"
+#include "cpu_affinity.h"
+#include "log_macros.h"
+
+#include <algorithm>
+#include <cstring>
+#include <platform/strerror.h>
+
+#if defined(HAVE_SCHED_SETAFFINITY) || defined(HAVE_SCHED_GETCPU)
+#include <sched.h>
+#endif
+
+#ifdef HAVE_LIBNUMA
+#include <numa.h>
+#endif
+
+/*
+ * The CPUs the housekeeping threads should run on. Computed by
+ * cpu_affinity_init() before any other threads are created, and
+ * read-only afterwards.
+ */
+static std::vector<int> housekeeping_cpus;
+
+#ifdef HAVE_SCHED_SETAFFINITY
+static bool bind_thread(const std::vector<int>& cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto cpu : cpus) {
+        if (cpu >= CPU_SETSIZE) {
+            LOG_WARNING(NULL, "Ignoring CPU %d; only CPUs below %d may be "
+                        "used for binding threads", cpu, CPU_SETSIZE);
+            continue;
+        }
+        CPU_SET(cpu, &set);
+    }
+
+    if (CPU_COUNT(&set) == 0) {
+        return false;
+    }
+
+    // On Linux a pid of 0 refers to the calling thread (not the process)
+    if (sched_setaffinity(0, sizeof(set), &set) == -1) {
+        LOG_WARNING(NULL, "Failed to bind thread to CPUs \"%s\": %s",
+                    cpu_affinity_to_string(cpus).c_str(),
+                    cb_strerror().c_str());
+        return false;
+    }
+    return true;
+}
+
+static std::vector<int> get_allowed_cpus() {
+    std::vector<int> ret;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &set)) {
+                ret.push_back(cpu);
+            }
+        }
+    }
+    return ret;
+}
+#else
+static bool bind_thread(const std::vector<int>&) {
+    return false;
+}
+
+static std::vector<int> get_allowed_cpus() {
+    return std::vector<int>();
+}
+#endif
+
+void cpu_affinity_init() {
+    const auto& workers = settings.getWorkerCpus();
+    if (settings.has.housekeeping_cpus) {
+        housekeeping_cpus = settings.getHousekeepingCpus();
+    } else if (!workers.empty()) {
+        for (auto cpu : get_allowed_cpus()) {
+            if (std::find(workers.begin(), workers.end(), cpu) ==
+                workers.end()) {
+                housekeeping_cpus.push_back(cpu);
+            }
+        }
+        if (housekeeping_cpus.empty()) {
+            LOG_WARNING(NULL, "No CPUs left for housekeeping threads after "
+                        "reserving \"%s\" for the worker threads",
+                        cpu_affinity_to_string(workers).c_str());
+        }
+    }
+
+#ifndef HAVE_SCHED_SETAFFINITY
+    if (!workers.empty() || !housekeeping_cpus.empty()) {
+        LOG_WARNING(NULL, "Binding threads to CPUs is not supported "
+                    "on this platform");
+    }
+#endif
+
+    if (!housekeeping_cpus.empty() && bind_thread(housekeeping_cpus)) {
+        LOG_NOTICE(NULL, "Housekeeping threads bound to CPUs \"%s\"",
+                   cpu_affinity_to_string(housekeeping_cpus).c_str());
+    }
+}
+
+int cpu_affinity_bind_worker_thread(int index) {
+    const auto& cpus = settings.getWorkerCpus();
+    if (cpus.empty()) {
+        return -1;
+    }
+
+    const int cpu = cpus[size_t(index) % cpus.size()];
+    if (!bind_thread(std::vector<int>{cpu})) {
+        return -1;
+    }
+    return cpu;
+}
+
+void cpu_affinity_bind_housekeeping_thread() {
+    if (!housekeeping_cpus.empty()) {
+        bind_thread(housekeeping_cpus);
+    }
+}
+
+int cpu_affinity_get_numa_node(int cpu) {
+#ifdef HAVE_LIBNUMA
+    if (cpu >= 0 && numa_available() == 0) {
+        return numa_node_of_cpu(cpu);
+    }
+#endif
+    (void)cpu;
+    return -1;
+}
+
+int cpu_affinity_get_current_cpu() {
+#ifdef HAVE_SCHED_GETCPU
+    return sched_getcpu();
+#else
+    return -1;
+#endif
+}
+
+std::string cpu_affinity_to_string(const std::vector<int>& cpus) {
+    std::string ret;
+    size_t ii = 0;
+    while (ii < cpus.size()) {
+        // Collapse consecutive CPUs into a range
+        size_t jj = ii;
+        while (jj + 1 < cpus.size() && cpus[jj + 1] == cpus[jj] + 1) {
+            ++jj;
+        }
+        if (!ret.empty()) {
+            ret.push_back(',');
+        }
+        ret.append(std::to_string(cpus[ii]));
+        if (jj != ii) {
+            ret.push_back('-');
+            ret.append(std::to_string(cpus[jj]));
+        }
+        ii = jj + 1;
+    }
+    return ret;
+}
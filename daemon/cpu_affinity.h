@@ -0,0 +1,77 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Binding of the threads in memcached to the CPUs specified by the
+ * "worker_cpus" and "housekeeping_cpus" settings.
+ *
+ * Threads inherit the CPU affinity of the thread creating them, so the
+ * main thread binds itself to the housekeeping CPUs before it starts
+ * any of the other threads. Threads created on demand by the worker
+ * threads (bucket creation/deletion etc) must call
+ * cpu_affinity_bind_housekeeping_thread() themselves to move off the
+ * worker's CPU.
+ */
+#pragma once
+
+#include <string>
+#include <vector>
+
+/**
+ * Compute the set of housekeeping CPUs and bind the calling thread
+ * to them. Must be called by the main thread after the settings are
+ * parsed, and before any other threads are created.
+ *
+ * If "housekeeping_cpus" isn't specified but "worker_cpus" is, the
+ * housekeeping threads use the CPUs the process is allowed to run on
+ * which isn't used by the worker threads.
+ */
+void cpu_affinity_init();
+
+/**
+ * Bind the calling thread to the CPU reserved for the given worker thread.
+ *
+ * @param index the index of the worker thread
+ * @return the CPU the thread is bound to, or -1 if it isn't bound
+ */
+int cpu_affinity_bind_worker_thread(int index);
+
+/**
+ * Bind the calling thread to the housekeeping CPUs (if configured)
+ */
+void cpu_affinity_bind_housekeeping_thread();
+
+/**
+ * Get the NUMA node the given CPU belongs to
+ *
+ * @param cpu the CPU to look up
+ * @return the NUMA node or -1 if unknown
+ */
+int cpu_affinity_get_numa_node(int cpu);
+
+/**
+ * Get the CPU the calling thread is currently running on
+ *
+ * @return the CPU number or -1 if unknown
+ */
+int cpu_affinity_get_current_cpu();
+
+/**
+ * Format a list of CPUs the same way as it is specified in the
+ * configuration, e.g. "0-3,8"
+ */
+std::string cpu_affinity_to_string(const std::vector<int>& cpus);
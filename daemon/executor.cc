@@ -16,11 +16,16 @@
  */
 
 #include "executor.h"
+#include "executorpool.h"
 #include "task.h"
 
 #include <iostream>
 
 Executor::~Executor() {
+    stop();
+}
+
+void Executor::stop() {
     std::unique_lock<std::mutex> lock(mutex);
     shutdown = true;
     idlecond.notify_all();
@@ -28,6 +33,7 @@ Executor::~Executor() {
     while (running) {
         shutdowncond.wait(lock);
     }
+    lock.unlock();
     waitForState(Couchbase::ThreadState::Zombie);
 }
 
@@ -39,16 +45,32 @@ void Executor::run() {
 
     while (true) {
         std::unique_lock<std::mutex> lock(mutex);
-        while (!shutdown && runq.empty()) {
-            idlecond.wait(lock);
-        }
-
         if (shutdown) {
             break;
         }
 
-        auto task = runq.front();
-        runq.pop();
+        auto task = popRunq();
+        if (!task) {
+            // Look for work in the other executors before going to sleep.
+            // We're flagged as idle while searching so that anyone
+            // scheduling work on us (or waking us up) won't expect
+            // someone else to pick it up.
+            idle = true;
+            stealHint = false;
+            lock.unlock();
+            if (pool != nullptr) {
+                task = pool->steal(this);
+            }
+            lock.lock();
+
+            if (!task) {
+                while (!shutdown && isRunqEmpty() && !stealHint) {
+                    idlecond.wait(lock);
+                }
+                continue;
+            }
+        }
+        idle = false;
 
         // Release the lock so that others may schedule new events
         lock.unlock();
@@ -91,16 +113,18 @@ void Executor::run() {
     shutdowncond.notify_all();
 }
 
-void Executor::schedule(const std::shared_ptr<Task>& task, bool runnable) {
+bool Executor::schedule(const std::shared_ptr<Task>& task, bool runnable) {
     std::lock_guard<std::mutex> guard(mutex);
     task->setExecutor(this);
 
     if (runnable) {
-        runq.push(task);
+        pushRunq(task);
         idlecond.notify_all();
-    } else {
-        waitq[task.get()] = task;
+        return idle;
     }
+
+    waitq[task.get()] = task;
+    return true;
 }
 
 void Executor::makeRunnable(Task* task) {
@@ -110,14 +134,69 @@ void Executor::makeRunnable(Task* task) {
             "The mutex should be held when trying to reschedule a event");
     }
 
+    bool wasIdle;
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        auto iter = waitq.find(task);
+        if (iter == waitq.end()) {
+            throw std::runtime_error(
+                "Internal error object is not in the waitq");
+        }
+        pushRunq(iter->second);
+        waitq.erase(iter);
+        idlecond.notify_all();
+        wasIdle = idle;
+    }
+
+    if (!wasIdle && pool != nullptr) {
+        // We're busy running another task; let someone else pick it up
+        pool->wakeThief(this);
+    }
+}
+
+std::shared_ptr<Task> Executor::steal(Executor* thief) {
+    std::lock_guard<std::mutex> guard(mutex);
+    auto task = popRunq();
+    if (task) {
+        // The task isn't executing (and can't be made runnable by anyone
+        // else while it sits in the run queue) so it is safe to move
+        task->setExecutor(thief);
+    }
+    return task;
+}
+
+bool Executor::wakeIfIdle() {
     std::lock_guard<std::mutex> guard(mutex);
-    auto iter = waitq.find(task);
-    if (iter == waitq.end()) {
-        throw std::runtime_error("Internal error object is not in the waitq");
+    if (!idle || shutdown) {
+        return false;
     }
-    runq.push(iter->second);
-    waitq.erase(iter);
+    stealHint = true;
     idlecond.notify_all();
+    return true;
+}
+
+std::shared_ptr<Task> Executor::popRunq() {
+    for (auto& queue : runq) {
+        if (!queue.empty()) {
+            auto task = std::move(queue.front());
+            queue.pop_front();
+            return task;
+        }
+    }
+    return std::shared_ptr<Task>();
+}
+
+void Executor::pushRunq(const std::shared_ptr<Task>& task) {
+    runq[size_t(task->getPriority())].push_back(task);
+}
+
+bool Executor::isRunqEmpty() const {
+    for (const auto& queue : runq) {
+        if (!queue.empty()) {
+            return false;
+        }
+    }
+    return true;
 }
 
 std::unique_ptr<Executor> createWorker() {
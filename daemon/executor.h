@@ -16,18 +16,20 @@
  */
 #pragma once
 
+#include <array>
 #include <atomic>
 #include <condition_variable>
+#include <deque>
 #include <memory>
 #include <platform/platform.h>
 #include <platform/thread.h>
-#include <queue>
 #include <unordered_map>
 
 /**
- * Forward decl of the Task to avoid circular dependencies
+ * Forward decl of the Task and ExecutorPool to avoid circular dependencies
  */
 class Task;
+class ExecutorPool;
 
 /**
  * The Executor class represents a single executor thread. It keeps
@@ -41,8 +43,15 @@ class Executor : public Couchbase::Thread {
 public:
     /**
      * Initialize the Executor object
+     *
+     * @param pool_ the pool the executor belongs to (and may steal
+     *              tasks from), or nullptr for a standalone executor
      */
-    Executor() : Couchbase::Thread("mc:executor") {
+    Executor(ExecutorPool* pool_ = nullptr)
+        : Couchbase::Thread("mc:executor"),
+          pool(pool_),
+          idle(false),
+          stealHint(false) {
         shutdown.store(false);
         running.store(false);
     }
@@ -54,19 +63,67 @@ public:
      */
     virtual ~Executor();
 
+    /**
+     * Stop the executor thread and wait for it to terminate (the
+     * tasks in the wait queue must be made runnable first)
+     */
+    void stop();
+
     /**
      * Schedule a task for execution at some time
+     *
+     * @return true if the executor was idle (and will pick up the task
+     *              immediately)
      */
-    void schedule(const std::shared_ptr<Task>& command, bool runnable);
+    bool schedule(const std::shared_ptr<Task>& command, bool runnable);
 
     /**
      * Make the task runnable
      */
     void makeRunnable(Task* task);
 
+    /**
+     * Remove the oldest task with the highest priority from the run
+     * queue so that another executor may run it.
+     *
+     * @param thief the executor which is going to run the task
+     * @return the task or nullptr if the run queue is empty
+     */
+    std::shared_ptr<Task> steal(Executor* thief);
+
+    /**
+     * Wake up the executor if it is idle so that it tries to steal work
+     * from the other executors.
+     *
+     * @return true if the executor was idle
+     */
+    bool wakeIfIdle();
+
 protected:
     virtual void run() override;
 
+    /**
+     * Pop the first task with the highest priority from the run queue.
+     * The caller must hold the mutex.
+     */
+    std::shared_ptr<Task> popRunq();
+
+    /**
+     * Push the task at the end of the run queue for its priority.
+     * The caller must hold the mutex.
+     */
+    void pushRunq(const std::shared_ptr<Task>& task);
+
+    /**
+     * Is the run queue empty? The caller must hold the mutex.
+     */
+    bool isRunqEmpty() const;
+
+    /**
+     * The pool we belong to
+     */
+    ExecutorPool* pool;
+
     /**
      * Is shutdown requested?
      */
@@ -85,9 +142,23 @@ protected:
     std::mutex mutex;
 
     /**
-     * The FIFO queue of commands ready to run
+     * The FIFO queues of commands ready to run (one per priority). Other
+     * executors in the pool steal from the queues when they run out of
+     * work.
+     */
+    std::array<std::deque<std::shared_ptr<Task> >, 3> runq;
+
+    /**
+     * Set when the executor has run out of work (and is looking for tasks
+     * to steal, or waiting for more work)
+     */
+    bool idle;
+
+    /**
+     * Set by wakeIfIdle to tell an idle executor that one of the other
+     * executors have got more work than it can handle
      */
-    std::queue<std::shared_ptr<Task> > runq;
+    bool stealHint;
 
     /**
      * When a task is being served by a backend thread it is put in
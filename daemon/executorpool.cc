@@ -24,9 +24,22 @@
 
 ExecutorPool::ExecutorPool(size_t sz) {
     roundRobin.store(0);
+    steals.store(0);
     executors.reserve(sz);
     for (size_t ii = 0; ii < sz; ++ii) {
-        executors.emplace_back(createWorker());
+        executors.emplace_back(new Executor(this));
+    }
+
+    // The executors look at each other when they run out of work, so
+    // we can't start any of them before the list is complete
+    for (auto& executor : executors) {
+        executor->start();
+    }
+}
+
+ExecutorPool::~ExecutorPool() {
+    for (auto& executor : executors) {
+        executor->stop();
     }
 }
 
@@ -37,5 +50,34 @@ void ExecutorPool::schedule(std::shared_ptr<Task>& task, bool runnable) {
             "The mutex should be held when trying to schedule a event");
     }
 
-    executors[++roundRobin % executors.size()]->schedule(task, runnable);
+    auto* executor = executors[++roundRobin % executors.size()].get();
+    if (!executor->schedule(task, runnable)) {
+        // The executor is busy with another task
+        wakeThief(executor);
+    }
+}
+
+std::shared_ptr<Task> ExecutorPool::steal(Executor* thief) {
+    const size_t size = executors.size();
+    const size_t start = size_t(roundRobin.load()) % size;
+    for (size_t ii = 0; ii < size; ++ii) {
+        auto* victim = executors[(start + ii) % size].get();
+        if (victim == thief) {
+            continue;
+        }
+        auto task = victim->steal(thief);
+        if (task) {
+            ++steals;
+            return task;
+        }
+    }
+    return std::shared_ptr<Task>();
+}
+
+void ExecutorPool::wakeThief(Executor* busy) {
+    for (auto& executor : executors) {
+        if (executor.get() != busy && executor->wakeIfIdle()) {
+            return;
+        }
+    }
 }
@@ -24,8 +24,12 @@
 
 /**
  * As the name implies the ExecutorPool is pool of executors to execute
- * tasks. A task is pinned to a thread when it is being scheduled
- * (by using round robin) and never switch the thread.
+ * tasks. A task is assigned to an executor when it is being scheduled
+ * (by using round robin). An executor which runs out of work steals
+ * runnable tasks from the other executors, so that a few slow tasks
+ * don't back up the queue of one executor while the others sit idle.
+ * A task which blocks (execute() returns false) stays with the executor
+ * that ran it until it is made runnable again.
  */
 class ExecutorPool {
 public:
@@ -36,6 +40,12 @@ public:
 
     ExecutorPool(const ExecutorPool &) = delete;
 
+    /**
+     * Stop all of the executors (they may steal from each other so
+     * they must all be stopped before any of them is released)
+     */
+    ~ExecutorPool();
+
     /**
      * Schedule a task for execution at some time. The tasks mutex
      * must be held while calling this method to avoid race conditions.
@@ -46,6 +56,30 @@ public:
      */
     void schedule(std::shared_ptr<Task>& task, bool runnable = true);
 
+    /**
+     * Steal a runnable task from one of the other executors
+     *
+     * @param thief the executor looking for work
+     * @return the task (now owned by the thief) or nullptr if none of
+     *         the other executors have any runnable tasks
+     */
+    std::shared_ptr<Task> steal(Executor* thief);
+
+    /**
+     * Wake up one of the idle executors (if any) so that it may steal
+     * the work queued up on a busy executor.
+     *
+     * @param busy the executor with more work than it can handle
+     */
+    void wakeThief(Executor* busy);
+
+    /**
+     * Get the number of tasks stolen by the executors
+     */
+    uint64_t getSteals() const {
+        return steals.load();
+    }
+
 private:
     /**
      * The actual list of executors
@@ -57,4 +91,9 @@ private:
      * worker threads
      */
     std::atomic_int roundRobin;
+
+    /**
+     * The number of tasks stolen by the executors
+     */
+    std::atomic<uint64_t> steals;
 };
@@ -0,0 +1,108 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include "config.h"
+#include "fair_scheduler.h"
+#include "buckets.h"
+#include "settings.h"
+
+const hrtime_t FairScheduler::period;
+
+FairScheduler::Share::Share()
+    : usage(0),
+      weight(Settings::default_bucket_weight) {
+}
+
+FairScheduler::FairScheduler()
+    : total_usage(0),
+      active_weight(0),
+      next_decay(0),
+      contended_until(0) {
+}
+
+FairScheduler::Share& FairScheduler::getShare(size_t bucket) {
+    if (bucket >= shares.size()) {
+        const size_t old = shares.size();
+        shares.resize(all_buckets.size() > bucket ? all_buckets.size()
+                                                  : bucket + 1);
+        for (size_t ii = old; ii < shares.size() && ii < all_buckets.size();
+             ++ii) {
+            shares[ii].weight = all_buckets[ii].weight.load(
+                std::memory_order_relaxed);
+        }
+    }
+    return shares[bucket];
+}
+
+void FairScheduler::decay(hrtime_t now) {
+    if (now < next_decay) {
+        return;
+    }
+    next_decay = now + period;
+
+    total_usage = 0;
+    active_weight = 0;
+    for (size_t ii = 0; ii < shares.size(); ++ii) {
+        auto& share = shares[ii];
+        share.usage >>= 1;
+        if (ii < all_buckets.size()) {
+            share.weight = all_buckets[ii].weight.load(
+                std::memory_order_relaxed);
+        }
+        if (share.usage != 0) {
+            total_usage += share.usage;
+            active_weight += share.weight;
+        }
+    }
+}
+
+bool FairScheduler::isOverShare(size_t bucket, hrtime_t now) {
+    decay(now);
+    if (now >= contended_until) {
+        return false;
+    }
+
+    const auto& share = getShare(bucket);
+    if (share.usage == 0 || active_weight == 0) {
+        return false;
+    }
+
+    // usage / total_usage > weight / active_weight, with 12.5% slack so
+    // that a bucket doesn't flip between the two states all the time
+    return 8 * share.usage * active_weight >
+           9 * total_usage * share.weight;
+}
+
+hrtime_t FairScheduler::getSlice(size_t bucket, hrtime_t slice) {
+    return slice * getShare(bucket).weight / Settings::default_bucket_weight;
+}
+
+void FairScheduler::charge(size_t bucket, hrtime_t now, hrtime_t cost) {
+    decay(now);
+    auto& share = getShare(bucket);
+    if (share.usage == 0 && cost != 0) {
+        active_weight += share.weight;
+    }
+    share.usage += cost;
+    total_usage += cost;
+}
+
+void FairScheduler::recordDelay(hrtime_t now, hrtime_t delay,
+                                hrtime_t slice) {
+    if (delay > slice) {
+        contended_until = now + 2 * period;
+    }
+}
@@ -0,0 +1,120 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Weighted sharing of a worker thread between the buckets.
+ *
+ * Each worker thread keeps track of how much of its time (the time spent
+ * serving connections in McbpConnection::runEventLoop) each bucket used
+ * recently. The usage is halved every FairScheduler::period, so it
+ * reflects the cost of the operations (large values, multi-gets, subdoc
+ * etc) over the last few hundred milliseconds rather than the number of
+ * operations.
+ *
+ * A bucket's fair share of the thread is its weight divided by the sum of
+ * the weights of the buckets which recently used the thread. While the
+ * thread is contended (a connection had to wait for more than a time
+ * slice before it was served) connections bound to a bucket which used
+ * more than its share may only execute a single command before they
+ * yield, giving the connections of the other buckets on the thread a
+ * chance to run.
+ *
+ * The scheduler is only accessed by the worker thread owning it, so it
+ * doesn't use any locking.
+ */
+#pragma once
+
+#include <platform/platform.h>
+#include <cstdint>
+#include <vector>
+
+class FairScheduler {
+public:
+    FairScheduler();
+
+    /**
+     * Check if the bucket used more than its share of the thread while
+     * other connections had to wait.
+     *
+     * @param bucket the index of the bucket
+     * @param now the current time
+     * @return true if connections for the bucket should yield early
+     */
+    bool isOverShare(size_t bucket, hrtime_t now);
+
+    /**
+     * Get the time slice for a connection bound to the bucket. The
+     * configured time slice is scaled by the weight of the bucket.
+     *
+     * @param bucket the index of the bucket
+     * @param slice the configured time slice (in ns)
+     * @return the time slice for the connection (in ns)
+     */
+    hrtime_t getSlice(size_t bucket, hrtime_t slice);
+
+    /**
+     * Charge the bucket for the time spent serving one of its connections
+     *
+     * @param bucket the index of the bucket
+     * @param now the current time
+     * @param cost the time spent serving the connection (in ns)
+     */
+    void charge(size_t bucket, hrtime_t now, hrtime_t cost);
+
+    /**
+     * Record that a connection waited for the given amount of time before
+     * it was served. If it waited longer than a time slice the thread is
+     * considered to be contended for the next couple of periods.
+     *
+     * @param now the current time
+     * @param delay the time the connection waited (in ns)
+     * @param slice the configured time slice (in ns)
+     */
+    void recordDelay(hrtime_t now, hrtime_t delay, hrtime_t slice);
+
+    /** The interval (in ns) between each time the usage is halved */
+    static const hrtime_t period = 10 * 1000 * 1000;
+
+private:
+    struct Share {
+        Share();
+
+        /** The recent usage of the thread (in ns) */
+        uint64_t usage;
+        /** The weight of the bucket (refreshed every period) */
+        uint32_t weight;
+    };
+
+    Share& getShare(size_t bucket);
+
+    /** Halve the usage of all buckets if the period expired */
+    void decay(hrtime_t now);
+
+    std::vector<Share> shares;
+
+    /** The sum of the usage of all of the buckets */
+    uint64_t total_usage;
+
+    /** The sum of the weights of the buckets with usage */
+    uint64_t active_weight;
+
+    /** The time the usage should be halved */
+    hrtime_t next_decay;
+
+    /** The thread is contended until this time */
+    hrtime_t contended_until;
+};
@@ -44,6 +44,40 @@ ENGINE_ERROR_CODE ioctl_get_property(const char* key, size_t keylen,
     }
 }
 
+/*
+ * "worker.<from>.migrate_to" with the value "<to>" asks worker thread
+ * <from> to move one of its idle connections over to worker thread <to>
+ */
+static ENGINE_ERROR_CODE migrate_connection(Connection* c,
+                                            const std::string& key,
+                                            const std::string& value) {
+    const std::string prefix("worker.");
+    const std::string suffix(".migrate_to");
+    if (key.size() <= prefix.size() + suffix.size() ||
+        key.compare(key.size() - suffix.size(), suffix.size(), suffix) != 0) {
+        return ENGINE_EINVAL;
+    }
+
+    int from;
+    int to;
+    try {
+        from = std::stoi(key.substr(prefix.size(),
+                                    key.size() - prefix.size() -
+                                    suffix.size()));
+        to = std::stoi(value);
+    } catch (...) {
+        return ENGINE_EINVAL;
+    }
+
+    if (!threads_request_migration(from, to)) {
+        return ENGINE_EINVAL;
+    }
+
+    LOG_NOTICE(c, "%u: IOCTL_SET: Requested worker thread %d to move a "
+               "connection to worker thread %d", c->getId(), from, to);
+    return ENGINE_SUCCESS;
+}
+
 ENGINE_ERROR_CODE ioctl_set_property(Connection* c,
                                      const char* key, size_t keylen,
                                      const char* value, size_t vallen) {
@@ -78,6 +112,8 @@ ENGINE_ERROR_CODE ioctl_set_property(Connection* c,
     } else if (request_key.find("trace.connection.") == 0) {
         return apply_connection_trace_mask(request_key,
                                            std::string(value, vallen));
+    } else if (request_key.find("worker.") == 0) {
+        return migrate_connection(c, request_key, std::string(value, vallen));
     } else {
         return ENGINE_EINVAL;
     }
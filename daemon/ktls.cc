@@ -0,0 +1,199 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include "config.h"
+#include "ktls.h"
+
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#ifdef HAVE_KTLS
+#include <linux/tls.h>
+#include <netinet/tcp.h>
+#include <openssl/kdf.h>
+#include <platform/strerror.h>
+
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+
+/*
+ * The keys for both directions are derived from the master secret
+ * (RFC 5246 section 6.3):
+ *
+ *   key_block = PRF(master_secret, "key expansion",
+ *                   server_random + client_random)
+ *
+ * which is split into client_write_key, server_write_key,
+ * client_write_IV and server_write_IV (the 4 byte implicit part of the
+ * GCM nonce, the "salt").
+ */
+static bool derive_key_block(SSL* ssl, size_t keylen,
+                             std::vector<unsigned char>& block,
+                             std::string& reason) {
+    const SSL_SESSION* session = SSL_get_session(ssl);
+    const SSL_CIPHER* cipher = SSL_get_current_cipher(ssl);
+    const EVP_MD* md = SSL_CIPHER_get_handshake_digest(cipher);
+    if (session == nullptr || md == nullptr) {
+        reason = "failed to get the session parameters";
+        return false;
+    }
+
+    unsigned char master[SSL_MAX_MASTER_KEY_LENGTH];
+    const size_t masterlen =
+        SSL_SESSION_get_master_key(session, master, sizeof(master));
+    unsigned char client_random[SSL3_RANDOM_SIZE];
+    unsigned char server_random[SSL3_RANDOM_SIZE];
+    SSL_get_client_random(ssl, client_random, sizeof(client_random));
+    SSL_get_server_random(ssl, server_random, sizeof(server_random));
+
+    static const unsigned char label[] = "key expansion";
+    block.resize(2 * keylen + 2 * 4);
+    size_t blocklen = block.size();
+
+    EVP_PKEY_CTX* pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_TLS1_PRF, nullptr);
+    bool ret = pctx != nullptr &&
+        EVP_PKEY_derive_init(pctx) > 0 &&
+        EVP_PKEY_CTX_set_tls1_prf_md(pctx, md) > 0 &&
+        EVP_PKEY_CTX_set1_tls1_prf_secret(pctx, master, int(masterlen)) > 0 &&
+        EVP_PKEY_CTX_add1_tls1_prf_seed(pctx, label, sizeof(label) - 1) > 0 &&
+        EVP_PKEY_CTX_add1_tls1_prf_seed(pctx, server_random,
+                                        sizeof(server_random)) > 0 &&
+        EVP_PKEY_CTX_add1_tls1_prf_seed(pctx, client_random,
+                                        sizeof(client_random)) > 0 &&
+        EVP_PKEY_derive(pctx, block.data(), &blocklen) > 0 &&
+        blocklen == block.size();
+    EVP_PKEY_CTX_free(pctx);
+    OPENSSL_cleanse(master, sizeof(master));
+
+    if (!ret) {
+        reason = "failed to derive the session keys";
+    }
+    return ret;
+}
+
+/*
+ * The Finished message is the first (and only) record sent in each
+ * direction with the new keys before the handshake completes, so the
+ * first application data record use sequence number 1.
+ */
+static const uint64_t first_record_seq = 1;
+
+template <typename CryptoInfo>
+static bool set_crypto_info(SOCKET sfd, int direction, uint16_t cipher_type,
+                            const unsigned char* key, size_t keylen,
+                            const unsigned char* salt, std::string& reason) {
+    CryptoInfo info;
+    static_assert(sizeof(info.rec_seq) == sizeof(uint64_t),
+                  "Unexpected size of the record sequence number");
+    memset(&info, 0, sizeof(info));
+    info.info.version = TLS_1_2_VERSION;
+    info.info.cipher_type = cipher_type;
+    memcpy(info.key, key, keylen);
+    memcpy(info.salt, salt, sizeof(info.salt));
+    for (size_t ii = 0; ii < sizeof(info.rec_seq); ++ii) {
+        info.rec_seq[ii] = uint8_t(first_record_seq >>
+                                   (8 * (sizeof(info.rec_seq) - 1 - ii)));
+    }
+    // The explicit part of the nonce is only used for the records we
+    // send, and OpenSSL use the sequence number as well
+    memcpy(info.iv, info.rec_seq, sizeof(info.iv));
+
+    if (setsockopt(sfd, SOL_TLS, direction, &info, sizeof(info)) != 0) {
+        reason = std::string("setsockopt(") +
+                 (direction == TLS_RX ? "TLS_RX" : "TLS_TX") +
+                 ") failed: " + cb_strerror();
+        OPENSSL_cleanse(&info, sizeof(info));
+        return false;
+    }
+    OPENSSL_cleanse(&info, sizeof(info));
+    return true;
+}
+
+static bool set_crypto_info(SOCKET sfd, int direction, size_t keylen,
+                            const unsigned char* key,
+                            const unsigned char* salt, std::string& reason) {
+    if (keylen == TLS_CIPHER_AES_GCM_128_KEY_SIZE) {
+        return set_crypto_info<tls12_crypto_info_aes_gcm_128>(
+            sfd, direction, TLS_CIPHER_AES_GCM_128, key, keylen, salt, reason);
+    }
+    return set_crypto_info<tls12_crypto_info_aes_gcm_256>(
+        sfd, direction, TLS_CIPHER_AES_GCM_256, key, keylen, salt, reason);
+}
+
+bool ktls_offload(SOCKET sfd, SSL* ssl, bool& rx, bool& tx,
+                  std::string& reason) {
+    rx = tx = false;
+
+    if (SSL_version(ssl) != TLS1_2_VERSION) {
+        reason = std::string("unsupported protocol ") + SSL_get_version(ssl);
+        return false;
+    }
+
+    const SSL_CIPHER* cipher = SSL_get_current_cipher(ssl);
+    size_t keylen;
+    switch (SSL_CIPHER_get_cipher_nid(cipher)) {
+    case NID_aes_128_gcm:
+        keylen = TLS_CIPHER_AES_GCM_128_KEY_SIZE;
+        break;
+    case NID_aes_256_gcm:
+        keylen = TLS_CIPHER_AES_GCM_256_KEY_SIZE;
+        break;
+    default:
+        reason = std::string("unsupported cipher ") +
+                 SSL_CIPHER_get_name(cipher);
+        return false;
+    }
+
+    std::vector<unsigned char> block;
+    if (!derive_key_block(ssl, keylen, block, reason)) {
+        return false;
+    }
+    const unsigned char* client_key = block.data();
+    const unsigned char* server_key = client_key + keylen;
+    const unsigned char* client_salt = server_key + keylen;
+    const unsigned char* server_salt = client_salt + 4;
+
+    // Until TLS_RX or TLS_TX is set the "tls" ULP passes the data
+    // through untouched, so we may still fall back if it fails
+    bool ret = false;
+    if (setsockopt(sfd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) != 0) {
+        reason = "the kernel doesn't support the tls ULP: " + cb_strerror();
+    } else if (set_crypto_info(sfd, TLS_RX, keylen, client_key, client_salt,
+                               reason)) {
+        rx = ret = true;
+        tx = set_crypto_info(sfd, TLS_TX, keylen, server_key, server_salt,
+                             reason);
+    }
+
+    OPENSSL_cleanse(block.data(), block.size());
+    return ret;
+}
+#else
+bool ktls_offload(SOCKET sfd, SSL* ssl, bool& rx, bool& tx,
+                  std::string& reason) {
+    (void)sfd;
+    (void)ssl;
+    rx = tx = false;
+    reason = "kTLS isn't supported on this platform";
+    return false;
+}
+#endif
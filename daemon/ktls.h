@@ -0,0 +1,55 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Kernel TLS (kTLS) offload of SSL connections.
+ *
+ * OpenSSL runs the handshake through the memory BIOs as usual. Once it
+ * completes, the session keys and sequence numbers are handed to the
+ * kernel (setsockopt(TLS_RX / TLS_TX) on the socket), and from then on
+ * the kernel encrypts and decrypts the records so the connection use
+ * plain recv and sendmsg (with no copies through the BIOs).
+ *
+ * Only TLS 1.2 with AES-GCM (128 or 256 bit) is offloaded, and only on
+ * Linux kernels with the "tls" ULP. Everything else keeps using OpenSSL
+ * and the memory BIOs.
+ */
+#pragma once
+
+#include <memcached/openssl.h>
+#include <platform/platform.h>
+#include <string>
+
+/**
+ * Try to offload the record layer of the SSL session to the kernel. Must
+ * be called right after the handshake completes, before any application
+ * data is read or written through OpenSSL, and with no data left in the
+ * BIOs.
+ *
+ * The receive side is offloaded first. If the kernel accepts it but not
+ * the transmit side, the connection continues to encrypt its data with
+ * OpenSSL (tx is set to false).
+ *
+ * @param sfd the socket for the connection
+ * @param ssl the SSL session which completed the handshake
+ * @param rx set to true if the kernel decrypts the incoming data
+ * @param tx set to true if the kernel encrypts the outgoing data
+ * @param reason set to the reason why (a direction) wasn't offloaded
+ * @return true if the receive side (at least) was offloaded
+ */
+bool ktls_offload(SOCKET sfd, SSL* ssl, bool& rx, bool& tx,
+                  std::string& reason);
@@ -18,6 +18,7 @@
 
 #include "debug_helpers.h"
 #include "memcached.h"
+#include "tsc_clock.h"
 #include "utilities/protocol2text.h"
 
 #include <snappy-c.h>
@@ -380,7 +381,7 @@ bool mcbp_response_handler(const void* key, uint16_t keylen,
 }
 
 void mcbp_collect_timings(const McbpConnection* c) {
-    hrtime_t now = gethrtime();
+    hrtime_t now = tsc_clock_now();
     const hrtime_t elapsed_ns = now - c->getStart();
     // aggregated timing for all buckets
     all_buckets[0].timings.collect(c->getCmd(), elapsed_ns);
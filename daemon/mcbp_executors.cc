@@ -28,18 +28,25 @@
 #include "mcaudit.h"
 #include "subdocument.h"
 #include "mc_time.h"
+#include "compression.h"
 #include "connections.h"
+#include "cpu_affinity.h"
 #include "mcbp_validators.h"
 #include "mcbp_topkeys.h"
 #include "enginemap.h"
 #include "mcbpdestroybuckettask.h"
 #include "sasl_tasks.h"
+#include "ssl_handshake_task.h"
 #include "mcbp_privileges.h"
+#include "tsc_clock.h"
 
 #include <memcached/audit_interface.h>
 #include <platform/checked_snprintf.h>
 #include <snappy-c.h>
 #include <utilities/protocol2text.h>
+#include <algorithm>
+#include <limits>
+#include <vector>
 
 /**
  * Tap stats (these are only used by the tap thread, so they don't need
@@ -87,6 +94,14 @@ static bool authenticated(McbpConnection* c) {
     return rv;
 }
 
+/**
+ * Get the start of the packet (the header) for the current command
+ */
+static char* binary_get_packet(McbpConnection* c) {
+    return c->read.curr - (c->binary_header.request.bodylen +
+                           sizeof(c->binary_header));
+}
+
 /**
  * get a pointer to the start of the request struct for the current command
  */
@@ -284,16 +299,20 @@ static ENGINE_ERROR_CODE server_stats(ADD_STAT add_stat_callback,
         add_stat(cookie, add_stat_callback, "memcached_version", MEMCACHED_VERSION);
         add_stat(cookie, add_stat_callback, "libevent", event_get_version());
         add_stat(cookie, add_stat_callback, "pointer_size", (8 * sizeof(void*)));
+        add_stat(cookie, add_stat_callback, "clock_source",
+                 tsc_clock_get_source());
 
         add_stat(cookie, add_stat_callback, "daemon_connections",
                  stats.daemon_conns);
         add_stat(cookie, add_stat_callback, "curr_connections",
                  stats.curr_conns.load(std::memory_order_relaxed));
         for (auto& instance : stats.listening_ports) {
-            std::string key =
-                "max_conns_on_port_" + std::to_string(instance.port);
+            const std::string name = instance.path.empty() ?
+                "port_" + std::to_string(instance.port) :
+                "unix_" + instance.path;
+            std::string key = "max_conns_on_" + name;
             add_stat(cookie, add_stat_callback, key.c_str(), instance.maxconns);
-            key = "curr_conns_on_port_" + std::to_string(instance.port);
+            key = "curr_conns_on_" + name;
             add_stat(cookie, add_stat_callback, key.c_str(), instance.curr_conns);
         }
         add_stat(cookie, add_stat_callback, "total_connections", stats.total_conns);
@@ -347,8 +366,45 @@ static ENGINE_ERROR_CODE server_stats(ADD_STAT add_stat_callback,
         add_stat(cookie, add_stat_callback, "listen_disabled_num",
                  get_listen_disabled_num());
         add_stat(cookie, add_stat_callback, "rejected_conns", stats.rejected_conns);
+        add_stat(cookie, add_stat_callback, "migrated_conns",
+                 stats.migrated_conns);
+        uint64_t signalled, coalesced;
+        threads_notify_stats(signalled, coalesced);
+        add_stat(cookie, add_stat_callback, "thread_notify_signalled",
+                 signalled);
+        add_stat(cookie, add_stat_callback, "thread_notify_coalesced",
+                 coalesced);
         add_stat(cookie, add_stat_callback, "threads", settings.getNumWorkerThreads());
         add_stat(cookie, add_stat_callback, "conn_yields", thread_stats.conn_yields);
+        add_stat(cookie, add_stat_callback, "sched_throttled",
+                 thread_stats.sched_throttled);
+        add_stat(cookie, add_stat_callback, "rate_limited",
+                 thread_stats.rate_limited);
+        add_stat(cookie, add_stat_callback, "cmd_shed", thread_stats.cmd_shed);
+        add_stat(cookie, add_stat_callback, "output_throttled",
+                 thread_stats.output_throttled);
+        add_stat(cookie, add_stat_callback, "slow_reader_disconnects",
+                 thread_stats.slow_reader_disconnects);
+        add_stat(cookie, add_stat_callback, "ktls_offloaded",
+                 thread_stats.ktls_offloaded);
+        add_stat(cookie, add_stat_callback, "ktls_fallbacks",
+                 thread_stats.ktls_fallbacks);
+        add_stat(cookie, add_stat_callback, "ssl_handshakes",
+                 thread_stats.ssl_handshakes);
+        add_stat(cookie, add_stat_callback, "ssl_resumptions",
+                 thread_stats.ssl_resumptions);
+        add_stat(cookie, add_stat_callback, "compressed_values",
+                 thread_stats.compressed_values);
+        add_stat(cookie, add_stat_callback, "compression_cache_hits",
+                 thread_stats.compression_cache_hits);
+        add_stat(cookie, add_stat_callback, "bytes_compression_saved",
+                 thread_stats.bytes_compression_saved);
+        size_t cache_items, cache_bytes;
+        compression_cache_get_stats(cache_items, cache_bytes);
+        add_stat(cookie, add_stat_callback, "compression_cache_items",
+                 cache_items);
+        add_stat(cookie, add_stat_callback, "compression_cache_bytes",
+                 cache_bytes);
         add_stat(cookie, add_stat_callback, "rbufs_allocated",
                  thread_stats.rbufs_allocated);
         add_stat(cookie, add_stat_callback, "rbufs_loaned",
@@ -452,7 +508,11 @@ static void process_stat_settings(ADD_STAT add_stat_callback,
         for (auto& ifce : stats.listening_ports) {
             char interface[1024];
             int offset;
-            if (ifce.host.empty()) {
+            if (!ifce.path.empty()) {
+                offset = checked_snprintf(interface, sizeof(interface),
+                                          "interface-unix:%s",
+                                          ifce.path.c_str());
+            } else if (ifce.host.empty()) {
                 offset = checked_snprintf(interface, sizeof(interface),
                                           "interface-*:%u",
                                          ifce.port);
@@ -482,6 +542,19 @@ static void process_stat_settings(ADD_STAT add_stat_callback,
             checked_snprintf(interface + offset, sizeof(interface) - offset,
                              "-management");
             add_stat(cookie, add_stat_callback, interface, ifce.management);
+            checked_snprintf(interface + offset, sizeof(interface) - offset,
+                             "-reuseport");
+            add_stat(cookie, add_stat_callback, interface, ifce.reuseport);
+            checked_snprintf(interface + offset, sizeof(interface) - offset,
+                             "-busy_poll");
+            add_stat(cookie, add_stat_callback, interface, ifce.busy_poll);
+            if (!ifce.path.empty()) {
+                char mode[8];
+                checked_snprintf(mode, sizeof(mode), "%04o", ifce.permissions);
+                checked_snprintf(interface + offset, sizeof(interface) - offset,
+                                 "-permissions");
+                add_stat(cookie, add_stat_callback, interface, mode);
+            }
 
             if (ifce.ssl.enabled) {
                 checked_snprintf(interface + offset, sizeof(interface) - offset,
@@ -547,12 +620,110 @@ static void process_stat_settings(ADD_STAT add_stat_callback,
             settings.isDatatypeSupport() ? "true" : "false");
     add_stat(cookie, add_stat_callback, "dedupe_nmvb_maps",
             settings.isDedupeNmvbMaps() ? "true" : "false");
+    add_stat(cookie, add_stat_callback, "connection_rebalance",
+            settings.isConnectionRebalance() ? "true" : "false");
+    add_stat(cookie, add_stat_callback, "busy_poll", settings.getBusyPoll());
+    add_stat(cookie, add_stat_callback, "busy_poll_threads",
+             settings.getBusyPollThreads());
+    add_stat(cookie, add_stat_callback, "sched_slice",
+             settings.getSchedSlice());
+    add_stat(cookie, add_stat_callback, "shed_threshold",
+             settings.getShedThreshold());
+    add_stat(cookie, add_stat_callback, "max_pending_bytes",
+             settings.getMaxPendingBytes());
+    add_stat(cookie, add_stat_callback, "max_pinned_items",
+             settings.getMaxPinnedItems());
+    add_stat(cookie, add_stat_callback, "slow_reader_timeout",
+             settings.getSlowReaderTimeout());
+    add_stat(cookie, add_stat_callback, "connection_pool_size",
+             settings.getConnectionPoolSize());
+    add_stat(cookie, add_stat_callback, "ssl_ktls",
+             settings.isSslKtls() ? "true" : "false");
+    add_stat(cookie, add_stat_callback, "ssl_handshake_offload",
+             settings.isSslHandshakeOffload() ? "true" : "false");
+    add_stat(cookie, add_stat_callback, "ssl_session_cache_size",
+             settings.getSslSessionCacheSize());
+    add_stat(cookie, add_stat_callback, "shm_ring_size",
+             settings.getShmRingSize());
+    add_stat(cookie, add_stat_callback, "compression_threshold",
+             settings.getCompressionThreshold());
+    add_stat(cookie, add_stat_callback, "compression_cache_size",
+             settings.getCompressionCacheSize());
+    for (const auto& entry : settings.getBucketWeights()) {
+        const std::string key = "bucket_weight_" + entry.first;
+        add_stat(cookie, add_stat_callback, key.c_str(), entry.second);
+    }
+    add_stat(cookie, add_stat_callback, "worker_cpus",
+             cpu_affinity_to_string(settings.getWorkerCpus()).c_str());
+    add_stat(cookie, add_stat_callback, "housekeeping_cpus",
+             cpu_affinity_to_string(settings.getHousekeepingCpus()).c_str());
+    add_stat(cookie, add_stat_callback, "background_threads",
+             settings.getBackgroundThreads());
     add_stat(cookie, add_stat_callback, "max_packet_size",
              std::to_string(settings.getMaxPacketSize()).c_str());
 }
 
 
-static void process_bin_get(McbpConnection* c) {
+/**
+ * Get the value to send to a client which asked for compressed values
+ * in HELLO
+ *
+ * @param c the connection sending the value
+ * @param info the item to send
+ * @param value set to the compressed value to send instead of the value
+ *              of the item, or to an empty pointer to send the value of
+ *              the item as it is
+ * @return false if the value of the item is snappy compressed and
+ *         couldn't be inflated to compress it with the client's codec
+ */
+static bool get_compressed_value(McbpConnection* c, const item_info& info,
+                                 CompressedValue& value) {
+    value.reset();
+    const auto codec = c->getCompressionCodec();
+    if (codec == CompressionCodec::None) {
+        return true;
+    }
+
+    const bool snappy = (info.datatype & PROTOCOL_BINARY_DATATYPE_COMPRESSED) ==
+                        PROTOCOL_BINARY_DATATYPE_COMPRESSED;
+    if (snappy) {
+        if (codec == CompressionCodec::Snappy) {
+            // It is already compressed with the client's codec
+            return true;
+        }
+    } else {
+        const size_t threshold = settings.getCompressionThreshold();
+        if (threshold == 0 || info.nbytes < threshold) {
+            return true;
+        }
+    }
+
+    if (info.nvalue != 1) {
+        return !snappy;
+    }
+
+    bool cached;
+    value = compression_get_value(c->getBucketIndex(), codec, info, cached);
+    if (!value) {
+        return !snappy;
+    }
+    if (!c->reserveCompressedValue(value)) {
+        value.reset();
+        return !snappy;
+    }
+
+    auto* thread_stats = get_thread_stats(c);
+    thread_stats->compressed_values++;
+    if (cached) {
+        thread_stats->compression_cache_hits++;
+    }
+    if (value->size() < info.nbytes) {
+        thread_stats->bytes_compression_saved += info.nbytes - value->size();
+    }
+    return true;
+}
+
+static void process_bin_get_continue(McbpConnection* c, ENGINE_ERROR_CODE ret) {
     item* it;
     protocol_binary_response_get* rsp = (protocol_binary_response_get*)c->write.buf;
     char* key = binary_get_key(c);
@@ -560,20 +731,10 @@ static void process_bin_get(McbpConnection* c) {
     uint16_t keylen;
     uint32_t bodylen;
     int ii;
-    ENGINE_ERROR_CODE ret;
     uint8_t datatype;
     bool need_inflate = false;
+    CompressedValue compressed;
 
-    if (settings.getVerbose() > 1) {
-        char buffer[1024];
-        if (key_to_printable_buffer(buffer, sizeof(buffer), c->getId(), true,
-                                    "GET", key, nkey) != -1) {
-            LOG_DEBUG(c, "%s", buffer);
-        }
-    }
-
-    ret = c->getAiostat();
-    c->setAiostat(ENGINE_SUCCESS);
     if (ret == ENGINE_SUCCESS) {
         ret = bucket_get(c, &it, key, (int)nkey,
                          c->binary_header.request.vbucket);
@@ -603,8 +764,22 @@ static void process_bin_get(McbpConnection* c) {
             }
         }
 
+        if (!need_inflate && !get_compressed_value(c, info.info,
+                                                   compressed)) {
+            bucket_release_item(c, it);
+            LOG_WARNING(c, "%u: Failed to inflate a compressed value",
+                        c->getId());
+            mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_EINTERNAL);
+            break;
+        }
+
         keylen = 0;
-        bodylen = sizeof(rsp->message.body) + info.info.nbytes;
+        if (compressed) {
+            datatype |= PROTOCOL_BINARY_DATATYPE_COMPRESSED;
+            bodylen = sizeof(rsp->message.body) + compressed->size();
+        } else {
+            bodylen = sizeof(rsp->message.body) + info.info.nbytes;
+        }
 
         if ((c->getCmd() == PROTOCOL_BINARY_CMD_GETK) ||
             (c->getCmd() == PROTOCOL_BINARY_CMD_GETKQ)) {
@@ -644,9 +819,13 @@ static void process_bin_get(McbpConnection* c) {
                 c->addIov(info.info.key, nkey);
             }
 
-            for (ii = 0; ii < info.info.nvalue; ++ii) {
-                c->addIov(info.info.value[ii].iov_base,
-                          info.info.value[ii].iov_len);
+            if (compressed) {
+                c->addIov(compressed->data(), compressed->size());
+            } else {
+                for (ii = 0; ii < info.info.nvalue; ++ii) {
+                    c->addIov(info.info.value[ii].iov_base,
+                              info.info.value[ii].iov_len);
+                }
             }
             c->setState(conn_mwrite);
             /* Remember this item so we can garbage collect it later */
@@ -681,7 +860,7 @@ static void process_bin_get(McbpConnection* c) {
         }
         break;
     case ENGINE_EWOULDBLOCK:
-        c->setEwouldblock(true);
+        c->suspend(process_bin_get_continue);
         break;
     case ENGINE_DISCONNECT:
         c->setState(conn_closing);
@@ -691,6 +870,19 @@ static void process_bin_get(McbpConnection* c) {
     }
 }
 
+static void process_bin_get(McbpConnection* c) {
+    if (settings.getVerbose() > 1) {
+        char buffer[1024];
+        if (key_to_printable_buffer(buffer, sizeof(buffer), c->getId(), true,
+                                    "GET", binary_get_key(c),
+                                    c->binary_header.request.keylen) != -1) {
+            LOG_DEBUG(c, "%s", buffer);
+        }
+    }
+
+    process_bin_get_continue(c, ENGINE_SUCCESS);
+}
+
 static void append_bin_stats(const char* key, const uint16_t klen,
                              const char* val, const uint32_t vlen,
                              McbpConnection* c) {
@@ -792,6 +984,12 @@ void ship_mcbp_tap_log(McbpConnection* c) {
             break;
         }
 
+        if (ii > 1 && c->isOverOutputLimits()) {
+            // Send what we've got before pinning any more items
+            get_thread_stats(c)->output_throttled++;
+            break;
+        }
+
         event = tap_iterator(c->getBucketEngineAsV0(), c->getCookie(), &it,
                              &engine, &nengine, &ttl,
                              &tap_flags, &seqno, &vbucket);
@@ -1942,7 +2140,7 @@ void ship_mcbp_dcp_log(McbpConnection* c) {
 
     // Begin timing DCP, each dcp callback needs to set the c->cmd for the timing
     // to be recorded.
-    c->setStart(gethrtime());
+    c->setStart(tsc_clock_now());
 
     if (!c->addMsgHdr(true)) {
         LOG_WARNING(c,
@@ -2742,34 +2940,28 @@ static void dcp_control_executor(McbpConnection* c, void* packet) {
     }
 }
 
-static void add_set_replace_executor(McbpConnection* c, void* packet,
+static void add_set_replace_continue(McbpConnection* c, ENGINE_ERROR_CODE ret,
+                                     ENGINE_STORE_OPERATION store_op);
+
+static void add_set_replace_suspend(McbpConnection* c,
+                                    ENGINE_STORE_OPERATION store_op) {
+    c->suspend([store_op](McbpConnection* conn, ENGINE_ERROR_CODE status) {
+        add_set_replace_continue(conn, status, store_op);
+    });
+}
+
+static void add_set_replace_continue(McbpConnection* c, ENGINE_ERROR_CODE ret,
                                      ENGINE_STORE_OPERATION store_op) {
+    char* packet = binary_get_packet(c);
     auto* req = reinterpret_cast<protocol_binary_request_add*>(packet);
-    ENGINE_ERROR_CODE ret = c->getAiostat();
-    c->setAiostat(ENGINE_SUCCESS);
-    c->setEwouldblock(false);
-
     uint8_t extlen = req->message.header.request.extlen;
-    char* key = (char*)packet + sizeof(req->bytes);
+    char* key = packet + sizeof(req->bytes);
     uint16_t nkey = ntohs(req->message.header.request.keylen);
     uint32_t vlen = ntohl(req->message.header.request.bodylen) - nkey - extlen;
     item_info_holder info;
     info.info.clsid = 0;
     info.info.nvalue = 1;
 
-    if (req->message.header.request.cas != 0) {
-        store_op = OPERATION_CAS;
-    }
-
-    if (settings.getVerbose() > 1) {
-        char buffer[1024];
-        if (key_to_printable_buffer(buffer, sizeof(buffer), c->getId(), true,
-                                    memcached_opcode_2_text(store_op), key,
-                                    nkey) != -1) {
-            LOG_DEBUG(c, "%s", buffer);
-        }
-    }
-
     if (c->getItem() == nullptr) {
         item* it;
 
@@ -2787,7 +2979,7 @@ static void add_set_replace_executor(McbpConnection* c, void* packet,
             update_topkeys(key, nkey, c);
             break;
         case ENGINE_EWOULDBLOCK:
-            c->setEwouldblock(true);
+            add_set_replace_suspend(c, store_op);
             return;
         case ENGINE_DISCONNECT:
             c->setState(conn_closing);
@@ -2860,7 +3052,7 @@ static void add_set_replace_executor(McbpConnection* c, void* packet,
         }
         break;
     case ENGINE_EWOULDBLOCK:
-        c->setEwouldblock(true);
+        add_set_replace_suspend(c, store_op);
         break;
     case ENGINE_DISCONNECT:
         c->setState(conn_closing);
@@ -2900,6 +3092,28 @@ static void add_set_replace_executor(McbpConnection* c, void* packet,
     }
 }
 
+static void add_set_replace_executor(McbpConnection* c, void* packet,
+                                     ENGINE_STORE_OPERATION store_op) {
+    auto* req = reinterpret_cast<protocol_binary_request_add*>(packet);
+    c->setEwouldblock(false);
+
+    if (req->message.header.request.cas != 0) {
+        store_op = OPERATION_CAS;
+    }
+
+    if (settings.getVerbose() > 1) {
+        char buffer[1024];
+        if (key_to_printable_buffer(buffer, sizeof(buffer), c->getId(), true,
+                                    memcached_opcode_2_text(store_op),
+                                    (char*)packet + sizeof(req->bytes),
+                                    ntohs(req->message.header.request.keylen)) != -1) {
+            LOG_DEBUG(c, "%s", buffer);
+        }
+    }
+
+    add_set_replace_continue(c, ENGINE_SUCCESS, store_op);
+}
+
 
 static void add_executor(McbpConnection* c, void* packet) {
     c->setNoReply(false);
@@ -2931,15 +3145,21 @@ static void replaceq_executor(McbpConnection* c, void* packet) {
     add_set_replace_executor(c, packet, OPERATION_REPLACE);
 }
 
-static void append_prepend_executor(McbpConnection* c,
-                                    void* packet,
+static void append_prepend_continue(McbpConnection* c, ENGINE_ERROR_CODE ret,
+                                    ENGINE_STORE_OPERATION store_op);
+
+static void append_prepend_suspend(McbpConnection* c,
+                                   ENGINE_STORE_OPERATION store_op) {
+    c->suspend([store_op](McbpConnection* conn, ENGINE_ERROR_CODE status) {
+        append_prepend_continue(conn, status, store_op);
+    });
+}
+
+static void append_prepend_continue(McbpConnection* c, ENGINE_ERROR_CODE ret,
                                     ENGINE_STORE_OPERATION store_op) {
+    char* packet = binary_get_packet(c);
     auto* req = reinterpret_cast<protocol_binary_request_append*>(packet);
-    ENGINE_ERROR_CODE ret = c->getAiostat();
-    c->setAiostat(ENGINE_SUCCESS);
-    c->setEwouldblock(false);
-
-    char* key = (char*)packet + sizeof(req->bytes);
+    char* key = packet + sizeof(req->bytes);
     uint16_t nkey = ntohs(req->message.header.request.keylen);
     uint32_t vlen = ntohl(req->message.header.request.bodylen) - nkey;
     item_info_holder info;
@@ -2960,7 +3180,7 @@ static void append_prepend_executor(McbpConnection* c,
         case ENGINE_SUCCESS:
             break;
         case ENGINE_EWOULDBLOCK:
-            c->setEwouldblock(true);
+            append_prepend_suspend(c, store_op);
             return;
         case ENGINE_DISCONNECT:
             c->setState(conn_closing);
@@ -3032,7 +3252,7 @@ static void append_prepend_executor(McbpConnection* c,
         }
         break;
     case ENGINE_EWOULDBLOCK:
-        c->setEwouldblock(true);
+        append_prepend_suspend(c, store_op);
         break;
     case ENGINE_DISCONNECT:
         c->setState(conn_closing);
@@ -3049,6 +3269,14 @@ static void append_prepend_executor(McbpConnection* c,
     }
 }
 
+static void append_prepend_executor(McbpConnection* c,
+                                    void* packet,
+                                    ENGINE_STORE_OPERATION store_op) {
+    (void)packet;
+    c->setEwouldblock(false);
+    append_prepend_continue(c, ENGINE_SUCCESS, store_op);
+}
+
 static void append_executor(McbpConnection* c, void* packet) {
     c->setNoReply(false);
     append_prepend_executor(c, packet, OPERATION_APPEND);
@@ -3098,142 +3326,754 @@ static void get_executor(McbpConnection* c, void* packet) {
 }
 
 /**
- * This is a very slow thing that you shouldn't use in production ;-)
+ * Add the entry for a single key of a GET_MULTI to the response. The
+ * value is sent straight from the item (which the connection holds on to
+ * until the response is sent), or from the compression cache.
  *
- * @param c the connection to return the details for
+ * @return the number of bytes added to the response, or -1 if we ran out
+ *         of memory
  */
-static void process_bucket_details(McbpConnection* c) {
-    cJSON* obj = cJSON_CreateObject();
+static int64_t get_multi_add_entry(McbpConnection* c,
+                                   const engine_key_t& key,
+                                   item* it,
+                                   protocol_binary_get_multi_entry* entry,
+                                   item_info_holder& info) {
+    const char* const k = static_cast<const char*>(key.key);
+    entry->status = htons(PROTOCOL_BINARY_RESPONSE_SUCCESS);
+    info.info.clsid = 0;
+    info.info.nvalue = IOV_MAX;
 
-    cJSON* array = cJSON_CreateArray();
-    for (int ii = 0; ii < settings.getMaxBuckets(); ++ii) {
-        cJSON* o = get_bucket_details(ii);
-        if (o != NULL) {
-            cJSON_AddItemToArray(array, o);
-        }
+    if (it == nullptr) {
+        STATS_MISS(c, get, k, key.nkey);
+        entry->status = htons(PROTOCOL_BINARY_RESPONSE_KEY_ENOENT);
+    } else if (!bucket_get_item_info(c, it, &info.info)) {
+        LOG_WARNING(c, "%u: Failed to get item info", c->getId());
+        entry->status = htons(PROTOCOL_BINARY_RESPONSE_EINTERNAL);
+    } else {
+        STATS_HIT(c, get, k, key.nkey);
+        update_topkeys(k, key.nkey, c);
+        entry->flags = info.info.flags;
+        entry->cas = htonll(info.info.cas);
+        entry->datatype = info.info.datatype;
     }
-    cJSON_AddItemToObject(obj, "buckets", array);
 
-    char* stats_str = cJSON_PrintUnformatted(obj);
-    append_stats("bucket details", 14, stats_str, uint32_t(strlen(stats_str)),
-                 c->getCookie());
-    cJSON_Free(stats_str);
-    cJSON_Delete(obj);
-}
+    if (!c->addIov(entry, sizeof(*entry))) {
+        return -1;
+    }
 
-/**
- * Handler for the <code>stats reset</code> command.
- *
- * Clear the global and the connected buckets stats.
- *
- * It is possible to clear a subset of the stats by using its submodule.
- * The following submodules exists:
- * <ul>
- *    <li>timings</li>
- * </ul>
- *
- * @todo I would have assumed that we wanted to clear the stats from
- *       <b>all</b> of the buckets?
- *
- * @param arg - should be empty
- * @param connection the connection that requested the operation
- */
-static ENGINE_ERROR_CODE stat_reset_executor(const std::string& arg,
-                                             McbpConnection& connection) {
-    if (arg.empty()) {
-        stats_reset(connection.getCookie());
-        bucket_reset_stats(&connection);
-        all_buckets[0].timings.reset();
-        all_buckets[connection.getBucketIndex()].timings.reset();
-        return ENGINE_SUCCESS;
-    } else if (arg == "timings") {
-        // Nuke the command timings section for the connected bucket
-        all_buckets[connection.getBucketIndex()].timings.reset();
-        return ENGINE_SUCCESS;
-    } else {
-        return ENGINE_EINVAL;
+    if (entry->status != htons(PROTOCOL_BINARY_RESPONSE_SUCCESS)) {
+        return sizeof(*entry);
     }
-}
 
-/**
- * Handler for the <code>stats settings</code> used to get the current
- * settings.
- *
- * @param arg - should be empty
- * @param connection the connection that requested the operation
- */
-static ENGINE_ERROR_CODE stat_settings_executor(const std::string& arg,
-                                                McbpConnection& connection) {
+    // The entry header is already added so we can't skip it on failures
+    auto failed = [entry]() -> int64_t {
+        entry->status = htons(PROTOCOL_BINARY_RESPONSE_EINTERNAL);
+        entry->flags = 0;
+        entry->cas = 0;
+        entry->datatype = PROTOCOL_BINARY_RAW_BYTES;
+        return sizeof(*entry);
+    };
 
-    if (arg.empty()) {
-        process_stat_settings(&append_stats, &connection);
-        return ENGINE_SUCCESS;
-    } else {
-        return ENGINE_EINVAL;
+    if (!c->isSupportsDatatype()) {
+        if ((entry->datatype & PROTOCOL_BINARY_DATATYPE_COMPRESSED) ==
+            PROTOCOL_BINARY_DATATYPE_COMPRESSED) {
+            // The client can't inflate it, so we need a copy
+            size_t inflated;
+            const char* value = static_cast<const char*>(
+                info.info.value[0].iov_base);
+            const size_t nvalue = info.info.value[0].iov_len;
+            char* buf;
+            if (info.info.nvalue != 1 ||
+                snappy_uncompressed_length(value, nvalue,
+                                           &inflated) != SNAPPY_OK ||
+                (buf = static_cast<char*>(malloc(inflated))) == nullptr) {
+                return failed();
+            }
+            if (!c->pushTempAlloc(buf)) {
+                free(buf);
+                return -1;
+            }
+            if (snappy_uncompress(value, nvalue, buf, &inflated) != SNAPPY_OK) {
+                LOG_WARNING(c, "%u: Failed to inflate item", c->getId());
+                return failed();
+            }
+            entry->datatype = PROTOCOL_BINARY_RAW_BYTES;
+            entry->valuelen = htonl(uint32_t(inflated));
+            return c->addIov(buf, inflated) ? int64_t(sizeof(*entry) + inflated)
+                                            : -1;
+        }
+        entry->datatype = PROTOCOL_BINARY_RAW_BYTES;
     }
-}
 
-/**
- * Handler for the <code>stats audit</code> used to get statistics from
- * the audit subsystem.
- *
- * @param arg - should be empty
- * @param connection the connection that requested the operation
- */
-static ENGINE_ERROR_CODE stat_audit_executor(const std::string& arg,
-                                             McbpConnection& connection) {
-    if (arg.empty()) {
-        process_auditd_stats(get_audit_handle(),
-                             &append_stats,
-                             const_cast<void*>(connection.getCookie()));
-        return ENGINE_SUCCESS;
-    } else {
-        return ENGINE_EINVAL;
+    CompressedValue compressed;
+    if (!get_compressed_value(c, info.info, compressed)) {
+        LOG_WARNING(c, "%u: Failed to inflate a compressed value", c->getId());
+        return failed();
+    }
+    if (compressed) {
+        entry->datatype |= PROTOCOL_BINARY_DATATYPE_COMPRESSED;
+        entry->valuelen = htonl(uint32_t(compressed->size()));
+        return c->addIov(compressed->data(), compressed->size())
+               ? int64_t(sizeof(*entry) + compressed->size()) : -1;
+    }
+
+    entry->valuelen = htonl(info.info.nbytes);
+    for (int ii = 0; ii < info.info.nvalue; ++ii) {
+        if (!c->addIov(info.info.value[ii].iov_base,
+                       info.info.value[ii].iov_len)) {
+            return -1;
+        }
     }
+    return int64_t(sizeof(*entry)) + info.info.nbytes;
 }
 
+static void get_multi_continue(McbpConnection* c, ENGINE_ERROR_CODE ret) {
+    auto* req = reinterpret_cast<protocol_binary_request_get_multi*>(
+        binary_get_packet(c));
 
-/**
- * Handler for the <code>stats bucket details</code> used to get information
- * of the buckets (type, state, #clients etc)
- *
- * @param arg - should be empty
- * @param connection the connection that requested the operation
- */
-static ENGINE_ERROR_CODE stat_bucket_details_executor(const std::string& arg,
-                                                      McbpConnection& connection) {
-    if (arg.empty()) {
-        process_bucket_details(&connection);
-        return ENGINE_SUCCESS;
-    } else {
-        return ENGINE_EINVAL;
+    // The validator checked that the keys are well formed
+    std::vector<engine_key_t> keys;
+    const uint8_t* ptr = req->bytes + sizeof(req->bytes);
+    const uint8_t* const end = ptr + c->binary_header.request.bodylen;
+    while (ptr < end) {
+        uint16_t nkey;
+        memcpy(&nkey, ptr, sizeof(nkey));
+        nkey = ntohs(nkey);
+        ptr += sizeof(nkey);
+        keys.push_back({ptr, nkey});
+        ptr += nkey;
     }
-}
 
-/**
- * Handler for the <code>stats aggregate</code>.. probably not used anymore
- * as it gives just a subset of what you'll get from an empty stat.
- *
- * @param arg - should be empty
- * @param connection the connection that requested the operation
- */
-static ENGINE_ERROR_CODE stat_aggregate_executor(const std::string& arg,
-                                                 McbpConnection& connection) {
-    if (arg.empty()) {
-        return server_stats(&append_stats, &connection);
-    } else {
-        return ENGINE_EINVAL;
+    // The items are all held until the response is sent, so a batch
+    // can't be larger than the limit for the connection
+    const size_t max_items = settings.getMaxPinnedItems();
+    if (max_items != 0 && keys.size() > max_items) {
+        mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_E2BIG);
+        return;
     }
-}
 
-/**
- * Handler for the <code>stats connection[ fd]</code> command to retrieve
- * information about connection specific details.
- *
- * @param arg an optional file descriptor representing the connection
- *            object to retrieve information about. If empty dump all.
- * @param connection the connection that requested the operation
- */
+    std::vector<item*> items(keys.size(), nullptr);
+    if (ret == ENGINE_SUCCESS) {
+        ret = bucket_get_multi(c, keys.data(), keys.size(), items.data(),
+                               c->binary_header.request.vbucket);
+    }
+
+    switch (ret) {
+    case ENGINE_SUCCESS:
+        break;
+    case ENGINE_EWOULDBLOCK:
+        c->suspend(get_multi_continue);
+        return;
+    case ENGINE_DISCONNECT:
+        c->setState(conn_closing);
+        return;
+    default:
+        mcbp_write_packet(c, engine_error_2_mcbp_protocol_error(ret));
+        return;
+    }
+
+    // Hand all of the items over to the connection so that they're
+    // released when the response is sent (or the connection is closed)
+    for (size_t ii = 0; ii < items.size(); ++ii) {
+        if (items[ii] != nullptr && !c->reserveItem(items[ii])) {
+            for (size_t jj = ii; jj < items.size(); ++jj) {
+                if (items[jj] != nullptr) {
+                    bucket_release_item(c, items[jj]);
+                }
+            }
+            LOG_WARNING(c, "%u: Failed to grow item array", c->getId());
+            c->setState(conn_closing);
+            return;
+        }
+    }
+
+    auto* entries = static_cast<protocol_binary_get_multi_entry*>(
+        calloc(keys.size(), sizeof(protocol_binary_get_multi_entry)));
+    if (entries == nullptr ||
+        !c->pushTempAlloc(reinterpret_cast<char*>(entries))) {
+        free(entries);
+        c->setState(conn_closing);
+        return;
+    }
+
+    // The body length is filled in when we know it
+    if (mcbp_add_header(c, PROTOCOL_BINARY_RESPONSE_SUCCESS, 0, 0, 0,
+                        PROTOCOL_BINARY_RAW_BYTES) == -1) {
+        c->setState(conn_closing);
+        return;
+    }
+    auto* rsp = reinterpret_cast<protocol_binary_response_header*>(
+        c->write.buf);
+
+    item_info_holder info;
+    uint64_t bodylen = 0;
+    for (size_t ii = 0; ii < keys.size(); ++ii) {
+        const int64_t nw = get_multi_add_entry(c, keys[ii], items[ii],
+                                               &entries[ii], info);
+        if (nw == -1) {
+            c->setState(conn_closing);
+            return;
+        }
+        bodylen += uint64_t(nw);
+    }
+
+    if (bodylen > std::numeric_limits<uint32_t>::max()) {
+        mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_E2BIG);
+        return;
+    }
+
+    rsp->response.bodylen = htonl(uint32_t(bodylen));
+    c->setState(conn_mwrite);
+}
+
+static void get_multi_executor(McbpConnection* c, void* packet) {
+    (void)packet;
+    get_multi_continue(c, ENGINE_SUCCESS);
+}
+
+/**
+ * The largest batch a client may ask SCAN for (so that a single request
+ * doesn't hold the locks of the engine, or build a response, for too long)
+ */
+static const uint32_t SCAN_MAX_BATCH = 10000;
+
+/**
+ * The response to SCAN is built in the dynamic buffer of the connection
+ * once the engine is done, so the keys are collected here in the
+ * meantime (the callback runs with the locks of the engine held, so it
+ * just appends the entry)
+ */
+struct ScanContext {
+    bool metadata;
+    bool nomem;
+    std::string body;
+};
+
+static void scan_callback(const item_info* info, void* ctx) {
+    auto* scan = static_cast<ScanContext*>(ctx);
+    if (scan->nomem) {
+        return;
+    }
+
+    try {
+        if (scan->metadata) {
+            protocol_binary_scan_entry entry;
+            entry.keylen = htons(info->nkey);
+            entry.datatype = info->datatype;
+            entry.reserved = 0;
+            entry.flags = info->flags;
+            entry.exptime = 0;
+            if (info->exptime != 0) {
+                entry.exptime = htonl(uint32_t(
+                    mc_time_convert_to_abs_time(info->exptime)));
+            }
+            entry.valuelen = htonl(info->nbytes);
+            entry.cas = htonll(info->cas);
+            scan->body.append(reinterpret_cast<const char*>(&entry),
+                              sizeof(entry));
+        } else {
+            const uint16_t nkey = htons(info->nkey);
+            scan->body.append(reinterpret_cast<const char*>(&nkey),
+                              sizeof(nkey));
+        }
+        scan->body.append(static_cast<const char*>(info->key), info->nkey);
+    } catch (const std::bad_alloc&) {
+        scan->nomem = true;
+    }
+}
+
+static void scan_continue(McbpConnection* c, ENGINE_ERROR_CODE ret) {
+    auto* req = reinterpret_cast<protocol_binary_request_scan*>(
+        binary_get_packet(c));
+    const char* prefix = reinterpret_cast<const char*>(
+        req->bytes + sizeof(req->bytes));
+    const uint16_t nprefix = c->binary_header.request.keylen;
+    uint64_t cursor = ntohll(req->message.body.cursor);
+    const uint32_t count = std::min(ntohl(req->message.body.count),
+                                    SCAN_MAX_BATCH);
+
+    ScanContext scan;
+    scan.metadata = (ntohl(req->message.body.flags) &
+                     PROTOCOL_BINARY_SCAN_FLAG_METADATA) != 0;
+    scan.nomem = false;
+
+    if (ret == ENGINE_SUCCESS) {
+        ret = bucket_scan(c, &cursor, prefix, nprefix, count, scan_callback,
+                          &scan, c->binary_header.request.vbucket);
+    }
+
+    switch (ret) {
+    case ENGINE_SUCCESS:
+        break;
+    case ENGINE_EWOULDBLOCK:
+        c->suspend(scan_continue);
+        return;
+    case ENGINE_DISCONNECT:
+        c->setState(conn_closing);
+        return;
+    default:
+        mcbp_write_packet(c, engine_error_2_mcbp_protocol_error(ret));
+        return;
+    }
+
+    if (scan.nomem) {
+        mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_ENOMEM);
+        return;
+    }
+
+    cursor = htonll(cursor);
+    if (mcbp_response_handler(NULL, 0, &cursor, sizeof(cursor),
+                              scan.body.data(), uint32_t(scan.body.size()),
+                              PROTOCOL_BINARY_RAW_BYTES,
+                              PROTOCOL_BINARY_RESPONSE_SUCCESS,
+                              0, c->getCookie())) {
+        mcbp_write_and_free(c, &c->getDynamicBuffer());
+    } else {
+        mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_ENOMEM);
+    }
+}
+
+static void scan_executor(McbpConnection* c, void* packet) {
+    (void)packet;
+    scan_continue(c, ENGINE_SUCCESS);
+}
+
+static void bulk_store_continue(McbpConnection* c, ENGINE_ERROR_CODE ret) {
+    auto* req = reinterpret_cast<protocol_binary_request_bulk_store*>(
+        binary_get_packet(c));
+    const uint16_t vbucket = c->binary_header.request.vbucket;
+
+    // The validator checked that the records are well formed
+    std::vector<protocol_binary_bulk_store_record> records;
+    std::vector<const char*> keys;
+    const uint8_t* ptr = req->bytes + sizeof(req->bytes);
+    const uint8_t* const end = ptr + c->binary_header.request.bodylen;
+    while (ptr < end) {
+        protocol_binary_bulk_store_record record;
+        memcpy(&record, ptr, sizeof(record));
+        ptr += sizeof(record);
+        record.keylen = ntohs(record.keylen);
+        record.exptime = ntohl(record.exptime);
+        record.valuelen = ntohl(record.valuelen);
+        records.push_back(record);
+        keys.push_back(reinterpret_cast<const char*>(ptr));
+        ptr += record.keylen + record.valuelen;
+    }
+
+    // The records which can't be allocated are failed right away, and
+    // the rest are stored with a single call to the engine
+    std::vector<ENGINE_ERROR_CODE> results(records.size(), ENGINE_SUCCESS);
+    std::vector<item*> items;
+    std::vector<size_t> index;
+    items.reserve(records.size());
+    index.reserve(records.size());
+
+    auto release = [c, &items]() {
+        for (auto* it : items) {
+            bucket_release_item(c, it);
+        }
+        items.clear();
+    };
+
+    item_info_holder info;
+    for (size_t ii = 0; ii < records.size() && ret == ENGINE_SUCCESS; ++ii) {
+        const auto& record = records[ii];
+        if (!c->isSupportsDatatype() &&
+            record.datatype != PROTOCOL_BINARY_RAW_BYTES) {
+            results[ii] = ENGINE_EINVAL;
+            continue;
+        }
+
+        item* it;
+        ret = c->getBucketEngine()->allocate(c->getBucketEngineAsV0(),
+                                             c->getCookie(), &it, keys[ii],
+                                             record.keylen, record.valuelen,
+                                             record.flags, record.exptime,
+                                             record.datatype);
+        switch (ret) {
+        case ENGINE_SUCCESS:
+            break;
+        case ENGINE_EWOULDBLOCK:
+        case ENGINE_DISCONNECT:
+        case ENGINE_NOT_MY_VBUCKET:
+        case ENGINE_NO_BUCKET:
+            // Fails the whole batch
+            continue;
+        default:
+            results[ii] = ret;
+            ret = ENGINE_SUCCESS;
+            continue;
+        }
+
+        items.push_back(it);
+        index.push_back(ii);
+
+        info.info.clsid = 0;
+        info.info.nvalue = 1;
+        if (!bucket_get_item_info(c, it, &info.info)) {
+            release();
+            mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_EINTERNAL);
+            return;
+        }
+        cb_assert(info.info.value[0].iov_len == record.valuelen);
+        memcpy(info.info.value[0].iov_base, keys[ii] + record.keylen,
+               record.valuelen);
+
+        if (!c->isSupportsDatatype()) {
+            auto* validator = c->getThread()->validator;
+            try {
+                auto* value = reinterpret_cast<uint8_t*>(
+                    info.info.value[0].iov_base);
+                if (validator->validate(value, info.info.value[0].iov_len)) {
+                    info.info.datatype = PROTOCOL_BINARY_DATATYPE_JSON;
+                    if (!bucket_set_item_info(c, it, &info.info)) {
+                        LOG_WARNING(c, "%u: Failed to set item info",
+                                    c->getId());
+                    }
+                }
+            } catch (std::bad_alloc&) {
+                release();
+                c->setState(conn_closing);
+                return;
+            }
+        }
+    }
+
+    std::vector<ENGINE_ERROR_CODE> stored(items.size(), ENGINE_SUCCESS);
+    if (ret == ENGINE_SUCCESS && !items.empty()) {
+        ret = bucket_store_multi(c, items.data(), items.size(),
+                                 OPERATION_SET, stored.data(), vbucket);
+    }
+    release();
+
+    switch (ret) {
+    case ENGINE_SUCCESS:
+        break;
+    case ENGINE_EWOULDBLOCK:
+        // The whole batch is retried (a SET may safely be repeated)
+        c->suspend(bulk_store_continue);
+        return;
+    case ENGINE_DISCONNECT:
+        c->setState(conn_closing);
+        return;
+    default:
+        mcbp_write_packet(c, engine_error_2_mcbp_protocol_error(ret));
+        return;
+    }
+
+    for (size_t ii = 0; ii < index.size(); ++ii) {
+        results[index[ii]] = stored[ii];
+    }
+
+    uint32_t nstored = 0;
+    uint32_t nfailed = 0;
+    uint16_t first_error = PROTOCOL_BINARY_RESPONSE_SUCCESS;
+    for (const auto result : results) {
+        if (result == ENGINE_SUCCESS) {
+            ++nstored;
+        } else {
+            if (nfailed++ == 0) {
+                first_error = engine_error_2_mcbp_protocol_error(result);
+            }
+        }
+    }
+    get_thread_stats(c)->cmd_set += records.size();
+
+    if (nfailed > 0) {
+        // BULK_STOREQ only stays quiet if everything was stored
+        c->setNoReply(false);
+    }
+
+    auto* rsp = reinterpret_cast<protocol_binary_response_bulk_store*>(
+        c->write.buf);
+    rsp->message.body.stored = htonl(nstored);
+    rsp->message.body.failed = htonl(nfailed);
+    rsp->message.body.first_error = htons(first_error);
+    rsp->message.body.reserved = 0;
+    mcbp_write_response(c, &rsp->message.body, sizeof(rsp->message.body), 0,
+                        sizeof(rsp->message.body));
+}
+
+static void bulk_store_executor(McbpConnection* c, void* packet) {
+    (void)packet;
+    c->setNoReply(c->getCmd() == PROTOCOL_BINARY_CMD_BULK_STOREQ);
+    bulk_store_continue(c, ENGINE_SUCCESS);
+}
+
+/**
+ * Send the item found by GET_LEASE. The value is sent like for GET, but
+ * the extras carry the state of the value as well as the flags.
+ */
+static void get_lease_send_item(McbpConnection* c, item* it, bool stale) {
+    auto* rsp = reinterpret_cast<protocol_binary_response_get_lease*>(
+        c->write.buf);
+    item_info_holder info;
+    info.info.clsid = 0;
+    info.info.nvalue = IOV_MAX;
+
+    if (!bucket_get_item_info(c, it, &info.info)) {
+        bucket_release_item(c, it);
+        LOG_WARNING(c, "%u: Failed to get item info", c->getId());
+        mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_EINTERNAL);
+        return;
+    }
+
+    // The CAS of a stale value is the lease token of another client
+    const uint64_t cas = stale ? 0 : info.info.cas;
+    const uint32_t state = htonl(stale ? PROTOCOL_BINARY_LEASE_STATE_STALE :
+                                         PROTOCOL_BINARY_LEASE_STATE_FRESH);
+
+    uint8_t datatype = info.info.datatype;
+    if (!c->isSupportsDatatype()) {
+        if ((datatype & PROTOCOL_BINARY_DATATYPE_COMPRESSED) ==
+            PROTOCOL_BINARY_DATATYPE_COMPRESSED) {
+            // Let the response handler inflate the value
+            rsp->message.body.flags = info.info.flags;
+            rsp->message.body.state = state;
+            if (info.info.nvalue == 1 &&
+                mcbp_response_handler(nullptr, 0, &rsp->message.body,
+                                      sizeof(rsp->message.body),
+                                      info.info.value[0].iov_base,
+                                      uint32_t(info.info.value[0].iov_len),
+                                      datatype,
+                                      PROTOCOL_BINARY_RESPONSE_SUCCESS,
+                                      cas, c->getCookie())) {
+                mcbp_write_and_free(c, &c->getDynamicBuffer());
+            } else {
+                mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_EINTERNAL);
+            }
+            bucket_release_item(c, it);
+            return;
+        }
+        datatype = PROTOCOL_BINARY_RAW_BYTES;
+    }
+
+    CompressedValue compressed;
+    if (!get_compressed_value(c, info.info, compressed)) {
+        bucket_release_item(c, it);
+        LOG_WARNING(c, "%u: Failed to inflate a compressed value",
+                    c->getId());
+        mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_EINTERNAL);
+        return;
+    }
+
+    uint32_t bodylen = sizeof(rsp->message.body);
+    if (compressed) {
+        datatype |= PROTOCOL_BINARY_DATATYPE_COMPRESSED;
+        bodylen += uint32_t(compressed->size());
+    } else {
+        bodylen += info.info.nbytes;
+    }
+
+    if (mcbp_add_header(c, 0, sizeof(rsp->message.body), 0, bodylen,
+                        datatype) == -1) {
+        bucket_release_item(c, it);
+        c->setState(conn_closing);
+        return;
+    }
+    rsp->message.header.response.cas = htonll(cas);
+    rsp->message.body.flags = info.info.flags;
+    rsp->message.body.state = state;
+    c->addIov(&rsp->message.body, sizeof(rsp->message.body));
+
+    if (compressed) {
+        c->addIov(compressed->data(), compressed->size());
+    } else {
+        for (int ii = 0; ii < info.info.nvalue; ++ii) {
+            c->addIov(info.info.value[ii].iov_base,
+                      info.info.value[ii].iov_len);
+        }
+    }
+    c->setState(conn_mwrite);
+    /* Remember this item so we can garbage collect it later */
+    c->setItem(it);
+}
+
+static void get_lease_continue(McbpConnection* c, ENGINE_ERROR_CODE ret) {
+    char* key = binary_get_key(c);
+    const size_t nkey = c->binary_header.request.keylen;
+    item* it = nullptr;
+    uint64_t lease = 0;
+    bool stale = false;
+
+    if (ret == ENGINE_SUCCESS) {
+        ret = bucket_get_lease(c, &it, key, int(nkey),
+                               c->binary_header.request.vbucket, &lease,
+                               &stale);
+    }
+
+    switch (ret) {
+    case ENGINE_SUCCESS:
+        STATS_HIT(c, get, key, nkey);
+        get_lease_send_item(c, it, stale);
+        update_topkeys(key, nkey, c);
+        break;
+    case ENGINE_KEY_ENOENT:
+        STATS_MISS(c, get, key, nkey);
+        // The lease token is returned as the CAS of the miss
+        if (mcbp_response_handler(nullptr, 0, nullptr, 0, nullptr, 0,
+                                  PROTOCOL_BINARY_RAW_BYTES,
+                                  PROTOCOL_BINARY_RESPONSE_KEY_ENOENT,
+                                  lease, c->getCookie())) {
+            mcbp_write_and_free(c, &c->getDynamicBuffer());
+        } else {
+            mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_ENOMEM);
+        }
+        break;
+    case ENGINE_EWOULDBLOCK:
+        c->suspend(get_lease_continue);
+        break;
+    case ENGINE_DISCONNECT:
+        c->setState(conn_closing);
+        break;
+    default:
+        mcbp_write_packet(c, engine_error_2_mcbp_protocol_error(ret));
+    }
+}
+
+static void get_lease_executor(McbpConnection* c, void* packet) {
+    (void)packet;
+    c->setNoReply(false);
+    get_lease_continue(c, ENGINE_SUCCESS);
+}
+
+/**
+ * This is a very slow thing that you shouldn't use in production ;-)
+ *
+ * @param c the connection to return the details for
+ */
+static void process_bucket_details(McbpConnection* c) {
+    cJSON* obj = cJSON_CreateObject();
+
+    cJSON* array = cJSON_CreateArray();
+    for (int ii = 0; ii < settings.getMaxBuckets(); ++ii) {
+        cJSON* o = get_bucket_details(ii);
+        if (o != NULL) {
+            cJSON_AddItemToArray(array, o);
+        }
+    }
+    cJSON_AddItemToObject(obj, "buckets", array);
+
+    char* stats_str = cJSON_PrintUnformatted(obj);
+    append_stats("bucket details", 14, stats_str, uint32_t(strlen(stats_str)),
+                 c->getCookie());
+    cJSON_Free(stats_str);
+    cJSON_Delete(obj);
+}
+
+/**
+ * Handler for the <code>stats reset</code> command.
+ *
+ * Clear the global and the connected buckets stats.
+ *
+ * It is possible to clear a subset of the stats by using its submodule.
+ * The following submodules exists:
+ * <ul>
+ *    <li>timings</li>
+ * </ul>
+ *
+ * @todo I would have assumed that we wanted to clear the stats from
+ *       <b>all</b> of the buckets?
+ *
+ * @param arg - should be empty
+ * @param connection the connection that requested the operation
+ */
+static ENGINE_ERROR_CODE stat_reset_executor(const std::string& arg,
+                                             McbpConnection& connection) {
+    if (arg.empty()) {
+        stats_reset(connection.getCookie());
+        bucket_reset_stats(&connection);
+        all_buckets[0].timings.reset();
+        all_buckets[connection.getBucketIndex()].timings.reset();
+        return ENGINE_SUCCESS;
+    } else if (arg == "timings") {
+        // Nuke the command timings section for the connected bucket
+        all_buckets[connection.getBucketIndex()].timings.reset();
+        return ENGINE_SUCCESS;
+    } else {
+        return ENGINE_EINVAL;
+    }
+}
+
+/**
+ * Handler for the <code>stats settings</code> used to get the current
+ * settings.
+ *
+ * @param arg - should be empty
+ * @param connection the connection that requested the operation
+ */
+static ENGINE_ERROR_CODE stat_settings_executor(const std::string& arg,
+                                                McbpConnection& connection) {
+
+    if (arg.empty()) {
+        process_stat_settings(&append_stats, &connection);
+        return ENGINE_SUCCESS;
+    } else {
+        return ENGINE_EINVAL;
+    }
+}
+
+/**
+ * Handler for the <code>stats audit</code> used to get statistics from
+ * the audit subsystem.
+ *
+ * @param arg - should be empty
+ * @param connection the connection that requested the operation
+ */
+static ENGINE_ERROR_CODE stat_audit_executor(const std::string& arg,
+                                             McbpConnection& connection) {
+    if (arg.empty()) {
+        process_auditd_stats(get_audit_handle(),
+                             &append_stats,
+                             const_cast<void*>(connection.getCookie()));
+        return ENGINE_SUCCESS;
+    } else {
+        return ENGINE_EINVAL;
+    }
+}
+
+
+/**
+ * Handler for the <code>stats bucket details</code> used to get information
+ * of the buckets (type, state, #clients etc)
+ *
+ * @param arg - should be empty
+ * @param connection the connection that requested the operation
+ */
+static ENGINE_ERROR_CODE stat_bucket_details_executor(const std::string& arg,
+                                                      McbpConnection& connection) {
+    if (arg.empty()) {
+        process_bucket_details(&connection);
+        return ENGINE_SUCCESS;
+    } else {
+        return ENGINE_EINVAL;
+    }
+}
+
+/**
+ * Handler for the <code>stats aggregate</code>.. probably not used anymore
+ * as it gives just a subset of what you'll get from an empty stat.
+ *
+ * @param arg - should be empty
+ * @param connection the connection that requested the operation
+ */
+static ENGINE_ERROR_CODE stat_aggregate_executor(const std::string& arg,
+                                                 McbpConnection& connection) {
+    if (arg.empty()) {
+        return server_stats(&append_stats, &connection);
+    } else {
+        return ENGINE_EINVAL;
+    }
+}
+
+/**
+ * Handler for the <code>stats connection[ fd]</code> command to retrieve
+ * information about connection specific details.
+ *
+ * @param arg an optional file descriptor representing the connection
+ *            object to retrieve information about. If empty dump all.
+ * @param connection the connection that requested the operation
+ */
 static ENGINE_ERROR_CODE stat_connections_executor(const std::string& arg,
                                                    McbpConnection& connection) {
     int64_t fd = -1;
@@ -3251,90 +4091,195 @@ static ENGINE_ERROR_CODE stat_connections_executor(const std::string& arg,
 }
 
 /**
- * Handler for the <code>stats topkeys</code> command used to retrieve
- * the most popular keys in the attached bucket.
+ * Handler for the <code>stats topkeys</code> command used to retrieve
+ * the most popular keys in the attached bucket.
+ *
+ * @param arg - should be empty
+ * @param connection the connection that requested the operation
+ */
+static ENGINE_ERROR_CODE stat_topkeys_executor(const std::string& arg,
+                                               McbpConnection& connection) {
+    if (arg.empty()) {
+        auto& bucket = all_buckets[connection.getBucketIndex()];
+        return bucket.topkeys->stats(connection.getCookie(),
+                                     mc_time_get_current_time(),
+                                     append_stats);
+    } else {
+        return ENGINE_EINVAL;
+    }
+}
+
+/**
+ * Handler for the <code>stats topkeys</code> command used to retrieve
+ * a JSON document containing the most popular keys in the attached bucket.
+ *
+ * @param arg - should be empty
+ * @param connection the connection that requested the operation
+ */
+static ENGINE_ERROR_CODE stat_topkeys_json_executor(const std::string& arg,
+                                                    McbpConnection& connection) {
+    if (arg.empty()) {
+        ENGINE_ERROR_CODE ret;
+
+        cJSON* topkeys_doc = cJSON_CreateObject();
+        if (topkeys_doc == nullptr) {
+            ret = ENGINE_ENOMEM;
+        } else {
+            auto& bucket = all_buckets[connection.getBucketIndex()];
+            ret = bucket.topkeys->json_stats(topkeys_doc,
+                                             mc_time_get_current_time());
+
+            if (ret == ENGINE_SUCCESS) {
+                char key[] = "topkeys_json";
+                char* topkeys_str = cJSON_PrintUnformatted(topkeys_doc);
+                if (topkeys_str != nullptr) {
+                    append_stats(key, (uint16_t)strlen(key),
+                                 topkeys_str, (uint32_t)strlen(topkeys_str),
+                                 connection.getCookie());
+                    cJSON_Free(topkeys_str);
+                } else {
+                    ret = ENGINE_ENOMEM;
+                }
+            }
+            cJSON_Delete(topkeys_doc);
+        }
+        return ret;
+    } else {
+        return ENGINE_EINVAL;
+    }
+}
+
+/**
+ * Handler for the <code>stats subdoc_execute</code> command used to retrieve
+ * information from the subdoc subsystem.
+ *
+ * @param arg - should be empty
+ * @param connection the connection that requested the operation
+ */
+static ENGINE_ERROR_CODE stat_subdoc_execute_executor(const std::string& arg,
+                                                      McbpConnection& connection) {
+    if (arg.empty()) {
+        const auto index = connection.getBucketIndex();
+        std::string json_str;
+        if (index == 0) {
+            // Aggregrated timings for all buckets.
+            TimingHistogram aggregated;
+            for (const auto& bucket : all_buckets) {
+                aggregated += bucket.subjson_operation_times;
+            }
+            json_str = aggregated.to_string();
+        } else {
+            // Timings for a specific bucket.
+            auto& bucket = all_buckets[connection.getBucketIndex()];
+            json_str = bucket.subjson_operation_times.to_string();
+        }
+        append_stats(nullptr, 0, json_str.c_str(), json_str.size(),
+                     connection.getCookie());
+        return ENGINE_SUCCESS;
+    } else {
+        return ENGINE_EINVAL;
+    }
+}
+
+/**
+ * Handler for the <code>stats sched_delay</code> command used to retrieve
+ * the histogram of the time the connections bound to the bucket waited
+ * for their worker thread after they yielded or their pending io
+ * completed.
+ *
+ * @param arg - should be empty
+ * @param connection the connection that requested the operation
+ */
+static ENGINE_ERROR_CODE stat_sched_delay_executor(const std::string& arg,
+                                                   McbpConnection& connection) {
+    if (arg.empty()) {
+        const auto index = connection.getBucketIndex();
+        std::string json_str;
+        if (index == 0) {
+            // Aggregrated delay for all buckets.
+            TimingHistogram aggregated;
+            for (const auto& bucket : all_buckets) {
+                aggregated += bucket.sched_delay;
+            }
+            json_str = aggregated.to_string();
+        } else {
+            json_str = all_buckets[index].sched_delay.to_string();
+        }
+        append_stats(nullptr, 0, json_str.c_str(), json_str.size(),
+                     connection.getCookie());
+        return ENGINE_SUCCESS;
+    } else {
+        return ENGINE_EINVAL;
+    }
+}
+
+/**
+ * Handler for the <code>stats ssl_handshake</code> command used to
+ * retrieve the histograms of the time spent in SSL_accept() for the full
+ * handshakes and the ones which resumed a previous session.
  *
  * @param arg - should be empty
  * @param connection the connection that requested the operation
  */
-static ENGINE_ERROR_CODE stat_topkeys_executor(const std::string& arg,
-                                               McbpConnection& connection) {
+static ENGINE_ERROR_CODE stat_ssl_handshake_executor(const std::string& arg,
+                                                     McbpConnection& connection) {
     if (arg.empty()) {
-        auto& bucket = all_buckets[connection.getBucketIndex()];
-        return bucket.topkeys->stats(connection.getCookie(),
-                                     mc_time_get_current_time(),
-                                     append_stats);
+        const std::string json_str =
+            "{\"full\":" + ssl_handshake_timings.full.to_string() +
+            ",\"resumed\":" + ssl_handshake_timings.resumed.to_string() + "}";
+        append_stats(nullptr, 0, json_str.c_str(), json_str.size(),
+                     connection.getCookie());
+        return ENGINE_SUCCESS;
     } else {
         return ENGINE_EINVAL;
     }
 }
 
 /**
- * Handler for the <code>stats topkeys</code> command used to retrieve
- * a JSON document containing the most popular keys in the attached bucket.
+ * Handler for the <code>stats worker</code> command used to retrieve
+ * the load and busy poll statistics for each of the worker threads.
  *
  * @param arg - should be empty
  * @param connection the connection that requested the operation
  */
-static ENGINE_ERROR_CODE stat_topkeys_json_executor(const std::string& arg,
-                                                    McbpConnection& connection) {
+static ENGINE_ERROR_CODE stat_worker_executor(const std::string& arg,
+                                              McbpConnection& connection) {
     if (arg.empty()) {
-        ENGINE_ERROR_CODE ret;
-
-        cJSON* topkeys_doc = cJSON_CreateObject();
-        if (topkeys_doc == nullptr) {
-            ret = ENGINE_ENOMEM;
-        } else {
-            auto& bucket = all_buckets[connection.getBucketIndex()];
-            ret = bucket.topkeys->json_stats(topkeys_doc,
-                                             mc_time_get_current_time());
-
-            if (ret == ENGINE_SUCCESS) {
-                char key[] = "topkeys_json";
-                char* topkeys_str = cJSON_PrintUnformatted(topkeys_doc);
-                if (topkeys_str != nullptr) {
-                    append_stats(key, (uint16_t)strlen(key),
-                                 topkeys_str, (uint32_t)strlen(topkeys_str),
-                                 connection.getCookie());
-                    cJSON_Free(topkeys_str);
-                } else {
-                    ret = ENGINE_ENOMEM;
-                }
-            }
-            cJSON_Delete(topkeys_doc);
-        }
-        return ret;
+        threads_stats(&append_stats, connection.getCookie());
+        return ENGINE_SUCCESS;
     } else {
         return ENGINE_EINVAL;
     }
 }
 
 /**
- * Handler for the <code>stats subdoc_execute</code> command used to retrieve
- * information from the subdoc subsystem.
+ * Handler for the <code>stats background</code> command used to retrieve
+ * the number of runs and the time spent in each of the tasks run by the
+ * background scheduler.
  *
  * @param arg - should be empty
  * @param connection the connection that requested the operation
  */
-static ENGINE_ERROR_CODE stat_subdoc_execute_executor(const std::string& arg,
-                                                      McbpConnection& connection) {
+static ENGINE_ERROR_CODE stat_background_executor(const std::string& arg,
+                                                  McbpConnection& connection) {
     if (arg.empty()) {
-        const auto index = connection.getBucketIndex();
-        std::string json_str;
-        if (index == 0) {
-            // Aggregrated timings for all buckets.
-            TimingHistogram aggregated;
-            for (const auto& bucket : all_buckets) {
-                aggregated += bucket.subjson_operation_times;
-            }
-            json_str = aggregated.to_string();
-        } else {
-            // Timings for a specific bucket.
-            auto& bucket = all_buckets[connection.getBucketIndex()];
-            json_str = bucket.subjson_operation_times.to_string();
+        const void* cookie = connection.getCookie();
+        add_stat(cookie, append_stats, "threads",
+                 uint64_t(backgroundScheduler->getNumThreads()));
+        add_stat(cookie, append_stats, "scheduled",
+                 uint64_t(backgroundScheduler->getNumScheduled()));
+        for (const auto& entry : backgroundScheduler->getStats()) {
+            const auto& name = entry.first;
+            const auto& stats = entry.second;
+            add_stat(cookie, append_stats, (name + ":runs").c_str(),
+                     stats.runs);
+            add_stat(cookie, append_stats, (name + ":runtime_us").c_str(),
+                     stats.runtime);
+            add_stat(cookie, append_stats, (name + ":cputime_us").c_str(),
+                     stats.cputime);
+            add_stat(cookie, append_stats, (name + ":max_runtime_us").c_str(),
+                     stats.max_runtime);
         }
-        append_stats(nullptr, 0, json_str.c_str(), json_str.size(),
-                     connection.getCookie());
         return ENGINE_SUCCESS;
     } else {
         return ENGINE_EINVAL;
@@ -3367,7 +4312,11 @@ static void stat_executor(McbpConnection* c, void*) {
         {"connections", {false, stat_connections_executor}},
         {"topkeys", {false, stat_topkeys_executor}},
         {"topkeys_json", {false, stat_topkeys_json_executor}},
-        {"subdoc_execute", {false, stat_subdoc_execute_executor}}
+        {"subdoc_execute", {false, stat_subdoc_execute_executor}},
+        {"worker", {false, stat_worker_executor}},
+        {"background", {false, stat_background_executor}},
+        {"sched_delay", {false, stat_sched_delay_executor}},
+        {"ssl_handshake", {false, stat_ssl_handshake_executor}}
     };
 
     // The raw representing the key
@@ -3533,6 +4482,7 @@ static void process_hello_packet_executor(McbpConnection* c, void* packet) {
     uint16_t out[MEMCACHED_TOTAL_HELLO_FEATURES];
     int jj = 0;
     bool tcpdelay_handled = false;
+    CompressionCodec compression = CompressionCodec::None;
     memset((char*)out, 0, sizeof(out));
 
     /*
@@ -3541,6 +4491,22 @@ static void process_hello_packet_executor(McbpConnection* c, void* packet) {
      */
     c->setSupportsDatatype(false);
     c->setSupportsMutationExtras(false);
+    c->setUnorderedExecution(false);
+    c->setCompressionCodec(CompressionCodec::None);
+
+    auto add_feature = [&out, &jj, &log_buffer, &offset](uint16_t in) {
+        out[jj++] = htons(in);
+
+        int nw = snprintf(log_buffer + offset, sizeof(log_buffer) - offset,
+                          "%s, ", protocol_feature_2_text(in));
+
+        if (nw < 0 || nw > sizeof(log_buffer) - offset) {
+            return false;
+        }
+
+        offset += nw;
+        return true;
+    };
 
     if (klen) {
         if (klen > 256) {
@@ -3588,20 +4554,45 @@ static void process_hello_packet_executor(McbpConnection* c, void* packet) {
                 added = true;
             }
             break;
-        }
 
-        if (added) {
-            out[jj++] = htons(in);
-
-            int nw = snprintf(log_buffer + offset, sizeof(log_buffer) - offset,
-                              "%s, ", protocol_feature_2_text(in));
+        case PROTOCOL_BINARY_FEATURE_UNORDERED_EXECUTION:
+            // DCP and TAP streams are full duplex and can't be reordered
+            if (!c->isUnorderedExecution() && !c->isDCP() && !c->isTAP()) {
+                c->setUnorderedExecution(true);
+                added = true;
+            }
+            break;
 
-            if (nw < 0 || nw > sizeof(log_buffer) - offset) {
-                mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_EINTERNAL);
-                return;
+        case PROTOCOL_BINARY_FEATURE_COMPRESSION_SNAPPY:
+        case PROTOCOL_BINARY_FEATURE_COMPRESSION_LZ4: {
+            // The codecs are listed in order of preference
+            const auto codec = (in == PROTOCOL_BINARY_FEATURE_COMPRESSION_LZ4)
+                               ? CompressionCodec::Lz4
+                               : CompressionCodec::Snappy;
+            if (compression == CompressionCodec::None &&
+                compression_codec_supported(codec)) {
+                compression = codec;
             }
+            break;
+        }
+        }
+
+        if (added && !add_feature(in)) {
+            mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_EINTERNAL);
+            return;
+        }
+    }
 
-            offset += nw;
+    // Compression changes the meaning of the compressed datatype, so it
+    // requires datatype (which may be listed after it)
+    if (compression != CompressionCodec::None && c->isSupportsDatatype() &&
+        settings.getCompressionThreshold() != 0) {
+        c->setCompressionCodec(compression);
+        if (!add_feature(compression == CompressionCodec::Lz4
+                         ? PROTOCOL_BINARY_FEATURE_COMPRESSION_LZ4
+                         : PROTOCOL_BINARY_FEATURE_COMPRESSION_SNAPPY)) {
+            mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_EINTERNAL);
+            return;
         }
     }
 
@@ -3719,30 +4710,13 @@ static void flush_executor(McbpConnection* c, void*) {
     }
 }
 
-static void delete_executor(McbpConnection* c, void*) {
-    if (c->getCmd() == PROTOCOL_BINARY_CMD_DELETEQ) {
-        c->setNoReply(true);
-    }
-
-    ENGINE_ERROR_CODE ret;
+static void delete_continue(McbpConnection* c, ENGINE_ERROR_CODE ret) {
     auto* req = reinterpret_cast<protocol_binary_request_delete*>
-    (binary_get_request(c));
+    (binary_get_packet(c));
     char* key = binary_get_key(c);
     size_t nkey = c->binary_header.request.keylen;
     uint64_t cas = ntohll(req->message.header.request.cas);
 
-    if (settings.getVerbose() > 1) {
-        char buffer[1024];
-        if (key_to_printable_buffer(buffer, sizeof(buffer), c->getId(), true,
-                                    "DELETE", key, nkey) != -1) {
-            LOG_DEBUG(c, "%s\n", buffer);
-        }
-    }
-
-    ret = c->getAiostat();
-    c->setAiostat(ENGINE_SUCCESS);
-    c->setEwouldblock(false);
-
     mutation_descr_t mut_info;
     if (ret == ENGINE_SUCCESS) {
         ret = c->getBucketEngine()->remove(c->getBucketEngineAsV0(),
@@ -3782,79 +4756,42 @@ static void delete_executor(McbpConnection* c, void*) {
         mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_ETMPFAIL);
         break;
     case ENGINE_EWOULDBLOCK:
-        c->setEwouldblock(true);
+        c->suspend(delete_continue);
         break;
     default:
         mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_EINVAL);
     }
 }
 
-static void arithmetic_executor(McbpConnection* c, void* packet) {
-    auto* req = reinterpret_cast<protocol_binary_request_incr*>(binary_get_request(
-        c));
-    ENGINE_ERROR_CODE ret;
-    uint64_t delta;
-    uint64_t initial;
-    rel_time_t expiration;
-    char* key;
-    size_t nkey;
-    bool incr;
-    uint64_t result;
-
-    (void)packet;
-
-    switch (c->getCmd()) {
-    case PROTOCOL_BINARY_CMD_INCREMENTQ:
-        c->setNoReply(true);
-        break;
-    case PROTOCOL_BINARY_CMD_INCREMENT:
-        c->setNoReply(false);
-        break;
-    case PROTOCOL_BINARY_CMD_DECREMENTQ:
+static void delete_executor(McbpConnection* c, void*) {
+    if (c->getCmd() == PROTOCOL_BINARY_CMD_DELETEQ) {
         c->setNoReply(true);
-        break;
-    case PROTOCOL_BINARY_CMD_DECREMENT:
-        c->setNoReply(false);
-        break;
-    default:
-        LOG_WARNING(c,
-                    "%u: arithmetic_executor: cmd (which is %d) is not a valid "
-                        "ARITHMETIC variant - closing connection", c->getCmd());
-        c->setState(conn_closing);
-        return;
-    }
-
-    if (req->message.header.request.cas != 0) {
-        mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_EINVAL);
-        return;
     }
 
-    /* fix byteorder in the request */
-    delta = ntohll(req->message.body.delta);
-    initial = ntohll(req->message.body.initial);
-    expiration = ntohl(req->message.body.expiration);
-    key = binary_get_key(c);
-    nkey = c->binary_header.request.keylen;
-    incr = (c->getCmd() == PROTOCOL_BINARY_CMD_INCREMENT ||
-            c->getCmd() == PROTOCOL_BINARY_CMD_INCREMENTQ);
-
     if (settings.getVerbose() > 1) {
         char buffer[1024];
-        ssize_t nw;
-        nw = key_to_printable_buffer(buffer, sizeof(buffer), c->getId(), true,
-                                     incr ? "INCR" : "DECR", key, nkey);
-        if (nw != -1) {
-            int nf = snprintf(buffer + nw, sizeof(buffer) - nw,
-                              " %" PRIu64 ", %" PRIu64 ", %" PRIu64 "\n",
-                              delta, initial, (uint64_t)expiration);
-            if (nf > 0 && nf < (sizeof(buffer) - nw)) {
-                LOG_DEBUG(c, "%s", buffer);
-            }
+        if (key_to_printable_buffer(buffer, sizeof(buffer), c->getId(), true,
+                                    "DELETE", binary_get_key(c),
+                                    c->binary_header.request.keylen) != -1) {
+            LOG_DEBUG(c, "%s\n", buffer);
         }
     }
 
-    ret = c->getAiostat();
-    c->setAiostat(ENGINE_SUCCESS);
+    c->setEwouldblock(false);
+    delete_continue(c, ENGINE_SUCCESS);
+}
+
+static void arithmetic_continue(McbpConnection* c, ENGINE_ERROR_CODE ret) {
+    auto* req = reinterpret_cast<protocol_binary_request_incr*>(binary_get_packet(
+        c));
+    const uint64_t delta = ntohll(req->message.body.delta);
+    const uint64_t initial = ntohll(req->message.body.initial);
+    const rel_time_t expiration = ntohl(req->message.body.expiration);
+    char* key = binary_get_key(c);
+    const size_t nkey = c->binary_header.request.keylen;
+    const bool incr = (c->getCmd() == PROTOCOL_BINARY_CMD_INCREMENT ||
+                       c->getCmd() == PROTOCOL_BINARY_CMD_INCREMENTQ);
+    uint64_t result;
 
     item* item = NULL;
     if (ret == ENGINE_SUCCESS) {
@@ -3950,7 +4887,7 @@ static void arithmetic_executor(McbpConnection* c, void* packet) {
         mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_NOT_MY_VBUCKET);
         break;
     case ENGINE_EWOULDBLOCK:
-        c->setEwouldblock(true);
+        c->suspend(arithmetic_continue);
         break;
     default:
         LOG_WARNING(c,
@@ -3961,6 +4898,58 @@ static void arithmetic_executor(McbpConnection* c, void* packet) {
     }
 }
 
+static void arithmetic_executor(McbpConnection* c, void* packet) {
+    auto* req = reinterpret_cast<protocol_binary_request_incr*>(packet);
+
+    switch (c->getCmd()) {
+    case PROTOCOL_BINARY_CMD_INCREMENTQ:
+        c->setNoReply(true);
+        break;
+    case PROTOCOL_BINARY_CMD_INCREMENT:
+        c->setNoReply(false);
+        break;
+    case PROTOCOL_BINARY_CMD_DECREMENTQ:
+        c->setNoReply(true);
+        break;
+    case PROTOCOL_BINARY_CMD_DECREMENT:
+        c->setNoReply(false);
+        break;
+    default:
+        LOG_WARNING(c,
+                    "%u: arithmetic_executor: cmd (which is %d) is not a valid "
+                        "ARITHMETIC variant - closing connection", c->getCmd());
+        c->setState(conn_closing);
+        return;
+    }
+
+    if (req->message.header.request.cas != 0) {
+        mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_EINVAL);
+        return;
+    }
+
+    if (settings.getVerbose() > 1) {
+        const bool incr = (c->getCmd() == PROTOCOL_BINARY_CMD_INCREMENT ||
+                           c->getCmd() == PROTOCOL_BINARY_CMD_INCREMENTQ);
+        char buffer[1024];
+        ssize_t nw;
+        nw = key_to_printable_buffer(buffer, sizeof(buffer), c->getId(), true,
+                                     incr ? "INCR" : "DECR", binary_get_key(c),
+                                     c->binary_header.request.keylen);
+        if (nw != -1) {
+            int nf = snprintf(buffer + nw, sizeof(buffer) - nw,
+                              " %" PRIu64 ", %" PRIu64 ", %" PRIu64 "\n",
+                              ntohll(req->message.body.delta),
+                              ntohll(req->message.body.initial),
+                              (uint64_t)ntohl(req->message.body.expiration));
+            if (nf > 0 && nf < (sizeof(buffer) - nw)) {
+                LOG_DEBUG(c, "%s", buffer);
+            }
+        }
+    }
+
+    arithmetic_continue(c, ENGINE_SUCCESS);
+}
+
 static void get_cmd_timer_executor(McbpConnection* c, void* packet) {
     std::string str;
     auto* req = reinterpret_cast<protocol_binary_request_get_cmd_timer*>(packet);
@@ -4055,6 +5044,35 @@ static void init_complete_executor(McbpConnection* c, void* packet) {
     }
 }
 
+static void shm_connect_executor(McbpConnection* c, void* packet) {
+    auto* req = reinterpret_cast<protocol_binary_request_shm_connect*>(packet);
+    ENGINE_ERROR_CODE ret = ENGINE_ENOTSUP;
+
+    if (c->isUnixSocket() && settings.getShmRingSize() != 0) {
+        // Everything the client sent before SHM_CONNECT must be answered
+        // on the socket before we move it over
+        if (c->getPendingBytes() != 0 || c->hasParkedCommands() ||
+            c->read.bytes > sizeof(c->binary_header)) {
+            LOG_NOTICE(c, "%u: SHM_CONNECT can't be pipelined with other "
+                       "commands", c->getId());
+            ret = ENGINE_EINVAL;
+        } else {
+            ret = conn_new_shm(c, req->message.header.request.opaque);
+        }
+    }
+
+    switch (ret) {
+    case ENGINE_SUCCESS:
+    case ENGINE_DISCONNECT:
+        // The client continues on the new connection (which keeps the
+        // socket open), or sees the socket close if that failed
+        c->setState(conn_closing);
+        break;
+    default:
+        mcbp_write_packet(c, engine_error_2_mcbp_protocol_error(ret));
+    }
+}
+
 static void ioctl_get_executor(McbpConnection* c, void* packet) {
     auto* req = reinterpret_cast<protocol_binary_request_ioctl_set*>(packet);
     const char* key = (const char*)(req->bytes + sizeof(req->bytes));
@@ -4207,7 +5225,8 @@ public:
                          const std::string& config_,
                          const BucketType& type_,
                          McbpConnection& connection_)
-        : thread(name_, config_, type_, connection_, this),
+        : Task(Priority::Low),
+          thread(name_, config_, type_, connection_, this),
           mcbpconnection(connection_) { }
 
     // start the bucket deletion
@@ -4473,6 +5492,11 @@ std::array<mcbp_package_execute, 0x100>& get_mcbp_executors(void) {
     executors[PROTOCOL_BINARY_CMD_GETQ] = get_executor;
     executors[PROTOCOL_BINARY_CMD_GETK] = get_executor;
     executors[PROTOCOL_BINARY_CMD_GETKQ] = get_executor;
+    executors[PROTOCOL_BINARY_CMD_GET_MULTI] = get_multi_executor;
+    executors[PROTOCOL_BINARY_CMD_SCAN] = scan_executor;
+    executors[PROTOCOL_BINARY_CMD_BULK_STORE] = bulk_store_executor;
+    executors[PROTOCOL_BINARY_CMD_BULK_STOREQ] = bulk_store_executor;
+    executors[PROTOCOL_BINARY_CMD_GET_LEASE] = get_lease_executor;
     executors[PROTOCOL_BINARY_CMD_DELETE] = delete_executor;
     executors[PROTOCOL_BINARY_CMD_DELETEQ] = delete_executor;
     executors[PROTOCOL_BINARY_CMD_STAT] = stat_executor;
@@ -4484,6 +5508,7 @@ std::array<mcbp_package_execute, 0x100>& get_mcbp_executors(void) {
     executors[PROTOCOL_BINARY_CMD_SET_CTRL_TOKEN] = set_ctrl_token_executor;
     executors[PROTOCOL_BINARY_CMD_GET_CTRL_TOKEN] = get_ctrl_token_executor;
     executors[PROTOCOL_BINARY_CMD_INIT_COMPLETE] = init_complete_executor;
+    executors[PROTOCOL_BINARY_CMD_SHM_CONNECT] = shm_connect_executor;
     executors[PROTOCOL_BINARY_CMD_IOCTL_GET] = ioctl_get_executor;
     executors[PROTOCOL_BINARY_CMD_IOCTL_SET] = ioctl_set_executor;
     executors[PROTOCOL_BINARY_CMD_CONFIG_VALIDATE] = config_validate_executor;
@@ -4604,12 +5629,26 @@ static void process_bin_packet(McbpConnection* c) {
     static McbpPrivilegeChains privilegeChains;
     protocol_binary_response_status result;
 
-    char* packet = (c->read.curr - (c->binary_header.request.bodylen +
-                                    sizeof(c->binary_header)));
+    if (c->isSuspended()) {
+        // The command was checked and validated before it was suspended;
+        // pick up where the executor left off
+        c->resume();
+        return;
+    }
+
+    char* packet = binary_get_packet(c);
 
     auto opcode = static_cast<protocol_binary_command>(c->binary_header.request.opcode);
     auto executor = executors[opcode];
 
+    if (c->isRejected()) {
+        // The body is read, but the command isn't admitted (the bucket
+        // is over its rate limits or the thread is shedding load)
+        c->setRejected(false);
+        mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_ETMPFAIL);
+        return;
+    }
+
     auto res = privilegeChains.invoke(opcode, c->getCookieObject());
     switch (res) {
     case PrivilegeAccess::Fail:
@@ -4638,7 +5677,20 @@ static void process_bin_packet(McbpConnection* c) {
         }
 
         if (executor != NULL) {
+            const auto state = c->getState();
             executor(c, packet);
+            if (c->isEwouldblock() && !c->isSuspended() &&
+                c->getState() == state) {
+                // The executor keeps track of its own progress; run it
+                // again when the command is resumed, but skip the checks
+                // above as they've already passed. (Executors which moved
+                // to a different state are resumed by that state.)
+                c->suspend([executor](McbpConnection* conn,
+                                      ENGINE_ERROR_CODE status) {
+                    conn->setAiostat(status);
+                    executor(conn, binary_get_packet(conn));
+                });
+            }
         } else {
             process_bin_unknown_packet(c);
         }
@@ -4670,6 +5722,70 @@ static CB_INLINE bool is_initialized(McbpConnection* c, uint8_t opcode) {
     }
 }
 
+/**
+ * Is the command subject to admission control (the rate limits of the
+ * bucket and load shedding)? Commands used to set up the connection,
+ * retrieve statistics and reload the configuration are always let
+ * through.
+ */
+static bool is_admission_controlled(uint8_t opcode) {
+    switch (opcode) {
+    case PROTOCOL_BINARY_CMD_HELLO:
+    case PROTOCOL_BINARY_CMD_SASL_LIST_MECHS:
+    case PROTOCOL_BINARY_CMD_SASL_AUTH:
+    case PROTOCOL_BINARY_CMD_SASL_STEP:
+    case PROTOCOL_BINARY_CMD_SELECT_BUCKET:
+    case PROTOCOL_BINARY_CMD_NOOP:
+    case PROTOCOL_BINARY_CMD_VERSION:
+    case PROTOCOL_BINARY_CMD_QUIT:
+    case PROTOCOL_BINARY_CMD_QUITQ:
+    case PROTOCOL_BINARY_CMD_STAT:
+    case PROTOCOL_BINARY_CMD_CONFIG_VALIDATE:
+    case PROTOCOL_BINARY_CMD_CONFIG_RELOAD:
+        return false;
+    default:
+        return true;
+    }
+}
+
+/**
+ * Decide if the command being read may be executed. Commands from
+ * normal priority connections are rejected while the worker thread is
+ * shedding load, and the bucket's rate limiter is charged for the
+ * command.
+ *
+ * @return false if the command should be rejected with ETMPFAIL
+ */
+static bool admit_command(McbpConnection* c) {
+    if (c->isAdmin() || c->isDCP() || c->isTAP() ||
+        c->binary_header.request.magic != PROTOCOL_BINARY_REQ ||
+        !is_admission_controlled(c->binary_header.request.opcode)) {
+        return true;
+    }
+
+    auto* thr = c->getThread();
+    if (thr->shed.active.load(std::memory_order_relaxed) &&
+        c->getPriority() != Connection::Priority::High) {
+        thr->shed.commands++;
+        get_thread_stats(c)->cmd_shed++;
+        return false;
+    }
+
+    auto* limiter = all_buckets[c->getBucketIndex()].rate_limiter;
+    if (limiter == nullptr || !limiter->isEnabled()) {
+        return true;
+    }
+
+    const size_t nread = sizeof(c->binary_header) +
+                         c->binary_header.request.bodylen;
+    if (limiter->admit(thr->index, nread, tsc_clock_now())) {
+        return true;
+    }
+
+    get_thread_stats(c)->rate_limited++;
+    return false;
+}
+
 static void dispatch_bin_command(McbpConnection* c) {
     uint16_t keylen = c->binary_header.request.keylen;
 
@@ -4698,7 +5814,7 @@ static void dispatch_bin_command(McbpConnection* c) {
     }
 
     if (c->getStart() == 0) {
-        c->setStart(gethrtime());
+        c->setStart(tsc_clock_now());
     }
 
     MEMCACHED_PROCESS_COMMAND_START(c->getId(), c->read.curr, c->read.bytes);
@@ -4719,6 +5835,7 @@ static void dispatch_bin_command(McbpConnection* c) {
         mcbp_write_packet(c, PROTOCOL_BINARY_RESPONSE_EINVAL);
         c->setWriteAndGo(conn_closing);
     } else {
+        c->setRejected(!admit_command(c));
         bin_read_chunk(c, c->binary_header.request.bodylen);
     }
 }
@@ -37,7 +37,14 @@ McbpPrivilegeChains::McbpPrivilegeChains() {
     setup(PROTOCOL_BINARY_CMD_GETQ, require<Privilege::Read>);
     setup(PROTOCOL_BINARY_CMD_GETK, require<Privilege::Read>);
     setup(PROTOCOL_BINARY_CMD_GETKQ, require<Privilege::Read>);
+    setup(PROTOCOL_BINARY_CMD_GET_MULTI, require<Privilege::Read>);
+    setup(PROTOCOL_BINARY_CMD_SCAN, require<Privilege::Read>);
+    // A miss (or a stale hit) stores a lease in the bucket
+    setup(PROTOCOL_BINARY_CMD_GET_LEASE, require<Privilege::Read>);
+    setup(PROTOCOL_BINARY_CMD_GET_LEASE, require<Privilege::Write>);
     setup(PROTOCOL_BINARY_CMD_SET, require<Privilege::Write>);
+    setup(PROTOCOL_BINARY_CMD_BULK_STORE, require<Privilege::Write>);
+    setup(PROTOCOL_BINARY_CMD_BULK_STOREQ, require<Privilege::Write>);
     setup(PROTOCOL_BINARY_CMD_SETQ, require<Privilege::Write>);
     setup(PROTOCOL_BINARY_CMD_ADD, require<Privilege::Write>);
     setup(PROTOCOL_BINARY_CMD_ADDQ, require<Privilege::Write>);
@@ -289,6 +296,9 @@ McbpPrivilegeChains::McbpPrivilegeChains() {
     /* ns_server - memcached internal communication */
     setup(PROTOCOL_BINARY_CMD_INIT_COMPLETE, require<Privilege::NodeManagement>);
 
+    /* Move the connection over to shared memory */
+    setup(PROTOCOL_BINARY_CMD_SHM_CONNECT, empty);
+
     if (getenv("MEMCACHED_UNIT_TESTS") != nullptr) {
         // The opcode used to set the clock by our extension
         setup(protocol_binary_command(0xe3), empty);
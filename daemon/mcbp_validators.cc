@@ -581,6 +581,116 @@ static protocol_binary_response_status init_complete_validator(const Cookie& coo
     return PROTOCOL_BINARY_RESPONSE_SUCCESS;
 }
 
+static protocol_binary_response_status shm_connect_validator(const Cookie& cookie)
+{
+    auto req = static_cast<protocol_binary_request_shm_connect*>(McbpConnection::getPacket(cookie));
+    if (req->message.header.request.magic != PROTOCOL_BINARY_REQ ||
+        req->message.header.request.extlen != 0 ||
+        req->message.header.request.keylen != 0 ||
+        req->message.header.request.bodylen != 0 ||
+        req->message.header.request.datatype != PROTOCOL_BINARY_RAW_BYTES) {
+        return PROTOCOL_BINARY_RESPONSE_EINVAL;
+    }
+
+    return PROTOCOL_BINARY_RESPONSE_SUCCESS;
+}
+
+static protocol_binary_response_status get_multi_validator(const Cookie& cookie)
+{
+    auto req = static_cast<protocol_binary_request_get_multi*>(McbpConnection::getPacket(cookie));
+    uint32_t blen = ntohl(req->message.header.request.bodylen);
+
+    if (req->message.header.request.magic != PROTOCOL_BINARY_REQ ||
+        req->message.header.request.extlen != 0 ||
+        req->message.header.request.keylen != 0 ||
+        blen == 0 ||
+        req->message.header.request.datatype != PROTOCOL_BINARY_RAW_BYTES ||
+        req->message.header.request.cas != 0) {
+        return PROTOCOL_BINARY_RESPONSE_EINVAL;
+    }
+
+    // The value must be a list of non-empty keys prefixed with their length
+    const uint8_t* ptr = req->bytes + sizeof(req->bytes);
+    const uint8_t* const end = ptr + blen;
+    int nkeys = 0;
+    while (ptr < end) {
+        if (++nkeys > PROTOCOL_BINARY_GET_MULTI_MAX_KEYS) {
+            return PROTOCOL_BINARY_RESPONSE_E2BIG;
+        }
+        uint16_t nkey;
+        if (size_t(end - ptr) < sizeof(nkey)) {
+            return PROTOCOL_BINARY_RESPONSE_EINVAL;
+        }
+        memcpy(&nkey, ptr, sizeof(nkey));
+        nkey = ntohs(nkey);
+        ptr += sizeof(nkey);
+        if (nkey == 0 || size_t(end - ptr) < nkey) {
+            return PROTOCOL_BINARY_RESPONSE_EINVAL;
+        }
+        ptr += nkey;
+    }
+
+    return PROTOCOL_BINARY_RESPONSE_SUCCESS;
+}
+
+static protocol_binary_response_status bulk_store_validator(const Cookie& cookie)
+{
+    auto req = static_cast<protocol_binary_request_bulk_store*>(McbpConnection::getPacket(cookie));
+    uint32_t blen = ntohl(req->message.header.request.bodylen);
+
+    if (req->message.header.request.magic != PROTOCOL_BINARY_REQ ||
+        req->message.header.request.extlen != 0 ||
+        req->message.header.request.keylen != 0 ||
+        blen == 0 ||
+        req->message.header.request.datatype != PROTOCOL_BINARY_RAW_BYTES ||
+        req->message.header.request.cas != 0) {
+        return PROTOCOL_BINARY_RESPONSE_EINVAL;
+    }
+
+    // The value must be a list of records with a valid key
+    const uint8_t* ptr = req->bytes + sizeof(req->bytes);
+    const uint8_t* const end = ptr + blen;
+    while (ptr < end) {
+        protocol_binary_bulk_store_record record;
+        if (size_t(end - ptr) < sizeof(record)) {
+            return PROTOCOL_BINARY_RESPONSE_EINVAL;
+        }
+        memcpy(&record, ptr, sizeof(record));
+        ptr += sizeof(record);
+        const uint16_t nkey = ntohs(record.keylen);
+        const uint32_t nvalue = ntohl(record.valuelen);
+        if (nkey == 0 || nkey > KEY_MAX_LENGTH ||
+            record.datatype > PROTOCOL_BINARY_DATATYPE_COMPRESSED_JSON ||
+            size_t(end - ptr) < size_t(nkey) + nvalue) {
+            return PROTOCOL_BINARY_RESPONSE_EINVAL;
+        }
+        ptr += nkey + nvalue;
+    }
+
+    return PROTOCOL_BINARY_RESPONSE_SUCCESS;
+}
+
+static protocol_binary_response_status scan_validator(const Cookie& cookie)
+{
+    auto req = static_cast<protocol_binary_request_scan*>(McbpConnection::getPacket(cookie));
+    uint16_t klen = ntohs(req->message.header.request.keylen);
+    uint32_t blen = ntohl(req->message.header.request.bodylen);
+    uint8_t extlen = req->message.header.request.extlen;
+
+    if (req->message.header.request.magic != PROTOCOL_BINARY_REQ ||
+        extlen != sizeof(req->message.body) ||
+        blen != uint32_t(klen) + extlen ||
+        req->message.header.request.datatype != PROTOCOL_BINARY_RAW_BYTES ||
+        req->message.header.request.cas != 0 ||
+        req->message.body.count == 0 ||
+        (ntohl(req->message.body.flags) &
+         ~uint32_t(PROTOCOL_BINARY_SCAN_FLAG_METADATA)) != 0) {
+        return PROTOCOL_BINARY_RESPONSE_EINVAL;
+    }
+
+    return PROTOCOL_BINARY_RESPONSE_SUCCESS;
+}
+
 static protocol_binary_response_status ioctl_get_validator(const Cookie& cookie)
 {
     auto req = static_cast<protocol_binary_request_ioctl_get*>(McbpConnection::getPacket(cookie));
@@ -862,6 +972,11 @@ void McbpValidatorChains::initializeMcbpValidatorChains(McbpValidatorChains& cha
     chains.push_unique(PROTOCOL_BINARY_CMD_GETQ, get_validator);
     chains.push_unique(PROTOCOL_BINARY_CMD_GETK, get_validator);
     chains.push_unique(PROTOCOL_BINARY_CMD_GETKQ, get_validator);
+    chains.push_unique(PROTOCOL_BINARY_CMD_GET_MULTI, get_multi_validator);
+    chains.push_unique(PROTOCOL_BINARY_CMD_SCAN, scan_validator);
+    chains.push_unique(PROTOCOL_BINARY_CMD_BULK_STORE, bulk_store_validator);
+    chains.push_unique(PROTOCOL_BINARY_CMD_BULK_STOREQ, bulk_store_validator);
+    chains.push_unique(PROTOCOL_BINARY_CMD_GET_LEASE, get_validator);
     chains.push_unique(PROTOCOL_BINARY_CMD_DELETE, delete_validator);
     chains.push_unique(PROTOCOL_BINARY_CMD_DELETEQ, delete_validator);
     chains.push_unique(PROTOCOL_BINARY_CMD_STAT, stat_validator);
@@ -873,6 +988,7 @@ void McbpValidatorChains::initializeMcbpValidatorChains(McbpValidatorChains& cha
     chains.push_unique(PROTOCOL_BINARY_CMD_SET_CTRL_TOKEN, set_ctrl_token_validator);
     chains.push_unique(PROTOCOL_BINARY_CMD_GET_CTRL_TOKEN, get_ctrl_token_validator);
     chains.push_unique(PROTOCOL_BINARY_CMD_INIT_COMPLETE, init_complete_validator);
+    chains.push_unique(PROTOCOL_BINARY_CMD_SHM_CONNECT, shm_connect_validator);
     chains.push_unique(PROTOCOL_BINARY_CMD_IOCTL_GET, ioctl_get_validator);
     chains.push_unique(PROTOCOL_BINARY_CMD_IOCTL_SET, ioctl_set_validator);
     chains.push_unique(PROTOCOL_BINARY_CMD_AUDIT_PUT, audit_put_validator);
@@ -30,7 +30,8 @@ public:
     McbpDestroyBucketTask(const std::string& name_,
                           bool force_,
                           Connection* connection_)
-    : thread(name_, force_, connection_, this) {
+    : Task(Priority::Low),
+      thread(name_, force_, connection_, this) {
     }
 
     // start the bucket deletion
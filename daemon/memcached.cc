@@ -24,7 +24,10 @@
 #include "utilities/engine_loader.h"
 #include "timings.h"
 #include "cmdline.h"
+#include "compression.h"
 #include "connections.h"
+#include "cpu_affinity.h"
+#include "tsc_clock.h"
 #include "mcbp_topkeys.h"
 #include "mcbp_validators.h"
 #include "ioctl.h"
@@ -43,12 +46,18 @@
 #include "stats.h"
 #include "mcbp_executors.h"
 #include "memcached_openssl.h"
+#include "ssl_server_ctx.h"
 #include "greenstack.h"
 #include "mcbpdestroybuckettask.h"
 #include "libevent_locking.h"
 
 #include <platform/strerror.h>
 
+#ifndef WIN32
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+
 #include <signal.h>
 #include <fcntl.h>
 #include <errno.h>
@@ -109,6 +118,7 @@ std::atomic<bool> service_online;
 static std::atomic<bool> enable_common_ports;
 
 std::unique_ptr<ExecutorPool> executorPool;
+std::unique_ptr<BackgroundScheduler> backgroundScheduler;
 
 /* Mutex for global stats */
 std::mutex stats_mutex;
@@ -224,7 +234,7 @@ void associate_initial_bucket(Connection *c) {
     associate_bucket(c, "default");
 }
 
-static void populate_log_level(void*) {
+static void populate_log_level() {
     // Lock the entire buckets array so that buckets can't be modified while
     // we notify them (blocking bucket creation/deletion)
     auto val = get_log_level();
@@ -247,8 +257,6 @@ void perform_callbacks(ENGINE_EVENT_TYPE type,
                        const void *data,
                        const void *void_cookie)
 {
-    cb_thread_t tid;
-
     switch (type) {
         /*
          * The following events operates on a connection which is passed in
@@ -287,9 +295,17 @@ void perform_callbacks(ENGINE_EVENT_TYPE type,
         }
 
         if (service_online) {
-            if (cb_create_thread(&tid, populate_log_level, nullptr, 1) == -1) {
+            try {
+                backgroundScheduler->schedule("log_level",
+                                              []() {
+                                                  populate_log_level();
+                                                  return false;
+                                              },
+                                              std::chrono::milliseconds(0),
+                                              std::chrono::milliseconds(0));
+            } catch (std::bad_alloc&) {
                 LOG_WARNING(NULL,
-                            "Failed to create thread to notify engines about "
+                            "Failed to schedule task to notify engines about "
                                 "changing log level");
             }
         }
@@ -383,6 +399,7 @@ static void stats_init(void) {
     stats.total_conns.reset();
     stats.daemon_conns.reset();
     stats.rejected_conns.reset();
+    stats.migrated_conns.reset();
     stats.curr_conns.store(0, std::memory_order_relaxed);
 }
 
@@ -409,6 +426,7 @@ void stats_reset(const void *void_cookie) {
     }
     stats.total_conns.reset();
     stats.rejected_conns.reset();
+    stats.migrated_conns.reset();
     threadlocal_stats_reset(all_buckets[conn->getBucketIndex()].stats);
     bucket_reset_stats(conn);
 }
@@ -446,19 +464,51 @@ static void breakpad_changed_listener(const std::string&, Settings &s) {
 
 static void ssl_minimum_protocol_changed_listener(const std::string&, Settings &s) {
     set_ssl_protocol_mask(s.getSslMinimumProtocol());
+    ssl_server_ctx_invalidate();
 }
 
 static void ssl_cipher_list_changed_listener(const std::string&, Settings &s) {
     set_ssl_cipher_list(s.getSslCipherList());
+    ssl_server_ctx_invalidate();
+}
+
+static void ssl_session_cache_size_changed_listener(const std::string&,
+                                                    Settings &s) {
+    ssl_server_ctx_invalidate();
+}
+
+static void compression_cache_size_changed_listener(const std::string&,
+                                                    Settings &s) {
+    compression_cache_clear();
 }
 
 static void verbosity_changed_listener(const std::string&, Settings &s) {
     perform_callbacks(ON_LOG_LEVEL, NULL, NULL);
 }
 
+static void bucket_weights_changed_listener(const std::string&, Settings &s) {
+    for (auto& bucket : all_buckets) {
+        cb_mutex_enter(&bucket.mutex);
+        if (bucket.name[0] != '\0') {
+            bucket.weight = s.getBucketWeight(bucket.name);
+        }
+        cb_mutex_exit(&bucket.mutex);
+    }
+}
+
+static void bucket_limits_changed_listener(const std::string&, Settings &s) {
+    for (auto& bucket : all_buckets) {
+        cb_mutex_enter(&bucket.mutex);
+        if (bucket.name[0] != '\0') {
+            bucket.rate_limiter->setLimits(s.getBucketLimits(bucket.name));
+        }
+        cb_mutex_exit(&bucket.mutex);
+    }
+}
+
 static void interfaces_changed_listener(const std::string&, Settings &s) {
     for (const auto& ifc : s.getInterfaces()) {
-        auto* port = get_listening_port_instance(ifc.port);
+        auto* port = get_listening_port_instance(ifc.port, ifc.path);
         if (port != nullptr) {
             if (port->maxconns != ifc.maxconn) {
                 port->maxconns = ifc.maxconn;
@@ -471,6 +521,21 @@ static void interfaces_changed_listener(const std::string&, Settings &s) {
             if (port->tcp_nodelay != ifc.tcp_nodelay) {
                 port->tcp_nodelay = ifc.tcp_nodelay;
             }
+
+            if (port->busy_poll != ifc.busy_poll) {
+                port->busy_poll = ifc.busy_poll;
+            }
+
+#ifndef WIN32
+            if (!port->path.empty() && port->permissions != ifc.permissions) {
+                if (chmod(port->path.c_str(), mode_t(ifc.permissions)) == 0) {
+                    port->permissions = ifc.permissions;
+                } else {
+                    LOG_WARNING(NULL, "Failed to change permissions of %s: %s",
+                                port->path.c_str(), cb_strerror().c_str());
+                }
+            }
+#endif
         }
     }
     s.calculateMaxconns();
@@ -484,8 +549,16 @@ static void settings_init(void) {
                                ssl_minimum_protocol_changed_listener);
     settings.addChangeListener("ssl_cipher_list",
                                ssl_cipher_list_changed_listener);
+    settings.addChangeListener("ssl_session_cache_size",
+                               ssl_session_cache_size_changed_listener);
+    settings.addChangeListener("compression_cache_size",
+                               compression_cache_size_changed_listener);
     settings.addChangeListener("verbosity", verbosity_changed_listener);
     settings.addChangeListener("interfaces", interfaces_changed_listener);
+    settings.addChangeListener("bucket_weights",
+                               bucket_weights_changed_listener);
+    settings.addChangeListener("bucket_limits",
+                               bucket_limits_changed_listener);
 
     struct interface default_interface;
     settings.addInterface(default_interface);
@@ -660,7 +733,7 @@ static PrivilegeAccess check_privilege(const void* void_cookie,
     return cookie->connection->checkPrivilege(privilege);
 }
 
-static void cbsasl_refresh_main(void *c)
+static void cbsasl_refresh_main(const void *c)
 {
     int rv = cbsasl_server_refresh();
     if (rv == CBSASL_OK) {
@@ -672,18 +745,20 @@ static void cbsasl_refresh_main(void *c)
 
 ENGINE_ERROR_CODE refresh_cbsasl(Connection *c)
 {
-    cb_thread_t tid;
-    int err;
-
     // @todo refactor and move this code over to MCBP
     auto* conn = dynamic_cast<McbpConnection*>(c);
+    const void* cookie = conn->getCookie();
 
-    err = cb_create_named_thread(&tid, cbsasl_refresh_main,
-                                 const_cast<void*>(conn->getCookie()),
-                                 1, "mc:refresh_sasl");
-    if (err != 0) {
-        LOG_WARNING(c, "Failed to create cbsasl db update thread: %s",
-                    strerror(err));
+    try {
+        backgroundScheduler->schedule("refresh_sasl",
+                                      [cookie]() {
+                                          cbsasl_refresh_main(cookie);
+                                          return false;
+                                      },
+                                      std::chrono::milliseconds(0),
+                                      std::chrono::milliseconds(0));
+    } catch (std::bad_alloc&) {
+        LOG_WARNING(c, "Failed to schedule cbsasl db update task");
         return ENGINE_DISCONNECT;
     }
 
@@ -717,6 +792,9 @@ ENGINE_ERROR_CODE refresh_ssl_certs(Connection *c)
 
     return ENGINE_EWOULDBLOCK;
 #endif
+    // The certificates are read when the shared SSL contexts are
+    // created, so drop them and let the next connection read the files
+    ssl_server_ctx_invalidate();
     return ENGINE_SUCCESS;
 }
 
@@ -750,6 +828,15 @@ static cJSON *get_bucket_details_UNLOCKED(const Bucket& bucket, int idx) {
 
     cJSON_AddNumberToObject(root, "clients", bucket.clients);
     cJSON_AddStringToObject(root, "name", bucket.name);
+    cJSON_AddNumberToObject(root, "weight", bucket.weight.load());
+    if (bucket.rate_limiter != nullptr && bucket.rate_limiter->isEnabled()) {
+        const auto limits = bucket.rate_limiter->getLimits();
+        cJSON* obj = cJSON_CreateObject();
+        cJSON_AddNumberToObject(obj, "ops", limits.ops);
+        cJSON_AddNumberToObject(obj, "read_bytes", limits.read_bytes);
+        cJSON_AddNumberToObject(obj, "write_bytes", limits.write_bytes);
+        cJSON_AddItemToObject(root, "limits", obj);
+    }
 
     switch (bucket.type) {
     case BucketType::Unknown:
@@ -816,7 +903,8 @@ bool conn_listening(ListenConnection *c)
     int curr_conns = stats.curr_conns.fetch_add(1, std::memory_order_relaxed);
     {
         std::lock_guard<std::mutex> guard(stats_mutex);
-        port_instance = get_listening_port_instance(c->getParentPort());
+        port_instance = get_listening_port_instance(c->getParentPort(),
+                                                    c->getParentPath());
         cb_assert(port_instance);
         port_conns = ++port_instance->curr_conns;
     }
@@ -847,7 +935,23 @@ bool conn_listening(ListenConnection *c)
         return false;
     }
 
-    dispatch_conn_new(sfd, c->getParentPort());
+    auto* worker = c->getWorkerThread();
+    if (worker == nullptr) {
+        dispatch_conn_new(sfd, c->getParentPort(), c->getParentPath());
+    } else if (conn_new(sfd, c->getParentPort(), c->getParentPath(),
+                        worker->base, worker) == nullptr) {
+        // The listen socket is owned by this worker thread (reuseport)
+        // so we serve the client without a trip through the dispatcher
+        LOG_WARNING(c, "Failed to create connection for socket %ld",
+                    long(sfd));
+        {
+            std::lock_guard<std::mutex> guard(stats_mutex);
+            --port_instance->curr_conns;
+        }
+        safe_close(sfd);
+    } else {
+        worker->load.connections++;
+    }
 
     return false;
 }
@@ -902,20 +1006,21 @@ void event_handler(evutil_socket_t fd, short which, void *arg) {
         }
     }
 
-    /*
-     * Remove the list from the list of pending io's (in case the
-     * object was scheduled to run in the dispatcher before the
-     * callback for the worker thread is executed.
-     */
-    thr->pending_io = list_remove(thr->pending_io, c);
-
     /* sanity */
     cb_assert(fd == c->getSocketDescriptor());
 
     if ((which & EV_TIMEOUT) == EV_TIMEOUT) {
         auto* mcbp = dynamic_cast<McbpConnection*>(c);
 
-        if (mcbp != nullptr && (c->isAdmin() || c->isDCP() || c->isTAP())) {
+        if (mcbp != nullptr && mcbp->isWaitingForSlowReader()) {
+            LOG_NOTICE(c, "%u: Shutting down slow reader %s (no data "
+                       "read for %u seconds, %zu bytes pending)",
+                       c->getId(), c->getDescription().c_str(),
+                       settings.getSlowReaderTimeout(),
+                       mcbp->getPendingBytes());
+            get_thread_stats(mcbp)->slow_reader_disconnects++;
+            c->initateShutdown();
+        } else if (mcbp != nullptr && (c->isAdmin() || c->isDCP() || c->isTAP())) {
             auto* mcbp = dynamic_cast<McbpConnection*>(c);
             if (c->isAdmin()) {
                 LOG_NOTICE(c, "%u: Timeout for admin connection. (ignore)",
@@ -937,7 +1042,7 @@ void event_handler(evutil_socket_t fd, short which, void *arg) {
         }
     }
 
-    run_event_loop(c, which);
+    run_event_loop(c, which, thr);
 
     if (memcached_shutdown) {
         // Someone requested memcached to shut down. If we don't have
@@ -970,6 +1075,13 @@ void listen_event_handler(evutil_socket_t, short which, void *arg) {
     }
 
     if (memcached_shutdown) {
+        if (c->getWorkerThread() != nullptr) {
+            // The worker thread owns the socket and terminates once
+            // all of its clients are disconnected. Just stop accepting
+            // new clients.
+            c->disable();
+            return;
+        }
         // Someone requested memcached to shut down. The listen thread should
         // be stopped immediately.
         LOG_NOTICE(NULL, "Stopping listen thread");
@@ -977,7 +1089,7 @@ void listen_event_handler(evutil_socket_t, short which, void *arg) {
         return;
     }
 
-    run_event_loop(c, which);
+    run_event_loop(c, which, nullptr);
 }
 
 static void dispatch_event_handler(evutil_socket_t fd, short, void *) {
@@ -1060,7 +1172,8 @@ static void maximize_sndbuf(const SOCKET sfd) {
     }
 }
 
-static SOCKET new_server_socket(struct addrinfo *ai, bool tcp_nodelay) {
+static SOCKET new_server_socket(struct addrinfo *ai, bool tcp_nodelay,
+                                bool reuseport) {
     SOCKET sfd;
 
     sfd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
@@ -1101,6 +1214,18 @@ static SOCKET new_server_socket(struct addrinfo *ai, bool tcp_nodelay) {
 #endif
 
     setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR, flags_ptr, sizeof(flags));
+#ifdef SO_REUSEPORT
+    if (reuseport) {
+        error = setsockopt(sfd, SOL_SOCKET, SO_REUSEPORT, flags_ptr,
+                           sizeof(flags));
+        if (error != 0) {
+            LOG_WARNING(NULL, "setsockopt(SO_REUSEPORT): %s",
+                        strerror(errno));
+            safe_close(sfd);
+            return INVALID_SOCKET;
+        }
+    }
+#endif
     error = setsockopt(sfd, SOL_SOCKET, SO_KEEPALIVE, flags_ptr,
                        sizeof(flags));
     if (error != 0) {
@@ -1136,7 +1261,7 @@ static SOCKET new_server_socket(struct addrinfo *ai, bool tcp_nodelay) {
  * @param family the address family for the port
  */
 static void add_listening_port(const struct interface *interf, in_port_t port, sa_family_t family) {
-    auto *descr = get_listening_port_instance(port);
+    auto *descr = get_listening_port_instance(port, interf->path);
 
     if (descr == nullptr) {
         listening_port newport;
@@ -1163,10 +1288,17 @@ static void add_listening_port(const struct interface *interf, in_port_t port, s
         } else if (family == AF_INET6) {
             newport.ipv4 = false;
             newport.ipv6 = true;
+        } else {
+            newport.ipv4 = false;
+            newport.ipv6 = false;
         }
 
         newport.tcp_nodelay = interf->tcp_nodelay;
         newport.management = interf->management;
+        newport.reuseport = interf->reuseport;
+        newport.busy_poll = interf->busy_poll;
+        newport.path = interf->path;
+        newport.permissions = interf->permissions;
         newport.protocol = interf->protocol;
 
         stats.listening_ports.push_back(newport);
@@ -1180,12 +1312,175 @@ static void add_listening_port(const struct interface *interf, in_port_t port, s
     }
 }
 
+/**
+ * Create a listen connection for the (bound) socket and link it into the
+ * list of server sockets.
+ *
+ * @param sfd the socket descriptor
+ * @param listenport the port number the socket is bound to
+ * @param family the address family for the socket
+ * @param interf the interface description used to create the socket
+ * @param worker the worker thread owning the socket, or nullptr to let
+ *               the dispatcher thread accept the clients
+ */
+static void add_listen_connection(SOCKET sfd, in_port_t listenport,
+                                  sa_family_t family,
+                                  const struct interface *interf,
+                                  LIBEVENT_THREAD* worker) {
+    struct event_base* base = (worker == nullptr) ? main_base : worker->base;
+    auto* lconn = conn_new_server(sfd, listenport, family, *interf, base,
+                                  worker);
+    if (lconn == nullptr) {
+        FATAL_ERROR(EXIT_FAILURE, "Failed to create listening connection");
+    }
+
+    lconn->setNext(listen_conn);
+    listen_conn = lconn;
+
+    // An address is only counted once, even if each of the worker
+    // threads have their own socket for it
+    if (lconn->isPrimary()) {
+        stats.daemon_conns++;
+        stats.curr_conns.fetch_add(1, std::memory_order_relaxed);
+        add_listening_port(interf, listenport, family);
+    }
+}
+
+/**
+ * Create one SO_REUSEPORT socket per worker thread for the given address.
+ * The kernel distributes the incoming connections between the sockets,
+ * and each worker thread accepts (and serves) its clients without
+ * involving the dispatcher thread. The connection limits are still
+ * checked in conn_listening for every client accepted.
+ *
+ * @param sfd the socket already bound to the address (owned by the
+ *            first worker thread)
+ * @param listenport the port number the socket is bound to
+ * @param ai the address the socket is bound to
+ * @param interf the interface description used to create the socket
+ */
+static void create_worker_listen_sockets(SOCKET sfd, in_port_t listenport,
+                                         struct addrinfo *ai,
+                                         const struct interface *interf) {
+    const sa_family_t family = ai->ai_addr->sa_family;
+    add_listen_connection(sfd, listenport, family, interf,
+                          get_worker_thread(0));
+
+    // The interface may use port 0 (let the OS pick one), so all of the
+    // other sockets must bind to the port picked for the first one.
+    struct sockaddr_storage addr;
+    memcpy(&addr, ai->ai_addr, ai->ai_addrlen);
+    if (family == AF_INET) {
+        reinterpret_cast<struct sockaddr_in*>(&addr)->sin_port =
+            htons(listenport);
+    } else if (family == AF_INET6) {
+        reinterpret_cast<struct sockaddr_in6*>(&addr)->sin6_port =
+            htons(listenport);
+    }
+
+    for (int ii = 1; ii < settings.getNumWorkerThreads(); ++ii) {
+        SOCKET sock = new_server_socket(ai, interf->tcp_nodelay, true);
+        if (sock == INVALID_SOCKET) {
+            LOG_WARNING(nullptr,
+                        "Failed to create SO_REUSEPORT socket for port %u "
+                            "on worker thread %d", listenport, ii);
+            return;
+        }
+
+        if (bind(sock, reinterpret_cast<struct sockaddr*>(&addr),
+                 (socklen_t)ai->ai_addrlen) == SOCKET_ERROR) {
+            log_errcode_error(EXTENSION_LOG_WARNING, nullptr,
+                              "Failed to bind SO_REUSEPORT socket: %s",
+                              GetLastNetworkError());
+            safe_close(sock);
+            return;
+        }
+
+        add_listen_connection(sock, listenport, family, interf,
+                              get_worker_thread(ii));
+    }
+}
+
+#ifndef WIN32
+/**
+ * Create a Unix domain socket and bind it to the path in the interface.
+ *
+ * A socket file left behind by a previous instance is removed, but we
+ * refuse to replace anything else. The permissions are set before we
+ * start to listen on the socket so that no one may connect before
+ * they're in place.
+ *
+ * @param interf the interface to bind to
+ * @return 0 on success, 1 on failure
+ */
+static int server_unix_socket(const struct interface *interf) {
+    const char* path = interf->path.c_str();
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (interf->path.size() >= sizeof(addr.sun_path)) {
+        LOG_WARNING(NULL, "Unix domain socket path too long: %s", path);
+        return 1;
+    }
+    memcpy(addr.sun_path, path, interf->path.size());
+
+    struct stat st;
+    if (lstat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            LOG_WARNING(NULL, "Refusing to replace %s: not a socket", path);
+            return 1;
+        }
+        if (unlink(path) == -1) {
+            LOG_WARNING(NULL, "Failed to remove stale socket %s: %s", path,
+                        cb_strerror().c_str());
+            return 1;
+        }
+    }
+
+    SOCKET sfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sfd == INVALID_SOCKET) {
+        LOG_WARNING(NULL, "socket(AF_UNIX): %s", cb_strerror().c_str());
+        return 1;
+    }
+
+    if (evutil_make_socket_nonblocking(sfd) == -1) {
+        safe_close(sfd);
+        return 1;
+    }
+
+    if (bind(sfd, reinterpret_cast<struct sockaddr*>(&addr),
+             sizeof(addr)) == SOCKET_ERROR) {
+        LOG_WARNING(NULL, "Failed to bind to %s: %s", path,
+                    cb_strerror().c_str());
+        safe_close(sfd);
+        return 1;
+    }
+
+    if (chmod(path, mode_t(interf->permissions)) == -1) {
+        LOG_WARNING(NULL, "Failed to set permissions of %s: %s", path,
+                    cb_strerror().c_str());
+        safe_close(sfd);
+        unlink(path);
+        return 1;
+    }
+
+    add_listen_connection(sfd, 0, AF_UNIX, interf, nullptr);
+    return 0;
+}
+#endif
+
 /**
  * Create a socket and bind it to a specific port number
  * @param interface the interface to bind to
  * @param port the port number to bind to
  */
 static int server_socket(const struct interface *interf) {
+#ifndef WIN32
+    if (!interf->path.empty()) {
+        return server_unix_socket(interf);
+    }
+#endif
+
     SOCKET sfd;
     struct addrinfo hints;
     int success = 0;
@@ -1210,6 +1505,17 @@ static int server_socket(const struct interface *interf) {
         host = interf->host.c_str();
     }
 
+#ifdef SO_REUSEPORT
+    const bool reuseport = interf->reuseport;
+#else
+    const bool reuseport = false;
+    if (interf->reuseport) {
+        LOG_WARNING(NULL, "SO_REUSEPORT is not supported on this platform. "
+                    "Clients on port %u is accepted by the dispatcher thread",
+                    interf->port);
+    }
+#endif
+
     struct addrinfo *ai;
     int error = getaddrinfo(host, port_buf.c_str(), &hints, &ai);
     if (error != 0) {
@@ -1227,7 +1533,8 @@ static int server_socket(const struct interface *interf) {
     }
 
     for (struct addrinfo* next = ai; next; next = next->ai_next) {
-        if ((sfd = new_server_socket(next, interf->tcp_nodelay)) == INVALID_SOCKET) {
+        if ((sfd = new_server_socket(next, interf->tcp_nodelay,
+                                     reuseport)) == INVALID_SOCKET) {
             /* getaddrinfo can return "junk" addresses,
              * we make sure at least one works before erroring.
              */
@@ -1265,18 +1572,12 @@ static int server_socket(const struct interface *interf) {
             }
         }
 
-        auto* lconn = conn_new_server(sfd, listenport, next->ai_addr->sa_family,
-                                      *interf, main_base);
-        if (lconn == nullptr) {
-            FATAL_ERROR(EXIT_FAILURE, "Failed to create listening connection");
+        if (reuseport) {
+            create_worker_listen_sockets(sfd, listenport, next, interf);
+        } else {
+            add_listen_connection(sfd, listenport, next->ai_addr->sa_family,
+                                  interf, nullptr);
         }
-
-        lconn->setNext(listen_conn);
-        listen_conn = lconn;
-
-        stats.daemon_conns++;
-        stats.curr_conns.fetch_add(1, std::memory_order_relaxed);
-        add_listening_port(interf, listenport, next->ai_addr->sa_family);
     }
 
     freeaddrinfo(ai);
@@ -1344,6 +1645,10 @@ static void create_listen_sockets(bool management) {
                                            " illegal objects: " +
                                        to_string(c->toJSON(), false));
             }
+            if (!lc->isPrimary()) {
+                // Only report one of the SO_REUSEPORT sockets
+                continue;
+            }
             cJSON_AddItemToArray(array.get(), lc->getDetails().release());
         }
 
@@ -1459,7 +1764,7 @@ static void store_engine_specific(const void *void_cookie,
     if (cookie->connection == nullptr) {
         throw std::runtime_error("store_engine_specific: cookie must represent connection");
     }
-    cookie->connection->setEngineStorage(engine_data);
+    const_cast<Cookie*>(cookie)->engine_storage = engine_data;
 }
 
 static void *get_engine_specific(const void *void_cookie) {
@@ -1469,7 +1774,7 @@ static void *get_engine_specific(const void *void_cookie) {
     if (cookie->connection == nullptr) {
         throw std::runtime_error("get_engine_specific: cookie must represent connection");
     }
-    return cookie->connection->getEngineStorage();
+    return cookie->engine_storage;
 }
 
 static bool is_datatype_supported(const void *void_cookie) {
@@ -1555,7 +1860,7 @@ static ENGINE_ERROR_CODE release_cookie(const void *void_cookie) {
      * pending IO and have the system retry the operation for the
      * connection
      */
-    notify = add_conn_to_pending_io_list(c);
+    notify = add_conn_to_pending_io_list(thr, c);
     UNLOCK_THREAD(thr);
 
     /* kick the thread in the butt */
@@ -1812,6 +2117,27 @@ static void set_log_level(EXTENSION_LOG_LEVEL severity)
  * @return pointer to a structure containing the interface. The client should
  *         know the layout and perform the proper casts.
  */
+static uint64_t scheduler_schedule(const char* name,
+                                   SERVER_TASK_CALLBACK callback,
+                                   void* arg,
+                                   uint32_t delay,
+                                   uint32_t period) {
+    try {
+        return backgroundScheduler->schedule(name,
+                                             [callback, arg]() {
+                                                 return callback(arg);
+                                             },
+                                             std::chrono::milliseconds(delay),
+                                             std::chrono::milliseconds(period));
+    } catch (std::bad_alloc&) {
+        return 0;
+    }
+}
+
+static bool scheduler_cancel(uint64_t id) {
+    return backgroundScheduler->cancel(id);
+}
+
 static SERVER_HANDLE_V1 *get_server_api(void)
 {
     static int init;
@@ -1822,6 +2148,7 @@ static SERVER_HANDLE_V1 *get_server_api(void)
     static SERVER_EXTENSION_API extension_api;
     static SERVER_CALLBACK_API callback_api;
     static ALLOCATOR_HOOKS_API hooks_api;
+    static SERVER_SCHEDULER_API scheduler_api;
     static SERVER_HANDLE_V1 rv;
 
     if (!init) {
@@ -1831,6 +2158,7 @@ static SERVER_HANDLE_V1 *get_server_api(void)
         core_api.get_current_time = mc_time_get_current_time;
         core_api.parse_config = parse_config;
         core_api.shutdown = shutdown_server;
+        core_api.bind_housekeeping_thread = cpu_affinity_bind_housekeeping_thread;
 
         server_cookie_api.store_engine_specific = store_engine_specific;
         server_cookie_api.get_engine_specific = get_engine_specific;
@@ -1871,6 +2199,9 @@ static SERVER_HANDLE_V1 *get_server_api(void)
         hooks_api.release_free_memory = mc_release_free_memory;
         hooks_api.enable_thread_cache = mc_enable_thread_cache;
 
+        scheduler_api.schedule = scheduler_schedule;
+        scheduler_api.cancel = scheduler_cancel;
+
         rv.interface = 1;
         rv.core = &core_api;
         rv.stat = &server_stat_api;
@@ -1879,6 +2210,7 @@ static SERVER_HANDLE_V1 *get_server_api(void)
         rv.log = &server_log_api;
         rv.cookie = &server_cookie_api;
         rv.alloc_hooks = &hooks_api;
+        rv.scheduler = &scheduler_api;
     }
 
     // @trondn fixme!!!
@@ -1946,6 +2278,9 @@ void CreateBucketThread::create() {
         all_buckets[ii].state = BucketState::Creating;
         all_buckets[ii].type = type;
         strcpy(all_buckets[ii].name, name.c_str());
+        all_buckets[ii].weight = settings.getBucketWeight(name);
+        all_buckets[ii].rate_limiter->setLimits(
+            settings.getBucketLimits(name));
         try {
             all_buckets[ii].topkeys = new TopKeys(settings.getTopkeysSize());
         } catch (const std::bad_alloc &) {
@@ -2030,6 +2365,9 @@ void CreateBucketThread::create() {
 void CreateBucketThread::run()
 {
     setRunning();
+    // The engine may start threads of its own while it is being created,
+    // so get off the CPU of the worker thread which created us
+    cpu_affinity_bind_housekeeping_thread();
     // Perform the task without having any locks. The task should be
     // scheduled in a pending state so the executor won't try to touch
     // the object until we're telling it that it is runnable
@@ -2151,6 +2489,9 @@ void DestroyBucketThread::destroy() {
     LOG_NOTICE(connection, "%s Delete bucket [%s]. Clean up allocated resources ",
                connection_id.c_str(), name.c_str());
 
+    // A new bucket in the slot may reuse the CAS values
+    compression_cache_clear();
+
     /* Clean up the stats... */
     delete[]all_buckets[idx].stats;
     int numthread = settings.getNumWorkerThreads() + 1;
@@ -2168,6 +2509,8 @@ void DestroyBucketThread::destroy() {
     cb_mutex_exit(&all_buckets[idx].mutex);
     // don't need lock because all timing data uses atomics
     all_buckets[idx].timings.reset();
+    all_buckets[idx].sched_delay.reset();
+    all_buckets[idx].rate_limiter->setLimits(BucketRateLimits());
 
     LOG_NOTICE(connection, "%s Delete bucket [%s] complete",
                connection_id.c_str(), name.c_str());
@@ -2176,6 +2519,7 @@ void DestroyBucketThread::destroy() {
 
 void DestroyBucketThread::run() {
     setRunning();
+    cpu_affinity_bind_housekeeping_thread();
     destroy();
     std::lock_guard<std::mutex> guard(task->getMutex());
     task->makeRunnable();
@@ -2188,6 +2532,7 @@ static void initialize_buckets(void) {
     int numthread = settings.getNumWorkerThreads() + 1;
     for (auto &b : all_buckets) {
         b.stats = new thread_stats[numthread];
+        b.rate_limiter = new RateLimiter(numthread);
     }
 
     // To make the life easier for us in the code, index 0
@@ -2235,6 +2580,7 @@ static void cleanup_buckets(void) {
         }
 
         delete []bucket.stats;
+        delete bucket.rate_limiter;
     }
 }
 
@@ -2254,7 +2600,8 @@ void delete_all_buckets() {
     class DestroyBucketTask : public Task {
     public:
         DestroyBucketTask(const std::string& name_)
-            : thread(name_, false, nullptr, this)
+            : Task(Priority::Low),
+              thread(name_, false, nullptr, this)
         {
             // empty
         }
@@ -2626,6 +2973,23 @@ extern "C" int memcached_main(int argc, char **argv) {
 
     update_settings_from_config();
 
+    /*
+     * Bind the main thread to the housekeeping CPUs before we start any
+     * other threads, so that they inherit the affinity.
+     */
+    cpu_affinity_init();
+
+    /*
+     * Calibrate the clock used for timing the commands. This must be
+     * done before any other threads are started (the result is logged
+     * once the logger is loaded).
+     */
+    std::string tsc_reason;
+    const bool tsc_clock = tsc_clock_init(tsc_reason);
+
+    backgroundScheduler.reset(
+        new BackgroundScheduler(settings.getBackgroundThreads()));
+
     set_server_initialized(!settings.isRequireInit());
 
     /* Initialize breakpad crash catcher with our just-parsed settings. */
@@ -2659,6 +3023,14 @@ extern "C" int memcached_main(int argc, char **argv) {
     }
 #endif
 
+    if (tsc_clock) {
+        LOG_NOTICE(NULL, "Timing commands with the TSC (%" PRIu64 " Hz)",
+                   tsc_clock_params.frequency);
+    } else {
+        LOG_NOTICE(NULL, "Timing commands with gethrtime(): %s",
+                   tsc_reason.c_str());
+    }
+
     initialize_audit();
 
     /* inform interested parties of initial verbosity level */
@@ -2747,6 +3119,15 @@ extern "C" int memcached_main(int argc, char **argv) {
     LOG_NOTICE(NULL, "Shutting down client worker threads");
     threads_shutdown();
 
+    // The SO_REUSEPORT sockets use the event base of the worker threads
+    // which is released in threads_cleanup
+    for (auto* c = listen_conn; c != nullptr; c = c->getNext()) {
+        auto* lc = dynamic_cast<ListenConnection*>(c);
+        if (lc != nullptr && lc->getWorkerThread() != nullptr) {
+            lc->releaseEvent();
+        }
+    }
+
     LOG_NOTICE(NULL, "Releasing client resources");
     close_all_connections();
 
@@ -2771,6 +3152,9 @@ extern "C" int memcached_main(int argc, char **argv) {
     LOG_NOTICE(NULL, "Shutting down engine map");
     shutdown_engine_map();
 
+    LOG_NOTICE(NULL, "Shutting down background scheduler");
+    delete backgroundScheduler.release();
+
     LOG_NOTICE(NULL, "Removing breakpad");
     destroy_breakpad();
 
@@ -2778,6 +3162,7 @@ extern "C" int memcached_main(int argc, char **argv) {
     free_callbacks();
 
     LOG_NOTICE(NULL, "Shutting down OpenSSL");
+    ssl_server_ctx_invalidate();
     shutdown_openssl();
 
     LOG_NOTICE(NULL, "Shutting down libevent");
@@ -20,9 +20,12 @@
 #include <memcached/engine.h>
 #include <memcached/extension.h>
 #include <JSON_checker.h>
+#include <relaxed_atomic.h>
 
 #include "dynamic_buffer.h"
+#include "background_scheduler.h"
 #include "executorpool.h"
+#include "fair_scheduler.h"
 #include "log_macros.h"
 #include "net_buf.h"
 #include "settings.h"
@@ -71,18 +74,61 @@ enum class ThreadType {
 class Connection;
 class ConnectionQueue;
 
+/**
+ * The vectors of a released McbpConnection, kept in the worker thread's
+ * connection pool so that the next connection doesn't have to allocate
+ * them again.
+ */
+struct ConnectionBuffers {
+    std::vector<iovec> iov;
+    std::vector<struct msghdr> msglist;
+    std::vector<void*> reservedItems;
+    std::vector<char*> temp_alloc;
+};
+
+/**
+ * The memory of a released McbpConnection (the object itself is
+ * destroyed) and its buffers
+ */
+struct PooledConnection {
+    void* memory;
+    ConnectionBuffers buffers;
+};
+
 struct LIBEVENT_THREAD {
     cb_thread_t thread_id;      /* unique ID of this thread */
     struct event_base *base;    /* libevent handle this thread uses */
     struct event notify_event;  /* listen event for notify pipe */
-    SOCKET notify[2];           /* notification pipes */
+    SOCKET notify[2];           /* notification pipes (or eventfd) */
     ConnectionQueue *new_conn_queue; /* queue of new connections to handle */
-    cb_mutex_t mutex;      /* Mutex to lock protect access to the pending_io */
+    cb_mutex_t mutex;      /* Mutex to serialize access to the connections */
     bool is_locked;
-    Connection *pending_io;    /* List of connection with pending async io ops */
+
+    /**
+     * List of connection with pending async io ops. Other threads push
+     * connections onto the list without holding the mutex, and the
+     * thread itself grabs the entire list in one go.
+     */
+    std::atomic<Connection*> pending_io;
+
+    /**
+     * Set when the thread is notified, and cleared by the thread before
+     * it starts processing the notification. Used to avoid signalling
+     * the thread more than once before it wakes up.
+     */
+    std::atomic_bool notified;
+
+    /** The number of times the thread was signalled */
+    Couchbase::RelaxedAtomic<uint64_t> notify_signalled;
+    /** The number of notifications which didn't need to signal the thread */
+    Couchbase::RelaxedAtomic<uint64_t> notify_coalesced;
+
     int index;                  /* index of this thread in the threads array */
     ThreadType type;      /* Type of IO this thread processes */
 
+    int cpu;              /* The CPU the thread is bound to (or -1) */
+    int numa_node;        /* The NUMA node of the CPU (or -1) */
+
     rel_time_t last_checked;
 
     struct net_buf read; /** Shared read buffer for all connections serviced by this thread. */
@@ -91,6 +137,13 @@ struct LIBEVENT_THREAD {
     subdoc_OPERATION* subdoc_op; /** Shared sub-document operation for all
                                      connections serviced by this thread. */
 
+    /**
+     * Staging buffer used to coalesce the iovecs of a response into full
+     * TLS records for the SSL connections served by this thread (allocated
+     * on first use)
+     */
+    std::vector<char> ssl_staging;
+
     /**
      * When we're deleting buckets we need to disconnect idle
      * clients. This variable is incremented for every delete bucket
@@ -103,6 +156,97 @@ struct LIBEVENT_THREAD {
     int deleting_buckets;
 
     JSON_checker::Validator *validator;
+
+    /**
+     * Load information for the thread used when we pick the thread to
+     * serve a new connection, and to decide if we should move connections
+     * away from the thread. The counters are updated by the thread itself,
+     * and the rates are sampled by the dispatcher thread once a second.
+     */
+    struct {
+        /** The number of connections bound to the thread */
+        Couchbase::RelaxedAtomic<uint32_t> connections;
+        /** The total time (in ns) spent serving connections */
+        Couchbase::RelaxedAtomic<uint64_t> busy_time;
+        /** The total number of commands executed */
+        Couchbase::RelaxedAtomic<uint64_t> ops;
+
+        /* The members below is only accessed by the dispatcher thread */
+        uint64_t last_busy_time;
+        uint64_t last_ops;
+        /** Moving average of the busy time per second (in ns) */
+        double busy_rate;
+        /** Moving average of the number of commands per second */
+        double ops_rate;
+
+        /**
+         * The index of the thread to move an idle connection to (set by
+         * the dispatcher, and reset by the thread itself), or -1
+         */
+        std::atomic<int> migrate_to;
+    } load;
+
+    /**
+     * Statistics for the busy poll mode, where the thread keeps on
+     * polling for more work for a while before it goes to sleep
+     */
+    struct {
+        /** The total time (in ns) spent polling without finding work */
+        Couchbase::RelaxedAtomic<uint64_t> spin_time;
+        /** The number of times the thread polled for work */
+        Couchbase::RelaxedAtomic<uint64_t> polls;
+        /** The number of polls which found work */
+        Couchbase::RelaxedAtomic<uint64_t> hits;
+        /** The number of times the thread went to sleep */
+        Couchbase::RelaxedAtomic<uint64_t> sleeps;
+    } busy_poll;
+
+    /**
+     * Book keeping of how the thread is shared between the buckets
+     * (only used when the "sched_slice" setting is enabled)
+     */
+    FairScheduler scheduler;
+
+    /**
+     * Load shedding. While the "shed_threshold" setting is set the thread
+     * samples how late its timer fires (the event loop lag) and the
+     * longest time a connection waited to be served, and rejects the
+     * commands from normal priority connections with ETMPFAIL while the
+     * moving average is above the threshold.
+     */
+    struct {
+        struct event timer;
+        /** Is the timer scheduled */
+        bool armed;
+        /** The time the timer is supposed to fire */
+        hrtime_t deadline;
+        /** The longest wait for a connection since the last sample */
+        hrtime_t max_delay;
+        /** Moving average of the lag (in ns) */
+        Couchbase::RelaxedAtomic<uint64_t> lag;
+        /** Is the thread currently shedding load */
+        std::atomic_bool active;
+        /** The number of commands rejected */
+        Couchbase::RelaxedAtomic<uint64_t> commands;
+        /** The number of times the thread started shedding load */
+        Couchbase::RelaxedAtomic<uint64_t> episodes;
+    } shed;
+
+    /**
+     * Free list of McbpConnection objects released by the thread (up to
+     * "connection_pool_size" of them), used for the new connections
+     * served by the thread. The list is only accessed by the thread
+     * itself.
+     */
+    struct {
+        std::vector<PooledConnection> free;
+        /** The number of connections in the free list */
+        Couchbase::RelaxedAtomic<uint64_t> size;
+        /** The number of connections allocated from the free list */
+        Couchbase::RelaxedAtomic<uint64_t> hits;
+        /** The number of connections allocated with new */
+        Couchbase::RelaxedAtomic<uint64_t> misses;
+    } conn_pool;
 };
 
 #define LOCK_THREAD(t) \
@@ -158,7 +302,9 @@ void thread_init(int nthreads, struct event_base *main_base,
 void threads_shutdown(void);
 void threads_cleanup(void);
 
-void dispatch_conn_new(SOCKET sfd, int parent_port);
+void dispatch_conn_new(SOCKET sfd, int parent_port,
+                       const std::string& parent_path = std::string());
+LIBEVENT_THREAD* get_worker_thread(int index);
 
 /* Lock wrappers for cache functions that are called from main loop. */
 int is_listen_thread(void);
@@ -171,13 +317,42 @@ void notify_io_complete(const void *cookie, ENGINE_ERROR_CODE status);
 void safe_close(SOCKET sfd);
 
 
-/* Number of times this connection is in the given pending list */
-bool list_contains(Connection *h, Connection *n);
-Connection *list_remove(Connection *h, Connection *n);
-
 bool load_extension(const char *soname, const char *config);
 
-int add_conn_to_pending_io_list(Connection *c);
+/**
+ * Add the connection to the pending io list of the thread serving it.
+ * May be called from any thread without holding the thread lock.
+ *
+ * The thread is passed in by the caller (which read it before locking
+ * the thread) as the connection may be disassociated from the thread
+ * by conn_close while we're adding it to the list.
+ *
+ * @return non-zero if the caller needs to notify the thread
+ */
+int add_conn_to_pending_io_list(LIBEVENT_THREAD* thread, Connection *c);
+
+/**
+ * Ask a worker thread to move one of its idle connections over to another
+ * worker thread (like the dispatcher does when it rebalances the
+ * connections).
+ *
+ * @param from the index of the thread to move the connection away from
+ * @param to the index of the thread to move the connection to
+ * @return false if the thread indexes aren't valid
+ */
+bool threads_request_migration(int from, int to);
+
+/**
+ * Get the total number of times the worker threads were signalled, and
+ * the number of notifications which were coalesced with a pending one.
+ */
+void threads_notify_stats(uint64_t& signalled, uint64_t& coalesced);
+
+/**
+ * Add the load and busy poll statistics for each of the worker threads
+ * (<code>stats worker</code>)
+ */
+void threads_stats(ADD_STAT add_stats, const void* cookie);
 
 /* connection state machine */
 bool conn_listening(ListenConnection *c);
@@ -338,6 +513,41 @@ static inline ENGINE_ERROR_CODE bucket_store(McbpConnection* c,
                                        item_, cas, operation, vbucket);
 }
 
+/**
+ * Store a batch of items in the bucket. Engines without store_multi get
+ * one call to store() per item instead. The errors which aren't about the
+ * item itself (like ENGINE_EWOULDBLOCK and ENGINE_NOT_MY_VBUCKET) fail
+ * the whole batch, but then the items stored before it remain stored.
+ */
+static inline ENGINE_ERROR_CODE bucket_store_multi(McbpConnection* c,
+                                                   item** items,
+                                                   size_t nitems,
+                                                   ENGINE_STORE_OPERATION operation,
+                                                   ENGINE_ERROR_CODE* results,
+                                                   uint16_t vbucket) {
+    auto* engine = c->getBucketEngine();
+    if (engine->store_multi != nullptr) {
+        return engine->store_multi(c->getBucketEngineAsV0(), c->getCookie(),
+                                   items, nitems, operation, results,
+                                   vbucket);
+    }
+
+    for (size_t ii = 0; ii < nitems; ++ii) {
+        uint64_t cas = 0;
+        results[ii] = bucket_store(c, items[ii], &cas, operation, vbucket);
+        switch (results[ii]) {
+        case ENGINE_EWOULDBLOCK:
+        case ENGINE_DISCONNECT:
+        case ENGINE_NOT_MY_VBUCKET:
+        case ENGINE_NO_BUCKET:
+            return results[ii];
+        default:
+            break;
+        }
+    }
+    return ENGINE_SUCCESS;
+}
+
 static inline ENGINE_ERROR_CODE bucket_get(McbpConnection* c,
                                            item** item_,
                                            const void* key,
@@ -352,6 +562,80 @@ static inline void bucket_release_item(McbpConnection* c, item* it) {
                                   c->getCookie(), it);
 }
 
+/**
+ * Look up a batch of keys in the bucket. Engines without get_multi get
+ * one call to get() per key instead (and the first error other than
+ * ENGINE_KEY_ENOENT fails the whole batch).
+ */
+static inline ENGINE_ERROR_CODE bucket_get_multi(McbpConnection* c,
+                                                 const engine_key_t* keys,
+                                                 size_t nkeys,
+                                                 item** items,
+                                                 uint16_t vbucket) {
+    auto* engine = c->getBucketEngine();
+    if (engine->get_multi != nullptr) {
+        return engine->get_multi(c->getBucketEngineAsV0(), c->getCookie(),
+                                 keys, nkeys, items, vbucket);
+    }
+
+    for (size_t ii = 0; ii < nkeys; ++ii) {
+        ENGINE_ERROR_CODE ret = bucket_get(c, &items[ii], keys[ii].key,
+                                           keys[ii].nkey, vbucket);
+        if (ret == ENGINE_KEY_ENOENT) {
+            items[ii] = nullptr;
+        } else if (ret != ENGINE_SUCCESS) {
+            for (size_t jj = 0; jj < ii; ++jj) {
+                if (items[jj] != nullptr) {
+                    bucket_release_item(c, items[jj]);
+                    items[jj] = nullptr;
+                }
+            }
+            items[ii] = nullptr;
+            return ret;
+        }
+    }
+    return ENGINE_SUCCESS;
+}
+
+/**
+ * Get an item or a lease to refill it (see ENGINE_HANDLE_V1::get_lease).
+ * Engines without get_lease return ENGINE_ENOTSUP.
+ */
+static inline ENGINE_ERROR_CODE bucket_get_lease(McbpConnection* c,
+                                                 item** item_,
+                                                 const void* key,
+                                                 const int nkey,
+                                                 uint16_t vbucket,
+                                                 uint64_t* lease,
+                                                 bool* stale) {
+    auto* engine = c->getBucketEngine();
+    if (engine->get_lease == nullptr) {
+        return ENGINE_ENOTSUP;
+    }
+    return engine->get_lease(c->getBucketEngineAsV0(), c->getCookie(), item_,
+                             key, nkey, vbucket, lease, stale);
+}
+
+/**
+ * Visit a batch of the keys in the bucket (see ENGINE_HANDLE_V1::scan).
+ * Engines without scan return ENGINE_ENOTSUP.
+ */
+static inline ENGINE_ERROR_CODE bucket_scan(McbpConnection* c,
+                                            uint64_t* cursor,
+                                            const void* prefix,
+                                            uint16_t nprefix,
+                                            uint32_t count,
+                                            engine_scan_callback_t callback,
+                                            void* ctx,
+                                            uint16_t vbucket) {
+    auto* engine = c->getBucketEngine();
+    if (engine->scan == nullptr) {
+        return ENGINE_ENOTSUP;
+    }
+    return engine->scan(c->getBucketEngineAsV0(), c->getCookie(), cursor,
+                        prefix, nprefix, count, callback, ctx, vbucket);
+}
+
 /**
  * The executor pool used to pick up the result for requests spawn by the
  * client io threads and dispatched over to a background thread (in order
@@ -359,4 +643,10 @@ static inline void bucket_release_item(McbpConnection* c, item* it) {
  */
 extern std::unique_ptr<ExecutorPool> executorPool;
 
+/**
+ * The scheduler running the background jobs for the daemon and the
+ * engines (on a fixed number of threads)
+ */
+extern std::unique_ptr<BackgroundScheduler> backgroundScheduler;
+
 #endif
@@ -0,0 +1,131 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include "config.h"
+#include "rate_limiter.h"
+#include "tsc_clock.h"
+
+#include <algorithm>
+#include <new>
+
+RateLimiter::Pool::Pool()
+    : limit(0),
+      tokens(0),
+      last_refill(0) {
+}
+
+void RateLimiter::Pool::setLimit(uint64_t new_limit, hrtime_t now) {
+    std::lock_guard<std::mutex> guard(mutex);
+    if (limit.load() != new_limit) {
+        limit.store(new_limit);
+        // Start out with a full second worth of tokens
+        tokens = double(new_limit);
+        last_refill = now;
+    }
+}
+
+int64_t RateLimiter::Pool::take(hrtime_t now) {
+    std::lock_guard<std::mutex> guard(mutex);
+    const uint64_t rate = limit.load();
+    if (rate == 0) {
+        return 0;
+    }
+
+    if (now > last_refill) {
+        tokens += double(rate) * double(now - last_refill) / 1e9;
+        tokens = std::min(tokens, double(rate));
+        last_refill = now;
+    }
+
+    // Hand out 10ms worth of tokens at the time
+    const int64_t batch = std::max(int64_t(1), int64_t(rate / 100));
+    const int64_t ret = std::min(batch, int64_t(tokens));
+    if (ret > 0) {
+        tokens -= double(ret);
+    }
+    return ret;
+}
+
+RateLimiter::RateLimiter(int nthreads)
+    : enabled(false),
+      caches(nullptr) {
+    static_assert(sizeof(ThreadCache) == 64,
+                  "ThreadCache should fill exactly one cache line");
+    size_t size = sizeof(ThreadCache) * nthreads + alignof(ThreadCache);
+    cache_storage.reset(new char[size]);
+    void* ptr = cache_storage.get();
+    ptr = std::align(alignof(ThreadCache), sizeof(ThreadCache) * nthreads,
+                     ptr, size);
+    caches = static_cast<ThreadCache*>(ptr);
+    for (int ii = 0; ii < nthreads; ++ii) {
+        new (&caches[ii]) ThreadCache();
+    }
+}
+
+void RateLimiter::setLimits(const BucketRateLimits& limits) {
+    const hrtime_t now = tsc_clock_now();
+    pools[Ops].setLimit(limits.ops, now);
+    pools[ReadBytes].setLimit(limits.read_bytes, now);
+    pools[WriteBytes].setLimit(limits.write_bytes, now);
+    enabled.store(limits.ops != 0 || limits.read_bytes != 0 ||
+                  limits.write_bytes != 0);
+}
+
+BucketRateLimits RateLimiter::getLimits() const {
+    BucketRateLimits ret;
+    ret.ops = pools[Ops].limit.load();
+    ret.read_bytes = pools[ReadBytes].limit.load();
+    ret.write_bytes = pools[WriteBytes].limit.load();
+    return ret;
+}
+
+bool RateLimiter::refill(ThreadCache& cache, Resource resource,
+                         hrtime_t now) {
+    if (pools[resource].limit.load(std::memory_order_relaxed) == 0) {
+        return true;
+    }
+
+    while (cache.tokens[resource] <= 0) {
+        const int64_t tokens = pools[resource].take(now);
+        if (tokens == 0) {
+            return false;
+        }
+        cache.tokens[resource] += tokens;
+    }
+    return true;
+}
+
+bool RateLimiter::admit(int thread, size_t nread, hrtime_t now) {
+    auto& cache = caches[thread];
+    if (!refill(cache, Ops, now) || !refill(cache, ReadBytes, now) ||
+        !refill(cache, WriteBytes, now)) {
+        return false;
+    }
+
+    if (pools[Ops].limit.load(std::memory_order_relaxed) != 0) {
+        --cache.tokens[Ops];
+    }
+    if (pools[ReadBytes].limit.load(std::memory_order_relaxed) != 0) {
+        cache.tokens[ReadBytes] -= int64_t(nread);
+    }
+    return true;
+}
+
+void RateLimiter::chargeWrite(int thread, size_t nbytes) {
+    if (pools[WriteBytes].limit.load(std::memory_order_relaxed) != 0) {
+        caches[thread].tokens[WriteBytes] -= int64_t(nbytes);
+    }
+}
@@ -0,0 +1,148 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Token bucket rate limiting of the commands executed in a bucket, and
+ * the number of bytes read from and written to its clients.
+ *
+ * Each limit is a token bucket refilled at the configured rate (and
+ * holding at most one second worth of tokens). To avoid having all of
+ * the worker threads fight over the same cache line for every command,
+ * each thread grabs tokens from the shared bucket in batches (of about
+ * 10ms worth of traffic) and keeps them in a cache only used by that
+ * thread. The byte counts are charged after the fact, so a thread's
+ * cache may go negative; new commands are then rejected until the debt
+ * is paid back.
+ */
+#pragma once
+
+#include <platform/platform.h>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+#include "settings.h"
+
+class RateLimiter {
+public:
+    /**
+     * Create a new rate limiter
+     *
+     * @param nthreads the number of threads which may use the limiter
+     */
+    RateLimiter(int nthreads);
+
+    RateLimiter(const RateLimiter&) = delete;
+
+    /**
+     * Set new limits (may be called while the worker threads use the
+     * limiter)
+     */
+    void setLimits(const BucketRateLimits& limits);
+
+    BucketRateLimits getLimits() const;
+
+    /**
+     * Check if the thread may execute another command, and charge it for
+     * the command and the number of bytes read for it.
+     *
+     * @param thread the index of the calling thread
+     * @param nread the size of the command
+     * @param now the current time
+     * @return true if the command may be executed, false if the bucket
+     *         is over one of its limits
+     */
+    bool admit(int thread, size_t nread, hrtime_t now);
+
+    /**
+     * Charge the thread for bytes sent to a client
+     *
+     * @param thread the index of the calling thread
+     * @param nbytes the number of bytes sent
+     */
+    void chargeWrite(int thread, size_t nbytes);
+
+    /**
+     * Is any of the limits set?
+     */
+    bool isEnabled() const {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+private:
+    enum Resource {
+        Ops,
+        ReadBytes,
+        WriteBytes,
+        NumResources
+    };
+
+    /**
+     * The shared token bucket for one of the limits
+     */
+    class Pool {
+    public:
+        Pool();
+
+        void setLimit(uint64_t limit, hrtime_t now);
+
+        /**
+         * Take up to batch tokens from the bucket
+         *
+         * @return the number of tokens taken
+         */
+        int64_t take(hrtime_t now);
+
+        /** The limit per second (0 = unlimited) */
+        std::atomic<uint64_t> limit;
+
+    private:
+        std::mutex mutex;
+        double tokens;
+        hrtime_t last_refill;
+    };
+
+    /**
+     * The tokens cached by a thread (each in a cache line of its own to
+     * avoid false sharing between the threads)
+     */
+    struct alignas(64) ThreadCache {
+        ThreadCache() {
+            tokens.fill(0);
+        }
+        std::array<int64_t, NumResources> tokens;
+    };
+
+    /**
+     * Make sure the thread has a positive balance of the given resource,
+     * grabbing more tokens from the shared pool if needed.
+     */
+    bool refill(ThreadCache& cache, Resource resource, hrtime_t now);
+
+    std::atomic_bool enabled;
+    std::array<Pool, NumResources> pools;
+
+    /**
+     * The storage for the caches. std::vector doesn't honour the alignment
+     * of the elements before C++17, so the array is aligned by hand.
+     */
+    std::unique_ptr<char[]> cache_storage;
+
+    /** One cache per thread (in cache_storage) */
+    ThreadCache* caches;
+};
@@ -58,7 +58,8 @@ SaslAuthTask::SaslAuthTask(Cookie& cookie_,
                            Connection& connection_,
                            const std::string& mechanism_,
                            const std::string& challenge_)
-    : cookie(cookie_),
+    : Task(Priority::High),
+      cookie(cookie_),
       connection(connection_),
       mechanism(mechanism_),
       challenge(challenge_),
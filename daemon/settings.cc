@@ -16,8 +16,14 @@
  */
 #include "config.h"
 
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <platform/dirutils.h>
+#ifndef WIN32
+#include <sys/un.h>
+#endif
 #include "settings.h"
 #include "ssl_utils.h"
 
@@ -31,6 +37,7 @@ Settings settings;
  */
 Settings::Settings()
     : num_threads(0),
+      background_threads(2),
       require_sasl(false),
       bio_drain_buffer_sz(0),
       datatype(false),
@@ -49,6 +56,21 @@ Settings::Settings()
     verbose.store(0);
     connection_idle_time.reset();
     dedupe_nmvb_maps.store(false);
+    connection_rebalance.store(false);
+    busy_poll.store(0);
+    busy_poll_threads.store(0);
+    sched_slice.store(0);
+    shed_threshold.store(0);
+    max_pending_bytes.store(0);
+    max_pinned_items.store(0);
+    slow_reader_timeout.store(0);
+    connection_pool_size.store(64);
+    ssl_ktls.store(false);
+    ssl_handshake_offload.store(true);
+    ssl_session_cache_size.store(20480);
+    shm_ring_size.store(1024 * 1024);
+    compression_threshold.store(1024);
+    compression_cache_size.store(32 * 1024 * 1024);
 
     memset(&has, 0, sizeof(has));
     memset(&extensions, 0, sizeof(extensions));
@@ -59,6 +81,8 @@ Settings::Settings(const unique_cJSON_ptr& json)
     reconfigure(json);
 }
 
+const uint32_t Settings::default_bucket_weight;
+
 /**
  * Handle the "admin" tag in the settings.
  *
@@ -390,6 +414,433 @@ static void handle_sasl_mechanisms(Settings& s, cJSON* obj) {
     s.setSaslMechanisms(obj->valuestring);
 }
 
+/**
+ * Handle the "connection_rebalance" tag in the settings
+ *
+ *  The value must be a boolean value
+ *
+ * @param s the settings object to update
+ * @param obj the object in the configuration
+ */
+static void handle_connection_rebalance(Settings& s, cJSON* obj) {
+    if (obj->type == cJSON_True) {
+        s.setConnectionRebalance(true);
+    } else if (obj->type == cJSON_False) {
+        s.setConnectionRebalance(false);
+    } else {
+        throw std::invalid_argument(
+            "\"connection_rebalance\" must be a boolean value");
+    }
+}
+
+/**
+ * Handle the "busy_poll" tag in the settings
+ *
+ *  The value must be a non-negative integer
+ *
+ * @param s the settings object to update
+ * @param obj the object in the configuration
+ */
+static void handle_busy_poll(Settings& s, cJSON* obj) {
+    if (obj->type != cJSON_Number || obj->valueint < 0) {
+        throw std::invalid_argument(
+            "\"busy_poll\" must be a non-negative integer");
+    }
+    s.setBusyPoll(uint32_t(obj->valueint));
+}
+
+/**
+ * Handle the "busy_poll_threads" tag in the settings
+ *
+ *  The value must be a non-negative integer
+ *
+ * @param s the settings object to update
+ * @param obj the object in the configuration
+ */
+static void handle_busy_poll_threads(Settings& s, cJSON* obj) {
+    if (obj->type != cJSON_Number || obj->valueint < 0) {
+        throw std::invalid_argument(
+            "\"busy_poll_threads\" must be a non-negative integer");
+    }
+    s.setBusyPollThreads(obj->valueint);
+}
+
+/**
+ * Parse a list of CPUs in the same format as taskset(1) and
+ * /sys/devices/system/cpu/online; a comma separated list of CPU
+ * numbers or ranges, e.g. "0-3,8,10-11".
+ *
+ * @param tag the name of the tag (used in the error message)
+ * @param obj the object in the configuration
+ * @return the CPU numbers in the order they were listed
+ * @throws std::invalid_argument if the list is malformed
+ */
+static std::vector<int> parse_cpu_list(const char* tag, cJSON* obj) {
+    if (obj->type != cJSON_String) {
+        throw std::invalid_argument(
+            "\"" + std::string(tag) + "\" must be a string");
+    }
+
+    const std::string error = "\"" + std::string(tag) +
+                              "\" must be a list of CPUs (e.g. \"0-3,8\")";
+    std::vector<int> ret;
+    const std::string value(obj->valuestring);
+    std::string::size_type pos = 0;
+    while (pos < value.size()) {
+        auto end = value.find(',', pos);
+        if (end == std::string::npos) {
+            end = value.size();
+        }
+        const std::string entry = value.substr(pos, end - pos);
+        pos = end + 1;
+
+        int first, last;
+        char trailing;
+        if (sscanf(entry.c_str(), "%d-%d%c", &first, &last, &trailing) == 2) {
+            // range
+        } else if (sscanf(entry.c_str(), "%d%c", &first, &trailing) == 1) {
+            last = first;
+        } else {
+            throw std::invalid_argument(error);
+        }
+
+        if (first < 0 || last < first) {
+            throw std::invalid_argument(error);
+        }
+
+        for (int cpu = first; cpu <= last; ++cpu) {
+            ret.push_back(cpu);
+        }
+    }
+
+    if (ret.empty()) {
+        throw std::invalid_argument(error);
+    }
+
+    return ret;
+}
+
+/**
+ * Handle the "worker_cpus" tag in the settings
+ *
+ *  The value must be a string containing a list of CPUs
+ *
+ * @param s the settings object to update
+ * @param obj the object in the configuration
+ */
+static void handle_worker_cpus(Settings& s, cJSON* obj) {
+    s.setWorkerCpus(parse_cpu_list("worker_cpus", obj));
+}
+
+/**
+ * Handle the "housekeeping_cpus" tag in the settings
+ *
+ *  The value must be a string containing a list of CPUs
+ *
+ * @param s the settings object to update
+ * @param obj the object in the configuration
+ */
+static void handle_housekeeping_cpus(Settings& s, cJSON* obj) {
+    s.setHousekeepingCpus(parse_cpu_list("housekeeping_cpus", obj));
+}
+
+/**
+ * Handle the "background_threads" tag in the settings
+ *
+ *  The value must be a positive integer value
+ *
+ * @param s the settings object to update
+ * @param obj the object in the configuration
+ */
+static void handle_background_threads(Settings& s, cJSON* obj) {
+    if (obj->type != cJSON_Number || obj->valueint < 1) {
+        throw std::invalid_argument(
+            "\"background_threads\" must be a positive integer");
+    }
+    s.setBackgroundThreads(size_t(obj->valueint));
+}
+
+/**
+ * Handle the "sched_slice" tag in the settings
+ *
+ *  The value must be a non-negative integer
+ *
+ * @param s the settings object to update
+ * @param obj the object in the configuration
+ */
+static void handle_sched_slice(Settings& s, cJSON* obj) {
+    if (obj->type != cJSON_Number || obj->valueint < 0) {
+        throw std::invalid_argument(
+            "\"sched_slice\" must be a non-negative integer");
+    }
+    s.setSchedSlice(uint32_t(obj->valueint));
+}
+
+/**
+ * Handle the "shed_threshold" tag in the settings
+ *
+ *  The value must be a non-negative integer
+ *
+ * @param s the settings object to update
+ * @param obj the object in the configuration
+ */
+static void handle_shed_threshold(Settings& s, cJSON* obj) {
+    if (obj->type != cJSON_Number || obj->valueint < 0) {
+        throw std::invalid_argument(
+            "\"shed_threshold\" must be a non-negative integer");
+    }
+    s.setShedThreshold(uint32_t(obj->valueint));
+}
+
+/**
+ * Handle the "max_pending_bytes" tag in the settings
+ *
+ *  The value must be a non-negative integer
+ *
+ * @param s the settings object to update
+ * @param obj the object in the configuration
+ */
+static void handle_max_pending_bytes(Settings& s, cJSON* obj) {
+    if (obj->type != cJSON_Number || obj->valueint < 0) {
+        throw std::invalid_argument(
+            "\"max_pending_bytes\" must be a non-negative integer");
+    }
+    s.setMaxPendingBytes(size_t(obj->valueint));
+}
+
+/**
+ * Handle the "max_pinned_items" tag in the settings
+ *
+ *  The value must be a non-negative integer
+ *
+ * @param s the settings object to update
+ * @param obj the object in the configuration
+ */
+static void handle_max_pinned_items(Settings& s, cJSON* obj) {
+    if (obj->type != cJSON_Number || obj->valueint < 0) {
+        throw std::invalid_argument(
+            "\"max_pinned_items\" must be a non-negative integer");
+    }
+    s.setMaxPinnedItems(size_t(obj->valueint));
+}
+
+/**
+ * Handle the "slow_reader_timeout" tag in the settings
+ *
+ *  The value must be a non-negative integer
+ *
+ * @param s the settings object to update
+ * @param obj the object in the configuration
+ */
+static void handle_slow_reader_timeout(Settings& s, cJSON* obj) {
+    if (obj->type != cJSON_Number || obj->valueint < 0) {
+        throw std::invalid_argument(
+            "\"slow_reader_timeout\" must be a non-negative integer");
+    }
+    s.setSlowReaderTimeout(uint32_t(obj->valueint));
+}
+
+/**
+ * Handle the "connection_pool_size" tag in the settings
+ *
+ *  The value must be a non-negative integer
+ *
+ * @param s the settings object to update
+ * @param obj the object in the configuration
+ */
+static void handle_connection_pool_size(Settings& s, cJSON* obj) {
+    if (obj->type != cJSON_Number || obj->valueint < 0) {
+        throw std::invalid_argument(
+            "\"connection_pool_size\" must be a non-negative integer");
+    }
+    s.setConnectionPoolSize(size_t(obj->valueint));
+}
+
+/**
+ * Handle the "shm_ring_size" tag in the settings
+ *
+ *  The value must be 0 or a power of two between 4k and 1G
+ *
+ * @param s the settings object to update
+ * @param obj the object in the configuration
+ */
+static void handle_shm_ring_size(Settings& s, cJSON* obj) {
+    if (obj->type != cJSON_Number || obj->valueint < 0) {
+        throw std::invalid_argument(
+            "\"shm_ring_size\" must be a non-negative integer");
+    }
+    const size_t size = size_t(obj->valueint);
+    if (size != 0 && (size < 4096 || size > (1024 * 1024 * 1024) ||
+                      (size & (size - 1)) != 0)) {
+        throw std::invalid_argument(
+            "\"shm_ring_size\" must be 0 or a power of two between 4096 "
+            "and 1073741824");
+    }
+    s.setShmRingSize(size);
+}
+
+/**
+ * Handle the "compression_threshold" tag in the settings
+ *
+ *  The value must be a non-negative integer
+ *
+ * @param s the settings object to update
+ * @param obj the object in the configuration
+ */
+static void handle_compression_threshold(Settings& s, cJSON* obj) {
+    if (obj->type != cJSON_Number || obj->valueint < 0) {
+        throw std::invalid_argument(
+            "\"compression_threshold\" must be a non-negative integer");
+    }
+    s.setCompressionThreshold(size_t(obj->valueint));
+}
+
+/**
+ * Handle the "compression_cache_size" tag in the settings
+ *
+ *  The value must be a non-negative integer
+ *
+ * @param s the settings object to update
+ * @param obj the object in the configuration
+ */
+static void handle_compression_cache_size(Settings& s, cJSON* obj) {
+    if (obj->type != cJSON_Number || obj->valueint < 0) {
+        throw std::invalid_argument(
+            "\"compression_cache_size\" must be a non-negative integer");
+    }
+    s.setCompressionCacheSize(size_t(obj->valueint));
+}
+
+/**
+ * Handle the "ssl_ktls" tag in the settings
+ *
+ *  The value must be a boolean value
+ *
+ * @param s the settings object to update
+ * @param obj the object in the configuration
+ */
+static void handle_ssl_ktls(Settings& s, cJSON* obj) {
+    if (obj->type == cJSON_True) {
+        s.setSslKtls(true);
+    } else if (obj->type == cJSON_False) {
+        s.setSslKtls(false);
+    } else {
+        throw std::invalid_argument("\"ssl_ktls\" must be a boolean value");
+    }
+}
+
+/**
+ * Handle the "ssl_handshake_offload" tag in the settings
+ *
+ *  The value must be a boolean value
+ *
+ * @param s the settings object to update
+ * @param obj the object in the configuration
+ */
+static void handle_ssl_handshake_offload(Settings& s, cJSON* obj) {
+    if (obj->type == cJSON_True) {
+        s.setSslHandshakeOffload(true);
+    } else if (obj->type == cJSON_False) {
+        s.setSslHandshakeOffload(false);
+    } else {
+        throw std::invalid_argument(
+            "\"ssl_handshake_offload\" must be a boolean value");
+    }
+}
+
+/**
+ * Handle the "ssl_session_cache_size" tag in the settings
+ *
+ *  The value must be a non-negative integer
+ *
+ * @param s the settings object to update
+ * @param obj the object in the configuration
+ */
+static void handle_ssl_session_cache_size(Settings& s, cJSON* obj) {
+    if (obj->type != cJSON_Number || obj->valueint < 0) {
+        throw std::invalid_argument(
+            "\"ssl_session_cache_size\" must be a non-negative integer");
+    }
+    s.setSslSessionCacheSize(size_t(obj->valueint));
+}
+
+/**
+ * Handle the "bucket_weights" tag in the settings
+ *
+ *  The value must be an object mapping bucket names to a weight
+ *  in the range [1, 10000]
+ *
+ * @param s the settings object to update
+ * @param obj the object in the configuration
+ */
+static void handle_bucket_weights(Settings& s, cJSON* obj) {
+    if (obj->type != cJSON_Object) {
+        throw std::invalid_argument("\"bucket_weights\" must be an object");
+    }
+
+    std::map<std::string, uint32_t> weights;
+    for (auto* child = obj->child; child != nullptr; child = child->next) {
+        if (child->type != cJSON_Number || child->valueint < 1 ||
+            child->valueint > 10000) {
+            throw std::invalid_argument(
+                "\"bucket_weights\" entries must be numbers in the range "
+                "[1, 10000]");
+        }
+        weights[child->string] = uint32_t(child->valueint);
+    }
+    s.setBucketWeights(weights);
+}
+
+static uint64_t parse_rate_limit(cJSON* obj) {
+    if (obj->type != cJSON_Number || obj->valuedouble < 0) {
+        throw std::invalid_argument(
+            "\"bucket_limits\": \"" + std::string(obj->string) +
+            "\" must be a non-negative number");
+    }
+    return uint64_t(obj->valuedouble);
+}
+
+/**
+ * Handle the "bucket_limits" tag in the settings
+ *
+ *  The value must be an object mapping bucket names to an object
+ *  with the (optional) attributes "ops", "read_bytes" and "write_bytes"
+ *
+ * @param s the settings object to update
+ * @param obj the object in the configuration
+ */
+static void handle_bucket_limits(Settings& s, cJSON* obj) {
+    if (obj->type != cJSON_Object) {
+        throw std::invalid_argument("\"bucket_limits\" must be an object");
+    }
+
+    std::map<std::string, BucketRateLimits> limits;
+    for (auto* bucket = obj->child; bucket != nullptr; bucket = bucket->next) {
+        if (bucket->type != cJSON_Object) {
+            throw std::invalid_argument(
+                "\"bucket_limits\" entries must be objects");
+        }
+
+        BucketRateLimits entry;
+        for (auto* child = bucket->child; child != nullptr;
+             child = child->next) {
+            const std::string key(child->string);
+            if (key == "ops") {
+                entry.ops = parse_rate_limit(child);
+            } else if (key == "read_bytes") {
+                entry.read_bytes = parse_rate_limit(child);
+            } else if (key == "write_bytes") {
+                entry.write_bytes = parse_rate_limit(child);
+            } else {
+                throw std::invalid_argument(
+                    "\"bucket_limits\": unknown limit \"" + key + "\"");
+            }
+        }
+        limits[bucket->string] = entry;
+    }
+    s.setBucketLimits(limits);
+}
+
 /**
  * Handle the "dedupe_nmvb_maps" tag in the settings
  *
@@ -511,7 +962,27 @@ void Settings::reconfigure(const unique_cJSON_ptr& json) {
         {"stdin_listen",                 handle_stdin_listen},
         {"exit_on_connection_close",     handle_exit_on_connection_close},
         {"sasl_mechanisms",              handle_sasl_mechanisms},
-        {"dedupe_nmvb_maps",             handle_dedupe_nmvb_maps}
+        {"dedupe_nmvb_maps",             handle_dedupe_nmvb_maps},
+        {"connection_rebalance",         handle_connection_rebalance},
+        {"busy_poll",                    handle_busy_poll},
+        {"busy_poll_threads",            handle_busy_poll_threads},
+        {"sched_slice",                  handle_sched_slice},
+        {"bucket_weights",               handle_bucket_weights},
+        {"bucket_limits",                handle_bucket_limits},
+        {"shed_threshold",               handle_shed_threshold},
+        {"max_pending_bytes",            handle_max_pending_bytes},
+        {"max_pinned_items",             handle_max_pinned_items},
+        {"slow_reader_timeout",          handle_slow_reader_timeout},
+        {"connection_pool_size",         handle_connection_pool_size},
+        {"ssl_ktls",                     handle_ssl_ktls},
+        {"ssl_handshake_offload",        handle_ssl_handshake_offload},
+        {"ssl_session_cache_size",       handle_ssl_session_cache_size},
+        {"shm_ring_size",                handle_shm_ring_size},
+        {"compression_threshold",        handle_compression_threshold},
+        {"compression_cache_size",       handle_compression_cache_size},
+        {"worker_cpus",                  handle_worker_cpus},
+        {"housekeeping_cpus",            handle_housekeeping_cpus},
+        {"background_threads",           handle_background_threads}
     };
 
     cJSON* obj = json->child;
@@ -608,6 +1079,52 @@ static void handle_interface_management(struct interface& ifc, cJSON* obj) {
     }
 }
 
+static void handle_interface_reuseport(struct interface& ifc, cJSON* obj) {
+    if (obj->type == cJSON_True) {
+        ifc.reuseport = true;
+    } else if (obj->type == cJSON_False) {
+        ifc.reuseport = false;
+    } else {
+        throw std::invalid_argument("\"reuseport\" must be a boolean value");
+    }
+}
+
+static void handle_interface_busy_poll(struct interface& ifc, cJSON* obj) {
+    if (obj->type != cJSON_Number || obj->valueint < 0) {
+        throw std::invalid_argument(
+            "\"busy_poll\" must be a non-negative number");
+    }
+
+    ifc.busy_poll = uint32_t(obj->valueint);
+}
+
+static void handle_interface_path(struct interface& ifc, cJSON* obj) {
+    if (obj->type != cJSON_String || obj->valuestring[0] == '\0') {
+        throw std::invalid_argument("\"path\" must be a non-empty string");
+    }
+
+    ifc.path.assign(obj->valuestring);
+}
+
+static void handle_interface_permissions(struct interface& ifc, cJSON* obj) {
+    // JSON don't have octal numbers, so the mode is a string ("0660")
+    if (obj->type != cJSON_String) {
+        throw std::invalid_argument(
+            "\"permissions\" must be a string with an octal number");
+    }
+
+    char* end;
+    errno = 0;
+    const auto mode = strtoul(obj->valuestring, &end, 8);
+    if (errno != 0 || end == obj->valuestring || *end != '\0' ||
+        mode > 0777) {
+        throw std::invalid_argument(
+            "\"permissions\" must be an octal number between 0 and 0777");
+    }
+
+    ifc.permissions = uint32_t(mode);
+}
+
 static void handle_interface_ssl(struct interface& ifc, cJSON* obj) {
     if (obj->type != cJSON_Object) {
         throw std::invalid_argument("\"ssl\" must be an object");
@@ -688,7 +1205,11 @@ interface::interface(const cJSON* json)
         {"tcp_nodelay", handle_interface_tcp_nodelay},
         {"ssl",         handle_interface_ssl},
         {"management",  handle_interface_management},
+        {"reuseport",   handle_interface_reuseport},
+        {"busy_poll",   handle_interface_busy_poll},
         {"protocol",    handle_interface_protocol},
+        {"path",        handle_interface_path},
+        {"permissions", handle_interface_permissions},
     };
 
     cJSON* obj = json->child;
@@ -711,6 +1232,27 @@ interface::interface(const cJSON* json)
 
         obj = obj->next;
     }
+
+    if (!path.empty()) {
+#ifdef WIN32
+        throw std::invalid_argument(
+            "\"path\": Unix domain sockets are not supported on this "
+            "platform");
+#else
+        if (!ssl.cert.empty()) {
+            throw std::invalid_argument(
+                "\"ssl\" can't be used with a Unix domain socket");
+        }
+        if (reuseport) {
+            throw std::invalid_argument(
+                "\"reuseport\" can't be used with a Unix domain socket");
+        }
+        if (path.size() >= sizeof(sockaddr_un::sun_path)) {
+            throw std::invalid_argument("\"path\" is too long");
+        }
+        tcp_nodelay = false;
+#endif
+    }
 }
 
 void Settings::updateSettings(const Settings& other, bool apply) {
@@ -785,6 +1327,24 @@ void Settings::updateSettings(const Settings& other, bool apply) {
                 "sasl_mechanisms can't be changed dynamically");
         }
     }
+    if (other.has.worker_cpus) {
+        if (other.worker_cpus != worker_cpus) {
+            throw std::invalid_argument(
+                "worker_cpus can't be changed dynamically");
+        }
+    }
+    if (other.has.housekeeping_cpus) {
+        if (other.housekeeping_cpus != housekeeping_cpus) {
+            throw std::invalid_argument(
+                "housekeeping_cpus can't be changed dynamically");
+        }
+    }
+    if (other.has.background_threads) {
+        if (other.background_threads != background_threads) {
+            throw std::invalid_argument(
+                "background_threads can't be changed dynamically");
+        }
+    }
 
     if (other.has.interfaces) {
         if (other.interfaces.size() != interfaces.size()) {
@@ -807,7 +1367,8 @@ void Settings::updateSettings(const Settings& other, bool apply) {
             if ((i1.host != i2.host) || (i1.port != i2.port) ||
                 (i1.ipv4 != i2.ipv4) || (i1.ipv6 != i2.ipv6) ||
                 (i1.protocol != i2.protocol) ||
-                (i1.management != i2.management)) {
+                (i1.management != i2.management) ||
+                (i1.reuseport != i2.reuseport) || (i1.path != i2.path)) {
                 throw std::invalid_argument(
                     "interfaces can't be changed dynamically");
             }
@@ -940,6 +1501,162 @@ void Settings::updateSettings(const Settings& other, bool apply) {
         }
     }
 
+    if (other.has.connection_rebalance) {
+        if (other.connection_rebalance != connection_rebalance) {
+            logit(EXTENSION_LOG_NOTICE,
+                  "%s rebalancing of connections between worker threads",
+                  other.connection_rebalance.load() ? "Enable" : "Disable");
+            setConnectionRebalance(other.connection_rebalance.load());
+        }
+    }
+
+    if (other.has.busy_poll) {
+        if (other.busy_poll != busy_poll) {
+            logit(EXTENSION_LOG_NOTICE,
+                  "Change busy poll window from %u to %u usec",
+                  busy_poll.load(), other.busy_poll.load());
+            setBusyPoll(other.busy_poll.load());
+        }
+    }
+
+    if (other.has.busy_poll_threads) {
+        if (other.busy_poll_threads != busy_poll_threads) {
+            logit(EXTENSION_LOG_NOTICE,
+                  "Change number of busy poll threads from %d to %d",
+                  busy_poll_threads.load(), other.busy_poll_threads.load());
+            setBusyPollThreads(other.busy_poll_threads.load());
+        }
+    }
+
+    if (other.has.sched_slice) {
+        if (other.sched_slice != sched_slice) {
+            logit(EXTENSION_LOG_NOTICE,
+                  "Change scheduler time slice from %u to %u usec",
+                  sched_slice.load(), other.sched_slice.load());
+            setSchedSlice(other.sched_slice.load());
+        }
+    }
+
+    if (other.has.bucket_weights) {
+        const auto weights = other.getBucketWeights();
+        if (weights != getBucketWeights()) {
+            logit(EXTENSION_LOG_NOTICE, "Change bucket weights");
+            setBucketWeights(weights);
+        }
+    }
+
+    if (other.has.shed_threshold) {
+        if (other.shed_threshold != shed_threshold) {
+            logit(EXTENSION_LOG_NOTICE,
+                  "Change load shedding threshold from %u to %u usec",
+                  shed_threshold.load(), other.shed_threshold.load());
+            setShedThreshold(other.shed_threshold.load());
+        }
+    }
+
+    if (other.has.max_pending_bytes) {
+        if (other.max_pending_bytes != max_pending_bytes) {
+            logit(EXTENSION_LOG_NOTICE,
+                  "Change max pending bytes per connection from %zu to %zu",
+                  max_pending_bytes.load(), other.max_pending_bytes.load());
+            setMaxPendingBytes(other.max_pending_bytes.load());
+        }
+    }
+
+    if (other.has.max_pinned_items) {
+        if (other.max_pinned_items != max_pinned_items) {
+            logit(EXTENSION_LOG_NOTICE,
+                  "Change max pinned items per connection from %zu to %zu",
+                  max_pinned_items.load(), other.max_pinned_items.load());
+            setMaxPinnedItems(other.max_pinned_items.load());
+        }
+    }
+
+    if (other.has.slow_reader_timeout) {
+        if (other.slow_reader_timeout != slow_reader_timeout) {
+            logit(EXTENSION_LOG_NOTICE,
+                  "Change slow reader timeout from %u to %u seconds",
+                  slow_reader_timeout.load(), other.slow_reader_timeout.load());
+            setSlowReaderTimeout(other.slow_reader_timeout.load());
+        }
+    }
+
+    if (other.has.connection_pool_size) {
+        if (other.connection_pool_size != connection_pool_size) {
+            logit(EXTENSION_LOG_NOTICE,
+                  "Change connection pool size per worker thread from %zu "
+                  "to %zu", connection_pool_size.load(),
+                  other.connection_pool_size.load());
+            setConnectionPoolSize(other.connection_pool_size.load());
+        }
+    }
+
+    if (other.has.ssl_ktls) {
+        if (other.ssl_ktls != ssl_ktls) {
+            logit(EXTENSION_LOG_NOTICE,
+                  "%s kTLS offload of new SSL connections",
+                  other.ssl_ktls.load() ? "Enable" : "Disable");
+            setSslKtls(other.ssl_ktls.load());
+        }
+    }
+
+    if (other.has.ssl_handshake_offload) {
+        if (other.ssl_handshake_offload != ssl_handshake_offload) {
+            logit(EXTENSION_LOG_NOTICE,
+                  "%s offload of the SSL handshake to the executor pool",
+                  other.ssl_handshake_offload.load() ? "Enable" : "Disable");
+            setSslHandshakeOffload(other.ssl_handshake_offload.load());
+        }
+    }
+
+    if (other.has.ssl_session_cache_size) {
+        if (other.ssl_session_cache_size != ssl_session_cache_size) {
+            logit(EXTENSION_LOG_NOTICE,
+                  "Change SSL session cache size from %zu to %zu",
+                  ssl_session_cache_size.load(),
+                  other.ssl_session_cache_size.load());
+            setSslSessionCacheSize(other.ssl_session_cache_size.load());
+        }
+    }
+
+    if (other.has.shm_ring_size) {
+        if (other.shm_ring_size != shm_ring_size) {
+            logit(EXTENSION_LOG_NOTICE,
+                  "Change the ring size for new shared memory connections "
+                  "from %zu to %zu", shm_ring_size.load(),
+                  other.shm_ring_size.load());
+            setShmRingSize(other.shm_ring_size.load());
+        }
+    }
+
+    if (other.has.compression_threshold) {
+        if (other.compression_threshold != compression_threshold) {
+            logit(EXTENSION_LOG_NOTICE,
+                  "Change compression threshold from %zu to %zu",
+                  compression_threshold.load(),
+                  other.compression_threshold.load());
+            setCompressionThreshold(other.compression_threshold.load());
+        }
+    }
+
+    if (other.has.compression_cache_size) {
+        if (other.compression_cache_size != compression_cache_size) {
+            logit(EXTENSION_LOG_NOTICE,
+                  "Change compression cache size from %zu to %zu",
+                  compression_cache_size.load(),
+                  other.compression_cache_size.load());
+            setCompressionCacheSize(other.compression_cache_size.load());
+        }
+    }
+
+    if (other.has.bucket_limits) {
+        const auto limits = other.getAllBucketLimits();
+        if (limits != getAllBucketLimits()) {
+            logit(EXTENSION_LOG_NOTICE, "Change bucket rate limits");
+            setBucketLimits(limits);
+        }
+    }
+
     if (other.has.interfaces) {
         // validate that we haven't changed stuff in the entries
         auto total = interfaces.size();
@@ -978,6 +1695,22 @@ void Settings::updateSettings(const Settings& other, bool apply) {
                 changed = true;
             }
 
+            if (i2.busy_poll != i1.busy_poll) {
+                logit(EXTENSION_LOG_NOTICE,
+                      "Change busy poll for %s:%u from %u to %u",
+                      i1.host.c_str(), i1.port, i1.busy_poll, i2.busy_poll);
+                i1.busy_poll = i2.busy_poll;
+                changed = true;
+            }
+
+            if (i2.permissions != i1.permissions) {
+                logit(EXTENSION_LOG_NOTICE,
+                      "Change permissions for %s from %04o to %04o",
+                      i1.path.c_str(), i1.permissions, i2.permissions);
+                i1.permissions = i2.permissions;
+                changed = true;
+            }
+
             if (i2.ssl.cert != i1.ssl.cert) {
                 logit(EXTENSION_LOG_NOTICE,
                       "Change SSL Certificiate for %s:%u from %s to %s",
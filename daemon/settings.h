@@ -24,6 +24,7 @@
 #include <cstdarg>
 #include <deque>
 #include <map>
+#include <mutex>
 #include <memcached/engine.h>
 #include <platform/dynamic.h>
 #include <relaxed_atomic.h>
@@ -53,6 +54,9 @@ struct interface {
           ipv4(true),
           tcp_nodelay(true),
           management(false),
+          reuseport(false),
+          busy_poll(0),
+          permissions(0600),
           protocol(Protocol::Memcached) {
     }
 
@@ -70,9 +74,57 @@ struct interface {
     bool ipv4;
     bool tcp_nodelay;
     bool management;
+    /**
+     * Create one SO_REUSEPORT socket per worker thread for each of the
+     * addresses (and let the kernel balance incoming connections between
+     * them) instead of accepting clients in the dispatcher thread.
+     */
+    bool reuseport;
+    /**
+     * The number of microseconds to busy poll the device queue when
+     * reading from the client sockets (SO_BUSY_POLL), 0 to disable
+     */
+    uint32_t busy_poll;
+    /**
+     * The path of a Unix domain socket to listen on instead of a TCP
+     * port (the host, port, ipv4, ipv6, tcp_nodelay and busy_poll
+     * attributes don't apply)
+     */
+    std::string path;
+    /**
+     * The file permissions for the Unix domain socket
+     */
+    uint32_t permissions;
     Protocol protocol;
 };
 
+/**
+ * The rate limits for a bucket (per second). 0 means unlimited.
+ */
+struct BucketRateLimits {
+    BucketRateLimits()
+        : ops(0),
+          read_bytes(0),
+          write_bytes(0) {
+    }
+
+    bool operator==(const BucketRateLimits& other) const {
+        return ops == other.ops && read_bytes == other.read_bytes &&
+               write_bytes == other.write_bytes;
+    }
+
+    bool operator!=(const BucketRateLimits& other) const {
+        return !(*this == other);
+    }
+
+    /** The number of commands */
+    uint64_t ops;
+    /** The number of bytes received from the clients */
+    uint64_t read_bytes;
+    /** The number of bytes sent to the clients */
+    uint64_t write_bytes;
+};
+
 /* pair of shared object name and config for an extension to be loaded. */
 struct extension_settings {
     extension_settings() {}
@@ -739,6 +791,484 @@ public:
         notify_changed("dedupe_nmvb_maps");
     }
 
+    /**
+     * Should the server move idle connections away from a worker thread
+     * which stays more loaded than the others over time?
+     *
+     * @return true if connections may be migrated between worker threads
+     */
+    bool isConnectionRebalance() const {
+        return connection_rebalance.load();
+    }
+
+    /**
+     * Set if the server should move idle connections away from a worker
+     * thread which stays more loaded than the others over time.
+     *
+     * @param connection_rebalance true to allow migrating connections
+     */
+    void setConnectionRebalance(const bool& connection_rebalance) {
+        Settings::connection_rebalance.store(connection_rebalance);
+        has.connection_rebalance = true;
+        notify_changed("connection_rebalance");
+    }
+
+    /**
+     * Get the number of microseconds a worker thread should keep on
+     * polling for more work before it goes to sleep
+     *
+     * @return the busy poll window in microseconds (0 means disabled)
+     */
+    uint32_t getBusyPoll() const {
+        return busy_poll.load();
+    }
+
+    /**
+     * Set the number of microseconds a worker thread should keep on
+     * polling for more work before it goes to sleep
+     *
+     * @param busy_poll the busy poll window in microseconds (0 to disable)
+     */
+    void setBusyPoll(const uint32_t& busy_poll) {
+        Settings::busy_poll.store(busy_poll);
+        has.busy_poll = true;
+        notify_changed("busy_poll");
+    }
+
+    /**
+     * Get the number of worker threads running in busy poll mode.
+     *
+     * @return the number of threads (0 means all of them)
+     */
+    int getBusyPollThreads() const {
+        return busy_poll_threads.load();
+    }
+
+    /**
+     * Set the number of worker threads running in busy poll mode. The
+     * first <code>busy_poll_threads</code> worker threads use busy poll
+     * and the rest of the threads sleep as soon as they're idle.
+     *
+     * @param busy_poll_threads the number of threads (0 for all)
+     */
+    void setBusyPollThreads(const int& busy_poll_threads) {
+        Settings::busy_poll_threads.store(busy_poll_threads);
+        has.busy_poll_threads = true;
+        notify_changed("busy_poll_threads");
+    }
+
+    /**
+     * Get the list of CPUs the worker threads should be bound to.
+     *
+     * @return the CPU list (empty if the workers may run on any CPU)
+     */
+    const std::vector<int>& getWorkerCpus() const {
+        return worker_cpus;
+    }
+
+    /**
+     * Set the list of CPUs the worker threads should be bound to. Worker
+     * thread <code>n</code> is bound to entry <code>n % size</code> in
+     * the list.
+     *
+     * @param worker_cpus the CPU numbers
+     */
+    void setWorkerCpus(const std::vector<int>& worker_cpus) {
+        Settings::worker_cpus = worker_cpus;
+        has.worker_cpus = true;
+        notify_changed("worker_cpus");
+    }
+
+    /**
+     * Get the list of CPUs the housekeeping threads (the dispatcher, the
+     * executor, the logger, the engine background tasks etc) should be
+     * bound to.
+     *
+     * @return the CPU list (empty if not configured)
+     */
+    const std::vector<int>& getHousekeepingCpus() const {
+        return housekeeping_cpus;
+    }
+
+    /**
+     * Set the list of CPUs the housekeeping threads should be bound to.
+     *
+     * @param housekeeping_cpus the CPU numbers
+     */
+    void setHousekeepingCpus(const std::vector<int>& housekeeping_cpus) {
+        Settings::housekeeping_cpus = housekeeping_cpus;
+        has.housekeeping_cpus = true;
+        notify_changed("housekeeping_cpus");
+    }
+
+    /**
+     * Get the number of threads used by the background scheduler to run
+     * the periodic and one-off tasks (log level propagation, sasl
+     * refresh, hash table expansion, item scrubbing etc)
+     *
+     * @return the number of background threads
+     */
+    size_t getBackgroundThreads() const {
+        return background_threads;
+    }
+
+    /**
+     * Set the number of threads used by the background scheduler
+     *
+     * @param background_threads the number of threads (must be > 0)
+     */
+    void setBackgroundThreads(size_t background_threads) {
+        Settings::background_threads = background_threads;
+        has.background_threads = true;
+        notify_changed("background_threads");
+    }
+
+    /**
+     * Get the length of the time slice (in microseconds) a connection
+     * may run on a worker thread before it must yield. When set the
+     * worker threads also share their time between the buckets according
+     * to the bucket weights.
+     *
+     * @return the time slice in microseconds (0 means disabled)
+     */
+    uint32_t getSchedSlice() const {
+        return sched_slice.load();
+    }
+
+    /**
+     * Set the length of the time slice a connection may run on a worker
+     * thread before it must yield.
+     *
+     * @param sched_slice the time slice in microseconds (0 to disable)
+     */
+    void setSchedSlice(const uint32_t& sched_slice) {
+        Settings::sched_slice.store(sched_slice);
+        has.sched_slice = true;
+        notify_changed("sched_slice");
+    }
+
+    /**
+     * Get the event loop lag (in microseconds) above which the worker
+     * threads start rejecting commands from normal priority connections
+     *
+     * @return the threshold in microseconds (0 means disabled)
+     */
+    uint32_t getShedThreshold() const {
+        return shed_threshold.load();
+    }
+
+    /**
+     * Set the event loop lag above which the worker threads start
+     * shedding load
+     *
+     * @param shed_threshold the threshold in microseconds (0 to disable)
+     */
+    void setShedThreshold(const uint32_t& shed_threshold) {
+        Settings::shed_threshold.store(shed_threshold);
+        has.shed_threshold = true;
+        notify_changed("shed_threshold");
+    }
+
+    /**
+     * Get the maximum number of bytes a connection may hold for commands
+     * which isn't completed and sent to the client yet before it stops
+     * reading new commands
+     *
+     * @return the limit in bytes (0 means unlimited)
+     */
+    size_t getMaxPendingBytes() const {
+        return max_pending_bytes.load();
+    }
+
+    /**
+     * Set the maximum number of pending bytes per connection
+     *
+     * @param max_pending_bytes the limit in bytes (0 for unlimited)
+     */
+    void setMaxPendingBytes(const size_t& max_pending_bytes) {
+        Settings::max_pending_bytes.store(max_pending_bytes);
+        has.max_pending_bytes = true;
+        notify_changed("max_pending_bytes");
+    }
+
+    /**
+     * Get the maximum number of items a connection may keep a reference
+     * to (while sending them to the client) before it stops reading new
+     * commands
+     *
+     * @return the limit (0 means unlimited)
+     */
+    size_t getMaxPinnedItems() const {
+        return max_pinned_items.load();
+    }
+
+    /**
+     * Set the maximum number of pinned items per connection
+     *
+     * @param max_pinned_items the limit (0 for unlimited)
+     */
+    void setMaxPinnedItems(const size_t& max_pinned_items) {
+        Settings::max_pinned_items.store(max_pinned_items);
+        has.max_pinned_items = true;
+        notify_changed("max_pinned_items");
+    }
+
+    /**
+     * Get the number of seconds a connection may wait for the client to
+     * read data before it is disconnected
+     *
+     * @return the timeout in seconds (0 means disabled)
+     */
+    uint32_t getSlowReaderTimeout() const {
+        return slow_reader_timeout.load();
+    }
+
+    /**
+     * Set the timeout for clients which don't read their responses
+     *
+     * @param slow_reader_timeout the timeout in seconds (0 to disable)
+     */
+    void setSlowReaderTimeout(const uint32_t& slow_reader_timeout) {
+        Settings::slow_reader_timeout.store(slow_reader_timeout);
+        has.slow_reader_timeout = true;
+        notify_changed("slow_reader_timeout");
+    }
+
+    /**
+     * Should the server hand the record layer of SSL connections over to
+     * the kernel (kTLS) when the handshake completes?
+     *
+     * @return true if kTLS should be used where it is supported
+     */
+    bool isSslKtls() const {
+        return ssl_ktls.load();
+    }
+
+    /**
+     * Set if the server should try to offload SSL connections to the
+     * kernel (kTLS). Only affects new connections.
+     *
+     * @param ssl_ktls true to use kTLS where it is supported
+     */
+    void setSslKtls(const bool& ssl_ktls) {
+        Settings::ssl_ktls.store(ssl_ktls);
+        has.ssl_ktls = true;
+        notify_changed("ssl_ktls");
+    }
+
+    /**
+     * Should the SSL handshake run on the executor pool instead of the
+     * worker thread serving the connection?
+     *
+     * @return true if the handshake should be offloaded
+     */
+    bool isSslHandshakeOffload() const {
+        return ssl_handshake_offload.load();
+    }
+
+    /**
+     * Set if the SSL handshake should run on the executor pool. Only
+     * affects handshakes which haven't started yet.
+     *
+     * @param ssl_handshake_offload true to run the handshake on the
+     *                              executor pool
+     */
+    void setSslHandshakeOffload(const bool& ssl_handshake_offload) {
+        Settings::ssl_handshake_offload.store(ssl_handshake_offload);
+        has.ssl_handshake_offload = true;
+        notify_changed("ssl_handshake_offload");
+    }
+
+    /**
+     * Get the max number of SSL sessions the server caches for resumption
+     *
+     * @return the number of sessions (0 means that session resumption
+     *         is disabled)
+     */
+    size_t getSslSessionCacheSize() const {
+        return ssl_session_cache_size.load();
+    }
+
+    /**
+     * Set the max number of SSL sessions the server caches for resumption
+     *
+     * @param ssl_session_cache_size the number of sessions (0 to disable
+     *                               session resumption)
+     */
+    void setSslSessionCacheSize(const size_t& ssl_session_cache_size) {
+        Settings::ssl_session_cache_size.store(ssl_session_cache_size);
+        has.ssl_session_cache_size = true;
+        notify_changed("ssl_session_cache_size");
+    }
+
+    /**
+     * Get the size (in bytes) of each of the two rings in the shared
+     * memory transport offered to clients on Unix domain sockets
+     *
+     * @return the ring size (0 means the transport is disabled)
+     */
+    size_t getShmRingSize() const {
+        return shm_ring_size.load();
+    }
+
+    /**
+     * Set the size of the shared memory rings used by new shared memory
+     * connections
+     *
+     * @param shm_ring_size the ring size in bytes (0 to disable)
+     */
+    void setShmRingSize(const size_t& shm_ring_size) {
+        Settings::shm_ring_size.store(shm_ring_size);
+        has.shm_ring_size = true;
+        notify_changed("shm_ring_size");
+    }
+
+    /**
+     * Get the smallest value (in bytes) the server compresses for clients
+     * which asked for compressed responses in HELLO
+     *
+     * @return the threshold (0 means compression is disabled)
+     */
+    size_t getCompressionThreshold() const {
+        return compression_threshold.load();
+    }
+
+    /**
+     * Set the smallest value the server compresses
+     *
+     * @param compression_threshold the size in bytes (0 to disable)
+     */
+    void setCompressionThreshold(const size_t& compression_threshold) {
+        Settings::compression_threshold.store(compression_threshold);
+        has.compression_threshold = true;
+        notify_changed("compression_threshold");
+    }
+
+    /**
+     * Get the max number of bytes used to cache compressed values
+     *
+     * @return the size of the cache (0 means values are compressed on
+     *         every read)
+     */
+    size_t getCompressionCacheSize() const {
+        return compression_cache_size.load();
+    }
+
+    /**
+     * Set the max number of bytes used to cache compressed values
+     *
+     * @param compression_cache_size the size in bytes (0 to disable)
+     */
+    void setCompressionCacheSize(const size_t& compression_cache_size) {
+        Settings::compression_cache_size.store(compression_cache_size);
+        has.compression_cache_size = true;
+        notify_changed("compression_cache_size");
+    }
+
+    /**
+     * Get the maximum number of released connection objects each worker
+     * thread keeps for reuse by new connections
+     *
+     * @return the number of connections (0 means disabled)
+     */
+    size_t getConnectionPoolSize() const {
+        return connection_pool_size.load();
+    }
+
+    /**
+     * Set the size of the per worker thread connection pool
+     *
+     * @param connection_pool_size the number of connections (0 to disable)
+     */
+    void setConnectionPoolSize(const size_t& connection_pool_size) {
+        Settings::connection_pool_size.store(connection_pool_size);
+        has.connection_pool_size = true;
+        notify_changed("connection_pool_size");
+    }
+
+    /**
+     * Get the weight of the named bucket when the worker threads share
+     * their time between the buckets.
+     *
+     * @param bucket the name of the bucket
+     * @return the weight of the bucket (default_bucket_weight unless
+     *         specified in "bucket_weights")
+     */
+    uint32_t getBucketWeight(const std::string& bucket) const {
+        std::lock_guard<std::mutex> guard(bucket_weights_mutex);
+        auto iter = bucket_weights.find(bucket);
+        if (iter == bucket_weights.end()) {
+            return default_bucket_weight;
+        }
+        return iter->second;
+    }
+
+    /**
+     * Get a copy of the configured bucket weights
+     */
+    std::map<std::string, uint32_t> getBucketWeights() const {
+        std::lock_guard<std::mutex> guard(bucket_weights_mutex);
+        return bucket_weights;
+    }
+
+    /**
+     * Set the weights of the buckets. Buckets not present in the map
+     * use default_bucket_weight.
+     *
+     * @param bucket_weights map from bucket name to weight
+     */
+    void setBucketWeights(const std::map<std::string, uint32_t>& bucket_weights) {
+        {
+            std::lock_guard<std::mutex> guard(bucket_weights_mutex);
+            Settings::bucket_weights = bucket_weights;
+        }
+        has.bucket_weights = true;
+        notify_changed("bucket_weights");
+    }
+
+    /**
+     * The weight used for buckets not listed in "bucket_weights"
+     */
+    static const uint32_t default_bucket_weight = 100;
+
+    /**
+     * Get the rate limits for the named bucket
+     *
+     * @param bucket the name of the bucket
+     * @return the limits for the bucket (all zero if it isn't limited)
+     */
+    BucketRateLimits getBucketLimits(const std::string& bucket) const {
+        std::lock_guard<std::mutex> guard(bucket_limits_mutex);
+        auto iter = bucket_limits.find(bucket);
+        if (iter == bucket_limits.end()) {
+            return BucketRateLimits();
+        }
+        return iter->second;
+    }
+
+    /**
+     * Get a copy of the configured bucket rate limits
+     */
+    std::map<std::string, BucketRateLimits> getAllBucketLimits() const {
+        std::lock_guard<std::mutex> guard(bucket_limits_mutex);
+        return bucket_limits;
+    }
+
+    /**
+     * Set the rate limits of the buckets. Buckets not present in the map
+     * aren't limited.
+     *
+     * @param bucket_limits map from bucket name to its limits
+     */
+    void setBucketLimits(const std::map<std::string, BucketRateLimits>& bucket_limits) {
+        {
+            std::lock_guard<std::mutex> guard(bucket_limits_mutex);
+            Settings::bucket_limits = bucket_limits;
+        }
+        has.bucket_limits = true;
+        notify_changed("bucket_limits");
+    }
+
     /**
      * Get the breakpad settings
      *
@@ -906,6 +1436,114 @@ protected:
      */
     std::atomic_bool dedupe_nmvb_maps;
 
+    /**
+     * Should we migrate connections from overloaded worker threads
+     */
+    std::atomic_bool connection_rebalance;
+
+    /**
+     * The number of microseconds a worker thread polls for more work
+     * before going to sleep
+     */
+    std::atomic<uint32_t> busy_poll;
+
+    /**
+     * The number of worker threads using busy poll
+     */
+    std::atomic_int busy_poll_threads;
+
+    /**
+     * The time slice (in microseconds) for a connection on a worker thread
+     */
+    std::atomic<uint32_t> sched_slice;
+
+    /**
+     * The lag (in microseconds) above which the worker threads shed load
+     */
+    std::atomic<uint32_t> shed_threshold;
+
+    /**
+     * The max number of bytes a connection may hold for commands which
+     * isn't completed and sent yet
+     */
+    std::atomic<size_t> max_pending_bytes;
+
+    /**
+     * The max number of items a connection may hold a reference to
+     */
+    std::atomic<size_t> max_pinned_items;
+
+    /**
+     * The number of seconds to wait for a client to read data before it
+     * is disconnected
+     */
+    std::atomic<uint32_t> slow_reader_timeout;
+
+    /**
+     * The max number of released connection objects kept by each worker
+     * thread
+     */
+    std::atomic<size_t> connection_pool_size;
+
+    /**
+     * Should we offload SSL connections to the kernel
+     */
+    std::atomic_bool ssl_ktls;
+
+    /**
+     * Should we run the SSL handshake on the executor pool
+     */
+    std::atomic_bool ssl_handshake_offload;
+
+    /**
+     * The max number of SSL sessions cached for resumption
+     */
+    std::atomic<size_t> ssl_session_cache_size;
+
+    /**
+     * The size of each ring in the shared memory transport
+     */
+    std::atomic<size_t> shm_ring_size;
+
+    /**
+     * The smallest value compressed for clients which asked for it
+     */
+    std::atomic<size_t> compression_threshold;
+
+    /**
+     * The max number of bytes in the cache of compressed values
+     */
+    std::atomic<size_t> compression_cache_size;
+
+    /**
+     * The weights of the buckets (may be updated at runtime so it's
+     * protected by bucket_weights_mutex)
+     */
+    std::map<std::string, uint32_t> bucket_weights;
+    mutable std::mutex bucket_weights_mutex;
+
+    /**
+     * The rate limits of the buckets (may be updated at runtime so it's
+     * protected by bucket_limits_mutex)
+     */
+    std::map<std::string, BucketRateLimits> bucket_limits;
+    mutable std::mutex bucket_limits_mutex;
+
+    /**
+     * The CPUs to bind the worker threads to
+     */
+    std::vector<int> worker_cpus;
+
+    /**
+     * The CPUs to bind the housekeeping threads to
+     */
+    std::vector<int> housekeeping_cpus;
+
+    /**
+     * The number of threads in the background scheduler
+     */
+    size_t background_threads;
+
 public:
     /**
      * Flags for each of the above config options, indicating if they were
@@ -939,6 +1577,26 @@ public:
         bool exit_on_connection_close;
         bool sasl_mechanisms;
         bool dedupe_nmvb_maps;
+        bool connection_rebalance;
+        bool busy_poll;
+        bool busy_poll_threads;
+        bool worker_cpus;
+        bool housekeeping_cpus;
+        bool background_threads;
+        bool sched_slice;
+        bool bucket_weights;
+        bool bucket_limits;
+        bool shed_threshold;
+        bool max_pending_bytes;
+        bool max_pinned_items;
+        bool slow_reader_timeout;
+        bool connection_pool_size;
+        bool ssl_ktls;
+        bool ssl_handshake_offload;
+        bool ssl_session_cache_size;
+        bool shm_ring_size;
+        bool compression_threshold;
+        bool compression_cache_size;
     } has;
 
 protected:
@@ -0,0 +1,244 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include "config.h"
+#include "shm_ring.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+
+#ifdef HAVE_SHM_TRANSPORT
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+ * The header at the start of the region. The data for the request ring
+ * starts at data_offset, and is followed by the data for the response
+ * ring.
+ */
+struct ShmRegionHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t ring_size;
+    uint64_t data_offset;
+    ShmRingControl request;
+    ShmRingControl response;
+};
+
+size_t ShmRing::write(const struct iovec* iov, size_t iovcnt) {
+    const uint64_t head = control.head.load(std::memory_order_relaxed);
+    const uint64_t tail = control.tail.load(std::memory_order_acquire);
+    size_t avail = capacity() - size_t(head - tail);
+    uint64_t pos = head;
+
+    for (size_t ii = 0; ii < iovcnt && avail > 0; ++ii) {
+        const uint8_t* src = static_cast<const uint8_t*>(iov[ii].iov_base);
+        size_t len = std::min(iov[ii].iov_len, avail);
+        avail -= len;
+        while (len > 0) {
+            const size_t offset = size_t(pos) & mask;
+            const size_t chunk = std::min(len, capacity() - offset);
+            memcpy(buffer + offset, src, chunk);
+            src += chunk;
+            len -= chunk;
+            pos += chunk;
+        }
+    }
+
+    if (pos != head) {
+        // Sequentially consistent so that it is ordered with the load of
+        // consumer_waiting in wakeConsumer()
+        control.head.store(pos, std::memory_order_seq_cst);
+    }
+    return size_t(pos - head);
+}
+
+size_t ShmRing::write(const void* data, size_t nbytes) {
+    struct iovec iov;
+    iov.iov_base = const_cast<void*>(data);
+    iov.iov_len = nbytes;
+    return write(&iov, 1);
+}
+
+size_t ShmRing::read(void* dest, size_t nbytes) {
+    const uint64_t tail = control.tail.load(std::memory_order_relaxed);
+    const uint64_t head = control.head.load(std::memory_order_acquire);
+    size_t len = std::min(nbytes, size_t(head - tail));
+    uint8_t* dst = static_cast<uint8_t*>(dest);
+    uint64_t pos = tail;
+
+    while (len > 0) {
+        const size_t offset = size_t(pos) & mask;
+        const size_t chunk = std::min(len, capacity() - offset);
+        memcpy(dst, buffer + offset, chunk);
+        dst += chunk;
+        len -= chunk;
+        pos += chunk;
+    }
+
+    if (pos != tail) {
+        control.tail.store(pos, std::memory_order_seq_cst);
+    }
+    return size_t(pos - tail);
+}
+
+bool ShmRing::prepareToWaitForData() {
+    control.consumer_waiting.store(1, std::memory_order_seq_cst);
+    if (control.head.load(std::memory_order_seq_cst) !=
+        control.tail.load(std::memory_order_relaxed) || isClosed()) {
+        control.consumer_waiting.store(0, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+bool ShmRing::prepareToWaitForSpace() {
+    control.producer_waiting.store(1, std::memory_order_seq_cst);
+    if (control.head.load(std::memory_order_relaxed) -
+        control.tail.load(std::memory_order_seq_cst) < capacity()) {
+        control.producer_waiting.store(0, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+ShmRegion::ShmRegion(int fd, void* base, size_t mapped, size_t ring_size)
+    : fd(fd),
+      base(static_cast<uint8_t*>(base)),
+      mapped(mapped),
+      ring_size(ring_size) {
+}
+
+ShmRing ShmRegion::getRequestRing() {
+    auto* header = reinterpret_cast<ShmRegionHeader*>(base);
+    return ShmRing(header->request, base + header->data_offset, ring_size);
+}
+
+ShmRing ShmRegion::getResponseRing() {
+    auto* header = reinterpret_cast<ShmRegionHeader*>(base);
+    return ShmRing(header->response, base + header->data_offset + ring_size,
+                   ring_size);
+}
+
+#ifdef HAVE_SHM_TRANSPORT
+static size_t header_size() {
+    const size_t page = size_t(sysconf(_SC_PAGESIZE));
+    return (sizeof(ShmRegionHeader) + page - 1) & ~(page - 1);
+}
+
+std::unique_ptr<ShmRegion> ShmRegion::create(size_t ring_size) {
+    if (ring_size == 0 || (ring_size & (ring_size - 1)) != 0) {
+        throw std::invalid_argument("ShmRegion::create: ring_size must be "
+                                        "a power of two");
+    }
+
+    int fd = memfd_create("memcached-shm", MFD_CLOEXEC);
+    if (fd == -1) {
+        throw std::runtime_error(std::string("memfd_create failed: ") +
+                                 strerror(errno));
+    }
+
+    const size_t size = header_size() + 2 * ring_size;
+    if (ftruncate(fd, off_t(size)) == -1) {
+        const std::string msg = std::string("ftruncate failed: ") +
+                                strerror(errno);
+        close(fd);
+        throw std::runtime_error(msg);
+    }
+
+    void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        const std::string msg = std::string("mmap failed: ") + strerror(errno);
+        close(fd);
+        throw std::runtime_error(msg);
+    }
+
+    // The memfd is zero filled so only the fixed fields need to be set
+    auto* header = new (base) ShmRegionHeader;
+    header->magic = magic;
+    header->version = version;
+    header->ring_size = ring_size;
+    header->data_offset = header_size();
+
+    return std::unique_ptr<ShmRegion>(new ShmRegion(fd, base, size,
+                                                    ring_size));
+}
+
+std::unique_ptr<ShmRegion> ShmRegion::attach(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) == -1 || size_t(st.st_size) < header_size()) {
+        close(fd);
+        throw std::runtime_error("ShmRegion::attach: invalid region");
+    }
+
+    const size_t size = size_t(st.st_size);
+    void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        const std::string msg = std::string("mmap failed: ") + strerror(errno);
+        close(fd);
+        throw std::runtime_error(msg);
+    }
+
+    const auto* header = static_cast<const ShmRegionHeader*>(base);
+    const size_t ring_size = size_t(header->ring_size);
+    if (header->magic != magic || header->version != version ||
+        header->data_offset != header_size() ||
+        header->data_offset + 2 * ring_size != size) {
+        munmap(base, size);
+        close(fd);
+        throw std::runtime_error("ShmRegion::attach: unsupported region");
+    }
+
+    return std::unique_ptr<ShmRegion>(new ShmRegion(fd, base, size,
+                                                    ring_size));
+}
+
+ShmRegion::~ShmRegion() {
+    munmap(base, mapped);
+    close(fd);
+}
+
+void shm_ring_doorbell(int fd) {
+    // The only possible error is EAGAIN when the counter overflows, and
+    // then the doorbell is rung anyway
+    (void)eventfd_write(fd, 1);
+}
+
+void shm_drain_doorbell(int fd) {
+    eventfd_t value;
+    (void)eventfd_read(fd, &value);
+}
+#else
+std::unique_ptr<ShmRegion> ShmRegion::create(size_t) {
+    throw std::runtime_error("The shared memory transport isn't supported "
+                                 "on this platform");
+}
+
+std::unique_ptr<ShmRegion> ShmRegion::attach(int) {
+    throw std::runtime_error("The shared memory transport isn't supported "
+                                 "on this platform");
+}
+
+ShmRegion::~ShmRegion() {
+}
+#endif
@@ -0,0 +1,229 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * The shared memory transport for clients on the same host.
+ *
+ * A client connected to a Unix domain socket may send SHM_CONNECT to get a
+ * memfd with a pair of single producer / single consumer byte rings (one
+ * for the requests and one for the responses) and two eventfd doorbells
+ * (one for each side). The MCBP frames are then copied through the rings
+ * instead of being sent through the socket, and the doorbell is only rung
+ * when the other side said it is about to sleep, so a busy connection
+ * runs without any system calls at all.
+ *
+ * The same code is used by the server and the clients, so the layout of
+ * the region is versioned and must not change without bumping
+ * ShmRegion::version.
+ */
+#pragma once
+
+#include "config.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#if defined(HAVE_MEMFD_CREATE) && defined(HAVE_EVENTFD)
+#define HAVE_SHM_TRANSPORT 1
+#endif
+
+#ifndef WIN32
+#include <sys/uio.h>
+#endif
+
+static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t),
+              "The ring positions must be usable from both processes");
+
+/**
+ * The control block for one direction. The producer updates head and the
+ * consumer updates tail (both are free running byte counters). They live
+ * on their own cache lines so the two sides don't fight over the line for
+ * every update.
+ */
+struct ShmRingControl {
+    alignas(64) std::atomic<uint64_t> head;
+    alignas(64) std::atomic<uint64_t> tail;
+    /* Set by the consumer before it sleeps on its doorbell */
+    alignas(64) std::atomic<uint32_t> consumer_waiting;
+    /* Set by the producer before it sleeps on its doorbell */
+    std::atomic<uint32_t> producer_waiting;
+    /* Set by the producer when it won't write any more */
+    std::atomic<uint32_t> closed;
+};
+
+/**
+ * A view of one direction of the transport
+ */
+class ShmRing {
+public:
+    ShmRing(ShmRingControl& ctl, uint8_t* data, size_t size)
+        : control(ctl),
+          buffer(data),
+          mask(size - 1) {
+    }
+
+    /**
+     * Copy as much of the iovecs as there is room for into the ring
+     * (producer only). The data is published when the copy completes.
+     *
+     * @return the number of bytes copied (0 if the ring is full)
+     */
+    size_t write(const struct iovec* iov, size_t iovcnt);
+
+    size_t write(const void* data, size_t nbytes);
+
+    /**
+     * Copy up to nbytes out of the ring (consumer only)
+     *
+     * @return the number of bytes copied (0 if the ring is empty)
+     */
+    size_t read(void* dest, size_t nbytes);
+
+    /** The number of bytes available for the consumer */
+    size_t used() const {
+        return size_t(control.head.load(std::memory_order_acquire) -
+                      control.tail.load(std::memory_order_acquire));
+    }
+
+    /** The number of bytes the producer may write */
+    size_t space() const {
+        return capacity() - used();
+    }
+
+    size_t capacity() const {
+        return mask + 1;
+    }
+
+    /**
+     * The consumer found the ring empty and wants to sleep on its
+     * doorbell. Tell the producer and look again (the producer may have
+     * written just before it saw the flag).
+     *
+     * @return true if the ring is still empty and the consumer may sleep
+     */
+    bool prepareToWaitForData();
+
+    /**
+     * The producer found the ring full and wants to sleep on its
+     * doorbell until the consumer made room.
+     *
+     * @return true if the ring is still full and the producer may sleep
+     */
+    bool prepareToWaitForSpace();
+
+    /**
+     * Called by the producer after it wrote data
+     *
+     * @return true if the consumer is sleeping and the caller must ring
+     *         the consumer's doorbell
+     */
+    bool wakeConsumer() {
+        return control.consumer_waiting.load(std::memory_order_seq_cst) != 0 &&
+               control.consumer_waiting.exchange(0) != 0;
+    }
+
+    /**
+     * Called by the consumer after it read data
+     *
+     * @return true if the producer is sleeping and the caller must ring
+     *         the producer's doorbell
+     */
+    bool wakeProducer() {
+        return control.producer_waiting.load(std::memory_order_seq_cst) != 0 &&
+               control.producer_waiting.exchange(0) != 0;
+    }
+
+    /** The producer won't write any more */
+    void close() {
+        control.closed.store(1, std::memory_order_release);
+    }
+
+    bool isClosed() const {
+        return control.closed.load(std::memory_order_acquire) != 0;
+    }
+
+private:
+    ShmRingControl& control;
+    uint8_t* const buffer;
+    const size_t mask;
+};
+
+/**
+ * The memory region shared with the client
+ */
+class ShmRegion {
+public:
+    /**
+     * Create a new region in a memfd with two rings of the given size
+     *
+     * @param ring_size the size of each ring (a power of two)
+     * @throws std::runtime_error if the region can't be created
+     */
+    static std::unique_ptr<ShmRegion> create(size_t ring_size);
+
+    /**
+     * Map a region created by the server (used by the clients). The
+     * region takes ownership of the descriptor.
+     *
+     * @throws std::runtime_error if the region is invalid
+     */
+    static std::unique_ptr<ShmRegion> attach(int fd);
+
+    ~ShmRegion();
+
+    ShmRegion(const ShmRegion&) = delete;
+
+    /** The memfd backing the region */
+    int getDescriptor() const {
+        return fd;
+    }
+
+    size_t getRingSize() const {
+        return ring_size;
+    }
+
+    /** The ring carrying the requests from the client to the server */
+    ShmRing getRequestRing();
+
+    /** The ring carrying the responses from the server to the client */
+    ShmRing getResponseRing();
+
+    static const uint32_t magic = 0x4d435348; // "MCSH"
+    static const uint32_t version = 1;
+
+protected:
+    ShmRegion(int fd, void* base, size_t mapped, size_t ring_size);
+
+    const int fd;
+    uint8_t* const base;
+    const size_t mapped;
+    const size_t ring_size;
+};
+
+#ifdef HAVE_SHM_TRANSPORT
+/**
+ * Ring an eventfd doorbell
+ */
+void shm_ring_doorbell(int fd);
+
+/**
+ * Reset an eventfd doorbell (the caller is about to look for more work)
+ */
+void shm_drain_doorbell(int fd);
+#endif
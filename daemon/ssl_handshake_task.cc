@@ -0,0 +1,50 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include "config.h"
+#include "ssl_handshake_task.h"
+#include "memcached.h"
+
+SslHandshakeTimings ssl_handshake_timings;
+
+SslHandshakeTask::SslHandshakeTask(McbpConnection& connection_)
+    : Task(Priority::Normal),
+      connection(connection_),
+      result(0),
+      complete(false) {
+    // no more init needed
+}
+
+bool SslHandshakeTask::execute() {
+    result = connection.sslAccept();
+    return true;
+}
+
+void SslHandshakeTask::notifyExecutionComplete() {
+    // Hold the thread lock (like release_cookie) so that the worker
+    // thread can't see the task as complete and release the connection
+    // before we're done touching it
+    auto* thr = connection.getThread();
+    LOCK_THREAD(thr);
+    complete.store(true);
+    connection.setRunnable();
+    const int notify = add_conn_to_pending_io_list(thr, &connection);
+    UNLOCK_THREAD(thr);
+
+    if (notify) {
+        notify_thread(thr);
+    }
+}
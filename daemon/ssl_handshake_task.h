@@ -0,0 +1,81 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include "task.h"
+#include "timing_histogram.h"
+
+#include <atomic>
+
+class McbpConnection;
+
+/**
+ * The time spent in SSL_accept() for the handshakes completed by the
+ * server (only the CPU time used by OpenSSL, not the time waiting for
+ * the client).
+ */
+struct SslHandshakeTimings {
+    /** Full handshakes */
+    TimingHistogram full;
+    /** Handshakes which resumed a previous session */
+    TimingHistogram resumed;
+};
+
+extern SslHandshakeTimings ssl_handshake_timings;
+
+/**
+ * The SslHandshakeTask runs a step of the SSL handshake (SSL_accept)
+ * for a connection on the executor pool, so that the public key
+ * operations in a full handshake don't block the other connections
+ * served by the worker thread.
+ *
+ * The worker thread fills the input BIO before the task is scheduled,
+ * and leaves the SSL stream alone (the connection waits in the
+ * conn_ssl_handshake state with its event unregistered) until the task
+ * notifies it.
+ */
+class SslHandshakeTask : public Task {
+public:
+    SslHandshakeTask() = delete;
+
+    SslHandshakeTask(const SslHandshakeTask&) = delete;
+
+    SslHandshakeTask(McbpConnection& connection_);
+
+    virtual bool execute() override;
+
+    virtual void notifyExecutionComplete() override;
+
+    /**
+     * Has the executor run SSL_accept? (the result is available)
+     */
+    bool isComplete() const {
+        return complete.load();
+    }
+
+    /**
+     * Get the return value from SSL_accept()
+     */
+    int getResult() const {
+        return result;
+    }
+
+protected:
+    McbpConnection& connection;
+    int result;
+    std::atomic_bool complete;
+};
@@ -0,0 +1,86 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include "config.h"
+#include "ssl_server_ctx.h"
+#include "memcached.h"
+#include "runtime.h"
+
+#include <map>
+#include <mutex>
+
+static std::mutex ssl_server_ctx_mutex;
+static std::map<std::pair<std::string, std::string>, SSL_CTX*> ssl_server_ctx;
+
+/* The session id context must be set for the server side session cache */
+static const unsigned char session_id_context[] = "memcached";
+
+static SSL_CTX* create_ssl_server_ctx(const std::string& cert,
+                                      const std::string& pkey) {
+    SSL_CTX* ctx = SSL_CTX_new(SSLv23_server_method());
+    if (ctx == nullptr) {
+        LOG_WARNING(nullptr, "Failed to create SSL context");
+        return nullptr;
+    }
+    set_ssl_ctx_protocol_mask(ctx);
+
+    if (!SSL_CTX_use_certificate_chain_file(ctx, cert.c_str()) ||
+        !SSL_CTX_use_PrivateKey_file(ctx, pkey.c_str(), SSL_FILETYPE_PEM)) {
+        LOG_WARNING(nullptr, "Failed to use SSL cert %s and pkey %s",
+                    cert.c_str(), pkey.c_str());
+        SSL_CTX_free(ctx);
+        return nullptr;
+    }
+
+    set_ssl_ctx_cipher_list(ctx);
+
+    const auto cache_size = settings.getSslSessionCacheSize();
+    if (cache_size == 0) {
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+        SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+    } else {
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(ctx, long(cache_size));
+        SSL_CTX_set_session_id_context(ctx, session_id_context,
+                                       sizeof(session_id_context) - 1);
+    }
+
+    return ctx;
+}
+
+SSL_CTX* ssl_server_ctx_get(const std::string& cert, const std::string& pkey) {
+    std::lock_guard<std::mutex> guard(ssl_server_ctx_mutex);
+    const auto key = std::make_pair(cert, pkey);
+    auto iter = ssl_server_ctx.find(key);
+    if (iter != ssl_server_ctx.end()) {
+        return iter->second;
+    }
+
+    SSL_CTX* ctx = create_ssl_server_ctx(cert, pkey);
+    if (ctx != nullptr) {
+        ssl_server_ctx[key] = ctx;
+    }
+    return ctx;
+}
+
+void ssl_server_ctx_invalidate() {
+    std::lock_guard<std::mutex> guard(ssl_server_ctx_mutex);
+    for (auto& entry : ssl_server_ctx) {
+        // The SSL objects using the context hold their own reference
+        SSL_CTX_free(entry.second);
+    }
+    ssl_server_ctx.clear();
+}
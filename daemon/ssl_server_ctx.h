@@ -0,0 +1,53 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * The SSL_CTX used by the SSL connections.
+ *
+ * All connections using the same certificate and private key share a
+ * single SSL_CTX, which holds the server side session cache and the keys
+ * used to encrypt the session tickets. This lets a client which
+ * reconnects resume its session (an abbreviated handshake without the
+ * public key operations) instead of running a full handshake.
+ *
+ * The contexts are created on first use with the current cipher list,
+ * protocol mask and session cache size, and must be invalidated when
+ * any of those (or the certificates) change. Connections already created
+ * keep a reference to the context they use.
+ */
+#pragma once
+
+#include <memcached/openssl.h>
+#include <string>
+
+/**
+ * Get the shared server context for the certificate and private key
+ *
+ * @param cert the certificate chain file
+ * @param pkey the private key file
+ * @return the context (owned by the cache, so the caller must not free
+ *         it; SSL_new() grabs its own reference), or nullptr if the
+ *         certificate or key couldn't be used
+ */
+SSL_CTX* ssl_server_ctx_get(const std::string& cert, const std::string& pkey);
+
+/**
+ * Drop all of the cached contexts so that the next connection creates a
+ * new one (with the current configuration and certificates). The
+ * sessions cached by the old contexts can't be resumed any more.
+ */
+void ssl_server_ctx_invalidate();
@@ -111,6 +111,8 @@ const char* McbpStateMachine::getTaskName(TaskFunction task) const {
         return "conn_delete_bucket";
     } else if (task == conn_sasl_auth) {
         return "conn_sasl_auth";
+    } else if (task == conn_ssl_handshake) {
+        return "conn_ssl_handshake";
     } else {
         throw std::invalid_argument("Unknown task");
     }
@@ -131,6 +133,13 @@ static void reset_cmd_handler(McbpConnection *c) {
     }
 
     c->shrinkBuffers();
+
+    // Commands parked on a connection using unordered execution are
+    // resumed before we start on the next command from the client
+    if (c->resumeParkedCommand()) {
+        return;
+    }
+
     if (c->read.bytes > 0) {
         c->setState(conn_parse_cmd);
     } else {
@@ -223,6 +232,17 @@ bool conn_read(McbpConnection *c) {
         return true;
     }
 
+    if (c->needsSslHandshake()) {
+        c->setState(conn_ssl_handshake);
+        return true;
+    }
+
+    if (c->hasReadyCommands()) {
+        // The engine completed one of the parked commands
+        c->setState(conn_new_cmd);
+        return true;
+    }
+
     switch (c->tryReadNetwork()) {
     case McbpConnection::TryReadResult::NoDataReceived:
         if (settings.isExitOnConnectionClose()) {
@@ -247,6 +267,23 @@ bool conn_read(McbpConnection *c) {
 }
 
 bool conn_parse_cmd(McbpConnection *c) {
+    if (c->mustWaitForParkedCommands()) {
+        if (c->hasReadyCommands()) {
+            c->setState(conn_new_cmd);
+            return true;
+        }
+
+        // Stop reading from the socket until the engine notifies one
+        // of the parked commands
+        if (c->isRegisteredInLibevent()) {
+            if (c->isOverOutputLimits()) {
+                get_thread_stats(c)->output_throttled++;
+            }
+            c->unregisterEvent();
+        }
+        return false;
+    }
+
     if (try_read_mcbp_command(c) == 0) {
         /* wee need more data! */
         c->setState(conn_waiting);
@@ -267,7 +304,8 @@ bool conn_new_cmd(McbpConnection *c) {
      * connection will only process a certain number of operations
      * before they will back off.
      */
-    if (c->decrementNumEvents() >= 0) {
+    if (c->decrementNumEvents() >= 0 && !c->isTimeSliceExhausted()) {
+        c->getThread()->load.ops++;
         reset_cmd_handler(c);
     } else {
         get_thread_stats(c)->conn_yields++;
@@ -284,7 +322,8 @@ bool conn_new_cmd(McbpConnection *c) {
          * connections in the way that they may not even get data from
          * the other end so that they'll _have_ to wait for a write event.
          */
-        if (c->havePendingInputData() || c->isDCP() || c->isTAP()) {
+        if (c->havePendingInputData() || c->hasReadyCommands() ||
+            c->isDCP() || c->isTAP()) {
             short flags = EV_WRITE | EV_PERSIST;
             // pipe requires EV_READ forcing to ensure we can read until EOF
             if (c->isPipeConnection()) {
@@ -294,6 +333,7 @@ bool conn_new_cmd(McbpConnection *c) {
                 c->setState(conn_closing);
                 return true;
             }
+            c->setRunnable();
         }
         return false;
     }
@@ -311,10 +351,21 @@ bool conn_nread(McbpConnection *c) {
     if (c->getRlbytes() == 0) {
         c->setEwouldblock(false);
         bool block = false;
+        c->startCommand();
         mcbp_complete_nread(c);
         if (c->isEwouldblock()) {
-            c->unregisterEvent();
-            block = true;
+            if (c->parkCommand()) {
+                // Move on to the next command while the engine works
+                // on this one
+                if (c->getState() == conn_nread) {
+                    c->setState(conn_new_cmd);
+                }
+            } else {
+                c->unregisterEvent();
+                block = true;
+            }
+        } else {
+            c->endCommand();
         }
         return !block;
     }
@@ -440,10 +491,13 @@ bool conn_pending_close(McbpConnection *c) {
      */
     perform_callbacks(ON_DISCONNECT, NULL, c->getCookie());
 
-    if (c->getRefcount() > 1) {
+    if (c->getRefcount() > 1 || c->hasOutstandingCommands() ||
+        c->isSslHandshakeRunning()) {
         return false;
     }
 
+    // The engine is done with all of the parked commands
+    c->releaseParkedCommands();
     c->setState(conn_immediate_close);
     return true;
 }
@@ -457,7 +511,8 @@ bool conn_immediate_close(McbpConnection *c) {
 
     {
         std::lock_guard<std::mutex> guard(stats_mutex);
-        port_instance = get_listening_port_instance(c->getParentPort());
+        port_instance = get_listening_port_instance(c->getParentPort(),
+                                                    c->getParentPath());
         if (port_instance) {
             --port_instance->curr_conns;
         } else if(!c->isPipeConnection()) {
@@ -466,6 +521,7 @@ bool conn_immediate_close(McbpConnection *c) {
         }
     }
 
+    c->releaseRetainedCommands();
     perform_callbacks(ON_DISCONNECT, NULL, c->getCookie());
     disassociate_bucket(c);
     conn_close(c);
@@ -482,7 +538,8 @@ bool conn_closing(McbpConnection *c) {
     /* engine::release any allocated state */
     conn_cleanup_engine_allocations(c);
 
-    if (c->getRefcount() > 1 || c->isEwouldblock()) {
+    if (c->getRefcount() > 1 || c->isEwouldblock() ||
+        c->hasParkedCommands() || c->isSslHandshakeRunning()) {
         c->setState(conn_pending_close);
     } else {
         c->setState(conn_immediate_close);
@@ -644,6 +701,15 @@ bool conn_delete_bucket(McbpConnection *c) {
     return true;
 }
 
+/**
+ * Run the SSL handshake on the executor pool (so that the public key
+ * operations don't block the other connections bound to the thread).
+ * The connection returns to conn_read once the handshake completes.
+ */
+bool conn_ssl_handshake(McbpConnection* c) {
+    return c->runSslHandshake();
+}
+
 bool conn_sasl_auth(McbpConnection* c) {
     c->setAiostat(ENGINE_SUCCESS);
     c->setEwouldblock(false);
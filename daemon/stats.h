@@ -48,6 +48,18 @@ struct thread_stats {
         bytes_read = 0;
         cmd_flush = 0;
         conn_yields = 0;
+        sched_throttled = 0;
+        rate_limited = 0;
+        cmd_shed = 0;
+        output_throttled = 0;
+        slow_reader_disconnects = 0;
+        ktls_offloaded = 0;
+        ktls_fallbacks = 0;
+        ssl_handshakes = 0;
+        ssl_resumptions = 0;
+        compressed_values = 0;
+        compression_cache_hits = 0;
+        bytes_compression_saved = 0;
         auth_cmds = 0;
         auth_errors = 0;
         cmd_subdoc_lookup = 0;
@@ -86,6 +98,18 @@ struct thread_stats {
         bytes_written += other.bytes_written;
         cmd_flush += other.cmd_flush;
         conn_yields += other.conn_yields;
+        sched_throttled += other.sched_throttled;
+        rate_limited += other.rate_limited;
+        cmd_shed += other.cmd_shed;
+        output_throttled += other.output_throttled;
+        slow_reader_disconnects += other.slow_reader_disconnects;
+        ktls_offloaded += other.ktls_offloaded;
+        ktls_fallbacks += other.ktls_fallbacks;
+        ssl_handshakes += other.ssl_handshakes;
+        ssl_resumptions += other.ssl_resumptions;
+        compressed_values += other.compressed_values;
+        compression_cache_hits += other.compression_cache_hits;
+        bytes_compression_saved += other.bytes_compression_saved;
         auth_cmds += other.auth_cmds;
         auth_errors += other.auth_errors;
         cmd_subdoc_lookup += other.cmd_subdoc_lookup;
@@ -131,6 +155,33 @@ struct thread_stats {
     Couchbase::RelaxedAtomic<uint64_t> bytes_written;
     Couchbase::RelaxedAtomic<uint64_t> cmd_flush;
     Couchbase::RelaxedAtomic<uint64_t> conn_yields; /* # of yields for connections (-R option)*/
+    /* # of times a connection got a reduced budget because its bucket used
+       more than its share of the worker thread */
+    Couchbase::RelaxedAtomic<uint64_t> sched_throttled;
+    /* # of commands rejected because the bucket was over its rate limits */
+    Couchbase::RelaxedAtomic<uint64_t> rate_limited;
+    /* # of commands rejected because the worker thread was shedding load */
+    Couchbase::RelaxedAtomic<uint64_t> cmd_shed;
+    /* # of times a connection stopped reading (or shipping) because it
+       held more than max_pending_bytes/max_pinned_items */
+    Couchbase::RelaxedAtomic<uint64_t> output_throttled;
+    /* # of connections closed because the client didn't read its data
+       within slow_reader_timeout */
+    Couchbase::RelaxedAtomic<uint64_t> slow_reader_disconnects;
+    /* # of SSL connections offloaded to the kernel (kTLS) */
+    Couchbase::RelaxedAtomic<uint64_t> ktls_offloaded;
+    /* # of SSL connections which tried kTLS but stayed with OpenSSL */
+    Couchbase::RelaxedAtomic<uint64_t> ktls_fallbacks;
+    /* # of SSL handshakes completed with a full handshake */
+    Couchbase::RelaxedAtomic<uint64_t> ssl_handshakes;
+    /* # of SSL handshakes which resumed a previous session */
+    Couchbase::RelaxedAtomic<uint64_t> ssl_resumptions;
+    /* # of values compressed for clients which asked for it in HELLO */
+    Couchbase::RelaxedAtomic<uint64_t> compressed_values;
+    /* # of the compressed values found in the compression cache */
+    Couchbase::RelaxedAtomic<uint64_t> compression_cache_hits;
+    /* # of bytes not sent thanks to compression */
+    Couchbase::RelaxedAtomic<uint64_t> bytes_compression_saved;
     Couchbase::RelaxedAtomic<uint64_t> auth_cmds;
     Couchbase::RelaxedAtomic<uint64_t> auth_errors;
     /* # of subdoc lookup commands (GET/EXISTS/MULTI_LOOKUP) */
@@ -194,6 +245,11 @@ struct listening_port {
     bool ipv4;
     bool tcp_nodelay;
     bool management;
+    bool reuseport;
+    uint32_t busy_poll;
+    /* The path for Unix domain sockets (empty for TCP ports) */
+    std::string path;
+    uint32_t permissions;
     Protocol protocol;
 };
 
@@ -216,6 +272,9 @@ struct stats {
     /** The number of times I reject a client */
     Couchbase::RelaxedAtomic<uint64_t> rejected_conns;
 
+    /** The number of connections moved between worker threads */
+    Couchbase::RelaxedAtomic<uint64_t> migrated_conns;
+
     std::vector<listening_port> listening_ports;
 };
 
@@ -29,7 +29,20 @@ class Executor;
  */
 class Task {
 public:
-    Task() : executor(nullptr) {
+    /**
+     * The priority of the task. Runnable tasks with a higher priority
+     * is executed before the ones with a lower priority (tasks with the
+     * same priority is executed in FIFO order).
+     */
+    enum class Priority : uint8_t {
+        High,
+        Normal,
+        Low
+    };
+
+    Task(Priority priority_ = Priority::Normal)
+        : executor(nullptr),
+          priority(priority_) {
         // empty
     }
 
@@ -75,6 +88,10 @@ public:
      */
     void makeRunnable();
 
+    Priority getPriority() const {
+        return priority;
+    }
+
 private:
     /**
      * The task is pinned to an executor thread while being executed. In
@@ -87,15 +104,14 @@ private:
     friend class Executor;
 
     /**
-     * Set the executor that is supposed to handle this task. Once the
-     * task is pinned to an executor it cannot be moved.
+     * Set the executor that is supposed to handle this task. A runnable
+     * task may be stolen by another executor (which then owns the task)
+     * but it may not move while it is executing or waiting to be made
+     * runnable.
      *
      * @param executor_ the executor used to run the task
      */
     void setExecutor(Executor *executor_) {
-        if (executor != nullptr && executor != executor_) {
-            throw std::logic_error("The task can't switch executor");
-        }
         executor = executor_;
     }
 
@@ -104,6 +120,11 @@ private:
      */
     Executor* executor;
 
+    /**
+     * The priority of the task
+     */
+    const Priority priority;
+
     /**
      * The mutex used to ensure that different threads don't race trying
      * to set the tasks internal state
@@ -5,6 +5,8 @@
 #include "config.h"
 #include "memcached.h"
 #include "connections.h"
+#include "cpu_affinity.h"
+#include "tsc_clock.h"
 
 #include <atomic>
 #include <stdio.h>
@@ -20,6 +22,14 @@
 #include <queue>
 #include <memory>
 
+#ifdef HAVE_EVENTFD
+#include <sys/eventfd.h>
+#endif
+
+#ifdef HAVE_LIBNUMA
+#include <numa.h>
+#endif
+
 #define ITEMS_PER_ALLOC 64
 
 static char devnull[8192];
@@ -27,14 +37,28 @@ extern std::atomic<bool> memcached_shutdown;
 
 /* An item in the connection queue. */
 struct ConnectionQueueItem {
-    ConnectionQueueItem(SOCKET sock, in_port_t port)
+    ConnectionQueueItem(SOCKET sock, in_port_t port, const std::string& path)
         : sfd(sock),
-          parent_port(port) {
+          parent_port(port),
+          parent_path(path),
+          connection(nullptr) {
+        // empty
+    }
+
+    ConnectionQueueItem(McbpConnection* c)
+        : sfd(c->getSocketDescriptor()),
+          parent_port(c->getParentPort()),
+          parent_path(c->getParentPath()),
+          connection(c) {
         // empty
     }
 
     SOCKET sfd;
     in_port_t parent_port;
+    /* The path of the Unix domain socket (empty for TCP) */
+    std::string parent_path;
+    /* An existing connection moved over from another worker thread */
+    McbpConnection* connection;
 };
 
 class ConnectionQueue {
@@ -89,6 +113,28 @@ static cb_cond_t init_cond;
 
 static void thread_libevent_process(evutil_socket_t fd, short which, void *arg);
 
+/*
+ * The dispatcher samples the load on the worker threads once a second
+ */
+static struct event load_sample_event;
+
+/* The weight of a new sample in the moving averages of the thread load */
+static const double load_sample_weight = 0.25;
+
+/*
+ * We only try to move connections away from a thread if it has been busy
+ * more than half of the time, and twice as busy as the least loaded
+ * thread for 5 samples in a row.
+ */
+static const double rebalance_min_busy_rate = 0.5e9;
+static const double rebalance_factor = 2.0;
+static const int rebalance_samples = 5;
+
+/* The interval (in usec) between each time a worker samples its lag */
+static const int shed_sample_interval = 10000;
+
+static void shed_sample(evutil_socket_t, short, void* arg);
+
 /*
  * Creates a worker thread.
  */
@@ -143,6 +189,35 @@ bool create_notification_pipe(LIBEVENT_THREAD *me)
     return true;
 }
 
+/*
+ * The worker threads use an eventfd (where available) for notifications.
+ * An eventfd is a single file descriptor, and the cost of signalling it is
+ * lower than sending data over a socket pair. The dispatcher thread keeps
+ * the socket pair as it counts the bytes it receives.
+ */
+static bool create_notification_channel(LIBEVENT_THREAD *me)
+{
+#ifdef HAVE_EVENTFD
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd != -1) {
+        me->notify[0] = me->notify[1] = fd;
+        return true;
+    }
+    LOG_WARNING(nullptr, "Failed to create eventfd: %s. Using socketpair",
+                cb_strerror().c_str());
+#endif
+
+    return create_notification_pipe(me);
+}
+
+static void close_notification_channel(LIBEVENT_THREAD *me)
+{
+    safe_close(me->notify[0]);
+    if (me->notify[1] != me->notify[0]) {
+        safe_close(me->notify[1]);
+    }
+}
+
 static void setup_dispatcher(struct event_base *main_base,
                              void (*dispatcher_callback)(evutil_socket_t, short, void *))
 {
@@ -195,6 +270,10 @@ static void setup_thread(LIBEVENT_THREAD *me) {
         FATAL_ERROR(EXIT_FAILURE, "Can't monitor libevent notify pipe");
     }
 
+    if (evtimer_assign(&me->shed.timer, me->base, shed_sample, me) == -1) {
+        FATAL_ERROR(EXIT_FAILURE, "Can't create load shedding timer");
+    }
+
     try {
         me->new_conn_queue = new ConnectionQueue;
     } catch (std::bad_alloc&) {
@@ -202,6 +281,23 @@ static void setup_thread(LIBEVENT_THREAD *me) {
     }
 
     cb_mutex_initialize(&me->mutex);
+}
+
+/*
+ * Allocate the buffers and objects shared by all of the connections
+ * served by the thread. This is run by the worker thread itself after
+ * it is bound to its CPU, so that the memory is allocated from the
+ * thread's local NUMA node.
+ */
+static void setup_thread_buffers(LIBEVENT_THREAD *me) {
+#ifdef HAVE_LIBNUMA
+    // memcached_main sets the process wide policy to interleave the
+    // memory across all nodes. A thread bound to a single CPU should
+    // rather use memory on its own node.
+    if (me->cpu != -1 && numa_available() == 0) {
+        numa_set_localalloc();
+    }
+#endif
 
     // Initialize threads' sub-document parser / handler
     me->subdoc_op = subdoc_op_alloc();
@@ -211,6 +307,126 @@ static void setup_thread(LIBEVENT_THREAD *me) {
     } catch (const std::bad_alloc&) {
         FATAL_ERROR(EXIT_FAILURE, "Failed to allocate memory for JSON validator");
     }
+
+    // Preallocate the read and write buffers loaned to the connections.
+    // If we fail they're allocated on demand (see conn_loan_buffers())
+    for (auto* buf : {&me->read, &me->write}) {
+        buf->buf = reinterpret_cast<char*>(malloc(DATA_BUFFER_SIZE));
+        if (buf->buf != nullptr) {
+            // Touch the memory so that the pages are faulted in on our node
+            memset(buf->buf, 0, DATA_BUFFER_SIZE);
+            buf->size = DATA_BUFFER_SIZE;
+            buf->curr = buf->buf;
+            buf->bytes = 0;
+        }
+    }
+}
+
+/*
+ * Should the thread poll for more work before it goes to sleep?
+ */
+static bool use_busy_poll(const LIBEVENT_THREAD* me) {
+    if (settings.getBusyPoll() == 0) {
+        return false;
+    }
+    const int nthr = settings.getBusyPollThreads();
+    return nthr == 0 || me->index < nthr;
+}
+
+/*
+ * Keep on polling the pending io list and the sockets bound to the thread
+ * until we haven't found any work for the configured number of
+ * microseconds. The time spent serving connections is tracked in
+ * load.busy_time, so everything else we spend in here is spin time.
+ */
+static void worker_busy_poll(LIBEVENT_THREAD* me) {
+    const hrtime_t window = hrtime_t(settings.getBusyPoll()) * 1000;
+    hrtime_t now = tsc_clock_now();
+    hrtime_t deadline = now + window;
+    uint64_t busy_time = me->load.busy_time;
+
+    while (now < deadline && !event_base_got_break(me->base)) {
+        if (me->pending_io.load(std::memory_order_relaxed) != nullptr) {
+            // Don't wait for the notification to be picked up by libevent
+            thread_libevent_process(me->notify[0], EV_READ, me);
+            if (event_base_got_break(me->base)) {
+                // The thread is stopping. event_base_loop clears the
+                // break flag when it starts, so we must not enter it
+                // again
+                return;
+            }
+        }
+        event_base_loop(me->base, EVLOOP_NONBLOCK);
+
+        const hrtime_t end = tsc_clock_now();
+        const uint64_t work = me->load.busy_time - busy_time;
+        const uint64_t elapsed = end - now;
+        busy_time += work;
+        me->busy_poll.polls++;
+        if (work > 0) {
+            me->busy_poll.hits++;
+            deadline = end + window;
+        }
+        if (elapsed > work) {
+            me->busy_poll.spin_time += elapsed - work;
+        }
+        now = end;
+    }
+}
+
+/*
+ * Schedule the next lag sample for the worker thread
+ */
+static void shed_arm_timer(LIBEVENT_THREAD* me) {
+    struct timeval tv = {0, shed_sample_interval};
+    me->shed.deadline = tsc_clock_now() + hrtime_t(shed_sample_interval) * 1000;
+    if (evtimer_add(&me->shed.timer, &tv) == -1) {
+        LOG_WARNING(nullptr, "Failed to schedule the load shedding timer "
+                    "for worker thread %d", me->index);
+        return;
+    }
+    me->shed.armed = true;
+}
+
+/*
+ * Sample the lag of the worker thread (runs in the worker thread every
+ * shed_sample_interval while load shedding is enabled), and start or stop
+ * shedding load. Shedding stops once the lag drops below half of the
+ * threshold so that the thread doesn't flip in and out of it.
+ */
+static void shed_sample(evutil_socket_t, short, void* arg) {
+    auto* me = reinterpret_cast<LIBEVENT_THREAD*>(arg);
+    me->shed.armed = false;
+
+    const hrtime_t threshold = hrtime_t(settings.getShedThreshold()) * 1000;
+    if (threshold == 0) {
+        me->shed.lag = 0;
+        me->shed.max_delay = 0;
+        me->shed.active = false;
+        return;
+    }
+
+    const hrtime_t now = tsc_clock_now();
+    hrtime_t sample = now > me->shed.deadline ? now - me->shed.deadline : 0;
+    if (me->shed.max_delay > sample) {
+        sample = me->shed.max_delay;
+    }
+    me->shed.max_delay = 0;
+
+    const uint64_t lag = (3 * uint64_t(me->shed.lag) + sample) / 4;
+    me->shed.lag = lag;
+    if (!me->shed.active && lag > threshold) {
+        me->shed.active = true;
+        me->shed.episodes++;
+        LOG_NOTICE(nullptr, "Worker thread %d: lag of %" PRIu64 " usec, "
+                   "start shedding load", me->index, lag / 1000);
+    } else if (me->shed.active && lag < threshold / 2) {
+        me->shed.active = false;
+        LOG_NOTICE(nullptr, "Worker thread %d: lag of %" PRIu64 " usec, "
+                   "stop shedding load", me->index, lag / 1000);
+    }
+
+    shed_arm_timer(me);
 }
 
 /*
@@ -222,30 +438,49 @@ static void worker_libevent(void *arg) {
     /* Any per-thread setup can happen here; thread_init() will block until
      * all threads have finished initializing.
      */
+    me->cpu = cpu_affinity_bind_worker_thread(me->index);
+    me->numa_node = cpu_affinity_get_numa_node(me->cpu);
+    setup_thread_buffers(me);
 
     cb_mutex_enter(&init_lock);
     init_count++;
     cb_cond_signal(&init_cond);
     cb_mutex_exit(&init_lock);
 
-    event_base_loop(me->base, 0);
+    // Run one iteration at the time (sleeping until there is work) so
+    // that we may switch to busy poll mode at runtime
+    while (!event_base_got_break(me->base)) {
+        if (!me->shed.armed && settings.getShedThreshold() != 0) {
+            shed_arm_timer(me);
+        }
+        if (use_busy_poll(me)) {
+            worker_busy_poll(me);
+            if (event_base_got_break(me->base)) {
+                break;
+            }
+            me->busy_poll.sleeps++;
+        }
+        event_base_loop(me->base, EVLOOP_ONCE);
+    }
 
     // Event loop exited; cleanup before thread exits.
     ERR_remove_state(0);
 }
 
-static int number_of_pending(Connection *c, Connection *list) {
-    int rv = 0;
-    for (; list; list = list->getNext()) {
-        if (list == c) {
-            rv ++;
+static void drain_notification_channel(LIBEVENT_THREAD* me, evutil_socket_t fd)
+{
+#ifdef HAVE_EVENTFD
+    if (me->notify[0] == me->notify[1]) {
+        // Reading the eventfd resets its counter
+        eventfd_t value;
+        if (eventfd_read(fd, &value) == -1 && errno != EAGAIN) {
+            LOG_WARNING(nullptr, "Can't read from eventfd: %s",
+                        cb_strerror().c_str());
         }
+        return;
     }
-    return rv;
-}
+#endif
 
-static void drain_notification_channel(evutil_socket_t fd)
-{
     int nread;
     while ((nread = recv(fd, devnull, sizeof(devnull), 0)) == (int)sizeof(devnull)) {
         /* empty */
@@ -257,18 +492,81 @@ static void drain_notification_channel(evutil_socket_t fd)
     }
 }
 
+/*
+ * Take over a connection moved from another worker thread
+ */
+static void adopt_connection(LIBEVENT_THREAD* me, McbpConnection* c) {
+    c->setMigrating(false);
+    if (!c->moveToEventBase(me->base)) {
+        LOG_WARNING(c, "%u: Failed to move connection to worker thread %u. "
+                    "Shutting down connection", c->getId(), me->index);
+        // Let the pending io handling run the connection through the
+        // state machinery to close it.
+        c->initateShutdown();
+        add_conn_to_pending_io_list(me, c);
+    }
+}
+
+/*
+ * Move the idle connection which is most likely to generate load over to
+ * another worker thread. Called by the thread itself (with the thread
+ * locked) after the dispatcher requested the move.
+ */
+static void migrate_idle_connection(LIBEVENT_THREAD* me, LIBEVENT_THREAD* to) {
+    auto* c = conn_find_migration_candidate(me);
+    if (c == nullptr) {
+        LOG_DEBUG(nullptr, "No idle connection to move away from worker "
+                  "thread %u", me->index);
+        return;
+    }
+
+    std::unique_ptr<ConnectionQueueItem> item;
+    try {
+        item.reset(new ConnectionQueueItem(c));
+    } catch (std::bad_alloc&) {
+        return;
+    }
+
+    if (!c->unregisterEvent()) {
+        return;
+    }
+
+    cb_assert(!c->isPendingIo());
+    LOG_INFO(c, "%u: Moving connection from worker thread %u to %u",
+             c->getId(), me->index, to->index);
+
+    // The connection is bound to the new thread right away so that it
+    // is accounted for while it is in the queue (by the shutdown and the
+    // bucket deletion), but it can't be signalled until the new thread
+    // picks it up from its queue
+    me->load.connections--;
+    c->setMigrating(true);
+    c->setThread(to);
+    to->load.connections++;
+    to->new_conn_queue->push(item);
+    stats.migrated_conns++;
+    notify_thread(to);
+}
+
 void dispatch_new_connections(LIBEVENT_THREAD* me) {
     std::unique_ptr<ConnectionQueueItem> item;
     while ((item = me->new_conn_queue->pop()) != nullptr) {
+        if (item->connection != nullptr) {
+            adopt_connection(me, item->connection);
+            continue;
+        }
+
         Connection* c = nullptr;
         if (item->sfd == fileno(stdin)) {
             c = conn_pipe_new(item->sfd, me->base, me);
         } else {
-            c = conn_new(item->sfd, item->parent_port, me->base, me);
+            c = conn_new(item->sfd, item->parent_port, item->parent_path,
+                         me->base, me);
         }
         if (c == nullptr) {
             LOG_WARNING(nullptr, "Failed to dispatch event for socket %ld",
                         long(item->sfd));
+            me->load.connections--;
             safe_close(item->sfd);
         }
     }
@@ -287,7 +585,8 @@ static void thread_libevent_process(evutil_socket_t fd, short which, void *arg)
     // tries to notify us while we're doing the work below (so we don't have
     // to care about race conditions for stuff people try to notify us
     // about.
-    drain_notification_channel(fd);
+    me->notified.store(false);
+    drain_notification_channel(me, fd);
 
     if (memcached_shutdown) {
         // Someone requested memcached to shut down. The listen thread should
@@ -307,14 +606,36 @@ static void thread_libevent_process(evutil_socket_t fd, short which, void *arg)
 
     dispatch_new_connections(me);
 
+    // Grab all of the connections with pending io. The list is built
+    // in LIFO order, so reverse it to serve the connections in the
+    // order they were notified.
+    Connection* pending = nullptr;
+    Connection* next = me->pending_io.exchange(nullptr);
+    while (next != nullptr) {
+        Connection* c = next;
+        next = c->getPendingNext();
+        c->setPendingNext(pending);
+        pending = c;
+    }
+
+    // The lock serialize the execution of the connections with
+    // release_cookie(), which may be called from other threads
     LOCK_THREAD(me);
-    Connection* pending = me->pending_io;
-    me->pending_io = NULL;
     while (pending != NULL) {
         Connection *c = pending;
+        pending = pending->getPendingNext();
+        c->setPendingNext(nullptr);
+        // Clear the flag before running the connection so that a
+        // notification arriving while it runs queues it again.
+        c->clearPendingIo();
+
+        if (c->getThread() == nullptr) {
+            // The connection was closed while it was queued, and is
+            // now released by run_event_loop
+            run_event_loop(c, EV_READ|EV_WRITE, me);
+            continue;
+        }
         cb_assert(me == c->getThread());
-        pending = pending->getNext();
-        c->setNext(nullptr);
 
         auto *mcbp = dynamic_cast<McbpConnection*>(c);
         if (mcbp != nullptr) {
@@ -332,7 +653,12 @@ static void thread_libevent_process(evutil_socket_t fd, short which, void *arg)
              */
             mcbp->setNumEvents(1);
         }
-        run_event_loop(c, EV_READ|EV_WRITE);
+        run_event_loop(c, EV_READ|EV_WRITE, me);
+    }
+
+    int target = me->load.migrate_to.exchange(-1);
+    if (target != -1 && !memcached_shutdown) {
+        migrate_idle_connection(me, threads + target);
     }
 
     /*
@@ -362,59 +688,6 @@ static void thread_libevent_process(evutil_socket_t fd, short which, void *arg)
 
 extern volatile rel_time_t current_time;
 
-static bool has_cycle(Connection *c) {
-    Connection *slowNode, *fastNode1, *fastNode2;
-
-    if (!c) {
-        return false;
-    }
-
-    slowNode = fastNode1 = fastNode2 = c;
-    while (slowNode && (fastNode1 = fastNode2->getNext()) && (fastNode2 = fastNode1->getNext())) {
-        if (slowNode == fastNode1 || slowNode == fastNode2) {
-            return true;
-        }
-        slowNode = slowNode->getNext();
-    }
-    return false;
-}
-
-bool list_contains(Connection *haystack, Connection *needle) {
-    for (; haystack; haystack = haystack->getNext()) {
-        if (needle == haystack) {
-            return true;
-        }
-    }
-    return false;
-}
-
-Connection * list_remove(Connection *haystack, Connection *needle) {
-    if (!haystack) {
-        return NULL;
-    }
-
-    if (haystack == needle) {
-        Connection *rv = needle->getNext();
-        needle->setNext(nullptr);
-        return rv;
-    }
-
-    haystack->setNext(list_remove(haystack->getNext(), needle));
-
-    return haystack;
-}
-
-static void enlist_conn(Connection *c, Connection **list) {
-    LIBEVENT_THREAD *thr = c->getThread();
-    cb_assert(list == &thr->pending_io);
-    cb_assert(!list_contains(thr->pending_io, c));
-    cb_assert(c->getNext() == nullptr);
-    c->setNext(*list);
-    *list = c;
-    cb_assert(list_contains(*list, c));
-    cb_assert(!has_cycle(*list));
-}
-
 void notify_io_complete(const void *void_cookie, ENGINE_ERROR_CODE status)
 {
     if (void_cookie == nullptr) {
@@ -439,15 +712,16 @@ void notify_io_complete(const void *void_cookie, ENGINE_ERROR_CODE status)
                 "notify_io_complete: connection should be bound to a thread");
         }
 
-        int notify;
-
         LOG_DEBUG(NULL, "Got notify from %u, status 0x%x",
                   connection->getId(), status);
 
-        LOCK_THREAD(thr);
-        reinterpret_cast<McbpConnection*>(connection)->setAiostat(status);
-        notify = add_conn_to_pending_io_list(connection);
-        UNLOCK_THREAD(thr);
+        // The status is published to the worker thread when the
+        // connection is added to the pending io list. The cookie may
+        // belong to one of the commands parked on the connection.
+        auto* mcbp = reinterpret_cast<McbpConnection*>(connection);
+        mcbp->setAiostat(*cookie, status);
+        mcbp->setRunnable();
+        int notify = add_conn_to_pending_io_list(thr, connection);
 
         /* kick the thread in the butt */
         if (notify) {
@@ -461,19 +735,145 @@ void notify_io_complete(const void *void_cookie, ENGINE_ERROR_CODE status)
 /* Which thread we assigned a connection to most recently. */
 static int last_thread = -1;
 
+/* The average load of the worker threads */
+struct LoadAverage {
+    double connections;
+    double busy_rate;
+    double ops_rate;
+};
+
+static LoadAverage get_average_load() {
+    LoadAverage ret = {0, 0, 0};
+    for (int ii = 0; ii < nthreads; ++ii) {
+        ret.connections += threads[ii].load.connections;
+        ret.busy_rate += threads[ii].load.busy_rate;
+        ret.ops_rate += threads[ii].load.ops_rate;
+    }
+    ret.connections /= nthreads;
+    ret.busy_rate /= nthreads;
+    ret.ops_rate /= nthreads;
+    return ret;
+}
+
+/*
+ * Get the load of the thread relative to the average load of all of the
+ * worker threads. Each of the number of connections, the busy time and
+ * the number of commands per second adds 1 to the score of a thread
+ * with an average load.
+ */
+static double get_load_score(const LIBEVENT_THREAD& thr,
+                             const LoadAverage& avg) {
+    double score = 0;
+    if (avg.connections > 0) {
+        score += thr.load.connections / avg.connections;
+    }
+    if (avg.busy_rate > 0) {
+        score += thr.load.busy_rate / avg.busy_rate;
+    }
+    if (avg.ops_rate > 0) {
+        score += thr.load.ops_rate / avg.ops_rate;
+    }
+    return score;
+}
+
+/*
+ * Pick the worker thread to serve a new connection. Start looking at the
+ * thread after the one we picked the last time (so that we end up doing
+ * round robin when the threads are equally loaded) and pick the thread
+ * with the lowest load score.
+ */
+static LIBEVENT_THREAD* get_least_loaded_thread() {
+    const auto avg = get_average_load();
+    int tid = (last_thread + 1) % nthreads;
+    double lowest = get_load_score(threads[tid], avg);
+
+    for (int ii = 1; ii < nthreads; ++ii) {
+        int idx = (last_thread + 1 + ii) % nthreads;
+        double score = get_load_score(threads[idx], avg);
+        if (score < lowest) {
+            lowest = score;
+            tid = idx;
+        }
+    }
+
+    last_thread = tid;
+    return threads + tid;
+}
+
+/*
+ * Sample the load on the worker threads (runs once a second in the
+ * dispatcher thread). If connection rebalancing is enabled we ask the
+ * busiest thread to move an idle connection over to the least loaded
+ * thread once the imbalance has persisted for a while.
+ */
+static void threads_sample_load(evutil_socket_t, short, void *) {
+    static int imbalanced = 0;
+
+    int busiest = 0;
+    int idlest = 0;
+    for (int ii = 0; ii < nthreads; ++ii) {
+        auto& load = threads[ii].load;
+        const uint64_t busy_time = load.busy_time;
+        const uint64_t ops = load.ops;
+
+        load.busy_rate += load_sample_weight *
+            (double(busy_time - load.last_busy_time) - load.busy_rate);
+        load.ops_rate += load_sample_weight *
+            (double(ops - load.last_ops) - load.ops_rate);
+        load.last_busy_time = busy_time;
+        load.last_ops = ops;
+
+        if (load.busy_rate > threads[busiest].load.busy_rate) {
+            busiest = ii;
+        }
+        if (load.busy_rate < threads[idlest].load.busy_rate) {
+            idlest = ii;
+        }
+    }
+
+    if (!settings.isConnectionRebalance() || busiest == idlest ||
+        memcached_shutdown) {
+        imbalanced = 0;
+        return;
+    }
+
+    const double busy_rate = threads[busiest].load.busy_rate;
+    if (busy_rate < rebalance_min_busy_rate ||
+        busy_rate < rebalance_factor * threads[idlest].load.busy_rate) {
+        imbalanced = 0;
+        return;
+    }
+
+    if (++imbalanced >= rebalance_samples) {
+        imbalanced = 0;
+        threads_request_migration(busiest, idlest);
+    }
+}
+
+bool threads_request_migration(int from, int to) {
+    if (from < 0 || from >= nthreads || to < 0 || to >= nthreads ||
+        from == to) {
+        return false;
+    }
+
+    threads[from].load.migrate_to.store(to);
+    notify_thread(&threads[from]);
+    return true;
+}
+
 /*
  * Dispatches a new connection to another thread. This is only ever called
  * from the main thread, or because of an incoming connection.
  */
-void dispatch_conn_new(SOCKET sfd, int parent_port) {
-    int tid = (last_thread + 1) % settings.getNumWorkerThreads();
-    LIBEVENT_THREAD* thread = threads + tid;
-    last_thread = tid;
+void dispatch_conn_new(SOCKET sfd, int parent_port,
+                       const std::string& parent_path) {
+    LIBEVENT_THREAD* thread = get_least_loaded_thread();
 
     try {
         std::unique_ptr<ConnectionQueueItem> item(
-            new ConnectionQueueItem(sfd, parent_port));
+            new ConnectionQueueItem(sfd, parent_port, parent_path));
         thread->new_conn_queue->push(item);
+        thread->load.connections++;
     } catch (std::bad_alloc& e) {
         LOG_WARNING(nullptr,
                     "dispatch_conn_new: Failed to dispatch new connection: %s",
@@ -486,6 +886,17 @@ void dispatch_conn_new(SOCKET sfd, int parent_port) {
     notify_thread(thread);
 }
 
+/*
+ * Returns the worker thread with the given index (or nullptr if the
+ * index is out of range).
+ */
+LIBEVENT_THREAD* get_worker_thread(int index) {
+    if (index < 0 || index >= nthreads) {
+        return nullptr;
+    }
+    return threads + index;
+}
+
 /*
  * Returns true if this is the thread that listens for new TCP connections.
  */
@@ -494,7 +905,12 @@ int is_listen_thread() {
 }
 
 void notify_dispatcher(void) {
-    notify_thread(&dispatcher_thread);
+    // The dispatcher counts the notifications, so they can't be coalesced
+    if (send(dispatcher_thread.notify[1], "", 1, 0) != 1 &&
+            !is_blocking(GetLastNetworkError())) {
+        log_socket_error(EXTENSION_LOG_WARNING, NULL,
+                         "Failed to notify dispatcher: %s");
+    }
 }
 
 /******************************* GLOBAL STATS ******************************/
@@ -520,9 +936,9 @@ void thread_init(int nthr, struct event_base *main_base,
     cb_mutex_initialize(&init_lock);
     cb_cond_initialize(&init_cond);
 
-    threads = reinterpret_cast<LIBEVENT_THREAD*>(calloc(nthreads,
-                                                        sizeof(LIBEVENT_THREAD)));
-    if (threads == nullptr) {
+    try {
+        threads = new LIBEVENT_THREAD[nthreads]();
+    } catch (std::bad_alloc&) {
         FATAL_ERROR(EXIT_FAILURE, "Can't allocate thread descriptors");
     }
     thread_ids = reinterpret_cast<cb_thread_t*>(calloc(nthreads, sizeof(cb_thread_t)));
@@ -533,14 +949,22 @@ void thread_init(int nthr, struct event_base *main_base,
     setup_dispatcher(main_base, dispatcher_callback);
 
     for (i = 0; i < nthreads; i++) {
-        if (!create_notification_pipe(&threads[i])) {
+        if (!create_notification_channel(&threads[i])) {
             FATAL_ERROR(EXIT_FAILURE, "Cannot create notification pipe");
         }
         threads[i].index = i;
+        threads[i].load.migrate_to.store(-1);
 
         setup_thread(&threads[i]);
     }
 
+    struct timeval tv = {1, 0};
+    if ((event_assign(&load_sample_event, main_base, -1, EV_PERSIST,
+                      threads_sample_load, nullptr) == -1) ||
+        (event_add(&load_sample_event, &tv) == -1)) {
+        FATAL_ERROR(EXIT_FAILURE, "Can't set up sampling of thread load");
+    }
+
     /* Create threads after we've done all the libevent setup. */
     for (i = 0; i < nthreads; i++) {
         std::string name = "mc:worker_" + std::to_string(i);
@@ -570,19 +994,19 @@ void threads_cleanup(void)
 {
     int ii;
     for (ii = 0; ii < nthreads; ++ii) {
-        safe_close(threads[ii].notify[0]);
-        safe_close(threads[ii].notify[1]);
+        close_notification_channel(&threads[ii]);
         event_base_free(threads[ii].base);
 
         free(threads[ii].read.buf);
         free(threads[ii].write.buf);
+        conn_pool_cleanup(&threads[ii]);
         subdoc_op_free(threads[ii].subdoc_op);
         delete threads[ii].validator;
         delete threads[ii].new_conn_queue;
     }
 
     free(thread_ids);
-    free(threads);
+    delete []threads;
 }
 
 void threads_notify_bucket_deletion(void)
@@ -614,6 +1038,24 @@ void threads_initiate_bucket_deletion(void)
 }
 
 void notify_thread(LIBEVENT_THREAD *thread) {
+    // There is no need to signal the thread again if it hasn't started
+    // processing the previous notification
+    if (thread->notified.exchange(true)) {
+        thread->notify_coalesced++;
+        return;
+    }
+
+    thread->notify_signalled++;
+#ifdef HAVE_EVENTFD
+    if (thread->notify[0] == thread->notify[1]) {
+        if (eventfd_write(thread->notify[1], 1) == -1 && errno != EAGAIN) {
+            LOG_WARNING(nullptr, "Failed to notify thread: %s",
+                        cb_strerror().c_str());
+        }
+        return;
+    }
+#endif
+
     if (send(thread->notify[1], "", 1, 0) != 1 &&
             !is_blocking(GetLastNetworkError())) {
         log_socket_error(EXTENSION_LOG_WARNING, NULL,
@@ -621,15 +1063,67 @@ void notify_thread(LIBEVENT_THREAD *thread) {
     }
 }
 
-int add_conn_to_pending_io_list(Connection *c) {
-    int notify = 0;
-    auto thread = c->getThread();
-    if (number_of_pending(c, thread->pending_io) == 0) {
-        if (thread->pending_io == NULL) {
-            notify = 1;
+int add_conn_to_pending_io_list(LIBEVENT_THREAD* thread, Connection *c) {
+    if (c->setPendingIo()) {
+        // Already queued
+        thread->notify_coalesced++;
+        return 0;
+    }
+
+    Connection* head = thread->pending_io.load(std::memory_order_relaxed);
+    do {
+        c->setPendingNext(head);
+    } while (!thread->pending_io.compare_exchange_weak(head, c));
+
+    // Only the one adding the first connection to the list needs to
+    // notify the thread; the others piggyback on that notification
+    if (head != nullptr) {
+        thread->notify_coalesced++;
+        return 0;
+    }
+    return 1;
+}
+
+void threads_stats(ADD_STAT add_stats, const void* cookie) {
+    auto add = [add_stats, cookie](int index, const char* name,
+                                   uint64_t value) {
+        const std::string key = "worker_" + std::to_string(index) + ":" +
+                                name;
+        const std::string val = std::to_string(value);
+        add_stats(key.data(), uint16_t(key.size()),
+                  val.data(), uint32_t(val.size()), cookie);
+    };
+
+    for (int ii = 0; ii < nthreads; ++ii) {
+        const auto& thr = threads[ii];
+        add(ii, "connections", thr.load.connections);
+        add(ii, "ops", thr.load.ops);
+        add(ii, "busy_time", thr.load.busy_time / 1000);
+        add(ii, "busy_poll", use_busy_poll(&thr) ? 1 : 0);
+        add(ii, "spin_time", thr.busy_poll.spin_time / 1000);
+        add(ii, "spin_polls", thr.busy_poll.polls);
+        add(ii, "spin_hits", thr.busy_poll.hits);
+        add(ii, "sleeps", thr.busy_poll.sleeps);
+        add(ii, "lag", thr.shed.lag / 1000);
+        add(ii, "shedding", thr.shed.active ? 1 : 0);
+        add(ii, "shed_commands", thr.shed.commands);
+        add(ii, "shed_episodes", thr.shed.episodes);
+        add(ii, "conn_pool_size", thr.conn_pool.size);
+        add(ii, "conn_pool_hits", thr.conn_pool.hits);
+        add(ii, "conn_pool_misses", thr.conn_pool.misses);
+        if (thr.cpu != -1) {
+            add(ii, "cpu", uint64_t(thr.cpu));
+            if (thr.numa_node != -1) {
+                add(ii, "numa_node", uint64_t(thr.numa_node));
+            }
         }
-        enlist_conn(c, &thread->pending_io);
     }
+}
 
-    return notify;
+void threads_notify_stats(uint64_t& signalled, uint64_t& coalesced) {
+    signalled = coalesced = 0;
+    for (int ii = 0; ii < nthreads; ++ii) {
+        signalled += threads[ii].notify_signalled;
+        coalesced += threads[ii].notify_coalesced;
+    }
 }
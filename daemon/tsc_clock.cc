@@ -0,0 +1,174 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include "config.h"
+#include "tsc_clock.h"
+
+#include <chrono>
+#include <fstream>
+#include <limits>
+#include <thread>
+
+#ifdef HAVE_TSC_CLOCK
+#include <cpuid.h>
+#endif
+
+TscClockParams tsc_clock_params = {false, 0, 0, 0, 0, 0};
+
+#ifdef HAVE_TSC_CLOCK
+/*
+ * CPUID.80000007H:EDX[8] is set if the TSC runs at a constant rate in
+ * all P-, C- and T-states.
+ */
+static bool has_invariant_tsc() {
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) == 0 ||
+        eax < 0x80000007) {
+        return false;
+    }
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    return (edx & (1u << 8)) != 0;
+}
+
+/*
+ * The kernel checks that the TSC is synchronized between the CPUs (and
+ * keeps an eye on it while running), and switches to another clock
+ * source if it isn't. Return an empty string if it isn't known.
+ */
+static std::string get_kernel_clocksource() {
+    std::string ret;
+#ifdef __linux__
+    std::ifstream file("/sys/devices/system/clocksource/clocksource0/"
+                       "current_clocksource");
+    file >> ret;
+#endif
+    return ret;
+}
+
+/*
+ * Read the TSC and gethrtime() as close together as possible. The TSC
+ * value is the midpoint of the two reads around gethrtime(), and we keep
+ * the sample with the shortest window.
+ */
+static void read_clocks(uint64_t& tsc, hrtime_t& ns) {
+    uint64_t window = std::numeric_limits<uint64_t>::max();
+    for (int ii = 0; ii < 8; ++ii) {
+        const uint64_t before = __rdtsc();
+        const hrtime_t now = gethrtime();
+        const uint64_t after = __rdtsc();
+        if (after >= before && after - before < window) {
+            window = after - before;
+            tsc = before + window / 2;
+            ns = now;
+        }
+    }
+}
+
+static bool calibrate(std::string& reason) {
+    uint64_t tsc0 = 0, tsc1 = 0;
+    hrtime_t ns0 = 0, ns1 = 0;
+    read_clocks(tsc0, ns0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    read_clocks(tsc1, ns1);
+
+    if (tsc1 <= tsc0 || ns1 <= ns0) {
+        reason = "the TSC didn't advance during the calibration";
+        return false;
+    }
+
+    const uint64_t ticks = tsc1 - tsc0;
+    const uint64_t elapsed = ns1 - ns0;
+    const uint64_t frequency =
+        uint64_t((unsigned __int128)ticks * 1000000000 / elapsed);
+    if (frequency < 100000000) {
+        reason = "the calibrated TSC frequency (" + std::to_string(frequency) +
+                 " Hz) is too low";
+        return false;
+    }
+
+    tsc_clock_params.base_tsc = tsc1;
+    tsc_clock_params.base_ns = ns1;
+    tsc_clock_params.shift = 32;
+    tsc_clock_params.mult =
+        uint64_t(((unsigned __int128)elapsed << tsc_clock_params.shift) /
+                 ticks);
+    tsc_clock_params.frequency = frequency;
+    tsc_clock_params.enabled = true;
+    return true;
+}
+
+/*
+ * Verify that the calibrated clock never goes backwards, and that it
+ * agrees with gethrtime() (within 0.5%) over another interval.
+ */
+static bool self_test(std::string& reason) {
+    hrtime_t prev = tsc_clock_now();
+    for (int ii = 0; ii < 10000; ++ii) {
+        const hrtime_t now = tsc_clock_now();
+        if (now < prev) {
+            reason = "the TSC clock went backwards";
+            return false;
+        }
+        prev = now;
+    }
+
+    const hrtime_t start_ns = gethrtime();
+    const hrtime_t start = tsc_clock_now();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    const hrtime_t elapsed = tsc_clock_now() - start;
+    const hrtime_t elapsed_ns = gethrtime() - start_ns;
+
+    const hrtime_t diff = elapsed > elapsed_ns ? elapsed - elapsed_ns
+                                               : elapsed_ns - elapsed;
+    if (diff * 200 > elapsed_ns) {
+        reason = "the TSC clock measured " + std::to_string(elapsed) +
+                 " ns over an interval of " + std::to_string(elapsed_ns) +
+                 " ns";
+        return false;
+    }
+    return true;
+}
+#endif
+
+bool tsc_clock_init(std::string& reason) {
+    tsc_clock_params = TscClockParams{false, 0, 0, 0, 0, 0};
+
+#ifdef HAVE_TSC_CLOCK
+    if (!has_invariant_tsc()) {
+        reason = "the CPU doesn't have an invariant TSC";
+        return false;
+    }
+
+    const auto clocksource = get_kernel_clocksource();
+    if (!clocksource.empty() && clocksource != "tsc") {
+        reason = "the kernel uses \"" + clocksource + "\" as its clock source";
+        return false;
+    }
+
+    if (!calibrate(reason) || !self_test(reason)) {
+        tsc_clock_params.enabled = false;
+        return false;
+    }
+    return true;
+#else
+    reason = "reading the TSC isn't supported on this platform";
+    return false;
+#endif
+}
+
+const char* tsc_clock_get_source() {
+    return tsc_clock_params.enabled ? "tsc" : "gethrtime";
+}
@@ -0,0 +1,99 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * A cheap high resolution clock for timing the commands.
+ *
+ * Every command reads the clock when it starts and when it completes,
+ * and at a few million operations per second the cost of gethrtime()
+ * (clock_gettime) shows up in the profiles. On x86-64 CPUs with an
+ * invariant time stamp counter (it ticks at a constant rate in all
+ * P- and C-states, and is synchronized between the cores) we read the
+ * TSC directly and scale it to nanoseconds with a multiplier calibrated
+ * against gethrtime() at startup.
+ *
+ * tsc_clock_now() falls back to gethrtime() if the CPU doesn't have an
+ * invariant TSC, the kernel doesn't trust it as its own clock source,
+ * or the calibration or self-test fails. The values returned are only
+ * comparable with other values returned by tsc_clock_now() (not with
+ * gethrtime()), so all of the users of a given timestamp must use the
+ * same clock.
+ */
+#pragma once
+
+#include <platform/platform.h>
+#include <string>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define HAVE_TSC_CLOCK 1
+#include <x86intrin.h>
+#endif
+
+/*
+ * The conversion from TSC ticks to nanoseconds. Set up by
+ * tsc_clock_init() before any other threads are created, and read-only
+ * afterwards.
+ */
+struct TscClockParams {
+    bool enabled;
+    /* The TSC and gethrtime() value at the time of the calibration */
+    uint64_t base_tsc;
+    hrtime_t base_ns;
+    /* ns = (ticks * mult) >> shift */
+    uint64_t mult;
+    unsigned int shift;
+    /* The calibrated TSC frequency in Hz */
+    uint64_t frequency;
+};
+
+extern TscClockParams tsc_clock_params;
+
+/**
+ * Calibrate the TSC against gethrtime() and verify that it may be used
+ * as a clock. Must be called by the main thread before any other threads
+ * is created. Takes around 50ms.
+ *
+ * @param reason set to the reason why the TSC isn't used
+ * @return true if tsc_clock_now() reads the TSC, false if it uses
+ *         gethrtime()
+ */
+bool tsc_clock_init(std::string& reason);
+
+/**
+ * Get the name of the clock source used by tsc_clock_now()
+ * ("tsc" or "gethrtime")
+ */
+const char* tsc_clock_get_source();
+
+/**
+ * Get a monotonically increasing timestamp in nanoseconds
+ */
+inline hrtime_t tsc_clock_now() {
+#ifdef HAVE_TSC_CLOCK
+    if (tsc_clock_params.enabled) {
+        const uint64_t tsc = __rdtsc();
+        if (tsc <= tsc_clock_params.base_tsc) {
+            return tsc_clock_params.base_ns;
+        }
+        const unsigned __int128 ticks = tsc - tsc_clock_params.base_tsc;
+        return tsc_clock_params.base_ns +
+               hrtime_t((ticks * tsc_clock_params.mult) >>
+                        tsc_clock_params.shift);
+    }
+#endif
+    return gethrtime();
+}
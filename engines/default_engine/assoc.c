@@ -128,7 +128,7 @@ static hash_item** _hashitem_before(struct default_engine *engine,
     return pos;
 }
 
-static void assoc_maintenance_thread(void *arg);
+static bool assoc_maintenance_task(void *arg);
 
 /*
     grows the hashtable to the next power of 2.
@@ -140,21 +140,23 @@ static void assoc_expand(struct default_engine *engine) {
     engine->assoc->primary_hashtable = calloc(hashsize(engine->assoc->hashpower + 1),
                                              sizeof(hash_item *));
     if (engine->assoc->primary_hashtable) {
-        int ret = 0;
-        cb_thread_t tid;
-
         engine->assoc->hashpower++;
         engine->assoc->expanding = true;
         engine->assoc->expand_bucket = 0;
+        engine->assoc->logger = NULL;
+        if (engine->config.verbose > 1) {
+            engine->assoc->logger = (void*)engine->server.extension->get_extension(EXTENSION_LOGGER);
+        }
 
-        /* start a thread to do the expansion */
-        if ((ret = cb_create_named_thread(&tid, assoc_maintenance_thread,
-                                          engine, 1, "mc:assoc_maint")) != 0)
+        /* let the server's background scheduler do the expansion */
+        if (engine->server.scheduler->schedule("assoc_maint",
+                                               assoc_maintenance_task,
+                                               engine->assoc, 0, 0) == 0)
         {
             EXTENSION_LOGGER_DESCRIPTOR *logger;
             logger = (void*)engine->server.extension->get_extension(EXTENSION_LOGGER);
             logger->log(EXTENSION_LOG_WARNING, NULL,
-                        "Can't create thread: %s\n", strerror(ret));
+                        "Can't schedule hash table expansion\n");
             engine->assoc->hashpower--;
             engine->assoc->expanding = false;
             free(engine->assoc->primary_hashtable);
@@ -218,48 +220,134 @@ void assoc_delete(struct default_engine *engine, uint32_t hash, const hash_key *
 }
 
 
+/*
+ * Reverse the bits of the cursor, so that it can be incremented from the
+ * most significant bit of the bucket index.
+ */
+static uint64_t assoc_reverse_bits(uint64_t v) {
+    v = ((v >> 1) & 0x5555555555555555ULL) | ((v & 0x5555555555555555ULL) << 1);
+    v = ((v >> 2) & 0x3333333333333333ULL) | ((v & 0x3333333333333333ULL) << 2);
+    v = ((v >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((v & 0x0F0F0F0F0F0F0F0FULL) << 4);
+    v = ((v >> 8) & 0x00FF00FF00FF00FFULL) | ((v & 0x00FF00FF00FF00FFULL) << 8);
+    v = ((v >> 16) & 0x0000FFFF0000FFFFULL) | ((v & 0x0000FFFF0000FFFFULL) << 16);
+    return (v >> 32) | (v << 32);
+}
+
+/*
+ * Visit the items in the buckets starting at the cursor (see assoc.h).
+ *
+ * The cursor is the index of the next bucket to visit, and it is
+ * incremented from its most significant bit. When the table doubles in
+ * size, the items in bucket b move to either b or b + hashsize(n), and
+ * those are visited after all of the buckets which were visited before
+ * b. That way the cursor remains valid when the table grows between two
+ * batches: the buckets already visited aren't visited again, and the
+ * ones not visited yet aren't skipped.
+ *
+ * While the table is expanding, we scan with the size of the old table
+ * and visit both of the new buckets of each bucket which is already
+ * moved over to the primary table.
+ */
+uint64_t assoc_scan(struct default_engine *engine, uint64_t cursor,
+                    size_t count, assoc_scan_visitor_t visitor, void *arg) {
+    struct assoc *assoc = engine->assoc;
+    size_t found = 0;
+    size_t visited = 0;
+    /* Don't spend too long holding the lock on a sparse table */
+    const size_t maxbuckets = count * 10;
+    uint64_t mask;
+
+    cb_mutex_enter(&assoc->lock);
+    if (assoc->expanding) {
+        mask = hashmask(assoc->hashpower - 1);
+    } else {
+        mask = hashmask(assoc->hashpower);
+    }
+
+    do {
+        const size_t bucket = (size_t)(cursor & mask);
+        hash_item *it;
+
+        if (!assoc->expanding) {
+            for (it = assoc->primary_hashtable[bucket]; it; it = it->h_next) {
+                found += visitor(it, arg) ? 1 : 0;
+            }
+        } else if (bucket >= assoc->expand_bucket) {
+            for (it = assoc->old_hashtable[bucket]; it; it = it->h_next) {
+                found += visitor(it, arg) ? 1 : 0;
+            }
+        } else {
+            for (it = assoc->primary_hashtable[bucket]; it; it = it->h_next) {
+                found += visitor(it, arg) ? 1 : 0;
+            }
+            for (it = assoc->primary_hashtable[bucket + mask + 1];
+                 it; it = it->h_next) {
+                found += visitor(it, arg) ? 1 : 0;
+            }
+        }
+
+        cursor |= ~mask;
+        cursor = assoc_reverse_bits(cursor);
+        cursor++;
+        cursor = assoc_reverse_bits(cursor);
+        ++visited;
+    } while (cursor != 0 && found < count && visited < maxbuckets);
+    cb_mutex_exit(&assoc->lock);
+
+    return cursor;
+}
+
 
 #define DEFAULT_HASH_BULK_MOVE 1
 int hash_bulk_move = DEFAULT_HASH_BULK_MOVE;
 
-static void assoc_maintenance_thread(void *arg) {
-    struct default_engine *engine = arg;
-    bool done = false;
-    do {
+/*
+ * The number of buckets moved from the old to the new hash table each
+ * time the maintenance task runs. The task is rescheduled until all of
+ * the buckets are moved, so that it doesn't occupy one of the
+ * scheduler's threads for the entire expansion.
+ */
+#define ASSOC_MAINTENANCE_BATCH 1024
+
+static bool assoc_maintenance_task(void *arg) {
+    struct assoc *assoc = arg;
+    bool expanding = true;
+    int batch;
+
+    for (batch = 0; batch < ASSOC_MAINTENANCE_BATCH && expanding;
+         batch += hash_bulk_move) {
         int ii;
-        cb_mutex_enter(&engine->assoc->lock);
+        cb_mutex_enter(&assoc->lock);
 
-        for (ii = 0; ii < hash_bulk_move && engine->assoc->expanding; ++ii) {
+        for (ii = 0; ii < hash_bulk_move && assoc->expanding; ++ii) {
             hash_item *it, *next;
             int bucket;
 
-            for (it = engine->assoc->old_hashtable[engine->assoc->expand_bucket];
+            for (it = assoc->old_hashtable[assoc->expand_bucket];
                  NULL != it; it = next) {
                 next = it->h_next;
                 const hash_key* key = item_get_key(it);
                 bucket = crc32c(hash_key_get_key(key),
                                 hash_key_get_key_len(key),
-                                0) & hashmask(engine->assoc->hashpower);
-                it->h_next = engine->assoc->primary_hashtable[bucket];
-                engine->assoc->primary_hashtable[bucket] = it;
+                                0) & hashmask(assoc->hashpower);
+                it->h_next = assoc->primary_hashtable[bucket];
+                assoc->primary_hashtable[bucket] = it;
             }
 
-            engine->assoc->old_hashtable[engine->assoc->expand_bucket] = NULL;
-            engine->assoc->expand_bucket++;
-            if (engine->assoc->expand_bucket == hashsize(engine->assoc->hashpower - 1)) {
-                engine->assoc->expanding = false;
-                free(engine->assoc->old_hashtable);
-                if (engine->config.verbose > 1) {
-                    EXTENSION_LOGGER_DESCRIPTOR *logger;
-                    logger = (void*)engine->server.extension->get_extension(EXTENSION_LOGGER);
-                    logger->log(EXTENSION_LOG_INFO, NULL,
-                                "Hash table expansion done\n");
+            assoc->old_hashtable[assoc->expand_bucket] = NULL;
+            assoc->expand_bucket++;
+            if (assoc->expand_bucket == hashsize(assoc->hashpower - 1)) {
+                assoc->expanding = false;
+                free(assoc->old_hashtable);
+                if (assoc->logger != NULL) {
+                    assoc->logger->log(EXTENSION_LOG_INFO, NULL,
+                                       "Hash table expansion done\n");
                 }
             }
         }
-        if (!engine->assoc->expanding) {
-            done = true;
-        }
-        cb_mutex_exit(&engine->assoc->lock);
-    } while (!done);
+        expanding = assoc->expanding;
+        cb_mutex_exit(&assoc->lock);
+    }
+
+    return expanding;
 }
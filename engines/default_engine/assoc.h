@@ -27,6 +27,11 @@ struct assoc {
     */
    unsigned int expand_bucket;
 
+   /*
+    * Logger used by the maintenance task to report when the expansion
+    * is done (NULL unless verbose logging is enabled)
+    */
+   EXTENSION_LOGGER_DESCRIPTOR *logger;
 
    /*
     * serialise access to the hashtable
@@ -43,7 +48,23 @@ int assoc_insert(struct default_engine *engine, uint32_t hash,
                  hash_item *item);
 void assoc_delete(struct default_engine *engine, uint32_t hash,
                   const hash_key* key);
-int start_assoc_maintenance_thread(struct default_engine *engine);
-void stop_assoc_maintenance_thread(struct default_engine *engine);
+
+/*
+ * Called for each item visited by assoc_scan (with assoc->lock held, so it
+ * must not modify the table). Returns true if the item is counted towards
+ * the size of the batch.
+ */
+typedef bool (*assoc_scan_visitor_t)(hash_item *item, void *arg);
+
+/*
+ * Visit a batch of the buckets in the hash table, starting at the cursor
+ * (0 to start at the beginning). Stops once "count" items are counted by
+ * the visitor (or after visiting a number of empty buckets), and returns
+ * the cursor to continue from (0 once all of the buckets are visited).
+ * The items which are in the table for the entire scan are visited at
+ * least once, even if the table grows during the scan.
+ */
+uint64_t assoc_scan(struct default_engine *engine, uint64_t cursor,
+                    size_t count, assoc_scan_visitor_t visitor, void *arg);
 
 #endif
@@ -46,6 +46,29 @@ static ENGINE_ERROR_CODE default_get(ENGINE_HANDLE* handle,
                                      const void* key,
                                      const int nkey,
                                      uint16_t vbucket);
+static ENGINE_ERROR_CODE default_get_multi(ENGINE_HANDLE* handle,
+                                           const void* cookie,
+                                           const engine_key_t* keys,
+                                           size_t nkeys,
+                                           item** items,
+                                           uint16_t vbucket);
+static ENGINE_ERROR_CODE default_scan(ENGINE_HANDLE* handle,
+                                      const void* cookie,
+                                      uint64_t* cursor,
+                                      const void* prefix,
+                                      uint16_t nprefix,
+                                      uint32_t count,
+                                      engine_scan_callback_t callback,
+                                      void* ctx,
+                                      uint16_t vbucket);
+static ENGINE_ERROR_CODE default_get_lease(ENGINE_HANDLE* handle,
+                                           const void* cookie,
+                                           item** item,
+                                           const void* key,
+                                           const int nkey,
+                                           uint16_t vbucket,
+                                           uint64_t* lease,
+                                           bool* stale);
 static ENGINE_ERROR_CODE default_get_stats(ENGINE_HANDLE* handle,
                   const void *cookie,
                   const char *stat_key,
@@ -58,6 +81,13 @@ static ENGINE_ERROR_CODE default_store(ENGINE_HANDLE* handle,
                                        uint64_t *cas,
                                        ENGINE_STORE_OPERATION operation,
                                        uint16_t vbucket);
+static ENGINE_ERROR_CODE default_store_multi(ENGINE_HANDLE* handle,
+                                             const void *cookie,
+                                             item** items,
+                                             size_t nitems,
+                                             ENGINE_STORE_OPERATION operation,
+                                             ENGINE_ERROR_CODE* results,
+                                             uint16_t vbucket);
 static ENGINE_ERROR_CODE default_arithmetic(ENGINE_HANDLE* handle,
                                             const void* cookie,
                                             const void* key,
@@ -144,9 +174,13 @@ void default_engine_constructor(struct default_engine* engine, bucket_id_t id)
     engine->engine.remove = default_item_delete;
     engine->engine.release = default_item_release;
     engine->engine.get = default_get;
+    engine->engine.get_multi = default_get_multi;
+    engine->engine.scan = default_scan;
+    engine->engine.get_lease = default_get_lease;
     engine->engine.get_stats = default_get_stats;
     engine->engine.reset_stats = default_reset_stats;
     engine->engine.store = default_store;
+    engine->engine.store_multi = default_store_multi;
     engine->engine.arithmetic = default_arithmetic;
     engine->engine.flush = default_flush;
     engine->engine.unknown_command = default_unknown_command;
@@ -162,6 +196,8 @@ void default_engine_constructor(struct default_engine* engine, bucket_id_t id)
     engine->config.factor = 1.25;
     engine->config.chunk_size = 48;
     engine->config.item_size_max= 1024 * 1024;
+    engine->config.lease_time = 10;
+    engine->config.lease_grace = 0;
     engine->info.engine.description = "Default engine v0.1";
     engine->info.engine.num_features = 1;
     engine->info.engine.features[0].feature = ENGINE_FEATURE_LRU;
@@ -179,6 +215,11 @@ ENGINE_ERROR_CODE create_instance(uint64_t interface,
       return ENGINE_ENOTSUP;
    }
 
+   /* The hash table expansion and the scrubber run as background tasks */
+   if (api->scheduler == NULL) {
+      return ENGINE_ENOTSUP;
+   }
+
    if ((engine = engine_manager_create_engine()) == NULL) {
       return ENGINE_ENOMEM;
    }
@@ -304,6 +345,8 @@ static ENGINE_ERROR_CODE default_item_delete(ENGINE_HANDLE* handle,
 
    it = item_get(engine, cookie, key, nkey);
    if (it == NULL) {
+      /* Make sure that the holder of a lease can't refill the key */
+      item_unlink_lease(engine, cookie, key, nkey);
       return ENGINE_KEY_ENOENT;
    }
 
@@ -346,6 +389,50 @@ static ENGINE_ERROR_CODE default_get(ENGINE_HANDLE* handle,
    }
 }
 
+static ENGINE_ERROR_CODE default_get_multi(ENGINE_HANDLE* handle,
+                                           const void* cookie,
+                                           const engine_key_t* keys,
+                                           size_t nkeys,
+                                           item** items,
+                                           uint16_t vbucket) {
+   struct default_engine *engine = get_handle(handle);
+   VBUCKET_GUARD(engine, vbucket);
+
+   item_get_multi(engine, cookie, keys, nkeys, (hash_item**)items);
+   return ENGINE_SUCCESS;
+}
+
+static ENGINE_ERROR_CODE default_scan(ENGINE_HANDLE* handle,
+                                      const void* cookie,
+                                      uint64_t* cursor,
+                                      const void* prefix,
+                                      uint16_t nprefix,
+                                      uint32_t count,
+                                      engine_scan_callback_t callback,
+                                      void* ctx,
+                                      uint16_t vbucket) {
+   struct default_engine *engine = get_handle(handle);
+   VBUCKET_GUARD(engine, vbucket);
+
+   item_scan(engine, cursor, prefix, nprefix, count, callback, ctx);
+   return ENGINE_SUCCESS;
+}
+
+static ENGINE_ERROR_CODE default_get_lease(ENGINE_HANDLE* handle,
+                                           const void* cookie,
+                                           item** item,
+                                           const void* key,
+                                           const int nkey,
+                                           uint16_t vbucket,
+                                           uint64_t* lease,
+                                           bool* stale) {
+   struct default_engine *engine = get_handle(handle);
+   VBUCKET_GUARD(engine, vbucket);
+
+   return item_get_lease(engine, cookie, key, nkey, (hash_item**)item,
+                         lease, stale);
+}
+
 static ENGINE_ERROR_CODE default_get_stats(ENGINE_HANDLE* handle,
                                            const void* cookie,
                                            const char* stat_key,
@@ -372,6 +459,12 @@ static ENGINE_ERROR_CODE default_get_stats(ENGINE_HANDLE* handle,
       add_stat("reclaimed", 9, val, len, cookie);
       len = sprintf(val, "%"PRIu64, (uint64_t)engine->config.maxbytes);
       add_stat("engine_maxbytes", 15, val, len, cookie);
+      len = sprintf(val, "%"PRIu64, engine->stats.leases_issued);
+      add_stat("leases_issued", 13, val, len, cookie);
+      len = sprintf(val, "%"PRIu64, engine->stats.lease_stale_hits);
+      add_stat("lease_stale_hits", 16, val, len, cookie);
+      len = sprintf(val, "%"PRIu64, engine->stats.lease_refills_avoided);
+      add_stat("lease_refills_avoided", 21, val, len, cookie);
       cb_mutex_exit(&engine->stats.lock);
    } else if (strncmp(stat_key, "slabs", 5) == 0) {
       slabs_stats(engine, add_stat, cookie);
@@ -429,6 +522,20 @@ static ENGINE_ERROR_CODE default_store(ENGINE_HANDLE* handle,
                       cookie);
 }
 
+static ENGINE_ERROR_CODE default_store_multi(ENGINE_HANDLE* handle,
+                                             const void *cookie,
+                                             item** items,
+                                             size_t nitems,
+                                             ENGINE_STORE_OPERATION operation,
+                                             ENGINE_ERROR_CODE* results,
+                                             uint16_t vbucket) {
+    struct default_engine *engine = get_handle(handle);
+    VBUCKET_GUARD(engine, vbucket);
+    store_item_multi(engine, (hash_item**)items, nitems, operation, results,
+                     cookie);
+    return ENGINE_SUCCESS;
+}
+
 static ENGINE_ERROR_CODE default_arithmetic(ENGINE_HANDLE* handle,
                                             const void* cookie,
                                             const void* key,
@@ -466,6 +573,9 @@ static void default_reset_stats(ENGINE_HANDLE* handle, const void *cookie) {
    engine->stats.evictions = 0;
    engine->stats.reclaimed = 0;
    engine->stats.total_items = 0;
+   engine->stats.leases_issued = 0;
+   engine->stats.lease_stale_hits = 0;
+   engine->stats.lease_refills_avoided = 0;
    cb_mutex_exit(&engine->stats.lock);
 }
 
@@ -476,7 +586,7 @@ static ENGINE_ERROR_CODE initalize_configuration(struct default_engine *se,
    se->config.vb0 = true;
 
    if (cfg_str != NULL) {
-       struct config_item items[13];
+       struct config_item items[15];
        int ii = 0;
 
        memset(&items, 0, sizeof(items));
@@ -539,9 +649,19 @@ static ENGINE_ERROR_CODE initalize_configuration(struct default_engine *se,
        items[ii].value.dt_string = &se->config.uuid;
        ++ii;
 
+       items[ii].key = "lease_time";
+       items[ii].datatype = DT_SIZE;
+       items[ii].value.dt_size = &se->config.lease_time;
+       ++ii;
+
+       items[ii].key = "lease_grace";
+       items[ii].datatype = DT_SIZE;
+       items[ii].value.dt_size = &se->config.lease_grace;
+       ++ii;
+
        items[ii].key = NULL;
        ++ii;
-       cb_assert(ii == 13);
+       cb_assert(ii == 15);
        ret = se->server.core->parse_config(cfg_str, items, stderr);
    }
 
@@ -45,6 +45,12 @@ struct default_engine;
 /* temp */
 #define ITEM_SLABBED (2<<8)
 
+/* A lease handed out by GET_LEASE (the CAS is the lease token) */
+#define ITEM_LEASE (4<<8)
+
+/* The lease carries the value of the expired item it replaced */
+#define ITEM_LEASE_STALE (8<<8)
+
 struct config {
    bool use_cas;
    size_t verbose;
@@ -58,6 +64,10 @@ struct config {
    bool ignore_vbucket;
    bool vb0;
    char *uuid;
+   /* How long a lease lasts before another client may refill the key */
+   size_t lease_time;
+   /* How long after it expired an item may be served stale to GET_LEASE */
+   size_t lease_grace;
 };
 
 MEMCACHED_PUBLIC_API
@@ -73,6 +83,9 @@ struct engine_stats {
    uint64_t curr_bytes;
    uint64_t curr_items;
    uint64_t total_items;
+   uint64_t leases_issued;
+   uint64_t lease_stale_hits;
+   uint64_t lease_refills_avoided;
 };
 
 struct engine_scrubber {
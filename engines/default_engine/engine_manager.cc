@@ -17,7 +17,7 @@
 
 /*
     Engine manager provides methods for creating and deleting of engine handles/structs
-    and the creation and safe teardown of the scrubber thread.
+    and the scheduling and safe teardown of the scrubber task.
 
     Note: A single scrubber exists for the purposes of running a user requested scrub
     and for background deletion of bucket items when a bucket is destroyed.
@@ -44,7 +44,11 @@
     The common use-case is for bucket deletion performing tasks 1 and 2.
     The start_scrub command only performs 1.
 
-    Global destruction can safely join the task and allow the engine to
+    The task runs on the server's background scheduler. It is scheduled
+    when work is placed on an empty queue, and runs until the queue is
+    drained.
+
+    Global destruction can safely wait for the task and allow the engine to
     safely unload the shared object.
 **/
 class EngineManager;
@@ -59,18 +63,18 @@ public:
     void shutdown();
 
     /**
-        Join the thread running the scrubber (to be called after shutdown).
+        Wait for the scheduled task to complete (to be called after shutdown).
     **/
-    void joinThread();
+    void waitForTask();
 
     /**
-        Place the engine on the threads work queue for item scrubbing.
+        Place the engine on the task's work queue for item scrubbing.
         bool destroy indicates if the engine should be deleted once scrubbed.
     **/
     void placeOnWorkQueue(struct default_engine* engine, bool destroy);
 
     /**
-        Task's run loop method.
+        Task's run method; drains the work queue.
     **/
     void run();
 
@@ -84,7 +88,8 @@ private:
     EngineManager* engineManager;
     std::mutex lock;
     std::condition_variable cvar;
-    cb_thread_t scrubberThread;
+    /* Is the task scheduled (or running)? */
+    bool scheduled;
 };
 
 /**
@@ -132,62 +137,66 @@ private:
 
 static std::unique_ptr<EngineManager> engineManager;
 
-static void scrubber_task_main(void* arg) {
+static bool scrubber_task_main(void* arg) {
     ScrubberTask* task = reinterpret_cast<ScrubberTask*>(arg);
     task->run();
+    return false;
 }
 
 ScrubberTask::ScrubberTask(EngineManager* manager)
   : shuttingdown(false),
-    engineManager(manager) {
-    if (cb_create_named_thread(&scrubberThread, &scrubber_task_main, this, 0,
-                               "mc:item_scrub") != 0) {
-        throw std::runtime_error("Error creating 'mc:item_scrub' thread");
-    }
-}
+    engineManager(manager),
+    scheduled(false) {}
 
 void ScrubberTask::shutdown() {
     shuttingdown = true;
-    // Serialize with ::run
-    std::lock_guard<std::mutex> lck(lock);
-    cvar.notify_one();
 }
 
-void ScrubberTask::joinThread() {
-    cb_join_thread(scrubberThread);
+void ScrubberTask::waitForTask() {
+    std::unique_lock<std::mutex> lck(lock);
+    cvar.wait(lck, [this]() { return !scheduled; });
 }
 
 void ScrubberTask::placeOnWorkQueue(struct default_engine* engine, bool destroy) {
     if (!shuttingdown) {
-        std::lock_guard<std::mutex> lck(lock);
+        std::unique_lock<std::mutex> lck(lock);
         engine->scrubber.force_delete = destroy;
         workQueue.push_back(std::make_pair(engine, destroy));
-        cvar.notify_one();
+        if (scheduled) {
+            // The running task picks it up
+            return;
+        }
+        scheduled = true;
+        lck.unlock();
+
+        auto* scheduler = engine->server.scheduler;
+        if (scheduler->schedule("item_scrub", scrubber_task_main,
+                                this, 0, 0) == 0) {
+            // Out of memory; do the work in the calling thread rather
+            // than leaking the engine
+            run();
+        }
     }
 }
 
 void ScrubberTask::run() {
-    while (true) {
-        std::unique_lock<std::mutex> lck(lock);
-        if (!workQueue.empty()) {
-            auto engine = workQueue.front();
-            workQueue.pop_front();
-            lck.unlock();
-
-            item_scrubber_main(engine.first);
-
-            if (engine.second) {
-                destroy_engine_instance(engine.first);
-                engineManager->deleteEngine(engine.first);
-            }
-
-            lck.lock(); // relock so lck can safely unlock when destroyed at loop end.
-        } else if (!shuttingdown) {
-            cvar.wait(lck);
-        } else {
-            return;
+    std::unique_lock<std::mutex> lck(lock);
+    while (!workQueue.empty()) {
+        auto engine = workQueue.front();
+        workQueue.pop_front();
+        lck.unlock();
+
+        item_scrubber_main(engine.first);
+
+        if (engine.second) {
+            destroy_engine_instance(engine.first);
+            engineManager->deleteEngine(engine.first);
         }
+
+        lck.lock();
     }
+    scheduled = false;
+    cvar.notify_all();
 }
 
 EngineManager::EngineManager()
@@ -239,12 +248,12 @@ void EngineManager::scrubEngine(struct default_engine* engine) {
 }
 
 /*
- * Join the scrubber and delete any data which wasn't cleaned by clients
+ * Wait for the scrubber and delete any data which wasn't cleaned by clients
  */
 void EngineManager::shutdown() {
     shuttingdown = true;
     scrubberTask.shutdown();
-    scrubberTask.joinThread();
+    scrubberTask.waitForTask();
     std::lock_guard<std::mutex> lck(lock);
     for (auto engine : engines) {
         delete engine;
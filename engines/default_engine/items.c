@@ -23,6 +23,8 @@ static hash_item *do_item_alloc(struct default_engine *engine,
                                 uint8_t datatype);
 static hash_item *do_item_get(struct default_engine *engine,
                               const hash_key* key);
+static hash_item *do_item_get_any(struct default_engine *engine,
+                                  const hash_key* key);
 static int do_item_link(struct default_engine *engine, hash_item *it);
 static void do_item_unlink(struct default_engine *engine, hash_item *it);
 static void do_item_release(struct default_engine *engine, hash_item *it);
@@ -476,9 +478,12 @@ static void do_item_stats_sizes(struct default_engine *engine,
     }
 }
 
-/** wrapper around assoc_find which does the lazy expiration logic */
-hash_item *do_item_get(struct default_engine *engine,
-                       const hash_key *key) {
+/**
+ * wrapper around assoc_find which does the lazy expiration logic. The
+ * leases are returned as well (see do_item_get)
+ */
+hash_item *do_item_get_any(struct default_engine *engine,
+                           const hash_key *key) {
     rel_time_t current_time = engine->server.core->get_current_time();
     hash_item *it = assoc_find(engine,
                                crc32c(hash_key_get_key(key),
@@ -538,6 +543,21 @@ hash_item *do_item_get(struct default_engine *engine,
     return it;
 }
 
+/**
+ * Get an item from the hash table. A lease is a placeholder for the value
+ * a client is about to refill, so it looks like a miss to everything but
+ * GET_LEASE and the stores.
+ */
+hash_item *do_item_get(struct default_engine *engine,
+                       const hash_key *key) {
+    hash_item *it = do_item_get_any(engine, key);
+    if (it != NULL && (it->iflag & ITEM_LEASE) != 0) {
+        do_item_release(engine, it);
+        it = NULL;
+    }
+    return it;
+}
+
 /*
  * Stores an item in the cache according to the semantics of one of the set
  * commands. In threaded mode, this is protected by the cache lock.
@@ -550,11 +570,23 @@ static ENGINE_ERROR_CODE do_store_item(struct default_engine *engine,
                                        const void *cookie,
                                        hash_item** stored_item) {
     const hash_key* key = item_get_key(it);
-    hash_item *old_it = do_item_get(engine, key);
+    hash_item *old_it = do_item_get_any(engine, key);
+    hash_item *lease = NULL;
     ENGINE_ERROR_CODE stored = ENGINE_NOT_STORED;
 
     hash_item *new_it = NULL;
 
+    if (old_it != NULL && (old_it->iflag & ITEM_LEASE) != 0 &&
+        operation != OPERATION_CAS) {
+        /*
+         * There is no value behind a lease: add and set replace it, and
+         * the others fail as they would for a missing item. A CAS with
+         * the lease token is the refill the lease was handed out for.
+         */
+        lease = old_it;
+        old_it = NULL;
+    }
+
     if (old_it != NULL && operation == OPERATION_ADD) {
         /* add only adds a nonexistent item, but promote to head of LRU */
         do_item_update(engine, old_it);
@@ -640,6 +672,8 @@ static ENGINE_ERROR_CODE do_store_item(struct default_engine *engine,
         if (stored == ENGINE_NOT_STORED) {
             if (old_it != NULL) {
                 do_item_replace(engine, old_it, it);
+            } else if (lease != NULL) {
+                do_item_replace(engine, lease, it);
             } else {
                 do_item_link(engine, it);
             }
@@ -653,6 +687,10 @@ static ENGINE_ERROR_CODE do_store_item(struct default_engine *engine,
         do_item_release(engine, old_it);         /* release our reference */
     }
 
+    if (lease != NULL) {
+        do_item_release(engine, lease);
+    }
+
     if (new_it != NULL) {
         do_item_release(engine, new_it);
     }
@@ -780,6 +818,310 @@ hash_item *item_get(struct default_engine *engine,
     return it;
 }
 
+/*
+ * The number of keys item_get_multi looks up for every time it grabs the
+ * items lock. The hash keys for a chunk live on the stack (they're
+ * roughly 150 bytes each), and we don't want to hold the lock for too
+ * long when the batch is big.
+ */
+#define ITEM_GET_MULTI_CHUNK 32
+
+void item_get_multi(struct default_engine *engine,
+                    const void *cookie,
+                    const engine_key_t *keys,
+                    const size_t nkeys,
+                    hash_item **items) {
+    hash_key hkeys[ITEM_GET_MULTI_CHUNK];
+    bool valid[ITEM_GET_MULTI_CHUNK];
+    size_t offset, count, ii;
+
+    for (offset = 0; offset < nkeys; offset += count) {
+        count = nkeys - offset;
+        if (count > ITEM_GET_MULTI_CHUNK) {
+            count = ITEM_GET_MULTI_CHUNK;
+        }
+
+        /* Build the keys before we grab the lock (it may allocate) */
+        for (ii = 0; ii < count; ++ii) {
+            valid[ii] = hash_key_create(&hkeys[ii], keys[offset + ii].key,
+                                        keys[offset + ii].nkey,
+                                        engine, cookie);
+        }
+
+        cb_mutex_enter(&engine->items.lock);
+        for (ii = 0; ii < count; ++ii) {
+            if (valid[ii]) {
+                items[offset + ii] = do_item_get(engine, &hkeys[ii]);
+            } else {
+                items[offset + ii] = NULL;
+            }
+        }
+        cb_mutex_exit(&engine->items.lock);
+
+        for (ii = 0; ii < count; ++ii) {
+            if (valid[ii]) {
+                hash_key_destroy(&hkeys[ii]);
+            }
+        }
+    }
+}
+
+struct item_scan_ctx {
+    struct default_engine *engine;
+    rel_time_t current_time;
+    const void *prefix;
+    uint16_t nprefix;
+    engine_scan_callback_t callback;
+    void *ctx;
+};
+
+static bool item_scan_visitor(hash_item *it, void *arg) {
+    struct item_scan_ctx *scan = arg;
+    struct default_engine *engine = scan->engine;
+    const hash_key *key = item_get_key(it);
+    item_info info;
+
+    /* The hash table is shared by all of the buckets */
+    if (hash_key_get_bucket_index(key) != engine->bucket_id) {
+        return false;
+    }
+
+    if (hash_key_get_client_key_len(key) < scan->nprefix ||
+        memcmp(hash_key_get_client_key(key), scan->prefix,
+               scan->nprefix) != 0) {
+        return false;
+    }
+
+    /* Leases don't have a value yet */
+    if ((it->iflag & ITEM_LEASE) != 0) {
+        return false;
+    }
+
+    /* Skip the items do_item_get would nuke (we can't unlink them here) */
+    if (engine->config.oldest_live != 0 &&
+        engine->config.oldest_live <= scan->current_time &&
+        it->time <= engine->config.oldest_live) {
+        return false;
+    }
+    if (it->exptime != 0 && it->exptime <= scan->current_time) {
+        return false;
+    }
+
+    memset(&info, 0, sizeof(info));
+    info.cas = item_get_cas(it);
+    info.exptime = it->exptime;
+    info.nbytes = it->nbytes;
+    info.flags = it->flags;
+    info.clsid = it->slabs_clsid;
+    info.datatype = it->datatype;
+    info.nkey = hash_key_get_client_key_len(key);
+    info.key = hash_key_get_client_key(key);
+    info.nvalue = 0;
+    scan->callback(&info, scan->ctx);
+    return true;
+}
+
+void item_scan(struct default_engine *engine,
+               uint64_t *cursor,
+               const void *prefix,
+               const uint16_t nprefix,
+               const uint32_t count,
+               engine_scan_callback_t callback,
+               void *ctx) {
+    struct item_scan_ctx scan;
+    scan.engine = engine;
+    scan.current_time = engine->server.core->get_current_time();
+    scan.prefix = prefix;
+    scan.nprefix = nprefix;
+    scan.callback = callback;
+    scan.ctx = ctx;
+
+    /*
+     * The locks are only held for a batch, so the items may change
+     * between two batches. The cursor is an index in the hash table and
+     * not a pointer to an item, so that's fine.
+     */
+    cb_mutex_enter(&engine->items.lock);
+    *cursor = assoc_scan(engine, *cursor, count, item_scan_visitor, &scan);
+    cb_mutex_exit(&engine->items.lock);
+}
+
+static void item_count_lease(struct default_engine *engine,
+                             uint64_t *stat) {
+    cb_mutex_enter(&engine->stats.lock);
+    (*stat)++;
+    cb_mutex_exit(&engine->stats.lock);
+}
+
+/*
+ * Hand out a new lease for the key. The lease is an item linked in the hash
+ * table in place of the value, with the lease token as its CAS. The lease
+ * expires after lease_time seconds so that another client gets to refill
+ * the key if the holder of the lease never comes back.
+ *
+ * @param stale the expired item to keep serving until the refill (or NULL)
+ */
+static ENGINE_ERROR_CODE do_item_issue_lease(struct default_engine *engine,
+                                             const void *cookie,
+                                             const hash_key *key,
+                                             hash_item *stale,
+                                             uint64_t *lease) {
+    rel_time_t exptime = engine->server.core->get_current_time() +
+                         (rel_time_t)engine->config.lease_time;
+    hash_item *it;
+
+    if (stale != NULL) {
+        it = do_item_alloc(engine, key, stale->flags, exptime, stale->nbytes,
+                           cookie, stale->datatype);
+    } else {
+        it = do_item_alloc(engine, key, 0, exptime, 0, cookie,
+                           PROTOCOL_BINARY_RAW_BYTES);
+    }
+
+    if (it == NULL) {
+        /* Let the client refill without a lease rather than fail it */
+        if (stale != NULL) {
+            do_item_unlink(engine, stale);
+        }
+        return ENGINE_KEY_ENOENT;
+    }
+
+    if (stale != NULL) {
+        memcpy(item_get_data(it), item_get_data(stale), stale->nbytes);
+        it->iflag |= ITEM_LEASE | ITEM_LEASE_STALE;
+        do_item_replace(engine, stale, it);
+    } else {
+        it->iflag |= ITEM_LEASE;
+        do_item_link(engine, it);
+    }
+
+    *lease = item_get_cas(it);
+    do_item_release(engine, it);
+    item_count_lease(engine, &engine->stats.leases_issued);
+    return ENGINE_KEY_ENOENT;
+}
+
+static ENGINE_ERROR_CODE do_item_get_lease(struct default_engine *engine,
+                                           const void *cookie,
+                                           const hash_key *key,
+                                           hash_item **result,
+                                           uint64_t *lease,
+                                           bool *stale) {
+    rel_time_t current_time = engine->server.core->get_current_time();
+    hash_item *it = assoc_find(engine,
+                               crc32c(hash_key_get_key(key),
+                                      hash_key_get_key_len(key), 0),
+                               key);
+    ENGINE_ERROR_CODE ret;
+
+    if (it != NULL && engine->config.oldest_live != 0 &&
+        engine->config.oldest_live <= current_time &&
+        it->time <= engine->config.oldest_live) {
+        do_item_unlink(engine, it);
+        it = NULL;
+    }
+
+    if (it != NULL && (it->iflag & ITEM_LEASE) != 0) {
+        if (it->exptime > current_time) {
+            /* Someone else is refilling the key */
+            item_count_lease(engine, &engine->stats.lease_refills_avoided);
+            if ((it->iflag & ITEM_LEASE_STALE) == 0) {
+                return ENGINE_TMPFAIL;
+            }
+
+            item_count_lease(engine, &engine->stats.lease_stale_hits);
+            it->refcount++;
+            DEBUG_REFCNT(it, '+');
+            *result = it;
+            *stale = true;
+            return ENGINE_SUCCESS;
+        }
+
+        /* The holder of the lease never refilled the key */
+        do_item_unlink(engine, it);
+        it = NULL;
+    }
+
+    if (it != NULL && it->exptime != 0 && it->exptime <= current_time) {
+        if (current_time - it->exptime >=
+            (rel_time_t)engine->config.lease_grace) {
+            do_item_unlink(engine, it);
+            return do_item_issue_lease(engine, cookie, key, NULL, lease);
+        }
+
+        /* Hold a reference so that the allocation can't steal the item */
+        it->refcount++;
+        DEBUG_REFCNT(it, '+');
+        ret = do_item_issue_lease(engine, cookie, key, it, lease);
+        do_item_release(engine, it);
+        return ret;
+    }
+
+    if (it == NULL) {
+        return do_item_issue_lease(engine, cookie, key, NULL, lease);
+    }
+
+    it->refcount++;
+    DEBUG_REFCNT(it, '+');
+    do_item_update(engine, it);
+    *result = it;
+    return ENGINE_SUCCESS;
+}
+
+ENGINE_ERROR_CODE item_get_lease(struct default_engine *engine,
+                                 const void *cookie,
+                                 const void *key,
+                                 const size_t nkey,
+                                 hash_item **item,
+                                 uint64_t *lease,
+                                 bool *stale) {
+    ENGINE_ERROR_CODE ret;
+    hash_key hkey;
+
+    *item = NULL;
+    *lease = 0;
+    *stale = false;
+
+    /* The lease token is the CAS of the lease */
+    if (!engine->config.use_cas) {
+        return ENGINE_ENOTSUP;
+    }
+
+    if (!hash_key_create(&hkey, key, nkey, engine, cookie)) {
+        return ENGINE_ENOMEM;
+    }
+    cb_mutex_enter(&engine->items.lock);
+    ret = do_item_get_lease(engine, cookie, &hkey, item, lease, stale);
+    cb_mutex_exit(&engine->items.lock);
+    hash_key_destroy(&hkey);
+    return ret;
+}
+
+bool item_unlink_lease(struct default_engine *engine,
+                       const void *cookie,
+                       const void *key,
+                       const size_t nkey) {
+    hash_item *it;
+    hash_key hkey;
+    bool ret = false;
+
+    if (!hash_key_create(&hkey, key, nkey, engine, cookie)) {
+        return false;
+    }
+    cb_mutex_enter(&engine->items.lock);
+    it = do_item_get_any(engine, &hkey);
+    if (it != NULL) {
+        if ((it->iflag & ITEM_LEASE) != 0) {
+            do_item_unlink(engine, it);
+            ret = true;
+        }
+        do_item_release(engine, it);
+    }
+    cb_mutex_exit(&engine->items.lock);
+    hash_key_destroy(&hkey);
+    return ret;
+}
+
 /*
  * Decrements the reference count on an item and adds it to the freelist if
  * needed.
@@ -892,6 +1234,37 @@ ENGINE_ERROR_CODE store_item(struct default_engine *engine,
     return ret;
 }
 
+/*
+ * The number of items store_item_multi stores every time it grabs the
+ * items lock, so that other connections get a chance to run between two
+ * chunks of a big batch.
+ */
+#define STORE_ITEM_MULTI_CHUNK 64
+
+void store_item_multi(struct default_engine *engine,
+                      hash_item **items,
+                      const size_t nitems,
+                      ENGINE_STORE_OPERATION operation,
+                      ENGINE_ERROR_CODE *results,
+                      const void *cookie) {
+    size_t offset, count, ii;
+
+    for (offset = 0; offset < nitems; offset += count) {
+        count = nitems - offset;
+        if (count > STORE_ITEM_MULTI_CHUNK) {
+            count = STORE_ITEM_MULTI_CHUNK;
+        }
+
+        cb_mutex_enter(&engine->items.lock);
+        for (ii = offset; ii < offset + count; ++ii) {
+            hash_item* stored_item = NULL;
+            results[ii] = do_store_item(engine, items[ii], operation, cookie,
+                                        &stored_item);
+        }
+        cb_mutex_exit(&engine->items.lock);
+    }
+}
+
 static hash_item *do_touch_item(struct default_engine *engine,
                                 const hash_key *hkey,
                                 uint32_t exptime)
@@ -1138,6 +1511,10 @@ static ENGINE_ERROR_CODE item_tap_iterfunc(struct default_engine *engine,
                                     hash_item *item,
                                     void *cookie) {
     struct tap_client *client = cookie;
+    if ((item->iflag & ITEM_LEASE) != 0) {
+        /* Leases don't have a value to replicate */
+        return ENGINE_SUCCESS;
+    }
     client->it = item;
     ++client->it->refcount;
     return ENGINE_SUCCESS;
@@ -1249,6 +1626,10 @@ static ENGINE_ERROR_CODE item_dcp_iterfunc(struct default_engine *engine,
                                            hash_item *item,
                                            void *cookie) {
     struct dcp_connection *connection = cookie;
+    if ((item->iflag & ITEM_LEASE) != 0) {
+        /* Leases don't have a value to replicate */
+        return ENGINE_SUCCESS;
+    }
     connection->it = item;
     ++connection->it->refcount;
     return ENGINE_SUCCESS;
@@ -156,6 +156,82 @@ hash_item *item_get(struct default_engine *engine,
                     const void *key,
                     const size_t nkey);
 
+/**
+ * Get a batch of items from the cache. The items lock is only acquired
+ * once for every few keys instead of once per key.
+ *
+ * @param engine handle to the storage engine
+ * @param cookie connection cookie
+ * @param keys the keys to look up
+ * @param nkeys the number of keys
+ * @param items where to store the items (NULL for the keys which don't
+ *              exist)
+ */
+void item_get_multi(struct default_engine *engine,
+                    const void *cookie,
+                    const engine_key_t *keys,
+                    const size_t nkeys,
+                    hash_item **items);
+
+/**
+ * Visit a batch of the items in the bucket (see ENGINE_HANDLE_V1::scan).
+ * Expired items and items which are flushed are skipped.
+ *
+ * @param engine handle to the storage engine
+ * @param cursor IN: where to continue the scan (0 to start), OUT: where to
+ *               continue with the next batch (0 when the scan is complete)
+ * @param prefix only visit the keys starting with the prefix
+ * @param nprefix the length of the prefix
+ * @param count the approximate number of items to visit
+ * @param callback called for each item visited (with the locks held)
+ * @param ctx passed to the callback
+ */
+void item_scan(struct default_engine *engine,
+               uint64_t *cursor,
+               const void *prefix,
+               const uint16_t nprefix,
+               const uint32_t count,
+               engine_scan_callback_t callback,
+               void *ctx);
+
+/**
+ * Get an item from the cache, or a lease to refill it on a miss (see
+ * ENGINE_HANDLE_V1::get_lease)
+ *
+ * @param engine handle to the storage engine
+ * @param cookie connection cookie
+ * @param key the key for the item to get
+ * @param nkey the number of bytes in the key
+ * @param item where to store the item
+ * @param lease where to store the lease token (0 if no lease was issued)
+ * @param stale set to true if the item is the value of an expired item
+ *              being refilled by another client
+ * @return ENGINE_SUCCESS with the item, ENGINE_KEY_ENOENT with the lease
+ *         token on a miss, ENGINE_TMPFAIL if another client holds the
+ *         lease or ENGINE_ENOTSUP if the engine doesn't use CAS
+ */
+ENGINE_ERROR_CODE item_get_lease(struct default_engine *engine,
+                                 const void *cookie,
+                                 const void *key,
+                                 const size_t nkey,
+                                 hash_item **item,
+                                 uint64_t *lease,
+                                 bool *stale);
+
+/**
+ * Drop the outstanding lease for the key (if any)
+ *
+ * @param engine handle to the storage engine
+ * @param cookie connection cookie
+ * @param key the key
+ * @param nkey the number of bytes in the key
+ * @return true if a lease was dropped
+ */
+bool item_unlink_lease(struct default_engine *engine,
+                       const void *cookie,
+                       const void *key,
+                       const size_t nkey);
+
 /**
  * Reset the item statistics
  * @param engine handle to the storage engine
@@ -235,6 +311,22 @@ ENGINE_ERROR_CODE store_item(struct default_engine *engine,
                              ENGINE_STORE_OPERATION operation,
                              const void *cookie);
 
+/**
+ * Store a batch of items in the cache (see ENGINE_HANDLE_V1::store_multi)
+ * @param engine handle to the storage engine
+ * @param items the items to store
+ * @param nitems the number of items
+ * @param operation what kind of store operation is this (ADD/SET etc)
+ * @param results where to store the status of each item
+ * @param cookie the cookie provided by the frontend
+ */
+void store_item_multi(struct default_engine *engine,
+                      hash_item **items,
+                      const size_t nitems,
+                      ENGINE_STORE_OPERATION operation,
+                      ENGINE_ERROR_CODE *results,
+                      const void *cookie);
+
 ENGINE_ERROR_CODE arithmetic(struct default_engine *engine,
                              const void* cookie,
                              const void* key,
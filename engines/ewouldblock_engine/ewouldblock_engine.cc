@@ -60,13 +60,14 @@
 #include "ewouldblock_engine.h"
 
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <cstring>
 #include <map>
 #include <memory>
 #include <mutex>
-#include <queue>
 #include <random>
+#include <set>
 #include <sstream>
 #include <string>
 
@@ -74,10 +75,11 @@
 #include "utilities/engine_loader.h"
 
 // Shared state between the main thread of execution and the background
-// thread processing pending io ops.
+// thread processing pending io ops. The ops are ordered by the time
+// they should be notified.
 static std::mutex mutex;
 static std::condition_variable condvar;
-static std::queue<const void*> pending_io_ops;
+static std::multimap<std::chrono::steady_clock::time_point, const void*> pending_io_ops;
 std::atomic<bool> stop_notification_thread;
 
 
@@ -130,7 +132,9 @@ public:
             return false;
         }
 
-        const bool inject = iter->second.second->should_inject_error(cmd, err);
+        const bool inject = iter->second.second->should_inject_error(cmd,
+                                                                     cookie,
+                                                                     err);
 
         if (inject) {
             auto logger = gsa()->log->get_logger();
@@ -141,10 +145,15 @@ public:
             if (err == ENGINE_EWOULDBLOCK) {
                 // The server expects that if EWOULDBLOCK is returned then the
                 // server should be notified in the future when the operation is
-                // ready - so add this op to the pending IO queue.
+                // ready - so add this op to the pending IO queue. Notify the
+                // cookie used for this call (which isn't necessarily the one
+                // used to configure the mode if the connection use
+                // unordered execution).
+                const auto when = std::chrono::steady_clock::now() +
+                                  iter->second.second->get_notify_delay();
                 {
                     std::lock_guard<std::mutex> guard(mutex);
-                    pending_io_ops.push(iter->second.first);
+                    pending_io_ops.emplace(when, cookie);
                 }
                 condvar.notify_one();
             }
@@ -209,6 +218,21 @@ public:
             ewb->ENGINE_HANDLE_V1::get_stats_struct = ewb->real_engine->get_stats_struct;
             ewb->ENGINE_HANDLE_V1::item_set_cas = ewb->real_engine->item_set_cas;
             ewb->ENGINE_HANDLE_V1::set_item_info = ewb->real_engine->set_item_info;
+
+            // Only offer the batched lookup if the real engine has it (the
+            // core emulates it with get() otherwise)
+            if (ewb->real_engine->get_multi != nullptr) {
+                ewb->ENGINE_HANDLE_V1::get_multi = get_multi;
+            }
+            if (ewb->real_engine->scan != nullptr) {
+                ewb->ENGINE_HANDLE_V1::scan = scan;
+            }
+            if (ewb->real_engine->store_multi != nullptr) {
+                ewb->ENGINE_HANDLE_V1::store_multi = store_multi;
+            }
+            if (ewb->real_engine->get_lease != nullptr) {
+                ewb->ENGINE_HANDLE_V1::get_lease = get_lease;
+            }
         }
         return res;
     }
@@ -275,6 +299,69 @@ public:
         }
     }
 
+    static ENGINE_ERROR_CODE get_multi(ENGINE_HANDLE* handle,
+                                       const void* cookie,
+                                       const engine_key_t* keys, size_t nkeys,
+                                       item** items, uint16_t vbucket) {
+        EWB_Engine* ewb = to_engine(handle);
+        ENGINE_ERROR_CODE err = ENGINE_SUCCESS;
+        if (ewb->should_inject_error(Cmd::GET, cookie, err)) {
+            return err;
+        } else {
+            return ewb->real_engine->get_multi(ewb->real_handle, cookie, keys,
+                                               nkeys, items, vbucket);
+        }
+    }
+
+    static ENGINE_ERROR_CODE scan(ENGINE_HANDLE* handle, const void* cookie,
+                                  uint64_t* cursor, const void* prefix,
+                                  uint16_t nprefix, uint32_t count,
+                                  engine_scan_callback_t callback,
+                                  void* ctx, uint16_t vbucket) {
+        EWB_Engine* ewb = to_engine(handle);
+        ENGINE_ERROR_CODE err = ENGINE_SUCCESS;
+        if (ewb->should_inject_error(Cmd::GET, cookie, err)) {
+            return err;
+        } else {
+            return ewb->real_engine->scan(ewb->real_handle, cookie, cursor,
+                                          prefix, nprefix, count, callback,
+                                          ctx, vbucket);
+        }
+    }
+
+    static ENGINE_ERROR_CODE get_lease(ENGINE_HANDLE* handle,
+                                       const void* cookie, item** item,
+                                       const void* key, const int nkey,
+                                       uint16_t vbucket, uint64_t* lease,
+                                       bool* stale) {
+        EWB_Engine* ewb = to_engine(handle);
+        ENGINE_ERROR_CODE err = ENGINE_SUCCESS;
+        if (ewb->should_inject_error(Cmd::GET, cookie, err)) {
+            return err;
+        } else {
+            return ewb->real_engine->get_lease(ewb->real_handle, cookie, item,
+                                               key, nkey, vbucket, lease,
+                                               stale);
+        }
+    }
+
+    static ENGINE_ERROR_CODE store_multi(ENGINE_HANDLE* handle,
+                                         const void* cookie, item** items,
+                                         size_t nitems,
+                                         ENGINE_STORE_OPERATION operation,
+                                         ENGINE_ERROR_CODE* results,
+                                         uint16_t vbucket) {
+        EWB_Engine* ewb = to_engine(handle);
+        ENGINE_ERROR_CODE err = ENGINE_SUCCESS;
+        if (ewb->should_inject_error(Cmd::STORE, cookie, err)) {
+            return err;
+        } else {
+            return ewb->real_engine->store_multi(ewb->real_handle, cookie,
+                                                 items, nitems, operation,
+                                                 results, vbucket);
+        }
+    }
+
     static ENGINE_ERROR_CODE store(ENGINE_HANDLE* handle, const void *cookie,
                                    item* item, uint64_t *cas,
                                    ENGINE_STORE_OPERATION operation,
@@ -383,6 +470,10 @@ public:
                     new_mode = std::make_shared<CASMismatch>(value);
                     break;
 
+                case EWBEngineMode::RandomDelay:
+                    new_mode = std::make_shared<ErrRandomDelay>(value);
+                    break;
+
                 case EWBEngineMode::IncrementClusterMapRevno:
                     ewb->clustermap_revno++;
                     response(nullptr, 0, nullptr, 0, nullptr, 0,
@@ -543,7 +634,14 @@ private:
         FaultInjectMode(ENGINE_ERROR_CODE injected_error_)
           : injected_error(injected_error_) {}
 
-        virtual bool should_inject_error(Cmd cmd, ENGINE_ERROR_CODE& err) = 0;
+        virtual bool should_inject_error(Cmd cmd, const void* cookie,
+                                         ENGINE_ERROR_CODE& err) = 0;
+
+        // How long to wait before notifying the cookie after injecting
+        // EWOULDBLOCK
+        virtual std::chrono::microseconds get_notify_delay() {
+            return std::chrono::microseconds(0);
+        }
 
         virtual std::string to_string() const = 0;
 
@@ -559,7 +657,8 @@ private:
           : FaultInjectMode(injected_error_),
             prev_cmd(Cmd::NONE) {}
 
-        bool should_inject_error(Cmd cmd, ENGINE_ERROR_CODE& err) {
+        bool should_inject_error(Cmd cmd, const void* cookie,
+                                 ENGINE_ERROR_CODE& err) {
             // Block unless the previous command from this cookie
             // was the same - i.e. all of a connections' commands
             // will EWOULDBLOCK the first time they are called.
@@ -586,7 +685,8 @@ private:
           : FaultInjectMode(injected_error_),
             count(count_) {}
 
-        bool should_inject_error(Cmd cmd, ENGINE_ERROR_CODE& err) {
+        bool should_inject_error(Cmd cmd, const void* cookie,
+                                 ENGINE_ERROR_CODE& err) {
             if (count > 0) {
                 --count;
                 err = injected_error;
@@ -613,7 +713,8 @@ private:
           : FaultInjectMode(injected_error_),
             percentage_to_err(percentage_) {}
 
-        bool should_inject_error(Cmd cmd, ENGINE_ERROR_CODE& err) {
+        bool should_inject_error(Cmd cmd, const void* cookie,
+                                 ENGINE_ERROR_CODE& err) {
             std::random_device rd;
             std::mt19937 gen(rd());
             std::uniform_int_distribution<uint32_t> dis(1, 100);
@@ -643,7 +744,8 @@ private:
               sequence(sequence_),
               pos(0) {}
 
-        bool should_inject_error(Cmd cmd, ENGINE_ERROR_CODE& err) {
+        bool should_inject_error(Cmd cmd, const void* cookie,
+                                 ENGINE_ERROR_CODE& err) {
             bool inject = false;
             if (pos < 32) {
                 inject = (sequence & (1 << pos)) != 0;
@@ -674,7 +776,8 @@ private:
           : FaultInjectMode(ENGINE_KEY_EEXISTS),
             count(count_) {}
 
-        bool should_inject_error(Cmd cmd, ENGINE_ERROR_CODE& err) {
+        bool should_inject_error(Cmd cmd, const void* cookie,
+                                 ENGINE_ERROR_CODE& err) {
             if (cmd == Cmd::STORE && (count > 0)) {
                 --count;
                 err = injected_error;
@@ -693,6 +796,42 @@ private:
         uint32_t count;
     };
 
+    class ErrRandomDelay : public FaultInjectMode {
+    public:
+        ErrRandomDelay(uint32_t max_delay_)
+          : FaultInjectMode(ENGINE_EWOULDBLOCK),
+            gen(std::random_device()()),
+            dis(0, max_delay_),
+            max_delay(max_delay_) {}
+
+        bool should_inject_error(Cmd cmd, const void* cookie,
+                                 ENGINE_ERROR_CODE& err) {
+            // Let the retry (after we've notified the cookie) through
+            if (delayed.erase(cookie) > 0) {
+                return false;
+            }
+            delayed.insert(cookie);
+            err = injected_error;
+            return true;
+        }
+
+        std::chrono::microseconds get_notify_delay() {
+            return std::chrono::microseconds(dis(gen));
+        }
+
+        std::string to_string() const {
+            return std::string("ErrRandomDelay") +
+                   " max_delay=" + std::to_string(max_delay);
+        }
+
+    private:
+        std::mt19937 gen;
+        std::uniform_int_distribution<uint32_t> dis;
+        uint32_t max_delay;
+        // The cookies we've returned EWOULDBLOCK for
+        std::set<const void*> delayed;
+    };
+
     // Map of connections (aka cookies) to their current mode.
     std::map<uint64_t, std::pair<const void*, std::shared_ptr<FaultInjectMode> > > connection_map;
     // Mutex for above map.
@@ -714,8 +853,18 @@ void process_pending_queue(void* arg) {
         condvar.wait(lk,
                      []{return (stop_notification_thread || !pending_io_ops.empty());});
         while (!pending_io_ops.empty()) {
-            const void* cookie = pending_io_ops.front();
-            pending_io_ops.pop();
+            auto next = pending_io_ops.begin();
+            if (next->first > std::chrono::steady_clock::now()) {
+                // Wait for it to expire (or for an op which should be
+                // notified before it)
+                condvar.wait_until(lk, next->first);
+                if (stop_notification_thread) {
+                    break;
+                }
+                continue;
+            }
+            const void* cookie = next->second;
+            pending_io_ops.erase(next);
             lk.unlock();
             server->cookie->notify_io_complete(cookie, ENGINE_SUCCESS);
             lk.lock();
@@ -750,6 +899,10 @@ EWB_Engine::EWB_Engine(GET_SERVER_API gsa_)
     ENGINE_HANDLE_V1::get_engine_vb_map = get_engine_vb_map;
     ENGINE_HANDLE_V1::get_stats_struct = NULL;
     ENGINE_HANDLE_V1::set_log_level = NULL;
+    ENGINE_HANDLE_V1::get_multi = NULL;
+    ENGINE_HANDLE_V1::scan = NULL;
+    ENGINE_HANDLE_V1::store_multi = NULL;
+    ENGINE_HANDLE_V1::get_lease = NULL;
 
     ENGINE_HANDLE_V1::dcp = {};
     ENGINE_HANDLE_V1::dcp.step = dcp_step;
@@ -84,5 +84,11 @@ enum class EWBEngineMode : uint32_t {
 
     // Increment the cluster map sequence number. Value and inject_error is
     // ignored for this opcode
-    IncrementClusterMapRevno = 5
+    IncrementClusterMapRevno = 5,
+
+    // The first call to a function with a given cookie returns EWOULDBLOCK,
+    // and the cookie is notified after a random delay of up to {value}
+    // microseconds. The retried call operates normally. inject_error is
+    // ignored for this mode.
+    RandomDelay = 6
 };
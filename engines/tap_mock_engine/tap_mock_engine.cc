@@ -861,6 +861,10 @@ struct EngineGlue {
         interface.get_item_info = get_item_info;
         interface.set_item_info = set_item_info;
         interface.set_log_level = NULL;
+        interface.get_multi = NULL;
+        interface.scan = NULL;
+        interface.store_multi = NULL;
+        interface.get_lease = NULL;
     }
 
     ENGINE_HANDLE_V1 interface;
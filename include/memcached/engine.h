@@ -77,6 +77,7 @@ extern "C" {
         SERVER_LOG_API *log;
         SERVER_COOKIE_API *cookie;
         ALLOCATOR_HOOKS_API *alloc_hooks;
+        SERVER_SCHEDULER_API *scheduler;
     };
 
     typedef enum { TAP_MUTATION = 1,
@@ -193,6 +194,23 @@ extern "C" {
         feature_info features[1];
     } engine_info;
 
+    /**
+     * A key in a batched lookup (see get_multi)
+     */
+    typedef struct {
+        const void* key;
+        uint16_t nkey;
+    } engine_key_t;
+
+    /**
+     * Callback for each key visited by scan (see scan). The item info
+     * describes the item without its value (nvalue is 0), and is only
+     * valid during the call. The callback is called with the locks of the
+     * engine held so it must be quick, and it must not call back into the
+     * engine.
+     */
+    typedef void (*engine_scan_callback_t)(const item_info* info, void* ctx);
+
     /**
      * Definition of the first version of the engine interface
      */
@@ -585,6 +603,127 @@ extern "C" {
          * @param level the current log level
          */
         void (*set_log_level)(ENGINE_HANDLE* handle, EXTENSION_LOG_LEVEL level);
+
+        /**
+         * Retrieve a batch of items from the same virtual bucket (optional).
+         * The core falls back to calling get() for each key if the engine
+         * doesn't implement it.
+         *
+         * @param handle the engine handle
+         * @param cookie The cookie provided by the frontend
+         * @param keys the keys to look up
+         * @param nkeys the number of keys
+         * @param items output array of nkeys entries receiving the located
+         *              items (NULL for the keys that weren't found). The
+         *              caller must release all of them.
+         * @param vbucket the virtual bucket id
+         *
+         * @return ENGINE_SUCCESS if the lookup was performed (even if some
+         *         or all of the keys weren't found), or the error for the
+         *         batch as a whole (no items are returned then)
+         */
+        ENGINE_ERROR_CODE (*get_multi)(ENGINE_HANDLE* handle,
+                                       const void* cookie,
+                                       const engine_key_t* keys,
+                                       size_t nkeys,
+                                       item** items,
+                                       uint16_t vbucket);
+
+        /**
+         * Visit a batch of the keys in the bucket (optional).
+         *
+         * The cursor is opaque to the caller: start a scan with 0, and
+         * keep calling scan with the cursor it returns until it returns
+         * 0. Every key which exists for the entire scan is visited at
+         * least once, but keys may be visited more than once (for instance
+         * if the engine resizes its hash table during the scan). A batch
+         * may visit no keys at all even if the scan isn't complete.
+         *
+         * @param handle the engine handle
+         * @param cookie The cookie provided by the frontend
+         * @param cursor IN: where to continue the scan, OUT: where to
+         *               continue with the next batch (0 when the scan is
+         *               complete)
+         * @param prefix only visit the keys starting with the prefix
+         * @param nprefix the length of the prefix (0 to visit all keys)
+         * @param count the approximate number of keys to visit
+         * @param callback called for each key visited
+         * @param ctx passed to the callback
+         * @param vbucket the virtual bucket to visit the keys in
+         *
+         * @return ENGINE_SUCCESS if the batch was visited
+         */
+        ENGINE_ERROR_CODE (*scan)(ENGINE_HANDLE* handle,
+                                  const void* cookie,
+                                  uint64_t* cursor,
+                                  const void* prefix,
+                                  uint16_t nprefix,
+                                  uint32_t count,
+                                  engine_scan_callback_t callback,
+                                  void* ctx,
+                                  uint16_t vbucket);
+
+        /**
+         * Store a batch of items (optional).
+         *
+         * The items are stored as if store() were called for each of
+         * them (but the engine may do it more efficiently, for instance
+         * by grabbing its locks once for the batch). The caller keeps its
+         * reference to the items and must release them.
+         *
+         * @param handle the engine handle
+         * @param cookie The cookie provided by the frontend
+         * @param items the items to store
+         * @param nitems the number of items
+         * @param operation the type of store operation to perform
+         * @param results where to store the status of each item
+         * @param vbucket the vbucket of all of the items
+         *
+         * @return ENGINE_SUCCESS if the batch was processed (the status of
+         *         each item is in results), or the error affecting the
+         *         whole batch (in which case no item is stored)
+         */
+        ENGINE_ERROR_CODE (*store_multi)(ENGINE_HANDLE* handle,
+                                         const void* cookie,
+                                         item** items,
+                                         size_t nitems,
+                                         ENGINE_STORE_OPERATION operation,
+                                         ENGINE_ERROR_CODE* results,
+                                         uint16_t vbucket);
+
+        /**
+         * Retrieve an item, or hand out a lease to refill it on a miss
+         * (optional).
+         *
+         * Only one client gets a lease for a key at a time, so that a
+         * miss on a popular key doesn't send every client to the backing
+         * store. The lease token is the CAS the refill must be stored
+         * with; a store without it or a delete of the key invalidates the
+         * lease.
+         *
+         * @param handle the engine handle
+         * @param cookie The cookie provided by the frontend
+         * @param item output variable that will receive the located item
+         * @param key the key to look up
+         * @param nkey the length of the key
+         * @param vbucket the virtual bucket id
+         * @param lease output variable that will receive the lease token
+         *              (0 if the engine couldn't hand out a lease)
+         * @param stale set to true if the item is an expired value which
+         *              is served while another client refills the key
+         *
+         * @return ENGINE_SUCCESS with the item, ENGINE_KEY_ENOENT with a
+         *         lease, or ENGINE_TMPFAIL if another client holds the
+         *         lease for the key (and there's no stale value to return)
+         */
+        ENGINE_ERROR_CODE (*get_lease)(ENGINE_HANDLE* handle,
+                                       const void* cookie,
+                                       item** item,
+                                       const void* key,
+                                       const int nkey,
+                                       uint16_t vbucket,
+                                       uint64_t* lease,
+                                       bool* stale);
     } ENGINE_HANDLE_V1;
 
     /**
@@ -461,6 +461,22 @@ extern "C"
         /* ns_server - memcached internal communication */
         PROTOCOL_BINARY_CMD_INIT_COMPLETE = 0xf6,
 
+        /* Move a Unix domain socket connection over to shared memory */
+        PROTOCOL_BINARY_CMD_SHM_CONNECT = 0xf7,
+
+        /* Get a batch of keys from one vbucket in a single response */
+        PROTOCOL_BINARY_CMD_GET_MULTI = 0xf8,
+
+        /* Enumerate the keys in the bucket with a cursor */
+        PROTOCOL_BINARY_CMD_SCAN = 0xf9,
+
+        /* Store a batch of items for loading the cache */
+        PROTOCOL_BINARY_CMD_BULK_STORE = 0xfa,
+        PROTOCOL_BINARY_CMD_BULK_STOREQ = 0xfb,
+
+        /* Get an item or a lease to refill it on a miss */
+        PROTOCOL_BINARY_CMD_GET_LEASE = 0xfc,
+
         /* Reserved for being able to signal invalid opcode */
         PROTOCOL_BINARY_CMD_INVALID = 0xff
     } protocol_binary_command;
@@ -1257,18 +1273,24 @@ extern "C"
         PROTOCOL_BINARY_FEATURE_TLS = 0x2,
         PROTOCOL_BINARY_FEATURE_TCPNODELAY = 0x03,
         PROTOCOL_BINARY_FEATURE_MUTATION_SEQNO = 0x04,
-        PROTOCOL_BINARY_FEATURE_TCPDELAY = 0x05
+        PROTOCOL_BINARY_FEATURE_TCPDELAY = 0x05,
+        PROTOCOL_BINARY_FEATURE_UNORDERED_EXECUTION = 0x06,
+        PROTOCOL_BINARY_FEATURE_COMPRESSION_SNAPPY = 0x07,
+        PROTOCOL_BINARY_FEATURE_COMPRESSION_LZ4 = 0x08
     } protocol_binary_hello_features;
 
     #define MEMCACHED_FIRST_HELLO_FEATURE 0x01
-    #define MEMCACHED_TOTAL_HELLO_FEATURES 0x05
+    #define MEMCACHED_TOTAL_HELLO_FEATURES 0x08
 
 #define protocol_feature_2_text(a) \
     (a == PROTOCOL_BINARY_FEATURE_DATATYPE) ? "Datatype" : \
     (a == PROTOCOL_BINARY_FEATURE_TLS) ? "TLS" : \
     (a == PROTOCOL_BINARY_FEATURE_TCPNODELAY) ? "TCP NODELAY" : \
     (a == PROTOCOL_BINARY_FEATURE_MUTATION_SEQNO) ? "Mutation seqno" : \
-    (a == PROTOCOL_BINARY_FEATURE_TCPDELAY) ? "TCP DELAY" : "Unknown"
+    (a == PROTOCOL_BINARY_FEATURE_TCPDELAY) ? "TCP DELAY" : \
+    (a == PROTOCOL_BINARY_FEATURE_UNORDERED_EXECUTION) ? "Unordered execution" : \
+    (a == PROTOCOL_BINARY_FEATURE_COMPRESSION_SNAPPY) ? "Snappy compression" : \
+    (a == PROTOCOL_BINARY_FEATURE_COMPRESSION_LZ4) ? "LZ4 compression" : "Unknown"
 
     /**
      * The HELLO command is used by the client and the server to agree
@@ -1283,6 +1305,16 @@ extern "C"
      *
      * In this example the server responds that it allows the client to
      * use the datatype extension, but not the tls extension.
+     *
+     * The compression features ask the server to compress the values
+     * bigger than its "compression_threshold" in the responses. They
+     * require the datatype extension, and the client lists the codecs it
+     * supports in order of preference: the server agrees to (at most) the
+     * first one it supports. The PROTOCOL_BINARY_DATATYPE_COMPRESSED bit
+     * in a response then means that the value is compressed with that
+     * codec. LZ4 blocks are prefixed with the length of the inflated
+     * value (32 bits in network byte order). Values sent by the client
+     * with the compressed bit set must still be snappy compressed.
      */
 
 
@@ -1710,6 +1742,189 @@ extern "C"
     typedef protocol_binary_request_no_extras protocol_binary_request_init_complete;
     typedef protocol_binary_response_no_extras protocol_binary_response_init_complete;
 
+    /**
+     * Message format for CMD_SHM_CONNECT
+     *
+     * The successful response carries no body. It is sent with three
+     * file descriptors attached (SCM_RIGHTS): the memfd holding the
+     * rings, the eventfd the client rings to wake up the server, and the
+     * eventfd the server rings to wake up the client. From then on the
+     * client must not send anything on the socket (it is only used to
+     * detect that the client went away).
+     *
+     * The connection on the rings starts out as a new connection (not
+     * authenticated, in the default bucket and without any HELLO
+     * features), so the client must redo HELLO, SASL and SELECT_BUCKET
+     * over the rings.
+     */
+    typedef protocol_binary_request_no_extras protocol_binary_request_shm_connect;
+    typedef protocol_binary_response_no_extras protocol_binary_response_shm_connect;
+
+    /**
+     * Message format for CMD_GET_MULTI
+     *
+     * The request carries no extras and no key, and the vbucket in the
+     * header applies to all of the keys. The value is the list of keys,
+     * each prefixed with its length (uint16_t in network byte order).
+     *
+     * The successful response carries one entry for every key in the same
+     * order as the request: a protocol_binary_get_multi_entry (with all
+     * fields in network byte order except the flags, which are returned
+     * as stored) followed by valuelen bytes of value. The status is
+     * PROTOCOL_BINARY_RESPONSE_KEY_ENOENT (and there is no value) for the
+     * keys that don't exist. Errors affecting the whole batch (like
+     * NOT_MY_VBUCKET) are returned in the status of the response.
+     */
+    typedef protocol_binary_request_no_extras protocol_binary_request_get_multi;
+    typedef protocol_binary_response_no_extras protocol_binary_response_get_multi;
+
+    /**
+     * The maximum number of keys in a GET_MULTI request (all of the items
+     * are held until the response is sent). Larger batches are rejected
+     * with PROTOCOL_BINARY_RESPONSE_E2BIG.
+     */
+    static const int PROTOCOL_BINARY_GET_MULTI_MAX_KEYS = 1000;
+
+    typedef struct {
+        uint16_t status;
+        uint8_t datatype;
+        uint8_t reserved0;
+        uint32_t flags;
+        uint64_t cas;
+        uint32_t valuelen;
+        uint32_t reserved1;
+    } protocol_binary_get_multi_entry;
+
+    /**
+     * Message format for CMD_SCAN
+     *
+     * The request carries the cursor to continue from (0 to start a new
+     * scan), the approximate number of keys to return and the flags. The
+     * key (which is optional) is a prefix, and only the keys starting with
+     * it are returned.
+     *
+     * The successful response carries the cursor for the next request in
+     * the extras (0 when the scan is complete). The value is the list of
+     * keys, each prefixed with its length (uint16_t in network byte order),
+     * or with a protocol_binary_scan_entry if
+     * PROTOCOL_BINARY_SCAN_FLAG_METADATA is set. The response may hold no
+     * keys even though the scan isn't complete.
+     *
+     * Every key which exists for the entire scan is returned at least
+     * once, but a key may be returned more than once.
+     */
+    typedef union {
+        struct {
+            protocol_binary_request_header header;
+            struct {
+                uint64_t cursor;
+                uint32_t count;
+                uint32_t flags;
+            } body;
+        } message;
+        uint8_t bytes[sizeof(protocol_binary_request_header) + 16];
+    } protocol_binary_request_scan;
+
+    typedef union {
+        struct {
+            protocol_binary_response_header header;
+            struct {
+                uint64_t cursor;
+            } body;
+        } message;
+        uint8_t bytes[sizeof(protocol_binary_response_header) + 8];
+    } protocol_binary_response_scan;
+
+    /* Return the metadata of the items as well as the keys */
+#define PROTOCOL_BINARY_SCAN_FLAG_METADATA 0x01
+
+    /**
+     * The entry preceding each key in the response to CMD_SCAN with
+     * PROTOCOL_BINARY_SCAN_FLAG_METADATA. All fields are in network byte
+     * order except the flags, which are returned as stored. The
+     * expiration is an absolute (unix) time, or 0 if the item never
+     * expires.
+     */
+    typedef struct {
+        uint16_t keylen;
+        uint8_t datatype;
+        uint8_t reserved;
+        uint32_t flags;
+        uint32_t exptime;
+        uint32_t valuelen;
+        uint64_t cas;
+    } protocol_binary_scan_entry;
+
+    /**
+     * Message format for CMD_BULK_STORE and CMD_BULK_STOREQ
+     *
+     * The request carries no extras and no key, and the vbucket in the
+     * header applies to all of the records. The value is the list of
+     * records: a protocol_binary_bulk_store_record (with all fields in
+     * network byte order except the flags, which are stored as they are)
+     * followed by keylen bytes of key and valuelen bytes of value. Every
+     * record is stored with a SET.
+     *
+     * The response only reports the number of records stored and failed,
+     * and the status of the first failure (SUCCESS if none failed).
+     * BULK_STOREQ only sends the response if a record failed (or if the
+     * whole batch failed), so a client may stream batches and send a NOOP
+     * at the end.
+     */
+    typedef protocol_binary_request_no_extras protocol_binary_request_bulk_store;
+
+    typedef union {
+        struct {
+            protocol_binary_response_header header;
+            struct {
+                uint32_t stored;
+                uint32_t failed;
+                uint16_t first_error;
+                uint16_t reserved;
+            } body;
+        } message;
+        uint8_t bytes[sizeof(protocol_binary_response_header) + 12];
+    } protocol_binary_response_bulk_store;
+
+    typedef struct {
+        uint16_t keylen;
+        uint8_t datatype;
+        uint8_t reserved;
+        uint32_t flags;
+        uint32_t exptime;
+        uint32_t valuelen;
+    } protocol_binary_bulk_store_record;
+
+    /**
+     * Message format for CMD_GET_LEASE
+     *
+     * The request carries the key only. On a hit the response is
+     * SUCCESS with the flags of the item and the state of the value in
+     * the extras. The value is PROTOCOL_BINARY_LEASE_STATE_STALE if it
+     * expired and another client is refilling the key (the CAS is 0 then).
+     *
+     * On a miss the response is KEY_ENOENT, and the CAS is the lease token
+     * (or 0 if the server couldn't hand out a lease). The client holding
+     * the lease refills the key with a SET carrying the token as the CAS.
+     * Other clients get ETMPFAIL until the key is refilled or the lease
+     * expires, and should retry after a short delay.
+     */
+    typedef protocol_binary_request_no_extras protocol_binary_request_get_lease;
+
+    typedef union {
+        struct {
+            protocol_binary_response_header header;
+            struct {
+                uint32_t flags;
+                uint32_t state;
+            } body;
+        } message;
+        uint8_t bytes[sizeof(protocol_binary_response_header) + 8];
+    } protocol_binary_response_get_lease;
+
+#define PROTOCOL_BINARY_LEASE_STATE_FRESH 0
+#define PROTOCOL_BINARY_LEASE_STATE_STALE 1
+
     /**
      * Message format for CMD_SET_CONFIG
      */
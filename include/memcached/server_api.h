@@ -36,8 +36,60 @@ extern "C" {
          * Request the server to start a shutdown sequence.
          */
         void (*shutdown)(void);
+
+        /**
+         * Bind the calling thread to the CPUs reserved for housekeeping
+         * threads. Engines should call this from background threads
+         * they create from within a frontend worker thread, as the new
+         * thread would otherwise share the CPU of the worker thread.
+         * May be NULL.
+         */
+        void (*bind_housekeeping_thread)(void);
     } SERVER_CORE_API;
 
+    /**
+     * A task run by the server's background scheduler.
+     *
+     * @param arg the argument passed to schedule
+     * @return true if the task should be run again (after the period it
+     *         was scheduled with), false if it is done
+     */
+    typedef bool (*SERVER_TASK_CALLBACK)(void *arg);
+
+    /**
+     * Run background work on the server's background threads instead of
+     * creating new threads.
+     */
+    typedef struct {
+        /**
+         * Schedule a task to run on one of the background threads. The
+         * task must not block for long as it holds up the other tasks.
+         *
+         * @param name the name of the task (shown in "stats background")
+         * @param callback the function to run
+         * @param arg the argument to pass to the callback
+         * @param delay the number of milliseconds before the first run
+         * @param period the number of milliseconds between each run
+         *               while the callback returns true
+         * @return the id of the task, or 0 if it couldn't be scheduled
+         */
+        uint64_t (*schedule)(const char *name,
+                             SERVER_TASK_CALLBACK callback,
+                             void *arg,
+                             uint32_t delay,
+                             uint32_t period);
+
+        /**
+         * Cancel a task. If the task is running on another thread the
+         * call blocks until it returns, so that the argument passed to
+         * the task may be released after the call.
+         *
+         * @param id the id returned from schedule
+         * @return true if the task was scheduled or running
+         */
+        bool (*cancel)(uint64_t id);
+    } SERVER_SCHEDULER_API;
+
     typedef struct {
         /**
          * Tell the server we've evicted an item.
@@ -59,6 +111,13 @@ extern "C" {
          * connection-specific data throughout duration of the
          * connection.
          *
+         * A command running on a connection which enabled unordered
+         * execution has a cookie of its own. The engine should clear
+         * the data when the command completes; a cookie still holding
+         * data isn't reused, and the ON_DISCONNECT callbacks are run
+         * for it when the connection is closed so the engine may
+         * release the data.
+         *
          * @param cookie The cookie provided by the frontend
          * @param engine_data pointer to opaque data
          */
@@ -13,6 +13,7 @@
 #include <memcached/extension_loggers.h>
 #include <memcached/server_api.h>
 #include "daemon/alloc_hooks.h"
+#include "daemon/background_scheduler.h"
 
 #include <array>
 #include <list>
@@ -343,6 +344,33 @@ static void mock_set_log_level(EXTENSION_LOG_LEVEL severity) {
     log_level = severity;
 }
 
+/**
+ * SCHEDULER API FUNCTIONS
+ **/
+static BackgroundScheduler& mock_get_scheduler() {
+    // Intentionally leaked; the engines may still have tasks running
+    // when the test program exits
+    static BackgroundScheduler* scheduler = new BackgroundScheduler(2);
+    return *scheduler;
+}
+
+static uint64_t mock_schedule(const char* name,
+                              SERVER_TASK_CALLBACK callback,
+                              void* arg,
+                              uint32_t delay,
+                              uint32_t period) {
+    return mock_get_scheduler().schedule(name,
+                                         [callback, arg]() {
+                                             return callback(arg);
+                                         },
+                                         std::chrono::milliseconds(delay),
+                                         std::chrono::milliseconds(period));
+}
+
+static bool mock_cancel(uint64_t id) {
+    return mock_get_scheduler().cancel(id);
+}
+
 void mock_init_alloc_hooks() {
     init_alloc_hooks();
 }
@@ -356,6 +384,7 @@ SERVER_HANDLE_V1 *get_mock_server_api(void)
    static SERVER_CALLBACK_API callback_api;
    static SERVER_LOG_API log_api;
    static ALLOCATOR_HOOKS_API hooks_api;
+   static SERVER_SCHEDULER_API scheduler_api;
    static SERVER_HANDLE_V1 rv;
    static int init;
    if (!init) {
@@ -402,6 +431,9 @@ SERVER_HANDLE_V1 *get_mock_server_api(void)
       hooks_api.release_free_memory = mc_release_free_memory;
       hooks_api.enable_thread_cache = mc_enable_thread_cache;
 
+      scheduler_api.schedule = mock_schedule;
+      scheduler_api.cancel = mock_cancel;
+
       rv.interface = 1;
       rv.core = &core_api;
       rv.stat = &server_stat_api;
@@ -410,6 +442,7 @@ SERVER_HANDLE_V1 *get_mock_server_api(void)
       rv.log = &log_api;
       rv.cookie = &server_cookie_api;
       rv.alloc_hooks = &hooks_api;
+      rv.scheduler = &scheduler_api;
    }
 
    return &rv;
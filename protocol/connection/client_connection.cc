@@ -77,6 +77,9 @@ void ConnectionMap::initialize(cJSON* ports) {
             family = AF_INET;
         } else if (strcmp(fam->valuestring, "AF_INET6") == 0) {
             family = AF_INET6;
+        } else if (strcmp(fam->valuestring, "AF_UNIX") == 0) {
+            // The client connections only support TCP
+            continue;
         } else {
             char* json = cJSON_PrintUnformatted(obj);
             std::string msg("Unsupported network family: ");
@@ -20,6 +20,7 @@
 #include <cJSON_utils.h>
 #include <daemon/settings.h>
 #include <platform/dirutils.h>
+#include <functional>
 
 class SettingsTest : public ::testing::Test {
 public:
@@ -303,6 +304,8 @@ TEST_F(SettingsTest, Interfaces) {
     cJSON_AddStringToObject(obj.get(), "host", "*");
     cJSON_AddStringToObject(obj.get(), "protocol", "memcached");
     cJSON_AddTrueToObject(obj.get(), "management");
+    cJSON_AddTrueToObject(obj.get(), "reuseport");
+    cJSON_AddNumberToObject(obj.get(), "busy_poll", 50);
 
     unique_cJSON_ptr ssl(cJSON_CreateObject());
     cJSON_AddStringToObject(ssl.get(), "key", key_pattern);
@@ -340,6 +343,8 @@ TEST_F(SettingsTest, Interfaces) {
         EXPECT_EQ("*", ifc0.host);
         EXPECT_EQ(Protocol::Memcached, ifc0.protocol);
         EXPECT_TRUE(ifc0.management);
+        EXPECT_TRUE(ifc0.reuseport);
+        EXPECT_EQ(50, ifc0.busy_poll);
 
         const auto& ifc1 = settings.getInterfaces()[1];
         EXPECT_EQ(0, ifc1.port);
@@ -350,6 +355,8 @@ TEST_F(SettingsTest, Interfaces) {
         EXPECT_EQ("*", ifc1.host);
         EXPECT_EQ(Protocol::Greenstack, ifc1.protocol);
         EXPECT_TRUE(ifc1.management);
+        EXPECT_FALSE(ifc1.reuseport);
+        EXPECT_EQ(0, ifc1.busy_poll);
 
 
     } catch (std::exception& exception) {
@@ -452,6 +459,92 @@ TEST_F(SettingsTest, InterfacesInvalidSslEntry) {
     CouchbaseDirectoryUtilities::rmrf(pattern);
 }
 
+#ifndef WIN32
+TEST_F(SettingsTest, InterfacesUnixSocket) {
+    unique_cJSON_ptr obj(cJSON_CreateObject());
+    cJSON_AddStringToObject(obj.get(), "path", "/tmp/memcached.sock");
+    cJSON_AddStringToObject(obj.get(), "permissions", "0660");
+    cJSON_AddNumberToObject(obj.get(), "maxconn", 10);
+    cJSON_AddStringToObject(obj.get(), "protocol", "memcached");
+
+    unique_cJSON_ptr array(cJSON_CreateArray());
+    cJSON_AddItemToArray(array.get(), obj.release());
+    unique_cJSON_ptr root(cJSON_CreateObject());
+    cJSON_AddItemToObject(root.get(), "interfaces", array.release());
+
+    try {
+        Settings settings(root);
+        ASSERT_EQ(1, settings.getInterfaces().size());
+        const auto& ifc = settings.getInterfaces()[0];
+        EXPECT_EQ("/tmp/memcached.sock", ifc.path);
+        EXPECT_EQ(0660, ifc.permissions);
+        EXPECT_EQ(10, ifc.maxconn);
+        EXPECT_FALSE(ifc.tcp_nodelay);
+    } catch (std::exception& exception) {
+        FAIL() << exception.what();
+    }
+
+    // The permissions defaults to 0600
+    obj.reset(cJSON_CreateObject());
+    cJSON_AddStringToObject(obj.get(), "path", "/tmp/memcached.sock");
+    array.reset(cJSON_CreateArray());
+    cJSON_AddItemToArray(array.get(), obj.release());
+    root.reset(cJSON_CreateObject());
+    cJSON_AddItemToObject(root.get(), "interfaces", array.release());
+    try {
+        Settings settings(root);
+        EXPECT_EQ(0600, settings.getInterfaces()[0].permissions);
+    } catch (std::exception& exception) {
+        FAIL() << exception.what();
+    }
+}
+
+TEST_F(SettingsTest, InterfacesInvalidUnixSocket) {
+    const auto check = [this](const std::function<void(cJSON*)>& add) {
+        unique_cJSON_ptr obj(cJSON_CreateObject());
+        add(obj.get());
+        unique_cJSON_ptr array(cJSON_CreateArray());
+        cJSON_AddItemToArray(array.get(), obj.release());
+        unique_cJSON_ptr root(cJSON_CreateObject());
+        cJSON_AddItemToObject(root.get(), "interfaces", array.release());
+        expectFail(root);
+    };
+
+    check([](cJSON* obj) { cJSON_AddStringToObject(obj, "path", ""); });
+    check([](cJSON* obj) { cJSON_AddNumberToObject(obj, "path", 1); });
+    check([](cJSON* obj) {
+        cJSON_AddStringToObject(obj, "path", std::string(200, 'a').c_str());
+    });
+    check([](cJSON* obj) {
+        cJSON_AddStringToObject(obj, "path", "/tmp/memcached.sock");
+        cJSON_AddNumberToObject(obj, "permissions", 660);
+    });
+    check([](cJSON* obj) {
+        cJSON_AddStringToObject(obj, "path", "/tmp/memcached.sock");
+        cJSON_AddStringToObject(obj, "permissions", "0999");
+    });
+    check([](cJSON* obj) {
+        cJSON_AddStringToObject(obj, "path", "/tmp/memcached.sock");
+        cJSON_AddStringToObject(obj, "permissions", "01777");
+    });
+    check([](cJSON* obj) {
+        cJSON_AddStringToObject(obj, "path", "/tmp/memcached.sock");
+        cJSON_AddTrueToObject(obj, "reuseport");
+    });
+
+    char pattern[] = {"ssl.XXXXXX"};
+    EXPECT_NE(nullptr, cb_mktemp(pattern));
+    check([&pattern](cJSON* obj) {
+        cJSON_AddStringToObject(obj, "path", "/tmp/memcached.sock");
+        unique_cJSON_ptr ssl(cJSON_CreateObject());
+        cJSON_AddStringToObject(ssl.get(), "key", pattern);
+        cJSON_AddStringToObject(ssl.get(), "cert", pattern);
+        cJSON_AddItemToObject(obj, "ssl", ssl.release());
+    });
+    CouchbaseDirectoryUtilities::rmrf(pattern);
+}
+#endif
+
 TEST_F(SettingsTest, Extensions) {
     nonArrayValuesShouldFail("extensions");
 
@@ -862,6 +955,452 @@ TEST_F(SettingsTest, SaslMechanisms) {
     }
 }
 
+TEST_F(SettingsTest, ConnectionRebalance) {
+    nonBooleanValuesShouldFail("connection_rebalance");
+
+    unique_cJSON_ptr obj(cJSON_CreateObject());
+    cJSON_AddTrueToObject(obj.get(), "connection_rebalance");
+    try {
+        Settings settings(obj);
+        EXPECT_TRUE(settings.isConnectionRebalance());
+        EXPECT_TRUE(settings.has.connection_rebalance);
+    } catch (std::exception& exception) {
+        FAIL() << exception.what();
+    }
+
+    obj.reset(cJSON_CreateObject());
+    cJSON_AddFalseToObject(obj.get(), "connection_rebalance");
+    try {
+        Settings settings(obj);
+        EXPECT_FALSE(settings.isConnectionRebalance());
+        EXPECT_TRUE(settings.has.connection_rebalance);
+    } catch (std::exception& exception) {
+        FAIL() << exception.what();
+    }
+}
+
+TEST_F(SettingsTest, SslKtls) {
+    nonBooleanValuesShouldFail("ssl_ktls");
+
+    unique_cJSON_ptr obj(cJSON_CreateObject());
+    cJSON_AddTrueToObject(obj.get(), "ssl_ktls");
+    try {
+        Settings settings(obj);
+        EXPECT_TRUE(settings.isSslKtls());
+        EXPECT_TRUE(settings.has.ssl_ktls);
+    } catch (std::exception& exception) {
+        FAIL() << exception.what();
+    }
+
+    obj.reset(cJSON_CreateObject());
+    cJSON_AddFalseToObject(obj.get(), "ssl_ktls");
+    try {
+        Settings settings(obj);
+        EXPECT_FALSE(settings.isSslKtls());
+        EXPECT_TRUE(settings.has.ssl_ktls);
+    } catch (std::exception& exception) {
+        FAIL() << exception.what();
+    }
+}
+
+TEST_F(SettingsTest, SslHandshakeOffload) {
+    nonBooleanValuesShouldFail("ssl_handshake_offload");
+
+    // The handshake is offloaded by default
+    EXPECT_TRUE(Settings().isSslHandshakeOffload());
+
+    unique_cJSON_ptr obj(cJSON_CreateObject());
+    cJSON_AddFalseToObject(obj.get(), "ssl_handshake_offload");
+    try {
+        Settings settings(obj);
+        EXPECT_FALSE(settings.isSslHandshakeOffload());
+        EXPECT_TRUE(settings.has.ssl_handshake_offload);
+    } catch (std::exception& exception) {
+        FAIL() << exception.what();
+    }
+}
+
+TEST_F(SettingsTest, SslSessionCacheSize) {
+    nonNumericValuesShouldFail("ssl_session_cache_size");
+
+    EXPECT_EQ(20480, Settings().getSslSessionCacheSize());
+
+    unique_cJSON_ptr obj(cJSON_CreateObject());
+    cJSON_AddNumberToObject(obj.get(), "ssl_session_cache_size", 0);
+    try {
+        Settings settings(obj);
+        EXPECT_EQ(0, settings.getSslSessionCacheSize());
+        EXPECT_TRUE(settings.has.ssl_session_cache_size);
+    } catch (std::exception& exception) {
+        FAIL() << exception.what();
+    }
+
+    obj.reset(cJSON_CreateObject());
+    cJSON_AddNumberToObject(obj.get(), "ssl_session_cache_size", -1);
+    EXPECT_THROW(Settings settings(obj), std::invalid_argument);
+}
+
+TEST_F(SettingsTest, BusyPoll) {
+    nonNumericValuesShouldFail("busy_poll");
+
+    unique_cJSON_ptr obj(cJSON_CreateObject());
+    cJSON_AddNumberToObject(obj.get(), "busy_poll", 100);
+    try {
+        Settings settings(obj);
+        EXPECT_EQ(100, settings.getBusyPoll());
+        EXPECT_TRUE(settings.has.busy_poll);
+    } catch (std::exception& exception) {
+        FAIL() << exception.what();
+    }
+
+    obj.reset(cJSON_CreateObject());
+    cJSON_AddNumberToObject(obj.get(), "busy_poll", -1);
+    EXPECT_THROW(Settings settings(obj), std::invalid_argument);
+}
+
+TEST_F(SettingsTest, BusyPollThreads) {
+    nonNumericValuesShouldFail("busy_poll_threads");
+
+    unique_cJSON_ptr obj(cJSON_CreateObject());
+    cJSON_AddNumberToObject(obj.get(), "busy_poll_threads", 2);
+    try {
+        Settings settings(obj);
+        EXPECT_EQ(2, settings.getBusyPollThreads());
+        EXPECT_TRUE(settings.has.busy_poll_threads);
+    } catch (std::exception& exception) {
+        FAIL() << exception.what();
+    }
+
+    obj.reset(cJSON_CreateObject());
+    cJSON_AddNumberToObject(obj.get(), "busy_poll_threads", -1);
+    EXPECT_THROW(Settings settings(obj), std::invalid_argument);
+}
+
+TEST_F(SettingsTest, WorkerCpus) {
+    nonStringValuesShouldFail("worker_cpus");
+
+    unique_cJSON_ptr obj(cJSON_CreateObject());
+    cJSON_AddStringToObject(obj.get(), "worker_cpus", "0-3,8,10-11");
+    try {
+        Settings settings(obj);
+        std::vector<int> expected = {0, 1, 2, 3, 8, 10, 11};
+        EXPECT_EQ(expected, settings.getWorkerCpus());
+        EXPECT_TRUE(settings.has.worker_cpus);
+    } catch (std::exception& exception) {
+        FAIL() << exception.what();
+    }
+
+    for (const auto& value : {"", "a", "1-", "-1", "3-1", "1,,2", "1x"}) {
+        obj.reset(cJSON_CreateObject());
+        cJSON_AddStringToObject(obj.get(), "worker_cpus", value);
+        EXPECT_THROW(Settings settings(obj), std::invalid_argument)
+            << "Value \"" << value << "\" should not be accepted";
+    }
+}
+
+TEST_F(SettingsTest, HousekeepingCpus) {
+    nonStringValuesShouldFail("housekeeping_cpus");
+
+    unique_cJSON_ptr obj(cJSON_CreateObject());
+    cJSON_AddStringToObject(obj.get(), "housekeeping_cpus", "4");
+    try {
+        Settings settings(obj);
+        std::vector<int> expected = {4};
+        EXPECT_EQ(expected, settings.getHousekeepingCpus());
+        EXPECT_TRUE(settings.has.housekeeping_cpus);
+    } catch (std::exception& exception) {
+        FAIL() << exception.what();
+    }
+
+    obj.reset(cJSON_CreateObject());
+    cJSON_AddStringToObject(obj.get(), "housekeeping_cpus", "4-");
+    EXPECT_THROW(Settings settings(obj), std::invalid_argument);
+}
+
+TEST_F(SettingsTest, BackgroundThreads) {
+    nonNumericValuesShouldFail("background_threads");
+
+    unique_cJSON_ptr obj(cJSON_CreateObject());
+    cJSON_AddNumberToObject(obj.get(), "background_threads", 4);
+    try {
+        Settings settings(obj);
+        EXPECT_EQ(4u, settings.getBackgroundThreads());
+        EXPECT_TRUE(settings.has.background_threads);
+    } catch (std::exception& exception) {
+        FAIL() << exception.what();
+    }
+
+    obj.reset(cJSON_CreateObject());
+    cJSON_AddNumberToObject(obj.get(), "background_threads", 0);
+    EXPECT_THROW(Settings settings(obj), std::invalid_argument);
+}
+
+TEST_F(SettingsTest, SchedSlice) {
+    nonNumericValuesShouldFail("sched_slice");
+
+    unique_cJSON_ptr obj(cJSON_CreateObject());
+    cJSON_AddNumberToObject(obj.get(), "sched_slice", 500);
+    try {
+        Settings settings(obj);
+        EXPECT_EQ(500, settings.getSchedSlice());
+        EXPECT_TRUE(settings.has.sched_slice);
+    } catch (std::exception& exception) {
+        FAIL() << exception.what();
+    }
+
+    obj.reset(cJSON_CreateObject());
+    cJSON_AddNumberToObject(obj.get(), "sched_slice", -1);
+    EXPECT_THROW(Settings settings(obj), std::invalid_argument);
+}
+
+TEST_F(SettingsTest, ShedThreshold) {
+    nonNumericValuesShouldFail("shed_threshold");
+
+    unique_cJSON_ptr obj(cJSON_CreateObject());
+    cJSON_AddNumberToObject(obj.get(), "shed_threshold", 20000);
+    try {
+        Settings settings(obj);
+        EXPECT_EQ(20000, settings.getShedThreshold());
+        EXPECT_TRUE(settings.has.shed_threshold);
+    } catch (std::exception& exception) {
+        FAIL() << exception.what();
+    }
+
+    obj.reset(cJSON_CreateObject());
+    cJSON_AddNumberToObject(obj.get(), "shed_threshold", -1);
+    EXPECT_THROW(Settings settings(obj), std::invalid_argument);
+}
+
+TEST_F(SettingsTest, MaxPendingBytes) {
+    nonNumericValuesShouldFail("max_pending_bytes");
+
+    unique_cJSON_ptr obj(cJSON_CreateObject());
+    cJSON_AddNumberToObject(obj.get(), "max_pending_bytes", 1048576);
+    try {
+        Settings settings(obj);
+        EXPECT_EQ(1048576, settings.getMaxPendingBytes());
+        EXPECT_TRUE(settings.has.max_pending_bytes);
+    } catch (std::exception& exception) {
+        FAIL() << exception.what();
+    }
+
+    obj.reset(cJSON_CreateObject());
+    cJSON_AddNumberToObject(obj.get(), "max_pending_bytes", -1);
+    EXPECT_THROW(Settings settings(obj), std::invalid_argument);
+}
+
+TEST_F(SettingsTest, ConnectionPoolSize) {
+    nonNumericValuesShouldFail("connection_pool_size");
+
+    // The pool is enabled by default
+    EXPECT_EQ(64, Settings().getConnectionPoolSize());
+
+    unique_cJSON_ptr obj(cJSON_CreateObject());
+    cJSON_AddNumberToObject(obj.get(), "connection_pool_size", 0);
+    try {
+        Settings settings(obj);
+        EXPECT_EQ(0, settings.getConnectionPoolSize());
+        EXPECT_TRUE(settings.has.connection_pool_size);
+    } catch (std::exception& exception) {
+        FAIL() << exception.what();
+    }
+
+    obj.reset(cJSON_CreateObject());
+    cJSON_AddNumberToObject(obj.get(), "connection_pool_size", -1);
+    EXPECT_THROW(Settings settings(obj), std::invalid_argument);
+}
+
+TEST_F(SettingsTest, ShmRingSize) {
+    nonNumericValuesShouldFail("shm_ring_size");
+
+    EXPECT_EQ(1024 * 1024, Settings().getShmRingSize());
+
+    for (const auto size : {0, 4096, 65536, 1024 * 1024 * 1024}) {
+        unique_cJSON_ptr obj(cJSON_CreateObject());
+        cJSON_AddNumberToObject(obj.get(), "shm_ring_size", size);
+        try {
+            Settings settings(obj);
+            EXPECT_EQ(size_t(size), settings.getShmRingSize());
+            EXPECT_TRUE(settings.has.shm_ring_size);
+        } catch (std::exception& exception) {
+            FAIL() << exception.what();
+        }
+    }
+
+    // It must be a power of two within the limits
+    for (const auto size : {-1, 1024, 65537, 2047 * 1024 * 1024}) {
+        unique_cJSON_ptr obj(cJSON_CreateObject());
+        cJSON_AddNumberToObject(obj.get(), "shm_ring_size", size);
+        EXPECT_THROW(Settings settings(obj), std::invalid_argument) << size;
+    }
+}
+
+TEST_F(SettingsTest, CompressionThreshold) {
+    nonNumericValuesShouldFail("compression_threshold");
+
+    EXPECT_EQ(1024, Settings().getCompressionThreshold());
+
+    unique_cJSON_ptr obj(cJSON_CreateObject());
+    cJSON_AddNumberToObject(obj.get(), "compression_threshold", 0);
+    try {
+        Settings settings(obj);
+        EXPECT_EQ(0, settings.getCompressionThreshold());
+        EXPECT_TRUE(settings.has.compression_threshold);
+    } catch (std::exception& exception) {
+        FAIL() << exception.what();
+    }
+
+    obj.reset(cJSON_CreateObject());
+    cJSON_AddNumberToObject(obj.get(), "compression_threshold", -1);
+    EXPECT_THROW(Settings settings(obj), std::invalid_argument);
+}
+
+TEST_F(SettingsTest, CompressionCacheSize) {
+    nonNumericValuesShouldFail("compression_cache_size");
+
+    EXPECT_EQ(32 * 1024 * 1024, Settings().getCompressionCacheSize());
+
+    unique_cJSON_ptr obj(cJSON_CreateObject());
+    cJSON_AddNumberToObject(obj.get(), "compression_cache_size", 1048576);
+    try {
+        Settings settings(obj);
+        EXPECT_EQ(1048576, settings.getCompressionCacheSize());
+        EXPECT_TRUE(settings.has.compression_cache_size);
+    } catch (std::exception& exception) {
+        FAIL() << exception.what();
+    }
+
+    obj.reset(cJSON_CreateObject());
+    cJSON_AddNumberToObject(obj.get(), "compression_cache_size", -1);
+    EXPECT_THROW(Settings settings(obj), std::invalid_argument);
+}
+
+TEST_F(SettingsTest, MaxPinnedItems) {
+    nonNumericValuesShouldFail("max_pinned_items");
+
+    unique_cJSON_ptr obj(cJSON_CreateObject());
+    cJSON_AddNumberToObject(obj.get(), "max_pinned_items", 64);
+    try {
+        Settings settings(obj);
+        EXPECT_EQ(64, settings.getMaxPinnedItems());
+        EXPECT_TRUE(settings.has.max_pinned_items);
+    } catch (std::exception& exception) {
+        FAIL() << exception.what();
+    }
+
+    obj.reset(cJSON_CreateObject());
+    cJSON_AddNumberToObject(obj.get(), "max_pinned_items", -1);
+    EXPECT_THROW(Settings settings(obj), std::invalid_argument);
+}
+
+TEST_F(SettingsTest, SlowReaderTimeout) {
+    nonNumericValuesShouldFail("slow_reader_timeout");
+
+    unique_cJSON_ptr obj(cJSON_CreateObject());
+    cJSON_AddNumberToObject(obj.get(), "slow_reader_timeout", 30);
+    try {
+        Settings settings(obj);
+        EXPECT_EQ(30, settings.getSlowReaderTimeout());
+        EXPECT_TRUE(settings.has.slow_reader_timeout);
+    } catch (std::exception& exception) {
+        FAIL() << exception.what();
+    }
+
+    obj.reset(cJSON_CreateObject());
+    cJSON_AddNumberToObject(obj.get(), "slow_reader_timeout", -1);
+    EXPECT_THROW(Settings settings(obj), std::invalid_argument);
+}
+
+TEST_F(SettingsTest, BucketWeights) {
+    nonObjectValuesShouldFail("bucket_weights");
+
+    unique_cJSON_ptr obj(cJSON_CreateObject());
+    unique_cJSON_ptr weights(cJSON_CreateObject());
+    cJSON_AddNumberToObject(weights.get(), "bucket-1", 200);
+    cJSON_AddNumberToObject(weights.get(), "bucket-2", 50);
+    cJSON_AddItemToObject(obj.get(), "bucket_weights", weights.release());
+    try {
+        Settings settings(obj);
+        EXPECT_EQ(200, settings.getBucketWeight("bucket-1"));
+        EXPECT_EQ(50, settings.getBucketWeight("bucket-2"));
+        EXPECT_EQ(Settings::default_bucket_weight,
+                  settings.getBucketWeight("bucket-3"));
+        EXPECT_TRUE(settings.has.bucket_weights);
+    } catch (std::exception& exception) {
+        FAIL() << exception.what();
+    }
+
+    for (auto value : {0, -1, 10001}) {
+        obj.reset(cJSON_CreateObject());
+        weights.reset(cJSON_CreateObject());
+        cJSON_AddNumberToObject(weights.get(), "bucket-1", value);
+        cJSON_AddItemToObject(obj.get(), "bucket_weights", weights.release());
+        EXPECT_THROW(Settings settings(obj), std::invalid_argument);
+    }
+
+    obj.reset(cJSON_CreateObject());
+    weights.reset(cJSON_CreateObject());
+    cJSON_AddStringToObject(weights.get(), "bucket-1", "100");
+    cJSON_AddItemToObject(obj.get(), "bucket_weights", weights.release());
+    EXPECT_THROW(Settings settings(obj), std::invalid_argument);
+}
+
+TEST_F(SettingsTest, BucketLimits) {
+    nonObjectValuesShouldFail("bucket_limits");
+
+    unique_cJSON_ptr obj(cJSON_CreateObject());
+    unique_cJSON_ptr limits(cJSON_CreateObject());
+    cJSON* bucket = cJSON_CreateObject();
+    cJSON_AddNumberToObject(bucket, "ops", 1000);
+    cJSON_AddNumberToObject(bucket, "read_bytes", 1024 * 1024);
+    cJSON_AddNumberToObject(bucket, "write_bytes", 2048 * 1024);
+    cJSON_AddItemToObject(limits.get(), "bucket-1", bucket);
+    bucket = cJSON_CreateObject();
+    cJSON_AddNumberToObject(bucket, "ops", 10);
+    cJSON_AddItemToObject(limits.get(), "bucket-2", bucket);
+    cJSON_AddItemToObject(obj.get(), "bucket_limits", limits.release());
+    try {
+        Settings settings(obj);
+        EXPECT_TRUE(settings.has.bucket_limits);
+        auto entry = settings.getBucketLimits("bucket-1");
+        EXPECT_EQ(1000, entry.ops);
+        EXPECT_EQ(1024 * 1024, entry.read_bytes);
+        EXPECT_EQ(2048 * 1024, entry.write_bytes);
+        entry = settings.getBucketLimits("bucket-2");
+        EXPECT_EQ(10, entry.ops);
+        EXPECT_EQ(0, entry.read_bytes);
+        EXPECT_EQ(0, entry.write_bytes);
+        EXPECT_EQ(BucketRateLimits(), settings.getBucketLimits("bucket-3"));
+    } catch (std::exception& exception) {
+        FAIL() << exception.what();
+    }
+
+    // The limits must be non-negative numbers
+    obj.reset(cJSON_CreateObject());
+    limits.reset(cJSON_CreateObject());
+    bucket = cJSON_CreateObject();
+    cJSON_AddNumberToObject(bucket, "ops", -1);
+    cJSON_AddItemToObject(limits.get(), "bucket-1", bucket);
+    cJSON_AddItemToObject(obj.get(), "bucket_limits", limits.release());
+    EXPECT_THROW(Settings settings(obj), std::invalid_argument);
+
+    // Unknown limits are not allowed
+    obj.reset(cJSON_CreateObject());
+    limits.reset(cJSON_CreateObject());
+    bucket = cJSON_CreateObject();
+    cJSON_AddNumberToObject(bucket, "iops", 10);
+    cJSON_AddItemToObject(limits.get(), "bucket-1", bucket);
+    cJSON_AddItemToObject(obj.get(), "bucket_limits", limits.release());
+    EXPECT_THROW(Settings settings(obj), std::invalid_argument);
+
+    // The entries must be objects
+    obj.reset(cJSON_CreateObject());
+    limits.reset(cJSON_CreateObject());
+    cJSON_AddNumberToObject(limits.get(), "bucket-1", 10);
+    cJSON_AddItemToObject(obj.get(), "bucket_limits", limits.release());
+    EXPECT_THROW(Settings settings(obj), std::invalid_argument);
+}
+
 TEST_F(SettingsTest, DedupeNmvbMaps) {
     nonBooleanValuesShouldFail("dedupe_nmvb_maps");
 
@@ -886,6 +1425,184 @@ TEST_F(SettingsTest, DedupeNmvbMaps) {
     }
 }
 
+TEST(SettingsUpdateTest, ConnectionRebalanceIsDynamic) {
+    Settings settings;
+    Settings updated;
+    // setting it to the same value should work
+    settings.setConnectionRebalance(true);
+    updated.setConnectionRebalance(settings.isConnectionRebalance());
+    EXPECT_NO_THROW(settings.updateSettings(updated, false));
+
+    // Changing it should also work
+    updated.setConnectionRebalance(!settings.isConnectionRebalance());
+    EXPECT_NO_THROW(settings.updateSettings(updated, false));
+    EXPECT_TRUE(settings.isConnectionRebalance());
+    EXPECT_NO_THROW(settings.updateSettings(updated, true));
+    EXPECT_FALSE(settings.isConnectionRebalance());
+}
+
+TEST(SettingsUpdateTest, BusyPollIsDynamic) {
+    Settings settings;
+    Settings updated;
+    settings.setBusyPoll(50);
+    settings.setBusyPollThreads(1);
+    updated.setBusyPoll(100);
+    updated.setBusyPollThreads(2);
+
+    EXPECT_NO_THROW(settings.updateSettings(updated, false));
+    EXPECT_EQ(50, settings.getBusyPoll());
+    EXPECT_EQ(1, settings.getBusyPollThreads());
+    EXPECT_NO_THROW(settings.updateSettings(updated, true));
+    EXPECT_EQ(100, settings.getBusyPoll());
+    EXPECT_EQ(2, settings.getBusyPollThreads());
+}
+
+TEST(SettingsUpdateTest, SchedulingIsDynamic) {
+    Settings settings;
+    Settings updated;
+    settings.setSchedSlice(500);
+    settings.setBucketWeights({{"bucket-1", 200}});
+    updated.setSchedSlice(1000);
+    updated.setBucketWeights({{"bucket-1", 50}, {"bucket-2", 300}});
+
+    EXPECT_NO_THROW(settings.updateSettings(updated, false));
+    EXPECT_EQ(500, settings.getSchedSlice());
+    EXPECT_EQ(200, settings.getBucketWeight("bucket-1"));
+    EXPECT_NO_THROW(settings.updateSettings(updated, true));
+    EXPECT_EQ(1000, settings.getSchedSlice());
+    EXPECT_EQ(50, settings.getBucketWeight("bucket-1"));
+    EXPECT_EQ(300, settings.getBucketWeight("bucket-2"));
+}
+
+TEST(SettingsUpdateTest, ShedThresholdIsDynamic) {
+    Settings settings;
+    Settings updated;
+    settings.setShedThreshold(10000);
+    updated.setShedThreshold(50000);
+
+    EXPECT_NO_THROW(settings.updateSettings(updated, false));
+    EXPECT_EQ(10000, settings.getShedThreshold());
+    EXPECT_NO_THROW(settings.updateSettings(updated, true));
+    EXPECT_EQ(50000, settings.getShedThreshold());
+}
+
+TEST(SettingsUpdateTest, OutputLimitsIsDynamic) {
+    Settings settings;
+    Settings updated;
+    settings.setMaxPendingBytes(1024);
+    settings.setMaxPinnedItems(8);
+    settings.setSlowReaderTimeout(10);
+    updated.setMaxPendingBytes(4096);
+    updated.setMaxPinnedItems(16);
+    updated.setSlowReaderTimeout(0);
+
+    EXPECT_NO_THROW(settings.updateSettings(updated, false));
+    EXPECT_EQ(1024, settings.getMaxPendingBytes());
+    EXPECT_EQ(8, settings.getMaxPinnedItems());
+    EXPECT_EQ(10, settings.getSlowReaderTimeout());
+    EXPECT_NO_THROW(settings.updateSettings(updated, true));
+    EXPECT_EQ(4096, settings.getMaxPendingBytes());
+    EXPECT_EQ(16, settings.getMaxPinnedItems());
+    EXPECT_EQ(0, settings.getSlowReaderTimeout());
+}
+
+TEST(SettingsUpdateTest, ConnectionPoolSizeIsDynamic) {
+    Settings settings;
+    Settings updated;
+    settings.setConnectionPoolSize(64);
+    updated.setConnectionPoolSize(0);
+
+    EXPECT_NO_THROW(settings.updateSettings(updated, false));
+    EXPECT_EQ(64, settings.getConnectionPoolSize());
+    EXPECT_NO_THROW(settings.updateSettings(updated, true));
+    EXPECT_EQ(0, settings.getConnectionPoolSize());
+}
+
+TEST(SettingsUpdateTest, SslKtlsIsDynamic) {
+    Settings settings;
+    Settings updated;
+    settings.setSslKtls(false);
+    updated.setSslKtls(true);
+
+    EXPECT_NO_THROW(settings.updateSettings(updated, false));
+    EXPECT_FALSE(settings.isSslKtls());
+    EXPECT_NO_THROW(settings.updateSettings(updated, true));
+    EXPECT_TRUE(settings.isSslKtls());
+}
+
+TEST(SettingsUpdateTest, SslHandshakeOffloadIsDynamic) {
+    Settings settings;
+    Settings updated;
+    settings.setSslHandshakeOffload(true);
+    updated.setSslHandshakeOffload(false);
+
+    EXPECT_NO_THROW(settings.updateSettings(updated, false));
+    EXPECT_TRUE(settings.isSslHandshakeOffload());
+    EXPECT_NO_THROW(settings.updateSettings(updated, true));
+    EXPECT_FALSE(settings.isSslHandshakeOffload());
+}
+
+TEST(SettingsUpdateTest, SslSessionCacheSizeIsDynamic) {
+    Settings settings;
+    Settings updated;
+    settings.setSslSessionCacheSize(20480);
+    updated.setSslSessionCacheSize(0);
+
+    EXPECT_NO_THROW(settings.updateSettings(updated, false));
+    EXPECT_EQ(20480, settings.getSslSessionCacheSize());
+    EXPECT_NO_THROW(settings.updateSettings(updated, true));
+    EXPECT_EQ(0, settings.getSslSessionCacheSize());
+}
+
+TEST(SettingsUpdateTest, ShmRingSizeIsDynamic) {
+    Settings settings;
+    Settings updated;
+    updated.setShmRingSize(65536);
+
+    EXPECT_NO_THROW(settings.updateSettings(updated, false));
+    EXPECT_EQ(1024 * 1024, settings.getShmRingSize());
+    EXPECT_NO_THROW(settings.updateSettings(updated));
+    EXPECT_EQ(65536, settings.getShmRingSize());
+}
+
+TEST(SettingsUpdateTest, CompressionThresholdIsDynamic) {
+    Settings settings;
+    Settings updated;
+    updated.setCompressionThreshold(0);
+
+    EXPECT_NO_THROW(settings.updateSettings(updated, false));
+    EXPECT_EQ(1024, settings.getCompressionThreshold());
+    EXPECT_NO_THROW(settings.updateSettings(updated));
+    EXPECT_EQ(0, settings.getCompressionThreshold());
+}
+
+TEST(SettingsUpdateTest, CompressionCacheSizeIsDynamic) {
+    Settings settings;
+    Settings updated;
+    updated.setCompressionCacheSize(0);
+
+    EXPECT_NO_THROW(settings.updateSettings(updated, false));
+    EXPECT_EQ(32 * 1024 * 1024, settings.getCompressionCacheSize());
+    EXPECT_NO_THROW(settings.updateSettings(updated));
+    EXPECT_EQ(0, settings.getCompressionCacheSize());
+}
+
+TEST(SettingsUpdateTest, BucketLimitsIsDynamic) {
+    Settings settings;
+    Settings updated;
+    BucketRateLimits limits;
+    limits.ops = 100;
+    settings.setBucketLimits({{"bucket-1", limits}});
+    limits.ops = 200;
+    limits.write_bytes = 1024;
+    updated.setBucketLimits({{"bucket-1", limits}});
+
+    EXPECT_NO_THROW(settings.updateSettings(updated, false));
+    EXPECT_EQ(100, settings.getBucketLimits("bucket-1").ops);
+    EXPECT_NO_THROW(settings.updateSettings(updated, true));
+    EXPECT_EQ(limits, settings.getBucketLimits("bucket-1"));
+}
+
 TEST(SettingsUpdateTest, EmptySettingsShouldWork) {
     Settings updated;
     Settings settings;
@@ -1010,6 +1727,7 @@ TEST(SettingsUpdateTest, InterfaceSomeValuesMayChange) {
     ifc.backlog = 10;
     ifc.maxconn = 10;
     ifc.tcp_nodelay = false;
+    ifc.busy_poll = 50;
     ifc.ssl.key.assign("/opt/couchbase/security/key.pem");
     ifc.ssl.cert.assign("/opt/couchbase/security/cert.pem");
 
@@ -1019,6 +1737,7 @@ TEST(SettingsUpdateTest, InterfaceSomeValuesMayChange) {
     EXPECT_NE(ifc.backlog, settings.getInterfaces()[0].backlog);
     EXPECT_NE(ifc.maxconn, settings.getInterfaces()[0].maxconn);
     EXPECT_NE(ifc.tcp_nodelay, settings.getInterfaces()[0].tcp_nodelay);
+    EXPECT_NE(ifc.busy_poll, settings.getInterfaces()[0].busy_poll);
     EXPECT_NE(ifc.ssl.key, settings.getInterfaces()[0].ssl.key);
     EXPECT_NE(ifc.ssl.cert, settings.getInterfaces()[0].ssl.cert);
 
@@ -1026,10 +1745,28 @@ TEST(SettingsUpdateTest, InterfaceSomeValuesMayChange) {
     EXPECT_EQ(ifc.backlog, settings.getInterfaces()[0].backlog);
     EXPECT_EQ(ifc.maxconn, settings.getInterfaces()[0].maxconn);
     EXPECT_EQ(ifc.tcp_nodelay, settings.getInterfaces()[0].tcp_nodelay);
+    EXPECT_EQ(ifc.busy_poll, settings.getInterfaces()[0].busy_poll);
     EXPECT_EQ(ifc.ssl.key, settings.getInterfaces()[0].ssl.key);
     EXPECT_EQ(ifc.ssl.cert, settings.getInterfaces()[0].ssl.cert);
 }
 
+TEST(SettingsUpdateTest, InterfaceUnixSocketPermissionsMayChange) {
+    Settings updated;
+    Settings settings;
+
+    interface ifc;
+    ifc.path.assign("/tmp/memcached.sock");
+    settings.addInterface(ifc);
+
+    ifc.permissions = 0666;
+    updated.addInterface(ifc);
+
+    EXPECT_NO_THROW(settings.updateSettings(updated, false));
+    EXPECT_EQ(0600, settings.getInterfaces()[0].permissions);
+    EXPECT_NO_THROW(settings.updateSettings(updated));
+    EXPECT_EQ(0666, settings.getInterfaces()[0].permissions);
+}
+
 TEST(SettingsUpdateTest, InterfaceSomeValuesMayNotChange) {
     Settings settings;
     // setting it to the same value should work
@@ -1097,6 +1834,25 @@ TEST(SettingsUpdateTest, InterfaceSomeValuesMayNotChange) {
         EXPECT_THROW(settings.updateSettings(updated, false),
                      std::invalid_argument);
     }
+
+    {
+        Settings updated;
+        interface myifc;
+        myifc.reuseport = true;
+        updated.addInterface(myifc);
+
+        EXPECT_THROW(settings.updateSettings(updated, false),
+                     std::invalid_argument);
+    }
+    {
+        Settings updated;
+        interface myifc;
+        myifc.path.assign("/tmp/memcached.sock");
+        updated.addInterface(myifc);
+
+        EXPECT_THROW(settings.updateSettings(updated, false),
+                     std::invalid_argument);
+    }
 }
 
 TEST(SettingsUpdateTest, InterfaceDifferentArraySizeShouldFail) {
@@ -1424,6 +2180,34 @@ TEST(SettingsUpdateTest, ExitOnConnectionCloseIsNotDynamic) {
                  std::invalid_argument);
 }
 
+TEST(SettingsUpdateTest, WorkerCpusIsNotDynamic) {
+    Settings settings;
+    Settings updated;
+    // setting it to the same value should work
+    settings.setWorkerCpus({0, 1});
+    updated.setWorkerCpus(settings.getWorkerCpus());
+    EXPECT_NO_THROW(settings.updateSettings(updated, false));
+
+    // changing it should not work
+    updated.setWorkerCpus({2, 3});
+    EXPECT_THROW(settings.updateSettings(updated, false),
+                 std::invalid_argument);
+}
+
+TEST(SettingsUpdateTest, HousekeepingCpusIsNotDynamic) {
+    Settings settings;
+    Settings updated;
+    // setting it to the same value should work
+    settings.setHousekeepingCpus({4});
+    updated.setHousekeepingCpus(settings.getHousekeepingCpus());
+    EXPECT_NO_THROW(settings.updateSettings(updated, false));
+
+    // changing it should not work
+    updated.setHousekeepingCpus({5});
+    EXPECT_THROW(settings.updateSettings(updated, false),
+                 std::invalid_argument);
+}
+
 TEST(SettingsUpdateTest, SaslMechanismsIsNotDynamic) {
     Settings settings;
     Settings updated;
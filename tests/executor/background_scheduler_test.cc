@@ -0,0 +1,161 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <daemon/background_scheduler.h>
+#include <gtest/gtest.h>
+#include <mutex>
+#include <thread>
+
+class BackgroundSchedulerTest : public ::testing::Test {
+protected:
+    BackgroundSchedulerTest()
+        : scheduler(2) {
+    }
+
+    /**
+     * Wait (for up to 10 seconds) for the predicate to become true
+     */
+    template <typename Predicate>
+    bool waitFor(Predicate pred) {
+        std::unique_lock<std::mutex> lck(mutex);
+        return cond.wait_for(lck, std::chrono::seconds(10), pred);
+    }
+
+    void notify() {
+        std::lock_guard<std::mutex> lg(mutex);
+        cond.notify_all();
+    }
+
+    BackgroundScheduler scheduler;
+    std::mutex mutex;
+    std::condition_variable cond;
+};
+
+TEST_F(BackgroundSchedulerTest, RunOnce) {
+    std::atomic<int> runs(0);
+    const auto id = scheduler.schedule("once",
+                                       [this, &runs]() {
+                                           ++runs;
+                                           notify();
+                                           return false;
+                                       },
+                                       std::chrono::milliseconds(0),
+                                       std::chrono::milliseconds(0));
+    EXPECT_NE(0u, id);
+    EXPECT_TRUE(waitFor([&runs]() { return runs.load() == 1; }));
+
+    // Give it a chance to (incorrectly) run again
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_EQ(1, runs.load());
+    EXPECT_EQ(0u, scheduler.getNumScheduled());
+    EXPECT_FALSE(scheduler.cancel(id));
+
+    const auto stats = scheduler.getStats();
+    ASSERT_EQ(1u, stats.count("once"));
+    EXPECT_EQ(1u, stats.at("once").runs);
+}
+
+TEST_F(BackgroundSchedulerTest, Periodic) {
+    std::atomic<int> runs(0);
+    scheduler.schedule("periodic",
+                       [this, &runs]() {
+                           ++runs;
+                           notify();
+                           return runs.load() < 5;
+                       },
+                       std::chrono::milliseconds(0),
+                       std::chrono::milliseconds(1));
+    EXPECT_TRUE(waitFor([&runs]() { return runs.load() == 5; }));
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_EQ(5, runs.load());
+    EXPECT_EQ(5u, scheduler.getStats().at("periodic").runs);
+}
+
+TEST_F(BackgroundSchedulerTest, Delay) {
+    std::atomic<bool> ran(false);
+    const auto start = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point end;
+    scheduler.schedule("delay",
+                       [this, &ran, &end]() {
+                           end = std::chrono::steady_clock::now();
+                           ran = true;
+                           notify();
+                           return false;
+                       },
+                       std::chrono::milliseconds(100),
+                       std::chrono::milliseconds(0));
+    EXPECT_TRUE(waitFor([&ran]() { return ran.load(); }));
+    EXPECT_LE(std::chrono::milliseconds(100), end - start);
+}
+
+TEST_F(BackgroundSchedulerTest, CancelBeforeRun) {
+    std::atomic<bool> ran(false);
+    const auto id = scheduler.schedule("cancel",
+                                       [&ran]() {
+                                           ran = true;
+                                           return false;
+                                       },
+                                       std::chrono::seconds(60),
+                                       std::chrono::milliseconds(0));
+    EXPECT_EQ(1u, scheduler.getNumScheduled());
+    EXPECT_TRUE(scheduler.cancel(id));
+    EXPECT_EQ(0u, scheduler.getNumScheduled());
+    EXPECT_FALSE(ran.load());
+}
+
+TEST_F(BackgroundSchedulerTest, CancelWaitsForRunningTask) {
+    std::atomic<bool> started(false);
+    std::atomic<bool> done(false);
+    const auto id = scheduler.schedule("slow",
+                                       [this, &started, &done]() {
+                                           started = true;
+                                           notify();
+                                           std::this_thread::sleep_for(
+                                               std::chrono::milliseconds(100));
+                                           done = true;
+                                           return true;
+                                       },
+                                       std::chrono::milliseconds(0),
+                                       std::chrono::milliseconds(0));
+    ASSERT_TRUE(waitFor([&started]() { return started.load(); }));
+    EXPECT_TRUE(scheduler.cancel(id));
+    EXPECT_TRUE(done.load());
+    EXPECT_EQ(0u, scheduler.getNumScheduled());
+}
+
+TEST_F(BackgroundSchedulerTest, CancelFromTask) {
+    std::atomic<int> runs(0);
+    std::atomic<uint64_t> id(0);
+    id = scheduler.schedule("self",
+                            [this, &runs, &id]() {
+                                while (id.load() == 0) {
+                                    std::this_thread::yield();
+                                }
+                                ++runs;
+                                // Must not wait for itself to return
+                                EXPECT_TRUE(scheduler.cancel(id.load()));
+                                notify();
+                                return true;
+                            },
+                            std::chrono::milliseconds(0),
+                            std::chrono::milliseconds(1));
+    EXPECT_TRUE(waitFor([&runs]() { return runs.load() == 1; }));
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_EQ(1, runs.load());
+}
@@ -0,0 +1,127 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2015 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Benchmark for the queue latency in the ExecutorPool (the time from a
+ * task is scheduled until an executor starts to execute it).
+ *
+ * The workload is a mix of quick tasks and slow tasks which keeps the
+ * executor busy for 2ms (like a SASL authentication using an expensive
+ * hash). The 50th and 99th percentile of the latency for the quick tasks
+ * is recorded as the properties "p50_us" and "p99_us", and the number of
+ * tasks stolen by the executors as "steals".
+ *
+ * Test groups:
+ * - Mixed_SamePriority: All tasks use normal priority
+ * - Mixed_QuickHighPriority: The quick tasks use high priority and the
+ *                            slow tasks low priority
+ */
+#include <daemon/executorpool.h>
+#include <daemon/task.h>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class LatencyTestTask : public Task {
+public:
+    LatencyTestTask(Priority priority,
+                    std::chrono::microseconds work_,
+                    std::atomic<int>& pending_)
+        : Task(priority),
+          work(work_),
+          pending(pending_) {
+    }
+
+    virtual bool execute() override {
+        const auto now = std::chrono::steady_clock::now();
+        latency = std::chrono::duration_cast<std::chrono::microseconds>(
+            now - scheduled);
+        // Spin rather than sleep to keep the executor busy
+        while (std::chrono::steady_clock::now() - now < work) {
+        }
+        return true;
+    }
+
+    virtual void notifyExecutionComplete() override {
+        --pending;
+    }
+
+    std::chrono::steady_clock::time_point scheduled;
+    std::chrono::microseconds latency;
+    const std::chrono::microseconds work;
+    std::atomic<int>& pending;
+};
+
+class ExecutorPerfTest : public ::testing::Test {
+protected:
+    void runMixedWorkload(Task::Priority quick, Task::Priority slow) {
+        const int count = 4000;
+        std::atomic<int> pending(count);
+        std::vector<std::shared_ptr<LatencyTestTask>> tasks;
+        std::vector<std::chrono::microseconds> latency;
+        ExecutorPool pool(4);
+
+        tasks.reserve(count);
+        for (int ii = 0; ii < count; ++ii) {
+            const bool isSlow = (ii % 8) == 0;
+            tasks.emplace_back(std::make_shared<LatencyTestTask>(
+                isSlow ? slow : quick,
+                std::chrono::microseconds(isSlow ? 2000 : 10),
+                pending));
+
+            std::shared_ptr<Task> task = tasks.back();
+            std::lock_guard<std::mutex> guard(task->getMutex());
+            tasks.back()->scheduled = std::chrono::steady_clock::now();
+            pool.schedule(task);
+
+            // Spread the arrivals a bit
+            if ((ii % 64) == 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+
+        while (pending.load() > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        for (int ii = 0; ii < count; ++ii) {
+            if ((ii % 8) != 0) {
+                latency.push_back(tasks[ii]->latency);
+            }
+        }
+        std::sort(latency.begin(), latency.end());
+        RecordProperty("p50_us", int(latency[latency.size() / 2].count()));
+        RecordProperty("p99_us",
+                       int(latency[latency.size() * 99 / 100].count()));
+        RecordProperty("steals", int(pool.getSteals()));
+    }
+};
+
+TEST_F(ExecutorPerfTest, Mixed_SamePriority) {
+    runMixedWorkload(Task::Priority::Normal, Task::Priority::Normal);
+}
+
+TEST_F(ExecutorPerfTest, Mixed_QuickHighPriority) {
+    runMixedWorkload(Task::Priority::High, Task::Priority::Low);
+}
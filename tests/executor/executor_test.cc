@@ -15,11 +15,14 @@
  *   limitations under the License.
  */
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <daemon/executorpool.h>
 #include <daemon/task.h>
 #include <gtest/gtest.h>
 #include <memory>
 #include <platform/backtrace.h>
+#include <vector>
 
 class ExecutorTest : public ::testing::Test {
 protected:
@@ -130,6 +133,128 @@ TEST_F(ExecutorTest, RescheduleMissingLock) {
     EXPECT_TRUE(cmd->executionComplete);
 }
 
+/**
+ * A task which blocks the executor running it until it is released
+ * (so that we may build up a backlog on the executor)
+ */
+class BlockingTestTask : public Task {
+public:
+    BlockingTestTask()
+        : Task(),
+          started(false),
+          released(false) {
+    }
+
+    virtual bool execute() override {
+        std::unique_lock<std::mutex> lock(mutex);
+        started = true;
+        cond.notify_all();
+        cond.wait(lock, [this]() { return released; });
+        return true;
+    }
+
+    void waitForStart() {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [this]() { return started; });
+    }
+
+    void release() {
+        std::lock_guard<std::mutex> guard(mutex);
+        released = true;
+        cond.notify_all();
+    }
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool started;
+    bool released;
+};
+
+/**
+ * A task which records the order the tasks were executed in
+ */
+class RecordingTestTask : public Task {
+public:
+    RecordingTestTask(int id_,
+                      Priority priority,
+                      std::vector<int>& order_,
+                      std::mutex& mutex_,
+                      std::condition_variable& cond_)
+        : Task(priority),
+          id(id_),
+          order(order_),
+          mutex(mutex_),
+          cond(cond_) {
+    }
+
+    virtual bool execute() override {
+        std::lock_guard<std::mutex> guard(mutex);
+        order.push_back(id);
+        cond.notify_all();
+        return true;
+    }
+
+    int id;
+    std::vector<int>& order;
+    std::mutex& mutex;
+    std::condition_variable& cond;
+};
+
+static void schedule(ExecutorPool& pool, std::shared_ptr<Task> task) {
+    std::lock_guard<std::mutex> guard(task->getMutex());
+    pool.schedule(task);
+}
+
+TEST(ExecutorPriorityTest, HighPriorityFirst) {
+    std::vector<int> order;
+    std::mutex mutex;
+    std::condition_variable cond;
+    ExecutorPool pool(1);
+    auto* blocker = new BlockingTestTask;
+    schedule(pool, std::shared_ptr<Task>(blocker));
+    blocker->waitForStart();
+
+    schedule(pool, std::make_shared<RecordingTestTask>(
+        0, Task::Priority::Low, order, mutex, cond));
+    schedule(pool, std::make_shared<RecordingTestTask>(
+        1, Task::Priority::Normal, order, mutex, cond));
+    schedule(pool, std::make_shared<RecordingTestTask>(
+        2, Task::Priority::High, order, mutex, cond));
+    schedule(pool, std::make_shared<RecordingTestTask>(
+        3, Task::Priority::Normal, order, mutex, cond));
+    blocker->release();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    cond.wait(lock, [&order]() { return order.size() == 4; });
+    EXPECT_EQ(std::vector<int>({2, 1, 3, 0}), order);
+}
+
+TEST(ExecutorStealTest, IdleExecutorStealsWork) {
+    std::vector<int> order;
+    std::mutex mutex;
+    std::condition_variable cond;
+    ExecutorPool pool(2);
+    auto* blocker = new BlockingTestTask;
+    schedule(pool, std::shared_ptr<Task>(blocker));
+    blocker->waitForStart();
+
+    // Half of these is scheduled behind the blocked task, and should be
+    // stolen by the other executor
+    for (int ii = 0; ii < 10; ++ii) {
+        schedule(pool, std::make_shared<RecordingTestTask>(
+            ii, Task::Priority::Normal, order, mutex, cond));
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        EXPECT_TRUE(cond.wait_for(lock, std::chrono::seconds(10),
+                                  [&order]() { return order.size() == 10; }))
+            << "The tasks behind the blocked task wasn't stolen";
+    }
+    EXPECT_LT(0, pool.getSteals());
+    blocker->release();
+}
+
 static std::terminate_handler default_terminate_handler;
 
 static void my_terminate_handler() {
@@ -0,0 +1,198 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Tests for the sharing of a worker thread between the buckets.
+ *
+ * The Share tests run a simulated worker thread serving connections which
+ * always have more commands to run, round-robin like libevent would, and
+ * use the scheduler the same way as McbpConnection::runEventLoop: the
+ * delay of each connection is recorded, a connection for a bucket over
+ * its share runs a single command, the others run until their time slice
+ * or the maximum number of requests per event is used, and the bucket is
+ * charged for the time spent. No real time passes.
+ */
+#include "config.h"
+#include <daemon/buckets.h>
+#include <daemon/fair_scheduler.h>
+#include <daemon/settings.h>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <vector>
+
+class FairSchedulerTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        all_buckets.resize(2);
+    }
+
+    void TearDown() override {
+        all_buckets.clear();
+    }
+
+    /**
+     * Set the weights of the buckets. Must be called before the
+     * scheduler is created (it picks up a change of the weights when
+     * the usage decays).
+     */
+    static void setWeights(uint32_t first, uint32_t second) {
+        all_buckets[0].weight = first;
+        all_buckets[1].weight = second;
+    }
+
+    struct Result {
+        /** The time each bucket used the thread */
+        std::vector<hrtime_t> usage;
+        /** The longest time a connection of each bucket waited */
+        std::vector<hrtime_t> max_delay;
+    };
+
+    /**
+     * Serve connections[b] connections for each bucket b round-robin for
+     * the given duration
+     */
+    static Result run(const std::vector<size_t>& connections,
+                      hrtime_t duration) {
+        struct Conn {
+            size_t bucket;
+            hrtime_t runnable;
+        };
+        std::vector<Conn> conns;
+        const size_t max = *std::max_element(connections.begin(),
+                                             connections.end());
+        for (size_t ii = 0; ii < max; ++ii) {
+            for (size_t bucket = 0; bucket < connections.size(); ++bucket) {
+                if (ii < connections[bucket]) {
+                    conns.push_back({bucket, 0});
+                }
+            }
+        }
+
+        FairScheduler scheduler;
+        Result result;
+        result.usage.resize(connections.size());
+        result.max_delay.resize(connections.size());
+
+        hrtime_t now = 1;
+        while (now < duration) {
+            for (auto& conn : conns) {
+                const hrtime_t delay = conn.runnable == 0 ? 0
+                                                          : now - conn.runnable;
+                scheduler.recordDelay(now, delay, slice);
+                result.max_delay[conn.bucket] =
+                    std::max(result.max_delay[conn.bucket], delay);
+
+                const int reqs =
+                    scheduler.isOverShare(conn.bucket, now) ? 1 : reqs_per_event;
+                const hrtime_t end = now + scheduler.getSlice(conn.bucket,
+                                                              slice);
+                hrtime_t time = now;
+                for (int ii = 0; ii < reqs && time < end; ++ii) {
+                    time += cost;
+                }
+
+                scheduler.charge(conn.bucket, time, time - now);
+                result.usage[conn.bucket] += time - now;
+                conn.runnable = time;
+                now = time;
+            }
+        }
+        return result;
+    }
+
+    /** The configured time slice (250us) */
+    static const hrtime_t slice = 250 * 1000;
+    /** The time each command takes (20us) */
+    static const hrtime_t cost = 20 * 1000;
+    /** The maximum number of commands per event */
+    static const int reqs_per_event = 20;
+    /** Run the simulations for 2s */
+    static const hrtime_t duration = 2000 * 1000 * 1000ull;
+};
+
+const hrtime_t FairSchedulerTest::slice;
+const hrtime_t FairSchedulerTest::cost;
+const int FairSchedulerTest::reqs_per_event;
+const hrtime_t FairSchedulerTest::duration;
+
+TEST_F(FairSchedulerTest, SliceScalesWithWeight) {
+    setWeights(Settings::default_bucket_weight * 2,
+               Settings::default_bucket_weight / 2);
+    FairScheduler scheduler;
+    EXPECT_EQ(2 * slice, scheduler.getSlice(0, slice));
+    EXPECT_EQ(slice / 2, scheduler.getSlice(1, slice));
+}
+
+TEST_F(FairSchedulerTest, NotOverShareUncontended) {
+    FairScheduler scheduler;
+    scheduler.charge(0, 1, FairScheduler::period / 2);
+    scheduler.charge(1, 1, cost);
+
+    // Nobody had to wait
+    scheduler.recordDelay(1, slice, slice);
+    EXPECT_FALSE(scheduler.isOverShare(0, 1));
+    EXPECT_FALSE(scheduler.isOverShare(1, 1));
+}
+
+TEST_F(FairSchedulerTest, OverShareWhileContended) {
+    FairScheduler scheduler;
+    scheduler.charge(0, 1, FairScheduler::period / 2);
+    scheduler.charge(1, 1, cost);
+
+    scheduler.recordDelay(1, slice + 1, slice);
+    EXPECT_TRUE(scheduler.isOverShare(0, 1));
+    EXPECT_FALSE(scheduler.isOverShare(1, 1));
+
+    // The thread is no longer contended two periods later
+    EXPECT_FALSE(scheduler.isOverShare(0, 2 * FairScheduler::period + 1));
+}
+
+TEST_F(FairSchedulerTest, ShareFollowsWeight) {
+    const uint32_t weight = Settings::default_bucket_weight;
+    setWeights(3 * weight, weight);
+    const auto result = run({4, 4}, duration);
+
+    // With the same number of connections the bucket with three times
+    // the weight gets most of the thread (the scheduler only approximates
+    // the ratio of the weights)
+    EXPECT_LT(2 * result.usage[1], result.usage[0]);
+    EXPECT_GT(4 * result.usage[1], result.usage[0]);
+}
+
+TEST_F(FairSchedulerTest, ShareDoesNotFollowConnections) {
+    const auto result = run({8, 1}, duration);
+
+    // Served round-robin the single connection would get 1/9 of the
+    // thread, but its bucket has the same weight as the other one
+    const auto total = result.usage[0] + result.usage[1];
+    EXPECT_LT(total / 3, result.usage[1]);
+}
+
+TEST_F(FairSchedulerTest, StarvationBound) {
+    setWeights(Settings::default_bucket_weight, 1);
+    FairScheduler scheduler;
+    const hrtime_t heavy_slice = scheduler.getSlice(0, slice);
+    const auto result = run({8, 1}, duration);
+
+    // The connection of the bucket with the lowest possible weight still
+    // runs a command every round, and never waits longer than it takes
+    // the other connections to use their time slice once
+    EXPECT_NE(0u, result.usage[1]);
+    EXPECT_GE(8 * (heavy_slice + cost), result.max_delay[1]);
+    EXPECT_GE(7 * (heavy_slice + cost) + cost, result.max_delay[0]);
+}
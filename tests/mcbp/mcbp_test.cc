@@ -114,6 +114,32 @@ namespace BinaryProtocolValidator {
         EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_EINVAL, validate(PROTOCOL_BINARY_CMD_GETKQ));
     }
 
+    // GET_LEASE uses the same validator as GET
+    class GetLeaseValidatorTest : public GetValidatorTest {
+    protected:
+        int validate() {
+            return GetValidatorTest::validate(PROTOCOL_BINARY_CMD_GET_LEASE);
+        }
+    };
+
+    TEST_F(GetLeaseValidatorTest, CorrectMessage) {
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_SUCCESS, validate());
+    }
+    TEST_F(GetLeaseValidatorTest, InvalidExtlen) {
+        request.message.header.request.extlen = 4;
+        request.message.header.request.bodylen = htonl(14);
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_EINVAL, validate());
+    }
+    TEST_F(GetLeaseValidatorTest, NoKey) {
+        request.message.header.request.keylen = 0;
+        request.message.header.request.bodylen = 0;
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_EINVAL, validate());
+    }
+    TEST_F(GetLeaseValidatorTest, InvalidCas) {
+        request.message.header.request.cas = 1;
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_EINVAL, validate());
+    }
+
     // Test ADD & ADDQ
     class AddValidatorTest : public ValidatorTest {
         virtual void SetUp() override {
@@ -2212,6 +2238,304 @@ namespace BinaryProtocolValidator {
         EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_EINVAL, validate());
     }
 
+    // PROTOCOL_BINARY_CMD_SHM_CONNECT
+    class ShmConnectValidatorTest : public ValidatorTest {
+        virtual void SetUp() override {
+            ValidatorTest::SetUp();
+            memset(&request, 0, sizeof(request));
+            request.message.header.request.magic = PROTOCOL_BINARY_REQ;
+            request.message.header.request.datatype = PROTOCOL_BINARY_RAW_BYTES;
+        }
+
+    protected:
+        int validate() {
+            return ValidatorTest::validate(PROTOCOL_BINARY_CMD_SHM_CONNECT,
+                                           static_cast<void*>(&request));
+        }
+        protocol_binary_request_shm_connect request;
+    };
+
+    TEST_F(ShmConnectValidatorTest, CorrectMessage) {
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_SUCCESS, validate());
+    }
+    TEST_F(ShmConnectValidatorTest, InvalidMagic) {
+        request.message.header.request.magic = 0;
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_EINVAL, validate());
+    }
+    TEST_F(ShmConnectValidatorTest, InvalidExtlen) {
+        request.message.header.request.extlen = 2;
+        request.message.header.request.bodylen = htonl(2);
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_EINVAL, validate());
+    }
+    TEST_F(ShmConnectValidatorTest, InvalidKey) {
+        request.message.header.request.keylen = 10;
+        request.message.header.request.bodylen = htonl(10);
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_EINVAL, validate());
+    }
+    TEST_F(ShmConnectValidatorTest, InvalidDatatype) {
+        request.message.header.request.datatype = PROTOCOL_BINARY_DATATYPE_JSON;
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_EINVAL, validate());
+    }
+    TEST_F(ShmConnectValidatorTest, InvalidBody) {
+        request.message.header.request.bodylen = htonl(4);
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_EINVAL, validate());
+    }
+
+    // PROTOCOL_BINARY_CMD_GET_MULTI
+    class GetMultiValidatorTest : public ValidatorTest {
+        virtual void SetUp() override {
+            ValidatorTest::SetUp();
+            memset(blob, 0, sizeof(blob));
+            request = reinterpret_cast<protocol_binary_request_get_multi*>(blob);
+            request->message.header.request.magic = PROTOCOL_BINARY_REQ;
+            request->message.header.request.datatype = PROTOCOL_BINARY_RAW_BYTES;
+            bodylen = 0;
+            addKey("foo");
+            addKey("bar");
+        }
+
+    protected:
+        void addKey(const std::string& key) {
+            const uint16_t nkey = htons(uint16_t(key.size()));
+            addBytes(&nkey, sizeof(nkey));
+            addBytes(key.data(), key.size());
+        }
+
+        void addBytes(const void* data, size_t nbytes) {
+            memcpy(blob + sizeof(request->bytes) + bodylen, data, nbytes);
+            bodylen += uint32_t(nbytes);
+            request->message.header.request.bodylen = htonl(bodylen);
+        }
+
+        int validate() {
+            return ValidatorTest::validate(PROTOCOL_BINARY_CMD_GET_MULTI,
+                                           static_cast<void*>(request));
+        }
+        uint8_t blob[4096];
+        uint32_t bodylen;
+        protocol_binary_request_get_multi* request;
+    };
+
+    TEST_F(GetMultiValidatorTest, CorrectMessage) {
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_SUCCESS, validate());
+    }
+    TEST_F(GetMultiValidatorTest, SingleKey) {
+        bodylen = 0;
+        addKey("foo");
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_SUCCESS, validate());
+    }
+    TEST_F(GetMultiValidatorTest, InvalidMagic) {
+        request->message.header.request.magic = 0;
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_EINVAL, validate());
+    }
+    TEST_F(GetMultiValidatorTest, InvalidExtlen) {
+        request->message.header.request.extlen = 2;
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_EINVAL, validate());
+    }
+    TEST_F(GetMultiValidatorTest, InvalidKey) {
+        request->message.header.request.keylen = htons(5);
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_EINVAL, validate());
+    }
+    TEST_F(GetMultiValidatorTest, InvalidDatatype) {
+        request->message.header.request.datatype = PROTOCOL_BINARY_DATATYPE_JSON;
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_EINVAL, validate());
+    }
+    TEST_F(GetMultiValidatorTest, InvalidCas) {
+        request->message.header.request.cas = 1;
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_EINVAL, validate());
+    }
+    TEST_F(GetMultiValidatorTest, NoKeys) {
+        request->message.header.request.bodylen = 0;
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_EINVAL, validate());
+    }
+    TEST_F(GetMultiValidatorTest, EmptyKey) {
+        addKey("");
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_EINVAL, validate());
+    }
+    TEST_F(GetMultiValidatorTest, TruncatedKeyLength) {
+        const uint8_t byte = 0;
+        addBytes(&byte, sizeof(byte));
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_EINVAL, validate());
+    }
+    TEST_F(GetMultiValidatorTest, TruncatedKey) {
+        const uint16_t nkey = htons(10);
+        addBytes(&nkey, sizeof(nkey));
+        addBytes("foo", 3);
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_EINVAL, validate());
+    }
+    TEST_F(GetMultiValidatorTest, MaxKeys) {
+        bodylen = 0;
+        for (int ii = 0; ii < PROTOCOL_BINARY_GET_MULTI_MAX_KEYS; ++ii) {
+            addKey("k");
+        }
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_SUCCESS, validate());
+        addKey("k");
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_E2BIG, validate());
+    }
+
+    // PROTOCOL_BINARY_CMD_BULK_STORE
+    class BulkStoreValidatorTest : public ValidatorTest {
+        virtual void SetUp() override {
+            ValidatorTest::SetUp();
+            memset(blob, 0, sizeof(blob));
+            request = reinterpret_cast<protocol_binary_request_bulk_store*>(blob);
+            request->message.header.request.magic = PROTOCOL_BINARY_REQ;
+            request->message.header.request.datatype = PROTOCOL_BINARY_RAW_BYTES;
+            bodylen = 0;
+            addRecord("foo", "value");
+            addRecord("bar", "");
+        }
+
+    protected:
+        void addRecord(const std::string& key, const std::string& value,
+                       uint8_t datatype = PROTOCOL_BINARY_RAW_BYTES) {
+            protocol_binary_bulk_store_record record;
+            memset(&record, 0, sizeof(record));
+            record.keylen = htons(uint16_t(key.size()));
+            record.datatype = datatype;
+            record.valuelen = htonl(uint32_t(value.size()));
+            addBytes(&record, sizeof(record));
+            addBytes(key.data(), key.size());
+            addBytes(value.data(), value.size());
+        }
+
+        void addBytes(const void* data, size_t nbytes) {
+            memcpy(blob + sizeof(request->bytes) + bodylen, data, nbytes);
+            bodylen += uint32_t(nbytes);
+            request->message.header.request.bodylen = htonl(bodylen);
+        }
+
+        int validate(uint8_t opcode = PROTOCOL_BINARY_CMD_BULK_STORE) {
+            return ValidatorTest::validate(opcode,
+                                           static_cast<void*>(request));
+        }
+        uint8_t blob[2048];
+        uint32_t bodylen;
+        protocol_binary_request_bulk_store* request;
+    };
+
+    TEST_F(BulkStoreValidatorTest, CorrectMessage) {
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_SUCCESS, validate());
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_SUCCESS,
+                  validate(PROTOCOL_BINARY_CMD_BULK_STOREQ));
+    }
+    TEST_F(BulkStoreValidatorTest, CorrectMessageJson) {
+        addRecord("json", "{}", PROTOCOL_BINARY_DATATYPE_JSON);
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_SUCCESS, validate());
+    }
+    TEST_F(BulkStoreValidatorTest, InvalidMagic) {
+        request->message.header.request.magic = 0;
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_EINVAL, validate());
+    }
+    TEST_F(BulkStoreValidatorTest, InvalidExtlen) {
+        request->message.header.request.extlen = 2;
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_EINVAL, validate());
+    }
+    TEST_F(BulkStoreValidatorTest, InvalidKey) {
+        request->message.header.request.keylen = htons(5);
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_EINVAL, validate());
+    }
+    TEST_F(BulkStoreValidatorTest, InvalidDatatype) {
+        request->message.header.request.datatype = PROTOCOL_BINARY_DATATYPE_JSON;
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_EINVAL, validate());
+    }
+    TEST_F(BulkStoreValidatorTest, InvalidCas) {
+        request->message.header.request.cas = 1;
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_EINVAL, validate());
+    }
+    TEST_F(BulkStoreValidatorTest, NoRecords) {
+        request->message.header.request.bodylen = 0;
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_EINVAL, validate());
+    }
+    TEST_F(BulkStoreValidatorTest, EmptyKey) {
+        addRecord("", "value");
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_EINVAL, validate());
+    }
+    TEST_F(BulkStoreValidatorTest, KeyTooLong) {
+        addRecord(std::string(251, 'a'), "value");
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_EINVAL, validate());
+    }
+    TEST_F(BulkStoreValidatorTest, InvalidRecordDatatype) {
+        addRecord("foo", "value", 0x04);
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_EINVAL, validate());
+    }
+    TEST_F(BulkStoreValidatorTest, TruncatedRecord) {
+        const uint8_t byte = 0;
+        addBytes(&byte, sizeof(byte));
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_EINVAL, validate());
+    }
+    TEST_F(BulkStoreValidatorTest, TruncatedValue) {
+        protocol_binary_bulk_store_record record;
+        memset(&record, 0, sizeof(record));
+        record.keylen = htons(3);
+        record.valuelen = htonl(10);
+        addBytes(&record, sizeof(record));
+        addBytes("foovalue", 8);
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_EINVAL, validate());
+    }
+
+    // PROTOCOL_BINARY_CMD_SCAN
+    class ScanValidatorTest : public ValidatorTest {
+        virtual void SetUp() override {
+            ValidatorTest::SetUp();
+            memset(&request, 0, sizeof(request));
+            request.message.header.request.magic = PROTOCOL_BINARY_REQ;
+            request.message.header.request.datatype = PROTOCOL_BINARY_RAW_BYTES;
+            request.message.header.request.extlen = 16;
+            request.message.header.request.bodylen = htonl(16);
+            request.message.body.count = htonl(100);
+        }
+
+    protected:
+        int validate() {
+            return ValidatorTest::validate(PROTOCOL_BINARY_CMD_SCAN,
+                                           static_cast<void*>(&request));
+        }
+        protocol_binary_request_scan request;
+    };
+
+    TEST_F(ScanValidatorTest, CorrectMessage) {
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_SUCCESS, validate());
+    }
+    TEST_F(ScanValidatorTest, CorrectMessageWithPrefix) {
+        request.message.header.request.keylen = htons(4);
+        request.message.header.request.bodylen = htonl(20);
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_SUCCESS, validate());
+    }
+    TEST_F(ScanValidatorTest, CorrectMessageMetadata) {
+        request.message.body.flags = htonl(PROTOCOL_BINARY_SCAN_FLAG_METADATA);
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_SUCCESS, validate());
+    }
+    TEST_F(ScanValidatorTest, InvalidMagic) {
+        request.message.header.request.magic = 0;
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_EINVAL, validate());
+    }
+    TEST_F(ScanValidatorTest, InvalidExtlen) {
+        request.message.header.request.extlen = 8;
+        request.message.header.request.bodylen = htonl(8);
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_EINVAL, validate());
+    }
+    TEST_F(ScanValidatorTest, InvalidBodylen) {
+        request.message.header.request.bodylen = htonl(20);
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_EINVAL, validate());
+    }
+    TEST_F(ScanValidatorTest, InvalidDatatype) {
+        request.message.header.request.datatype = PROTOCOL_BINARY_DATATYPE_JSON;
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_EINVAL, validate());
+    }
+    TEST_F(ScanValidatorTest, InvalidCas) {
+        request.message.header.request.cas = 1;
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_EINVAL, validate());
+    }
+    TEST_F(ScanValidatorTest, InvalidCount) {
+        request.message.body.count = 0;
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_EINVAL, validate());
+    }
+    TEST_F(ScanValidatorTest, InvalidFlags) {
+        request.message.body.flags = htonl(0x02);
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_EINVAL, validate());
+    }
+
     // PROTOCOL_BINARY_CMD_GET_ALL_VB_SEQNOS
     class GetAllVbSeqnoValidatorTest : public ValidatorTest {
         virtual void SetUp() override {
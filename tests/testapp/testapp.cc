@@ -55,7 +55,7 @@ static int current_phase = 0;
 
 pid_t server_pid = pid_t(-1);
 in_port_t port = -1;
-static in_port_t ssl_port = -1;
+in_port_t ssl_port = -1;
 SOCKET sock = INVALID_SOCKET;
 static SOCKET sock_ssl;
 static std::atomic<bool> allow_closed_read;
@@ -936,6 +936,29 @@ static ssize_t phase_recv(void *buf, size_t len) {
     return rv;
 }
 
+uint64_t get_ssl_bytes_received() {
+    if (current_phase == phase_ssl && ssl_bio_r != nullptr) {
+        return BIO_number_written(ssl_bio_r);
+    }
+    return 0;
+}
+
+in_port_t get_ssl_local_port() {
+    if (current_phase != phase_ssl) {
+        return 0;
+    }
+    sockaddr_storage addr;
+    socklen_t addrlen = sizeof(addr);
+    if (getsockname(sock_ssl, reinterpret_cast<sockaddr*>(&addr),
+                    &addrlen) != 0) {
+        return 0;
+    }
+    if (addr.ss_family == AF_INET) {
+        return ntohs(reinterpret_cast<sockaddr_in*>(&addr)->sin_port);
+    }
+    return ntohs(reinterpret_cast<sockaddr_in6*>(&addr)->sin6_port);
+}
+
 char ssl_error_string[256];
 int ssl_error_string_len = 256;
 
@@ -2121,6 +2144,81 @@ TEST_P(McdTestappTest, IOCTL_Set) {
     }
 }
 
+TEST_P(McdTestappTest, IOCTL_MigrateConnection) {
+    // The extra connections are plain connections
+    if (GetParam() != Transport::Plain) {
+        return;
+    }
+
+    const auto nthreads = extract_single_stat(request_stats(), "threads");
+    if (nthreads < 2) {
+        return;
+    }
+
+    // Set up a few idle connections on each of the worker threads
+    const SOCKET main_sock = sock;
+    std::vector<SOCKET> sockets;
+    for (uint64_t ii = 0; ii < nthreads * 2; ++ii) {
+        sock = connect_to_server_plain(port);
+        ASSERT_NE(INVALID_SOCKET, sock);
+        sockets.push_back(sock);
+        store_object("IOCTL_MigrateConnection", "value");
+    }
+    sock = main_sock;
+
+    const auto migrated = extract_single_stat(request_stats(),
+                                              "migrated_conns");
+    union {
+        protocol_binary_request_no_extras request;
+        protocol_binary_response_no_extras response;
+        char bytes[1024];
+    } buffer;
+    for (uint64_t ii = 0; ii < nthreads; ++ii) {
+        const std::string key = "worker." + std::to_string(ii) +
+                                ".migrate_to";
+        const std::string value = std::to_string((ii + 1) % nthreads);
+        size_t len = mcbp_raw_command(buffer.bytes, sizeof(buffer.bytes),
+                                      PROTOCOL_BINARY_CMD_IOCTL_SET,
+                                      key.data(), key.size(),
+                                      value.data(), value.size());
+        safe_send(buffer.bytes, len, false);
+        safe_recv_packet(buffer.bytes, sizeof(buffer.bytes));
+        mcbp_validate_response_header(&buffer.response,
+                                      PROTOCOL_BINARY_CMD_IOCTL_SET,
+                                      PROTOCOL_BINARY_RESPONSE_SUCCESS);
+    }
+
+    // Wait (for up to 10 seconds) for the threads to move the connections
+    uint64_t current = migrated;
+    for (int ii = 0; ii < 1000 && current == migrated; ++ii) {
+        usleep(10000);
+        current = extract_single_stat(request_stats(), "migrated_conns");
+    }
+    EXPECT_LT(migrated, current);
+
+    // All of the connections should still work
+    for (auto s : sockets) {
+        sock = s;
+        validate_object("IOCTL_MigrateConnection", "value");
+        closesocket(sock);
+    }
+    sock = main_sock;
+    validate_object("IOCTL_MigrateConnection", "value");
+    delete_object("IOCTL_MigrateConnection");
+
+    // Moving a connection to the same thread is invalid
+    const std::string key("worker.0.migrate_to");
+    size_t len = mcbp_raw_command(buffer.bytes, sizeof(buffer.bytes),
+                                  PROTOCOL_BINARY_CMD_IOCTL_SET,
+                                  key.data(), key.size(), "0", 1);
+    safe_send(buffer.bytes, len, false);
+    safe_recv_packet(buffer.bytes, sizeof(buffer.bytes));
+    mcbp_validate_response_header(&buffer.response,
+                                  PROTOCOL_BINARY_CMD_IOCTL_SET,
+                                  PROTOCOL_BINARY_RESPONSE_EINVAL);
+    reconnect_to_server();
+}
+
 #if defined(HAVE_TCMALLOC)
 TEST_P(McdTestappTest, IOCTL_TCMallocAggrDecommit) {
     union {
@@ -2812,6 +2910,10 @@ void set_mutation_seqno_feature(bool enable) {
     set_feature(PROTOCOL_BINARY_FEATURE_MUTATION_SEQNO, enable);
 }
 
+void set_unordered_execution_feature(bool enable) {
+    set_feature(PROTOCOL_BINARY_FEATURE_UNORDERED_EXECUTION, enable);
+}
+
 enum test_return store_object_w_datatype(const char *key,
                                          const void *data, size_t datalen,
                                          bool deflate, bool json)
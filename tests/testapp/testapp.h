@@ -23,6 +23,7 @@
 
 #include "testapp_binprot.h"
 
+#include <chrono>
 #include <memory>
 #include <stdint.h>
 #include <stdlib.h>
@@ -54,6 +55,7 @@ std::string to_string(const Transport& transport);
 // Needed by subdocument tests in seperate .cc file.
 extern SOCKET sock;
 extern in_port_t port;
+extern in_port_t ssl_port;
 extern pid_t server_pid;
 
 // Set of HELLO features which are currently enabled.
@@ -241,6 +243,9 @@ enum test_return store_object_w_datatype(const char *key,
 // Enables / disables the MUTATION_SEQNO feature.
 void set_mutation_seqno_feature(bool enable);
 
+// Enables / disables the UNORDERED_EXECUTION feature.
+void set_unordered_execution_feature(bool enable);
+
 /* Send the specified buffer+len to memcached. */
 void safe_send(const void* buf, size_t len, bool hickup);
 
@@ -248,6 +253,17 @@ void safe_send(const void* buf, size_t len, bool hickup);
  */
 bool safe_recv_packet(void *buf, size_t size);
 
+/* Get the number of bytes received from the network on the SSL socket
+ * (including the TLS record overhead) since it was connected. Returns 0
+ * for the plain transports.
+ */
+uint64_t get_ssl_bytes_received();
+
+/* Get the local port of the SSL socket (to locate the connection in
+ * "stats connections"). Returns 0 for the plain transports.
+ */
+in_port_t get_ssl_local_port();
+
 int write_config_to_file(const std::string& config, const std::string& fname);
 
 
@@ -266,4 +282,19 @@ stats_response_t request_stats();
 uint64_t extract_single_stat(const stats_response_t& stats,
                                       const char* name);
 
+/* Run the function and record the wall clock time per operation as the
+ * "us_per_op" property of the current test (used by the perf tests).
+ * @param ops the number of operations the function performs
+ */
+template <typename Function>
+void measure(size_t ops, Function function) {
+    const auto start = std::chrono::steady_clock::now();
+    function();
+    const auto elapsed = std::chrono::duration_cast<
+        std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    ::testing::Test::RecordProperty("us_per_op",
+                                    std::to_string(double(elapsed.count()) /
+                                                   ops));
+}
+
 unique_cJSON_ptr loadJsonFile(const std::string &file);
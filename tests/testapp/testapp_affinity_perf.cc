@@ -0,0 +1,129 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Performance tests for binding the threads in memcached to CPUs.
+ *
+ * The same workload is run against a server where the threads may run
+ * on any CPU (NoAffinityPerfTest) and a server where the worker threads
+ * are bound to their own CPUs, and the housekeeping threads are bound
+ * to CPU 0 (AffinityPerfTest). Compare the time spent in each of the
+ * test groups, and run them under "perf stat -e node-load-misses" (or
+ * look at numastat for the memcached process) to see the effect on the
+ * cross-socket traffic on a NUMA system.
+ *
+ * Test groups:
+ * - MultiConnection: Send a 4k SET on 16 connections before reading any
+ *                    of the responses, then do the same with a GET.
+ *                    Repeated 5,000 times.
+ */
+
+#include "testapp.h"
+#include "testapp_binprot.h"
+
+#include <thread>
+#include <vector>
+
+static void run_multi_connection_workload(int iterations) {
+    const SOCKET main_sock = sock;
+    std::vector<SOCKET> sockets(16);
+    for (auto& s : sockets) {
+        s = connect_to_server_plain(port);
+        ASSERT_NE(INVALID_SOCKET, s);
+    }
+
+    union {
+        protocol_binary_request_no_extras request;
+        protocol_binary_response_no_extras response;
+        char bytes[8192];
+    } receive;
+    std::vector<char> set(8192);
+    std::vector<char> get(1024);
+    const std::string key("AffinityPerfTest_MultiConnection");
+    const std::vector<char> value(4096, 'x');
+    const size_t setlen = mcbp_storage_command(set.data(), set.size(),
+                                               PROTOCOL_BINARY_CMD_SET,
+                                               key.data(), key.size(),
+                                               value.data(), value.size(),
+                                               0, 0);
+    const size_t getlen = mcbp_raw_command(get.data(), get.size(),
+                                           PROTOCOL_BINARY_CMD_GET,
+                                           key.data(), key.size(), NULL, 0);
+
+    for (int ii = 0; ii < iterations; ++ii) {
+        for (const auto& cmd : {std::make_pair(&set, setlen),
+                                std::make_pair(&get, getlen)}) {
+            const uint8_t opcode = uint8_t(cmd.first->data()[1]);
+            for (auto& s : sockets) {
+                sock = s;
+                safe_send(cmd.first->data(), cmd.second, false);
+            }
+            for (auto& s : sockets) {
+                sock = s;
+                ASSERT_TRUE(safe_recv_packet(receive.bytes,
+                                             sizeof(receive.bytes)));
+                mcbp_validate_response_header(&receive.response, opcode,
+                                              PROTOCOL_BINARY_RESPONSE_SUCCESS);
+            }
+        }
+    }
+
+    for (auto& s : sockets) {
+        closesocket(s);
+    }
+    sock = main_sock;
+    delete_object(key.c_str());
+}
+
+class NoAffinityPerfTest : public TestappTest {
+};
+
+TEST_F(NoAffinityPerfTest, MultiConnection_16x5k) {
+    run_multi_connection_workload(5000);
+}
+
+class AffinityPerfTest : public TestappTest {
+public:
+    static void SetUpTestCase() {
+        memcached_cfg.reset(generate_config(0));
+
+        // Reserve CPU 0 for the housekeeping threads and spread the
+        // workers over the rest of them.
+        const unsigned int ncpu = std::thread::hardware_concurrency();
+        if (ncpu > 1) {
+            const std::string workers = "1-" + std::to_string(ncpu - 1);
+            cJSON_AddStringToObject(memcached_cfg.get(), "worker_cpus",
+                                    workers.c_str());
+            cJSON_AddStringToObject(memcached_cfg.get(), "housekeeping_cpus",
+                                    "0");
+        }
+
+        start_memcached_server(memcached_cfg.get());
+
+        if (HasFailure()) {
+            server_pid = reinterpret_cast<pid_t>(-1);
+        } else {
+            CreateTestBucket();
+        }
+
+        ASSERT_NE(reinterpret_cast<pid_t>(-1), server_pid);
+    }
+};
+
+TEST_F(AffinityPerfTest, MultiConnection_16x5k) {
+    run_multi_connection_workload(5000);
+}
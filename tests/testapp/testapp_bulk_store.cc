@@ -0,0 +1,316 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Tests for BULK_STORE and BULK_STOREQ (a batch of records stored with a
+ * single request, and only the number of failures in the response).
+ *
+ * BulkStorePerfTest compares it with the usual way of loading the cache:
+ * a pipeline of SETQ followed by a NOOP.
+ *
+ * Properties recorded by the perf tests:
+ * - us_per_op: Wall clock time per item stored.
+ */
+
+#include "testapp.h"
+#include "testapp_binprot.h"
+
+#include <string>
+#include <vector>
+
+class BulkStoreTest : public TestappTest {
+protected:
+    struct Result {
+        uint16_t status;
+        uint32_t stored;
+        uint32_t failed;
+        uint16_t first_error;
+    };
+
+    /**
+     * Append a record to the body of a BULK_STORE request
+     */
+    static void addRecord(std::vector<char>& body, const std::string& key,
+                          const std::string& value, uint32_t flags = 0,
+                          uint32_t exptime = 0,
+                          uint8_t datatype = PROTOCOL_BINARY_RAW_BYTES) {
+        protocol_binary_bulk_store_record record;
+        memset(&record, 0, sizeof(record));
+        record.keylen = htons(uint16_t(key.size()));
+        record.datatype = datatype;
+        record.flags = htonl(flags);
+        record.exptime = htonl(exptime);
+        record.valuelen = htonl(uint32_t(value.size()));
+        const char* ptr = reinterpret_cast<const char*>(&record);
+        body.insert(body.end(), ptr, ptr + sizeof(record));
+        body.insert(body.end(), key.begin(), key.end());
+        body.insert(body.end(), value.begin(), value.end());
+    }
+
+    /**
+     * Build a BULK_STORE (or BULK_STOREQ) request with the records
+     */
+    static std::vector<char> encode(uint8_t opcode,
+                                    const std::vector<char>& body) {
+        std::vector<char> send(sizeof(protocol_binary_request_header) +
+                               body.size());
+        const size_t len = mcbp_raw_command(send.data(), send.size(), opcode,
+                                            NULL, 0, body.data(),
+                                            body.size());
+        send.resize(len);
+        return send;
+    }
+
+    Result recvResult(uint8_t opcode) {
+        Result result;
+        memset(&result, 0, sizeof(result));
+
+        // safe_recv_packet converts the header to host byte order
+        union {
+            protocol_binary_response_bulk_store response;
+            char bytes[1024];
+        } receive;
+        EXPECT_TRUE(safe_recv_packet(receive.bytes, sizeof(receive.bytes)));
+        if (::testing::Test::HasFailure()) {
+            result.status = PROTOCOL_BINARY_RESPONSE_EINTERNAL;
+            return result;
+        }
+        auto& header = receive.response.message.header.response;
+        EXPECT_EQ(opcode, header.opcode);
+        result.status = header.status;
+        if (result.status == PROTOCOL_BINARY_RESPONSE_SUCCESS) {
+            EXPECT_EQ(sizeof(receive.response.message.body), header.extlen);
+            result.stored = ntohl(receive.response.message.body.stored);
+            result.failed = ntohl(receive.response.message.body.failed);
+            result.first_error = ntohs(
+                receive.response.message.body.first_error);
+        }
+        return result;
+    }
+
+    Result bulkStore(const std::vector<char>& body) {
+        const auto send = encode(PROTOCOL_BINARY_CMD_BULK_STORE, body);
+        safe_send(send.data(), send.size(), false);
+        return recvResult(PROTOCOL_BINARY_CMD_BULK_STORE);
+    }
+};
+
+TEST_F(BulkStoreTest, StoreRecords) {
+    std::vector<char> body;
+    addRecord(body, "BulkStoreTest_1", "value1", 0xcafe);
+    addRecord(body, "BulkStoreTest_2", "value2", 0xbeef);
+    addRecord(body, "BulkStoreTest_3", "");
+
+    const auto result = bulkStore(body);
+    ASSERT_EQ(PROTOCOL_BINARY_RESPONSE_SUCCESS, result.status);
+    EXPECT_EQ(3, result.stored);
+    EXPECT_EQ(0, result.failed);
+    EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_SUCCESS, result.first_error);
+
+    validate_object("BulkStoreTest_1", "value1");
+    validate_flags("BulkStoreTest_1", 0xcafe);
+    validate_object("BulkStoreTest_2", "value2");
+    validate_flags("BulkStoreTest_2", 0xbeef);
+    validate_object("BulkStoreTest_3", "");
+
+    delete_object("BulkStoreTest_1");
+    delete_object("BulkStoreTest_2");
+    delete_object("BulkStoreTest_3");
+}
+
+TEST_F(BulkStoreTest, ReplacesExisting) {
+    store_object("BulkStoreTest_existing", "old");
+
+    std::vector<char> body;
+    addRecord(body, "BulkStoreTest_existing", "new");
+    const auto result = bulkStore(body);
+    ASSERT_EQ(PROTOCOL_BINARY_RESPONSE_SUCCESS, result.status);
+    EXPECT_EQ(1, result.stored);
+    validate_object("BulkStoreTest_existing", "new");
+
+    delete_object("BulkStoreTest_existing");
+}
+
+TEST_F(BulkStoreTest, AggregateErrors) {
+    // The datatype isn't negotiated, so the JSON record is rejected
+    std::vector<char> body;
+    addRecord(body, "BulkStoreTest_ok", "value");
+    addRecord(body, "BulkStoreTest_json", "{}", 0, 0,
+              PROTOCOL_BINARY_DATATYPE_JSON);
+    addRecord(body, "BulkStoreTest_big", std::string(2 * 1024 * 1024, 'a'));
+
+    const auto result = bulkStore(body);
+    ASSERT_EQ(PROTOCOL_BINARY_RESPONSE_SUCCESS, result.status);
+    EXPECT_EQ(1, result.stored);
+    EXPECT_EQ(2, result.failed);
+    EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_EINVAL, result.first_error);
+
+    validate_object("BulkStoreTest_ok", "value");
+    delete_object("BulkStoreTest_ok");
+}
+
+TEST_F(BulkStoreTest, QuietOnlyReportsFailures) {
+    std::vector<char> send;
+    std::vector<char> body;
+    addRecord(body, "BulkStoreTest_quiet", "value");
+    auto frame = encode(PROTOCOL_BINARY_CMD_BULK_STOREQ, body);
+    send.insert(send.end(), frame.begin(), frame.end());
+
+    body.clear();
+    addRecord(body, "BulkStoreTest_quiet_json", "{}", 0, 0,
+              PROTOCOL_BINARY_DATATYPE_JSON);
+    frame = encode(PROTOCOL_BINARY_CMD_BULK_STOREQ, body);
+    send.insert(send.end(), frame.begin(), frame.end());
+
+    char noop[1024];
+    const size_t len = mcbp_raw_command(noop, sizeof(noop),
+                                        PROTOCOL_BINARY_CMD_NOOP,
+                                        NULL, 0, NULL, 0);
+    send.insert(send.end(), noop, noop + len);
+    safe_send(send.data(), send.size(), false);
+
+    // Only the second batch has a failure to report
+    const auto result = recvResult(PROTOCOL_BINARY_CMD_BULK_STOREQ);
+    ASSERT_EQ(PROTOCOL_BINARY_RESPONSE_SUCCESS, result.status);
+    EXPECT_EQ(0, result.stored);
+    EXPECT_EQ(1, result.failed);
+
+    union {
+        protocol_binary_response_no_extras response;
+        char bytes[1024];
+    } receive;
+    ASSERT_TRUE(safe_recv_packet(receive.bytes, sizeof(receive.bytes)));
+    mcbp_validate_response_header(&receive.response, PROTOCOL_BINARY_CMD_NOOP,
+                                  PROTOCOL_BINARY_RESPONSE_SUCCESS);
+
+    validate_object("BulkStoreTest_quiet", "value");
+    delete_object("BulkStoreTest_quiet");
+}
+
+TEST_F(BulkStoreTest, WouldBlock) {
+    ewouldblock_engine_configure(ENGINE_EWOULDBLOCK, EWBEngineMode::First,
+                                 /*unused*/0);
+
+    std::vector<char> body;
+    addRecord(body, "BulkStoreTest_ewb", "value");
+    const auto result = bulkStore(body);
+    ASSERT_EQ(PROTOCOL_BINARY_RESPONSE_SUCCESS, result.status);
+    EXPECT_EQ(1, result.stored);
+
+    ewouldblock_engine_disable();
+    validate_object("BulkStoreTest_ewb", "value");
+    delete_object("BulkStoreTest_ewb");
+}
+
+TEST_F(BulkStoreTest, NotMyVbucket) {
+    ewouldblock_engine_configure(ENGINE_NOT_MY_VBUCKET, EWBEngineMode::Next_N,
+                                 1);
+
+    std::vector<char> body;
+    addRecord(body, "BulkStoreTest_nmvb", "value");
+    EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_NOT_MY_VBUCKET,
+              bulkStore(body).status);
+
+    ewouldblock_engine_disable();
+}
+
+TEST_F(BulkStoreTest, InvalidBody) {
+    // A record header without the key
+    std::vector<char> body;
+    addRecord(body, "BulkStoreTest_invalid", "value");
+    body.resize(sizeof(protocol_binary_bulk_store_record) + 2);
+    EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_EINVAL, bulkStore(body).status);
+}
+
+class BulkStorePerfTest : public BulkStoreTest {
+protected:
+    virtual void SetUp() override {
+        BulkStoreTest::SetUp();
+        for (size_t ii = 0; ii < 1000; ++ii) {
+            keys.push_back("BulkStorePerfTest_" + std::to_string(ii));
+        }
+    }
+
+    virtual void TearDown() override {
+        for (const auto& key : keys) {
+            delete_object(key.c_str());
+        }
+        BulkStoreTest::TearDown();
+    }
+
+    std::vector<std::string> keys;
+    const std::string value = std::string(256, 'v');
+};
+
+TEST_F(BulkStorePerfTest, BulkStoreq_100x1000) {
+    std::vector<char> body;
+    for (const auto& key : keys) {
+        addRecord(body, key, value);
+    }
+    auto send = encode(PROTOCOL_BINARY_CMD_BULK_STOREQ, body);
+    char noop[1024];
+    const size_t len = mcbp_raw_command(noop, sizeof(noop),
+                                        PROTOCOL_BINARY_CMD_NOOP,
+                                        NULL, 0, NULL, 0);
+    send.insert(send.end(), noop, noop + len);
+
+    union {
+        protocol_binary_response_no_extras response;
+        char bytes[1024];
+    } receive;
+    measure(100 * keys.size(), [&]() {
+        for (int ii = 0; ii < 100; ++ii) {
+            safe_send(send.data(), send.size(), false);
+            ASSERT_TRUE(safe_recv_packet(receive.bytes,
+                                         sizeof(receive.bytes)));
+            ASSERT_EQ(PROTOCOL_BINARY_CMD_NOOP,
+                      receive.response.message.header.response.opcode);
+        }
+    });
+}
+
+TEST_F(BulkStorePerfTest, SetqPipeline_100x1000) {
+    std::vector<char> send;
+    std::vector<char> command(1024);
+    for (const auto& key : keys) {
+        const size_t len = mcbp_storage_command(command.data(),
+                                                command.size(),
+                                                PROTOCOL_BINARY_CMD_SETQ,
+                                                key.data(), key.size(),
+                                                value.data(), value.size(),
+                                                0, 0);
+        send.insert(send.end(), command.data(), command.data() + len);
+    }
+    const size_t len = mcbp_raw_command(command.data(), command.size(),
+                                        PROTOCOL_BINARY_CMD_NOOP,
+                                        NULL, 0, NULL, 0);
+    send.insert(send.end(), command.data(), command.data() + len);
+
+    union {
+        protocol_binary_response_no_extras response;
+        char bytes[1024];
+    } receive;
+    measure(100 * keys.size(), [&]() {
+        for (int ii = 0; ii < 100; ++ii) {
+            safe_send(send.data(), send.size(), false);
+            ASSERT_TRUE(safe_recv_packet(receive.bytes,
+                                         sizeof(receive.bytes)));
+            ASSERT_EQ(PROTOCOL_BINARY_CMD_NOOP,
+                      receive.response.message.header.response.opcode);
+        }
+    });
+}
@@ -0,0 +1,358 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Tests for the compression of the values in the responses to clients
+ * which asked for it in HELLO (PROTOCOL_BINARY_FEATURE_COMPRESSION_SNAPPY
+ * and _LZ4), with the default "compression_threshold" of 1024 bytes.
+ *
+ * CompressionPerfTest compares GETs of a value sent as it is stored with
+ * GETs of the same value compressed (and served from the compression
+ * cache).
+ *
+ * Properties recorded by the perf tests:
+ * - us_per_op: Wall clock time per GET.
+ */
+
+#include "testapp.h"
+#include "testapp_binprot.h"
+
+#include "daemon/compression.h"
+
+#include <string>
+#include <vector>
+
+class CompressionTest : public TestappTest {
+protected:
+    struct Value {
+        uint16_t status;
+        uint8_t datatype;
+        std::string value;
+    };
+
+    /**
+     * Send a HELLO with the features and return the features the server
+     * agreed to
+     */
+    std::vector<uint16_t> hello(const std::vector<uint16_t>& features) {
+        std::vector<uint16_t> body;
+        for (const auto feature : features) {
+            body.push_back(htons(feature));
+        }
+
+        const std::string agent = "CompressionTest";
+        char send[1024];
+        const size_t len = mcbp_raw_command(send, sizeof(send),
+                                            PROTOCOL_BINARY_CMD_HELLO,
+                                            agent.data(), agent.size(),
+                                            body.data(),
+                                            body.size() * sizeof(uint16_t));
+        safe_send(send, len, false);
+
+        receive.resize(1024);
+        auto* response = reinterpret_cast<protocol_binary_response_no_extras*>(
+            receive.data());
+        std::vector<uint16_t> ret;
+        EXPECT_TRUE(safe_recv_packet(receive.data(), receive.size()));
+        if (::testing::Test::HasFailure()) {
+            return ret;
+        }
+        mcbp_validate_response_header(response, PROTOCOL_BINARY_CMD_HELLO,
+                                      PROTOCOL_BINARY_RESPONSE_SUCCESS);
+
+        const uint8_t* ptr = receive.data() + sizeof(response->bytes);
+        const size_t bodylen = response->message.header.response.bodylen;
+        for (size_t ii = 0; ii + 1 < bodylen; ii += 2) {
+            uint16_t feature;
+            memcpy(&feature, ptr + ii, sizeof(feature));
+            ret.push_back(ntohs(feature));
+        }
+        return ret;
+    }
+
+    /**
+     * GET the key (the value is returned as sent by the server)
+     */
+    Value get(const std::string& key) {
+        char send[1024];
+        const size_t len = mcbp_raw_command(send, sizeof(send),
+                                            PROTOCOL_BINARY_CMD_GET,
+                                            key.data(), key.size(), NULL, 0);
+        safe_send(send, len, false);
+
+        receive.resize(1024 * 1024);
+        auto* response = reinterpret_cast<protocol_binary_response_no_extras*>(
+            receive.data());
+        Value ret;
+        ret.status = PROTOCOL_BINARY_RESPONSE_EINTERNAL;
+        EXPECT_TRUE(safe_recv_packet(receive.data(), receive.size()));
+        if (::testing::Test::HasFailure()) {
+            return ret;
+        }
+        const auto& header = response->message.header.response;
+        ret.status = header.status;
+        ret.datatype = header.datatype;
+        const size_t offset = sizeof(response->bytes) + header.extlen +
+                              header.keylen;
+        ret.value.assign(reinterpret_cast<const char*>(receive.data()) +
+                         offset,
+                         header.bodylen - header.extlen - header.keylen);
+        return ret;
+    }
+
+    /**
+     * Inflate the value if it is compressed
+     */
+    std::string inflate(const Value& value, const CompressionCodec codec) {
+        if ((value.datatype & PROTOCOL_BINARY_DATATYPE_COMPRESSED) == 0) {
+            return value.value;
+        }
+        std::string inflated;
+        EXPECT_TRUE(compression_inflate(codec, value.value.data(),
+                                        value.value.size(), inflated));
+        return inflated;
+    }
+
+    /**
+     * A value which is bigger than the threshold and compresses well
+     */
+    static std::string compressible(const std::string& seed) {
+        std::string ret;
+        while (ret.size() < 4096) {
+            ret.append(seed);
+            ret.append(std::to_string(ret.size()));
+        }
+        return ret;
+    }
+
+    std::vector<uint8_t> receive;
+};
+
+TEST_F(CompressionTest, Snappy) {
+    const std::string value = compressible("CompressionTest_Snappy");
+    store_object("CompressionTest_Snappy", value.c_str());
+
+    const std::vector<uint16_t> acked = {
+        PROTOCOL_BINARY_FEATURE_DATATYPE,
+        PROTOCOL_BINARY_FEATURE_COMPRESSION_SNAPPY};
+    EXPECT_EQ(acked, hello(acked));
+
+    const auto rsp = get("CompressionTest_Snappy");
+    ASSERT_EQ(PROTOCOL_BINARY_RESPONSE_SUCCESS, rsp.status);
+    EXPECT_EQ(PROTOCOL_BINARY_DATATYPE_COMPRESSED,
+              rsp.datatype & PROTOCOL_BINARY_DATATYPE_COMPRESSED);
+    EXPECT_GT(value.size(), rsp.value.size());
+    EXPECT_EQ(value, inflate(rsp, CompressionCodec::Snappy));
+
+    delete_object("CompressionTest_Snappy");
+}
+
+TEST_F(CompressionTest, RequiresDatatype) {
+    const std::string value = compressible("CompressionTest_Datatype");
+    store_object("CompressionTest_Datatype", value.c_str());
+
+    EXPECT_TRUE(hello({PROTOCOL_BINARY_FEATURE_COMPRESSION_SNAPPY}).empty());
+
+    const auto rsp = get("CompressionTest_Datatype");
+    ASSERT_EQ(PROTOCOL_BINARY_RESPONSE_SUCCESS, rsp.status);
+    EXPECT_EQ(PROTOCOL_BINARY_RAW_BYTES, rsp.datatype);
+    EXPECT_EQ(value, rsp.value);
+
+    delete_object("CompressionTest_Datatype");
+}
+
+TEST_F(CompressionTest, DatatypeListedLast) {
+    // The features may be listed in any order, but compression is acked
+    // after datatype
+    EXPECT_EQ(std::vector<uint16_t>({PROTOCOL_BINARY_FEATURE_DATATYPE,
+                                     PROTOCOL_BINARY_FEATURE_COMPRESSION_SNAPPY}),
+              hello({PROTOCOL_BINARY_FEATURE_COMPRESSION_SNAPPY,
+                     PROTOCOL_BINARY_FEATURE_DATATYPE}));
+}
+
+TEST_F(CompressionTest, PreferredCodec) {
+    const uint16_t expected =
+        compression_codec_supported(CompressionCodec::Lz4)
+        ? PROTOCOL_BINARY_FEATURE_COMPRESSION_LZ4
+        : PROTOCOL_BINARY_FEATURE_COMPRESSION_SNAPPY;
+    EXPECT_EQ(std::vector<uint16_t>({PROTOCOL_BINARY_FEATURE_DATATYPE,
+                                     expected}),
+              hello({PROTOCOL_BINARY_FEATURE_DATATYPE,
+                     PROTOCOL_BINARY_FEATURE_COMPRESSION_LZ4,
+                     PROTOCOL_BINARY_FEATURE_COMPRESSION_SNAPPY}));
+
+    // Snappy first
+    EXPECT_EQ(std::vector<uint16_t>({PROTOCOL_BINARY_FEATURE_DATATYPE,
+                                     PROTOCOL_BINARY_FEATURE_COMPRESSION_SNAPPY}),
+              hello({PROTOCOL_BINARY_FEATURE_DATATYPE,
+                     PROTOCOL_BINARY_FEATURE_COMPRESSION_SNAPPY,
+                     PROTOCOL_BINARY_FEATURE_COMPRESSION_LZ4}));
+}
+
+TEST_F(CompressionTest, Lz4) {
+    if (!compression_codec_supported(CompressionCodec::Lz4)) {
+        EXPECT_EQ(1, hello({PROTOCOL_BINARY_FEATURE_DATATYPE,
+                            PROTOCOL_BINARY_FEATURE_COMPRESSION_LZ4}).size());
+        return;
+    }
+
+    const std::string value = compressible("CompressionTest_Lz4");
+    store_object("CompressionTest_Lz4", value.c_str());
+
+    // A value the client stored snappy compressed is re-encoded
+    char* deflated;
+    const size_t deflated_len = compress_document(value.data(), value.size(),
+                                                  &deflated);
+    set_datatype_feature(true);
+    store_object_w_datatype("CompressionTest_Lz4_snappy", deflated,
+                            deflated_len, /*compressed*/true, /*JSON*/false);
+    free(deflated);
+
+    const std::vector<uint16_t> acked = {
+        PROTOCOL_BINARY_FEATURE_DATATYPE,
+        PROTOCOL_BINARY_FEATURE_COMPRESSION_LZ4};
+    EXPECT_EQ(acked, hello(acked));
+
+    for (const auto* key : {"CompressionTest_Lz4",
+                            "CompressionTest_Lz4_snappy"}) {
+        const auto rsp = get(key);
+        ASSERT_EQ(PROTOCOL_BINARY_RESPONSE_SUCCESS, rsp.status) << key;
+        EXPECT_EQ(PROTOCOL_BINARY_DATATYPE_COMPRESSED,
+                  rsp.datatype & PROTOCOL_BINARY_DATATYPE_COMPRESSED) << key;
+        EXPECT_EQ(value, inflate(rsp, CompressionCodec::Lz4)) << key;
+        delete_object(key);
+    }
+}
+
+TEST_F(CompressionTest, SmallValuesAreSentAsStored) {
+    store_object("CompressionTest_Small", "small value");
+
+    EXPECT_EQ(2, hello({PROTOCOL_BINARY_FEATURE_DATATYPE,
+                        PROTOCOL_BINARY_FEATURE_COMPRESSION_SNAPPY}).size());
+
+    const auto rsp = get("CompressionTest_Small");
+    ASSERT_EQ(PROTOCOL_BINARY_RESPONSE_SUCCESS, rsp.status);
+    EXPECT_EQ(PROTOCOL_BINARY_RAW_BYTES, rsp.datatype);
+    EXPECT_EQ("small value", rsp.value);
+
+    delete_object("CompressionTest_Small");
+}
+
+TEST_F(CompressionTest, CachedUntilMutated) {
+    const std::string value = compressible("CompressionTest_Cached");
+    store_object("CompressionTest_Cached", value.c_str());
+    EXPECT_EQ(2, hello({PROTOCOL_BINARY_FEATURE_DATATYPE,
+                        PROTOCOL_BINARY_FEATURE_COMPRESSION_SNAPPY}).size());
+
+    EXPECT_EQ(value, inflate(get("CompressionTest_Cached"),
+                             CompressionCodec::Snappy));
+    const auto hits = extract_single_stat(request_stats(),
+                                          "compression_cache_hits");
+    EXPECT_EQ(value, inflate(get("CompressionTest_Cached"),
+                             CompressionCodec::Snappy));
+    EXPECT_EQ(hits + 1, extract_single_stat(request_stats(),
+                                            "compression_cache_hits"));
+
+    // The CAS changes, so the new value is compressed
+    const std::string updated = compressible("CompressionTest_Updated");
+    store_object("CompressionTest_Cached", updated.c_str());
+    EXPECT_EQ(updated, inflate(get("CompressionTest_Cached"),
+                               CompressionCodec::Snappy));
+    EXPECT_EQ(hits + 1, extract_single_stat(request_stats(),
+                                            "compression_cache_hits"));
+
+    delete_object("CompressionTest_Cached");
+}
+
+TEST_F(CompressionTest, GetMulti) {
+    const std::string value = compressible("CompressionTest_GetMulti");
+    store_object("CompressionTest_GetMulti", value.c_str());
+    EXPECT_EQ(2, hello({PROTOCOL_BINARY_FEATURE_DATATYPE,
+                        PROTOCOL_BINARY_FEATURE_COMPRESSION_SNAPPY}).size());
+
+    const std::string key = "CompressionTest_GetMulti";
+    const uint16_t nkey = htons(uint16_t(key.size()));
+    std::string body(reinterpret_cast<const char*>(&nkey), sizeof(nkey));
+    body.append(key);
+    char send[1024];
+    const size_t len = mcbp_raw_command(send, sizeof(send),
+                                        PROTOCOL_BINARY_CMD_GET_MULTI,
+                                        NULL, 0, body.data(), body.size());
+    safe_send(send, len, false);
+
+    receive.resize(1024 * 1024);
+    auto* response = reinterpret_cast<protocol_binary_response_no_extras*>(
+        receive.data());
+    ASSERT_TRUE(safe_recv_packet(receive.data(), receive.size()));
+    ASSERT_EQ(PROTOCOL_BINARY_RESPONSE_SUCCESS,
+              response->message.header.response.status);
+
+    protocol_binary_get_multi_entry entry;
+    ASSERT_LE(sizeof(entry), response->message.header.response.bodylen);
+    memcpy(&entry, receive.data() + sizeof(response->bytes), sizeof(entry));
+    EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_SUCCESS, ntohs(entry.status));
+
+    Value rsp;
+    rsp.datatype = entry.datatype;
+    rsp.value.assign(reinterpret_cast<const char*>(receive.data()) +
+                     sizeof(response->bytes) + sizeof(entry),
+                     ntohl(entry.valuelen));
+    EXPECT_EQ(PROTOCOL_BINARY_DATATYPE_COMPRESSED,
+              rsp.datatype & PROTOCOL_BINARY_DATATYPE_COMPRESSED);
+    EXPECT_EQ(value, inflate(rsp, CompressionCodec::Snappy));
+
+    delete_object("CompressionTest_GetMulti");
+}
+
+class CompressionPerfTest : public CompressionTest {
+protected:
+    void SetUp() override {
+        CompressionTest::SetUp();
+        value = compressible("CompressionPerfTest");
+        store_object("CompressionPerfTest", value.c_str());
+    }
+
+    void TearDown() override {
+        delete_object("CompressionPerfTest");
+        CompressionTest::TearDown();
+    }
+
+    /**
+     * GET the value a number of times and record the time per GET
+     */
+    void measure(size_t ops) {
+        ::measure(ops, [this, ops]() {
+            for (size_t ii = 0; ii < ops; ++ii) {
+                ASSERT_EQ(PROTOCOL_BINARY_RESPONSE_SUCCESS,
+                          get("CompressionPerfTest").status);
+            }
+        });
+    }
+
+    std::string value;
+};
+
+TEST_F(CompressionPerfTest, Get_Raw_10000) {
+    set_datatype_feature(true);
+    measure(10000);
+}
+
+TEST_F(CompressionPerfTest, Get_Snappy_10000) {
+    EXPECT_EQ(2, hello({PROTOCOL_BINARY_FEATURE_DATATYPE,
+                        PROTOCOL_BINARY_FEATURE_COMPRESSION_SNAPPY}).size());
+    measure(10000);
+}
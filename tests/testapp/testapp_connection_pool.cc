@@ -0,0 +1,269 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Tests for the per worker thread connection pool ("connection_pool_size"
+ * in the configuration).
+ *
+ * The connections enable all of the HELLO features and run a pipeline of
+ * commands before they disconnect, so that the objects returned to the
+ * pool is as "dirty" as possible. The connections created from the pool
+ * must look exactly like a fresh connection.
+ */
+
+#include "testapp.h"
+#include "testapp_binprot.h"
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+typedef std::vector<std::pair<std::string, std::string>> stats_vector_t;
+
+/**
+ * Send a STAT command for the given group on the current socket and
+ * return all of the key/value pairs in the response (the connections
+ * group use an empty key for all of the entries)
+ */
+static stats_vector_t request_stats_group(const std::string& group) {
+    std::vector<char> buffer(64 * 1024);
+    const size_t len = mcbp_raw_command(buffer.data(), buffer.size(),
+                                        PROTOCOL_BINARY_CMD_STAT,
+                                        group.data(), group.size(),
+                                        NULL, 0);
+    safe_send(buffer.data(), len, false);
+
+    stats_vector_t result;
+    while (true) {
+        EXPECT_TRUE(safe_recv_packet(buffer.data(), buffer.size()));
+        auto* response =
+            reinterpret_cast<protocol_binary_response_no_extras*>(buffer.data());
+        mcbp_validate_response_header(response, PROTOCOL_BINARY_CMD_STAT,
+                                      PROTOCOL_BINARY_RESPONSE_SUCCESS);
+        const auto& header = response->message.header.response;
+        const size_t keylen = ntohs(header.keylen);
+        if (keylen == 0 && ntohl(header.bodylen) == 0) {
+            break;
+        }
+        const char* key = buffer.data() + sizeof(*response) + header.extlen;
+        const size_t vallen = ntohl(header.bodylen) - keylen - header.extlen;
+        result.emplace_back(std::string(key, keylen),
+                            std::string(key + keylen, vallen));
+    }
+    return result;
+}
+
+/**
+ * Get the sum of the named "stats worker" counter for all worker threads
+ */
+static uint64_t get_worker_stat(const std::string& name) {
+    uint64_t ret = 0;
+    for (const auto& entry : request_stats_group("worker")) {
+        const auto& key = entry.first;
+        if (key.size() > name.size() &&
+            key.compare(key.size() - name.size(), name.size(), name) == 0 &&
+            key[key.size() - name.size() - 1] == ':') {
+            ret += std::stoull(entry.second);
+        }
+    }
+    return ret;
+}
+
+/**
+ * Get the description of the server side of the current socket from
+ * "stats connections"
+ */
+static unique_cJSON_ptr get_own_connection() {
+    sockaddr_storage addr;
+    socklen_t addrlen = sizeof(addr);
+    EXPECT_EQ(0, getsockname(sock, reinterpret_cast<sockaddr*>(&addr),
+                             &addrlen));
+    in_port_t localport;
+    if (addr.ss_family == AF_INET) {
+        localport = ntohs(reinterpret_cast<sockaddr_in*>(&addr)->sin_port);
+    } else {
+        localport = ntohs(reinterpret_cast<sockaddr_in6*>(&addr)->sin6_port);
+    }
+    const std::string suffix = ":" + std::to_string(localport);
+
+    unique_cJSON_ptr ret;
+    for (const auto& entry : request_stats_group("connections")) {
+        unique_cJSON_ptr json(cJSON_Parse(entry.second.c_str()));
+        if (json.get() == nullptr) {
+            continue;
+        }
+        auto* peer = cJSON_GetObjectItem(json.get(), "peername");
+        if (peer == nullptr || peer->type != cJSON_String) {
+            continue;
+        }
+        const std::string peername(peer->valuestring);
+        if (peername.size() > suffix.size() &&
+            peername.compare(peername.size() - suffix.size(),
+                             suffix.size(), suffix) == 0) {
+            ret.swap(json);
+        }
+    }
+    return ret;
+}
+
+static std::string json_to_string(cJSON* json) {
+    char* ptr = cJSON_PrintUnformatted(json);
+    std::string ret(ptr);
+    cJSON_Free(ptr);
+    return ret;
+}
+
+class ConnectionPoolTest : public TestappTest {
+protected:
+    /**
+     * Connect to the server, enable all of the features, run a pipeline
+     * of commands and disconnect. Wait for the server to release the
+     * connection.
+     */
+    void dirtyConnection(const std::string& key) {
+        const SOCKET main_sock = sock;
+        const auto curr = get_curr_connections();
+        sock = connect_to_server_plain(port);
+        ASSERT_NE(INVALID_SOCKET, sock);
+        set_datatype_feature(true);
+        set_mutation_seqno_feature(true);
+        set_unordered_execution_feature(true);
+
+        char buffer[1024];
+        const size_t len = mcbp_raw_command(buffer, sizeof(buffer),
+                                            PROTOCOL_BINARY_CMD_GET,
+                                            key.data(), key.size(), NULL, 0);
+        std::vector<char> send;
+        for (int ii = 0; ii < 64; ++ii) {
+            send.insert(send.end(), buffer, buffer + len);
+        }
+        safe_send(send.data(), send.size(), false);
+        union {
+            protocol_binary_response_no_extras response;
+            char bytes[1024];
+        } receive;
+        for (int ii = 0; ii < 64; ++ii) {
+            ASSERT_TRUE(safe_recv_packet(receive.bytes, sizeof(receive.bytes)));
+        }
+        closesocket(sock);
+        sock = main_sock;
+
+        // Wait (for up to 10 seconds) for the server to release it
+        for (int ii = 0; ii < 1000 && get_curr_connections() > curr; ++ii) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+
+    uint64_t get_curr_connections() {
+        return extract_single_stat(request_stats(), "curr_connections");
+    }
+
+    /**
+     * Set the size of the connection pool, and return the previous size.
+     * The settings missing from the configuration keep their value, so
+     * the tests must write back the previous size when they're done.
+     */
+    int setPoolSize(int size) {
+        int previous = 64;
+        auto* obj = cJSON_GetObjectItem(memcached_cfg.get(),
+                                        "connection_pool_size");
+        if (obj != nullptr) {
+            previous = obj->valueint;
+        }
+        cJSON_DeleteItemFromObject(memcached_cfg.get(),
+                                   "connection_pool_size");
+        cJSON_AddNumberToObject(memcached_cfg.get(), "connection_pool_size",
+                                size);
+        reconfigure();
+        return previous;
+    }
+};
+
+TEST_F(ConnectionPoolTest, PooledConnectionStartsFresh) {
+    const std::string key("ConnectionPoolTest");
+    store_object(key.c_str(), "value");
+
+    // The pool may hold connections from the other tests, so disable it
+    // (which drains the pool) while we create the connection to compare
+    // with
+    const int size = setPoolSize(0);
+    const SOCKET main_sock = sock;
+    sock = connect_to_server_plain(port);
+    ASSERT_NE(INVALID_SOCKET, sock);
+    auto fresh = get_own_connection();
+    closesocket(sock);
+    sock = main_sock;
+    setPoolSize(size);
+    ASSERT_NE(nullptr, fresh.get());
+
+    const auto hits = get_worker_stat("conn_pool_hits");
+    for (int ii = 0; ii < 16; ++ii) {
+        dirtyConnection(key);
+    }
+    EXPECT_LT(hits, get_worker_stat("conn_pool_hits"))
+        << "Expected some of the connections to be served from the pool";
+
+    sock = connect_to_server_plain(port);
+    ASSERT_NE(INVALID_SOCKET, sock);
+    auto pooled = get_own_connection();
+    ASSERT_NE(nullptr, pooled.get());
+    closesocket(sock);
+    sock = main_sock;
+
+    // Everything except the identity of the connection (and its socket)
+    // and the counters for the traffic should be the same.
+    for (const auto* name : {"protocol", "parent_port", "bucket_index",
+                             "admin", "username", "nodelay", "refcount",
+                             "datatype", "mutation_extras", "features",
+                             "engine_storage", "next", "priority",
+                             "clustermap_revno", "tap", "dcp", "opaque",
+                             "max_reqs_per_event", "state", "cmd",
+                             "write_and_go", "ritem", "rlbytes", "item",
+                             "itemlist", "temp_alloc_list", "noreply",
+                             "cas", "aiostat", "ewouldblock",
+                             "unordered_execution", "compression",
+                             "parked_commands",
+                             "pending_bytes", "pinned_items", "ssl"}) {
+        auto* expected = cJSON_GetObjectItem(fresh.get(), name);
+        auto* actual = cJSON_GetObjectItem(pooled.get(), name);
+        if (expected == nullptr) {
+            EXPECT_EQ(nullptr, actual) << name;
+            continue;
+        }
+        ASSERT_NE(nullptr, actual) << name;
+        EXPECT_EQ(json_to_string(expected), json_to_string(actual)) << name;
+    }
+
+    delete_object(key.c_str());
+}
+
+TEST_F(ConnectionPoolTest, DisabledPool) {
+    const int size = setPoolSize(0);
+
+    const std::string key("ConnectionPoolTest");
+    store_object(key.c_str(), "value");
+    const auto hits = get_worker_stat("conn_pool_hits");
+    const auto misses = get_worker_stat("conn_pool_misses");
+    for (int ii = 0; ii < 4; ++ii) {
+        dirtyConnection(key);
+    }
+    EXPECT_EQ(hits, get_worker_stat("conn_pool_hits"));
+    EXPECT_EQ(misses + 4, get_worker_stat("conn_pool_misses"));
+
+    delete_object(key.c_str());
+    setPoolSize(size);
+}
@@ -0,0 +1,128 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Performance tests for the pending io handling in the worker threads.
+ *
+ * The ewouldblock_engine is configured to return EWOULDBLOCK for the
+ * first call to each engine function, so every command is parked by the
+ * worker thread and resumed when the engine calls notify_io_complete()
+ * from its notification thread.
+ *
+ * Test groups:
+ * - SingleConnection: Run a SET followed by a GET 10,000 times over a
+ *                     single connection.
+ * - Arithmetic: Run an INCREMENT 10,000 times over a single connection.
+ * - MultiConnection: Send a GET on 16 connections before reading any of
+ *                    the responses, so that the engine completes io for
+ *                    multiple connections at the same time. Repeated
+ *                    1,000 times.
+ */
+
+#include "testapp.h"
+#include "testapp_binprot.h"
+
+#include <vector>
+
+class EWBPerfTest : public TestappTest {
+public:
+    void SetUp() {
+        TestappTest::SetUp();
+        ewouldblock_engine_configure(ENGINE_EWOULDBLOCK, EWBEngineMode::First,
+                                     /*unused*/0);
+    }
+};
+
+TEST_F(EWBPerfTest, SingleConnection_10k) {
+    const char* key = "EWBPerfTest_SingleConnection";
+    for (int ii = 0; ii < 10000; ++ii) {
+        store_object(key, "value");
+        auto ret = fetch_value(key);
+        ASSERT_EQ(PROTOCOL_BINARY_RESPONSE_SUCCESS, ret.first);
+    }
+    delete_object(key);
+}
+
+TEST_F(EWBPerfTest, Arithmetic_10k) {
+    const std::string key("EWBPerfTest_Arithmetic");
+    union {
+        protocol_binary_request_no_extras request;
+        protocol_binary_response_no_extras response_header;
+        protocol_binary_response_incr response;
+        char bytes[1024];
+    } send, receive;
+    const size_t len = mcbp_arithmetic_command(send.bytes, sizeof(send.bytes),
+                                               PROTOCOL_BINARY_CMD_INCREMENT,
+                                               key.data(), key.size(), 1, 0, 0);
+
+    for (int ii = 0; ii < 10000; ++ii) {
+        safe_send(send.bytes, len, false);
+        ASSERT_TRUE(safe_recv_packet(receive.bytes, sizeof(receive.bytes)));
+        mcbp_validate_response_header(&receive.response_header,
+                                      PROTOCOL_BINARY_CMD_INCREMENT,
+                                      PROTOCOL_BINARY_RESPONSE_SUCCESS);
+        mcbp_validate_arithmetic(&receive.response, ii);
+    }
+    delete_object(key.c_str());
+}
+
+TEST_F(EWBPerfTest, MultiConnection_16x1k) {
+    const std::string key("EWBPerfTest_MultiConnection");
+    store_object(key.c_str(), "value");
+
+    // The helper functions operate on the global socket, so swap it
+    // while we configure the engine for each of the connections
+    const SOCKET main_sock = sock;
+    std::vector<SOCKET> sockets(16);
+    for (auto& s : sockets) {
+        s = connect_to_server_plain(port);
+        ASSERT_NE(INVALID_SOCKET, s);
+        sock = s;
+        ewouldblock_engine_configure(ENGINE_EWOULDBLOCK,
+                                     EWBEngineMode::First, /*unused*/0);
+    }
+
+    union {
+        protocol_binary_request_no_extras request;
+        protocol_binary_response_no_extras response;
+        char bytes[1024];
+    } send, receive;
+    const size_t len = mcbp_raw_command(send.bytes, sizeof(send.bytes),
+                                        PROTOCOL_BINARY_CMD_GET,
+                                        key.data(), key.size(), NULL, 0);
+
+    for (int ii = 0; ii < 1000; ++ii) {
+        for (auto& s : sockets) {
+            sock = s;
+            safe_send(send.bytes, len, false);
+        }
+        for (auto& s : sockets) {
+            sock = s;
+            ASSERT_TRUE(safe_recv_packet(receive.bytes,
+                                         sizeof(receive.bytes)));
+            mcbp_validate_response_header(&receive.response,
+                                          PROTOCOL_BINARY_CMD_GET,
+                                          PROTOCOL_BINARY_RESPONSE_SUCCESS);
+        }
+    }
+
+    for (auto& s : sockets) {
+        closesocket(s);
+    }
+    sock = main_sock;
+    delete_object(key.c_str());
+}
@@ -0,0 +1,324 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Tests for GET_MULTI (a batch of keys in one request, with all of the
+ * values in one response).
+ *
+ * GetMultiPerfTest compares it with the usual way of fetching a batch of
+ * keys: a pipeline of GETKQ followed by a NOOP.
+ *
+ * Properties recorded by the perf tests:
+ * - us_per_op: Wall clock time per key.
+ */
+
+#include "testapp.h"
+#include "testapp_binprot.h"
+
+#include <string>
+#include <vector>
+
+class GetMultiTest : public TestappTest {
+protected:
+    struct Entry {
+        uint16_t status;
+        uint8_t datatype;
+        uint32_t flags;
+        uint64_t cas;
+        std::string value;
+    };
+
+    /**
+     * Send a GET_MULTI for the keys and return the status of the
+     * response (and the entries in it)
+     */
+    uint16_t getMulti(const std::vector<std::string>& keys,
+                      std::vector<Entry>& entries) {
+        std::vector<char> body;
+        for (const auto& key : keys) {
+            const uint16_t nkey = htons(uint16_t(key.size()));
+            const char* ptr = reinterpret_cast<const char*>(&nkey);
+            body.insert(body.end(), ptr, ptr + sizeof(nkey));
+            body.insert(body.end(), key.begin(), key.end());
+        }
+
+        std::vector<char> send(sizeof(protocol_binary_request_header) +
+                               body.size());
+        const size_t len = mcbp_raw_command(send.data(), send.size(),
+                                            PROTOCOL_BINARY_CMD_GET_MULTI,
+                                            NULL, 0, body.data(),
+                                            body.size());
+        safe_send(send.data(), len, false);
+        return recvGetMulti(entries);
+    }
+
+    uint16_t recvGetMulti(std::vector<Entry>& entries) {
+        // safe_recv_packet converts the header to host byte order
+        receive.resize(1024 * 1024);
+        auto* response = reinterpret_cast<protocol_binary_response_no_extras*>(
+            receive.data());
+        entries.clear();
+        EXPECT_TRUE(safe_recv_packet(receive.data(), receive.size()));
+        if (::testing::Test::HasFailure()) {
+            return PROTOCOL_BINARY_RESPONSE_EINTERNAL;
+        }
+        EXPECT_EQ(PROTOCOL_BINARY_RES, response->message.header.response.magic);
+        EXPECT_EQ(PROTOCOL_BINARY_CMD_GET_MULTI,
+                  response->message.header.response.opcode);
+        const uint16_t status = response->message.header.response.status;
+        if (status != PROTOCOL_BINARY_RESPONSE_SUCCESS) {
+            return status;
+        }
+
+        const uint8_t* body = receive.data() + sizeof(response->bytes);
+        const size_t bodylen = response->message.header.response.bodylen;
+
+        size_t offset = 0;
+        while (offset < bodylen) {
+            protocol_binary_get_multi_entry raw;
+            EXPECT_LE(offset + sizeof(raw), bodylen);
+            if (offset + sizeof(raw) > bodylen) {
+                break;
+            }
+            memcpy(&raw, body + offset, sizeof(raw));
+            offset += sizeof(raw);
+
+            Entry entry;
+            entry.status = ntohs(raw.status);
+            entry.datatype = raw.datatype;
+            entry.flags = ntohl(raw.flags);
+            entry.cas = ntohll(raw.cas);
+            const size_t nvalue = ntohl(raw.valuelen);
+            EXPECT_LE(offset + nvalue, bodylen);
+            entry.value.assign(reinterpret_cast<const char*>(body) + offset,
+                               nvalue);
+            offset += nvalue;
+            entries.push_back(entry);
+        }
+
+        return status;
+    }
+
+    std::vector<uint8_t> receive;
+};
+
+TEST_F(GetMultiTest, HitsAndMisses) {
+    store_object_with_flags("GetMultiTest_1", "value1", 0xcafe);
+    store_object_with_flags("GetMultiTest_2", "value2", 0xbeef);
+
+    std::vector<Entry> entries;
+    ASSERT_EQ(PROTOCOL_BINARY_RESPONSE_SUCCESS,
+              getMulti({"GetMultiTest_1", "GetMultiTest_missing",
+                        "GetMultiTest_2"}, entries));
+    ASSERT_EQ(3, entries.size());
+
+    EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_SUCCESS, entries[0].status);
+    EXPECT_EQ(0xcafe, entries[0].flags);
+    EXPECT_NE(0, entries[0].cas);
+    EXPECT_EQ("value1", entries[0].value);
+
+    EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_KEY_ENOENT, entries[1].status);
+    EXPECT_EQ(0, entries[1].cas);
+    EXPECT_EQ("", entries[1].value);
+
+    EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_SUCCESS, entries[2].status);
+    EXPECT_EQ(0xbeef, entries[2].flags);
+    EXPECT_EQ("value2", entries[2].value);
+
+    delete_object("GetMultiTest_1");
+    delete_object("GetMultiTest_2");
+}
+
+TEST_F(GetMultiTest, DuplicateKeys) {
+    store_object("GetMultiTest_dup", "value");
+
+    std::vector<Entry> entries;
+    ASSERT_EQ(PROTOCOL_BINARY_RESPONSE_SUCCESS,
+              getMulti({"GetMultiTest_dup", "GetMultiTest_dup"}, entries));
+    ASSERT_EQ(2, entries.size());
+    for (const auto& entry : entries) {
+        EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_SUCCESS, entry.status);
+        EXPECT_EQ("value", entry.value);
+    }
+    EXPECT_EQ(entries[0].cas, entries[1].cas);
+
+    delete_object("GetMultiTest_dup");
+}
+
+TEST_F(GetMultiTest, ManyKeys) {
+    // More keys than the default engine looks up under the lock at once
+    std::vector<std::string> keys;
+    for (int ii = 0; ii < 500; ++ii) {
+        keys.push_back("GetMultiTest_many_" + std::to_string(ii));
+        if (ii % 2 == 0) {
+            store_object(keys.back().c_str(), keys.back().c_str());
+        }
+    }
+
+    std::vector<Entry> entries;
+    ASSERT_EQ(PROTOCOL_BINARY_RESPONSE_SUCCESS, getMulti(keys, entries));
+    ASSERT_EQ(keys.size(), entries.size());
+    for (size_t ii = 0; ii < keys.size(); ++ii) {
+        if (ii % 2 == 0) {
+            EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_SUCCESS, entries[ii].status);
+            EXPECT_EQ(keys[ii], entries[ii].value);
+            delete_object(keys[ii].c_str());
+        } else {
+            EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_KEY_ENOENT, entries[ii].status);
+        }
+    }
+}
+
+TEST_F(GetMultiTest, TooManyKeys) {
+    std::vector<std::string> keys(PROTOCOL_BINARY_GET_MULTI_MAX_KEYS + 1,
+                                  "GetMultiTest_toomany");
+    std::vector<Entry> entries;
+    EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_E2BIG, getMulti(keys, entries));
+
+    keys.pop_back();
+    EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_SUCCESS, getMulti(keys, entries));
+    EXPECT_EQ(keys.size(), entries.size());
+}
+
+TEST_F(GetMultiTest, OverPinnedItemsLimit) {
+    // All of the items of a batch are held until the response is sent
+    cJSON_DeleteItemFromObject(memcached_cfg.get(), "max_pinned_items");
+    cJSON_AddNumberToObject(memcached_cfg.get(), "max_pinned_items", 2);
+    reconfigure();
+
+    std::vector<Entry> entries;
+    EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_E2BIG,
+              getMulti({"GetMultiTest_1", "GetMultiTest_2", "GetMultiTest_3"},
+                       entries));
+    EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_SUCCESS,
+              getMulti({"GetMultiTest_1", "GetMultiTest_2"}, entries));
+
+    cJSON_DeleteItemFromObject(memcached_cfg.get(), "max_pinned_items");
+    cJSON_AddNumberToObject(memcached_cfg.get(), "max_pinned_items", 0);
+    reconfigure();
+}
+
+TEST_F(GetMultiTest, WouldBlock) {
+    store_object("GetMultiTest_ewb", "value");
+    ewouldblock_engine_configure(ENGINE_EWOULDBLOCK, EWBEngineMode::First,
+                                 /*unused*/0);
+
+    std::vector<Entry> entries;
+    ASSERT_EQ(PROTOCOL_BINARY_RESPONSE_SUCCESS,
+              getMulti({"GetMultiTest_ewb"}, entries));
+    ASSERT_EQ(1, entries.size());
+    EXPECT_EQ("value", entries[0].value);
+
+    ewouldblock_engine_disable();
+    delete_object("GetMultiTest_ewb");
+}
+
+TEST_F(GetMultiTest, NotMyVbucket) {
+    ewouldblock_engine_configure(ENGINE_NOT_MY_VBUCKET, EWBEngineMode::Next_N,
+                                 1);
+
+    std::vector<Entry> entries;
+    EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_NOT_MY_VBUCKET,
+              getMulti({"GetMultiTest_1", "GetMultiTest_2"}, entries));
+
+    ewouldblock_engine_disable();
+}
+
+TEST_F(GetMultiTest, InvalidBody) {
+    // A key length without the key
+    const uint16_t nkey = htons(10);
+    char send[1024];
+    const size_t len = mcbp_raw_command(send, sizeof(send),
+                                        PROTOCOL_BINARY_CMD_GET_MULTI,
+                                        NULL, 0, &nkey, sizeof(nkey));
+    safe_send(send, len, false);
+
+    union {
+        protocol_binary_response_no_extras response;
+        char bytes[1024];
+    } receive;
+    ASSERT_TRUE(safe_recv_packet(receive.bytes, sizeof(receive.bytes)));
+    mcbp_validate_response_header(&receive.response,
+                                  PROTOCOL_BINARY_CMD_GET_MULTI,
+                                  PROTOCOL_BINARY_RESPONSE_EINVAL);
+}
+
+class GetMultiPerfTest : public GetMultiTest {
+protected:
+    void storeKeys(size_t nkeys) {
+        for (size_t ii = 0; ii < nkeys; ++ii) {
+            keys.push_back("GetMultiPerfTest_" + std::to_string(ii));
+            store_object(keys.back().c_str(), "value");
+        }
+    }
+
+    virtual void TearDown() override {
+        for (const auto& key : keys) {
+            delete_object(key.c_str());
+        }
+        GetMultiTest::TearDown();
+    }
+
+    std::vector<std::string> keys;
+};
+
+TEST_F(GetMultiPerfTest, GetMulti_1000x100) {
+    storeKeys(100);
+    std::vector<Entry> entries;
+    measure(1000 * keys.size(), [this, &entries]() {
+        for (int ii = 0; ii < 1000; ++ii) {
+            ASSERT_EQ(PROTOCOL_BINARY_RESPONSE_SUCCESS,
+                      getMulti(keys, entries));
+            ASSERT_EQ(keys.size(), entries.size());
+        }
+    });
+}
+
+TEST_F(GetMultiPerfTest, GetkqPipeline_1000x100) {
+    storeKeys(100);
+
+    std::vector<char> send;
+    char command[1024];
+    for (const auto& key : keys) {
+        const size_t len = mcbp_raw_command(command, sizeof(command),
+                                            PROTOCOL_BINARY_CMD_GETKQ,
+                                            key.data(), key.size(), NULL, 0);
+        send.insert(send.end(), command, command + len);
+    }
+    const size_t len = mcbp_raw_command(command, sizeof(command),
+                                        PROTOCOL_BINARY_CMD_NOOP,
+                                        NULL, 0, NULL, 0);
+    send.insert(send.end(), command, command + len);
+
+    union {
+        protocol_binary_response_no_extras response;
+        char bytes[1024];
+    } receive;
+    measure(1000 * keys.size(), [&]() {
+        for (int ii = 0; ii < 1000; ++ii) {
+            safe_send(send.data(), send.size(), false);
+            size_t hits = 0;
+            do {
+                ASSERT_TRUE(safe_recv_packet(receive.bytes,
+                                             sizeof(receive.bytes)));
+                ++hits;
+            } while (receive.response.message.header.response.opcode !=
+                     PROTOCOL_BINARY_CMD_NOOP);
+            ASSERT_EQ(keys.size() + 1, hits);
+        }
+    });
+}
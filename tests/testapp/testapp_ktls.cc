@@ -0,0 +1,83 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Tests for the kTLS offload of SSL connections ("ssl_ktls" in the
+ * configuration).
+ *
+ * Whether or not the connection is offloaded depends on the kernel and
+ * the negotiated protocol and cipher, so the tests verify that the data
+ * makes it through either way and that the connection is counted as
+ * offloaded or as a fallback.
+ */
+
+#include "testapp.h"
+#include "testapp_binprot.h"
+
+class KtlsTest : public McdTestappTest {
+protected:
+    void SetUp() override {
+        McdTestappTest::SetUp();
+        cJSON_DeleteItemFromObject(memcached_cfg.get(), "ssl_ktls");
+        cJSON_AddTrueToObject(memcached_cfg.get(), "ssl_ktls");
+        reconfigure();
+    }
+
+    void TearDown() override {
+        // The settings missing from the configuration keep their value,
+        // so it must be disabled before the entry is removed
+        cJSON_DeleteItemFromObject(memcached_cfg.get(), "ssl_ktls");
+        cJSON_AddFalseToObject(memcached_cfg.get(), "ssl_ktls");
+        reconfigure();
+        cJSON_DeleteItemFromObject(memcached_cfg.get(), "ssl_ktls");
+        McdTestappTest::TearDown();
+    }
+
+    uint64_t getKtlsConnections() {
+        const auto stats = request_stats();
+        return extract_single_stat(stats, "ktls_offloaded") +
+               extract_single_stat(stats, "ktls_fallbacks");
+    }
+};
+
+INSTANTIATE_TEST_CASE_P(Transport,
+                        KtlsTest,
+                        ::testing::Values(Transport::Plain, Transport::SSL),
+                        ::testing::PrintToStringParamName());
+
+TEST_P(KtlsTest, SmallAndLargeDocuments) {
+    const auto before = getKtlsConnections();
+
+    // Only connections created after the configuration change is
+    // offloaded
+    reconnect_to_server();
+    if (GetParam() == Transport::SSL) {
+        EXPECT_EQ(before + 1, getKtlsConnections());
+    } else {
+        EXPECT_EQ(before, getKtlsConnections());
+    }
+
+    const std::string key("KtlsTest");
+    for (const size_t size : {size_t(1), size_t(100), size_t(256 * 1024)}) {
+        std::string value(size, 'x');
+        for (size_t ii = 0; ii < value.size(); ii += 1000) {
+            value[ii] = char('a' + (ii / 1000) % 26);
+        }
+        store_object(key.c_str(), value.c_str(), true);
+    }
+    delete_object(key.c_str());
+}
@@ -0,0 +1,207 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Tests for GET_LEASE (a lease token on a miss, so that only one client
+ * refills a key which just expired).
+ *
+ * Properties recorded by the perf tests:
+ * - us_per_op: Wall clock time per GET_LEASE.
+ */
+
+#include "testapp.h"
+#include "testapp_binprot.h"
+
+#include <string>
+#include <vector>
+
+class LeaseTest : public TestappTest {
+protected:
+    struct Result {
+        uint16_t status;
+        uint64_t cas;
+        uint32_t flags;
+        uint32_t state;
+        std::string value;
+    };
+
+    Result getLease(const std::string& key) {
+        Result result;
+        result.cas = 0;
+        result.flags = 0;
+        result.state = 0;
+
+        char send[1024];
+        const size_t len = mcbp_raw_command(send, sizeof(send),
+                                            PROTOCOL_BINARY_CMD_GET_LEASE,
+                                            key.data(), key.size(),
+                                            NULL, 0);
+        safe_send(send, len, false);
+
+        // safe_recv_packet converts the header to host byte order
+        std::vector<char> receive(64 * 1024);
+        auto* response = reinterpret_cast<protocol_binary_response_get_lease*>(
+            receive.data());
+        EXPECT_TRUE(safe_recv_packet(receive.data(), receive.size()));
+        if (::testing::Test::HasFailure()) {
+            result.status = PROTOCOL_BINARY_RESPONSE_EINTERNAL;
+            return result;
+        }
+
+        auto& header = response->message.header.response;
+        EXPECT_EQ(PROTOCOL_BINARY_CMD_GET_LEASE, header.opcode);
+        result.status = header.status;
+        result.cas = header.cas;
+        if (result.status == PROTOCOL_BINARY_RESPONSE_SUCCESS) {
+            EXPECT_EQ(sizeof(response->message.body), header.extlen);
+            result.flags = ntohl(response->message.body.flags);
+            result.state = ntohl(response->message.body.state);
+            result.value.assign(receive.data() + sizeof(response->bytes),
+                                header.bodylen - header.extlen);
+        }
+        return result;
+    }
+
+    /**
+     * Store the value with a SET carrying the lease token as the CAS
+     */
+    uint16_t refill(const std::string& key, const std::string& value,
+                    uint64_t lease) {
+        char send[1024];
+        const size_t len = mcbp_storage_command(send, sizeof(send),
+                                                PROTOCOL_BINARY_CMD_SET,
+                                                key.data(), key.size(),
+                                                value.data(), value.size(),
+                                                0, 0);
+        auto* request = reinterpret_cast<protocol_binary_request_set*>(send);
+        request->message.header.request.cas = htonll(lease);
+        safe_send(send, len, false);
+
+        union {
+            protocol_binary_response_no_extras response;
+            char bytes[1024];
+        } receive;
+        EXPECT_TRUE(safe_recv_packet(receive.bytes, sizeof(receive.bytes)));
+        if (::testing::Test::HasFailure()) {
+            return PROTOCOL_BINARY_RESPONSE_EINTERNAL;
+        }
+        EXPECT_EQ(PROTOCOL_BINARY_CMD_SET,
+                  receive.response.message.header.response.opcode);
+        return receive.response.message.header.response.status;
+    }
+};
+
+TEST_F(LeaseTest, Hit) {
+    store_object_with_flags("LeaseTest_hit", "value", 0xcafe);
+
+    const auto result = getLease("LeaseTest_hit");
+    ASSERT_EQ(PROTOCOL_BINARY_RESPONSE_SUCCESS, result.status);
+    EXPECT_NE(0, result.cas);
+    EXPECT_EQ(0xcafe, result.flags);
+    EXPECT_EQ(PROTOCOL_BINARY_LEASE_STATE_FRESH, result.state);
+    EXPECT_EQ("value", result.value);
+
+    delete_object("LeaseTest_hit");
+}
+
+TEST_F(LeaseTest, MissGrantsLease) {
+    const auto lease = getLease("LeaseTest_miss");
+    ASSERT_EQ(PROTOCOL_BINARY_RESPONSE_KEY_ENOENT, lease.status);
+    EXPECT_NE(0, lease.cas);
+
+    // Only the first miss gets the lease
+    EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_ETMPFAIL,
+              getLease("LeaseTest_miss").status);
+    EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_KEY_EEXISTS,
+              refill("LeaseTest_miss", "value", lease.cas + 1));
+
+    EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_SUCCESS,
+              refill("LeaseTest_miss", "value", lease.cas));
+    const auto result = getLease("LeaseTest_miss");
+    EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_SUCCESS, result.status);
+    EXPECT_EQ("value", result.value);
+
+    delete_object("LeaseTest_miss");
+}
+
+TEST_F(LeaseTest, DeleteInvalidatesLease) {
+    const auto lease = getLease("LeaseTest_delete");
+    ASSERT_EQ(PROTOCOL_BINARY_RESPONSE_KEY_ENOENT, lease.status);
+
+    delete_object("LeaseTest_delete", true);
+    EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_KEY_ENOENT,
+              refill("LeaseTest_delete", "value", lease.cas));
+
+    // The next miss gets a new lease
+    const auto next = getLease("LeaseTest_delete");
+    EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_KEY_ENOENT, next.status);
+    EXPECT_NE(lease.cas, next.cas);
+    delete_object("LeaseTest_delete", true);
+}
+
+TEST_F(LeaseTest, SetInvalidatesLease) {
+    const auto lease = getLease("LeaseTest_set");
+    ASSERT_EQ(PROTOCOL_BINARY_RESPONSE_KEY_ENOENT, lease.status);
+
+    store_object("LeaseTest_set", "other");
+    EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_KEY_EEXISTS,
+              refill("LeaseTest_set", "value", lease.cas));
+    validate_object("LeaseTest_set", "other");
+
+    delete_object("LeaseTest_set");
+}
+
+TEST_F(LeaseTest, WouldBlock) {
+    store_object("LeaseTest_ewb", "value");
+    ewouldblock_engine_configure(ENGINE_EWOULDBLOCK, EWBEngineMode::First,
+                                 /*unused*/0);
+
+    EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_SUCCESS,
+              getLease("LeaseTest_ewb").status);
+
+    ewouldblock_engine_disable();
+    delete_object("LeaseTest_ewb");
+}
+
+class LeasePerfTest : public LeaseTest {
+protected:
+    /**
+     * Send the GET_LEASE niter times and record the time per request for
+     * the test
+     */
+    void measure(const std::string& key, uint16_t status, size_t niter) {
+        ::measure(niter, [this, &key, status, niter]() {
+            for (size_t ii = 0; ii < niter; ++ii) {
+                ASSERT_EQ(status, getLease(key).status);
+            }
+        });
+    }
+};
+
+TEST_F(LeasePerfTest, Hit_10000) {
+    store_object("LeasePerfTest_hit", "value");
+    measure("LeasePerfTest_hit", PROTOCOL_BINARY_RESPONSE_SUCCESS, 10000);
+    delete_object("LeasePerfTest_hit");
+}
+
+TEST_F(LeasePerfTest, HotMiss_10000) {
+    // Every request after the first one waits for the refill
+    ASSERT_EQ(PROTOCOL_BINARY_RESPONSE_KEY_ENOENT,
+              getLease("LeasePerfTest_miss").status);
+    measure("LeasePerfTest_miss", PROTOCOL_BINARY_RESPONSE_ETMPFAIL, 10000);
+    delete_object("LeasePerfTest_miss", true);
+}
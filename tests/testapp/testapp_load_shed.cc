@@ -0,0 +1,95 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Tests for load shedding ("shed_threshold" in the configuration).
+ *
+ * The threshold is set to 1 usec, which any pipeline of commands will
+ * exceed (the connection has to yield and wait for the event loop after
+ * every reqs_per_event command), so the worker thread should start
+ * rejecting commands with ETMPFAIL shortly after.
+ */
+
+#include "testapp.h"
+#include "testapp_binprot.h"
+
+#include <chrono>
+#include <thread>
+
+class LoadShedTest : public TestappTest {
+protected:
+    void setShedThreshold(int threshold) {
+        cJSON_DeleteItemFromObject(memcached_cfg.get(), "shed_threshold");
+        cJSON_AddNumberToObject(memcached_cfg.get(), "shed_threshold",
+                                threshold);
+        reconfigure();
+    }
+
+    /**
+     * Send a pipeline of GETs (for a missing key) and return the number
+     * of commands rejected with ETMPFAIL.
+     */
+    int sendPipeline(int count) {
+        char buffer[1024];
+        const std::string key("LoadShedTest");
+        const size_t len = mcbp_raw_command(buffer, sizeof(buffer),
+                                            PROTOCOL_BINARY_CMD_GET,
+                                            key.data(), key.size(),
+                                            NULL, 0);
+        std::vector<char> send;
+        for (int ii = 0; ii < count; ++ii) {
+            send.insert(send.end(), buffer, buffer + len);
+        }
+        safe_send(send.data(), send.size(), false);
+
+        union {
+            protocol_binary_response_no_extras response;
+            char bytes[1024];
+        } receive;
+        int rejected = 0;
+        for (int ii = 0; ii < count; ++ii) {
+            EXPECT_TRUE(safe_recv_packet(receive.bytes, sizeof(receive.bytes)));
+            const auto status =
+                receive.response.message.header.response.status;
+            if (ntohs(status) == PROTOCOL_BINARY_RESPONSE_ETMPFAIL) {
+                ++rejected;
+            } else {
+                mcbp_validate_response_header(&receive.response,
+                                              PROTOCOL_BINARY_CMD_GET,
+                                              PROTOCOL_BINARY_RESPONSE_KEY_ENOENT);
+            }
+        }
+        return rejected;
+    }
+};
+
+TEST_F(LoadShedTest, ShedWhenLagging) {
+    setShedThreshold(1);
+
+    bool shed = false;
+    const auto timeout = std::chrono::steady_clock::now() +
+                         std::chrono::seconds(10);
+    while (!shed && std::chrono::steady_clock::now() < timeout) {
+        shed = sendPipeline(200) > 0;
+    }
+    EXPECT_TRUE(shed) << "Expected the worker thread to shed load";
+
+    // The thread stops shedding load when the feature is disabled
+    setShedThreshold(0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_EQ(0, sendPipeline(200));
+}
@@ -0,0 +1,141 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Tests for the per-bucket rate limits ("bucket_limits" in the
+ * configuration). The test bucket is limited to 50 operations per
+ * second, so a burst of commands well above that must be rejected with
+ * ETMPFAIL.
+ */
+
+#include "testapp.h"
+#include "testapp_binprot.h"
+
+#include <chrono>
+#include <thread>
+
+class RateLimitTest : public TestappTest {
+public:
+    static void SetUpTestCase() {
+        memcached_cfg.reset(generate_config(0));
+        setLimits(50);
+        start_memcached_server(memcached_cfg.get());
+
+        if (HasFailure()) {
+            server_pid = reinterpret_cast<pid_t>(-1);
+        } else {
+            CreateTestBucket();
+        }
+
+        ASSERT_NE(reinterpret_cast<pid_t>(-1), server_pid);
+    }
+
+    void TearDown() override {
+        // Let the bucket get a few tokens back so that the next test can
+        // configure the ewouldblock engine
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        TestappTest::TearDown();
+    }
+
+protected:
+    static void setLimits(int ops) {
+        unique_cJSON_ptr limits(cJSON_CreateObject());
+        cJSON* bucket = cJSON_CreateObject();
+        cJSON_AddNumberToObject(bucket, "ops", ops);
+        cJSON_AddItemToObject(limits.get(), "default", bucket);
+        cJSON_DeleteItemFromObject(memcached_cfg.get(), "bucket_limits");
+        cJSON_AddItemToObject(memcached_cfg.get(), "bucket_limits",
+                              limits.release());
+    }
+
+    /**
+     * Send a burst of GETs (for a missing key) and return the number of
+     * commands rejected with ETMPFAIL.
+     */
+    int sendBurst(int count) {
+        char buffer[1024];
+        const std::string key("RateLimitTest");
+        const size_t len = mcbp_raw_command(buffer, sizeof(buffer),
+                                            PROTOCOL_BINARY_CMD_GET,
+                                            key.data(), key.size(),
+                                            NULL, 0);
+        std::vector<char> send;
+        for (int ii = 0; ii < count; ++ii) {
+            send.insert(send.end(), buffer, buffer + len);
+        }
+        safe_send(send.data(), send.size(), false);
+
+        union {
+            protocol_binary_response_no_extras response;
+            char bytes[1024];
+        } receive;
+        int rejected = 0;
+        for (int ii = 0; ii < count; ++ii) {
+            EXPECT_TRUE(safe_recv_packet(receive.bytes, sizeof(receive.bytes)));
+            const auto status =
+                receive.response.message.header.response.status;
+            if (ntohs(status) == PROTOCOL_BINARY_RESPONSE_ETMPFAIL) {
+                ++rejected;
+            } else {
+                mcbp_validate_response_header(&receive.response,
+                                              PROTOCOL_BINARY_CMD_GET,
+                                              PROTOCOL_BINARY_RESPONSE_KEY_ENOENT);
+            }
+        }
+        return rejected;
+    }
+};
+
+TEST_F(RateLimitTest, BurstIsRejected) {
+    // The bucket starts out with a second worth of tokens, so most of
+    // the 500 commands must be rejected
+    EXPECT_LE(400, sendBurst(500));
+}
+
+TEST_F(RateLimitTest, TokensAreRefilled) {
+    // Drain the bucket, and wait for it to be refilled
+    sendBurst(500);
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    EXPECT_GT(500, sendBurst(500));
+}
+
+TEST_F(RateLimitTest, NoopIsNotLimited) {
+    sendBurst(500);
+    char buffer[1024];
+    const size_t len = mcbp_raw_command(buffer, sizeof(buffer),
+                                        PROTOCOL_BINARY_CMD_NOOP,
+                                        NULL, 0, NULL, 0);
+    safe_send(buffer, len, false);
+    union {
+        protocol_binary_response_no_extras response;
+        char bytes[1024];
+    } receive;
+    ASSERT_TRUE(safe_recv_packet(receive.bytes, sizeof(receive.bytes)));
+    mcbp_validate_response_header(&receive.response,
+                                  PROTOCOL_BINARY_CMD_NOOP,
+                                  PROTOCOL_BINARY_RESPONSE_SUCCESS);
+}
+
+TEST_F(RateLimitTest, LimitsAreDynamic) {
+    setLimits(0);
+    reconfigure();
+    EXPECT_EQ(0, sendBurst(500));
+
+    setLimits(50);
+    reconfigure();
+    EXPECT_LE(400, sendBurst(500));
+}
@@ -0,0 +1,253 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Tests for SCAN (enumerating the keys of the bucket with a cursor).
+ *
+ * Properties recorded by the perf tests:
+ * - us_per_op: Wall clock time per key returned.
+ */
+
+#include "testapp.h"
+#include "testapp_binprot.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+class ScanTest : public TestappTest {
+protected:
+    struct Entry {
+        uint8_t datatype;
+        uint32_t flags;
+        uint32_t exptime;
+        uint32_t valuelen;
+        uint64_t cas;
+    };
+
+    /**
+     * Send a single SCAN request and return the status of the response
+     * (and the cursor and the keys in it)
+     */
+    uint16_t scan(uint64_t& cursor, uint32_t count, const std::string& prefix,
+                  bool metadata, std::map<std::string, Entry>& keys) {
+        protocol_binary_request_scan request;
+        memset(&request, 0, sizeof(request));
+        request.message.header.request.magic = PROTOCOL_BINARY_REQ;
+        request.message.header.request.opcode = PROTOCOL_BINARY_CMD_SCAN;
+        request.message.header.request.extlen = sizeof(request.message.body);
+        request.message.header.request.keylen = htons(uint16_t(prefix.size()));
+        request.message.header.request.bodylen = htonl(
+            uint32_t(sizeof(request.message.body) + prefix.size()));
+        request.message.body.cursor = htonll(cursor);
+        request.message.body.count = htonl(count);
+        request.message.body.flags = htonl(
+            metadata ? PROTOCOL_BINARY_SCAN_FLAG_METADATA : 0);
+
+        std::vector<char> send(request.bytes,
+                               request.bytes + sizeof(request.bytes));
+        send.insert(send.end(), prefix.begin(), prefix.end());
+        safe_send(send.data(), send.size(), false);
+
+        // safe_recv_packet converts the header to host byte order
+        receive.resize(4 * 1024 * 1024);
+        auto* response = reinterpret_cast<protocol_binary_response_scan*>(
+            receive.data());
+        EXPECT_TRUE(safe_recv_packet(receive.data(), receive.size()));
+        if (::testing::Test::HasFailure()) {
+            return PROTOCOL_BINARY_RESPONSE_EINTERNAL;
+        }
+        EXPECT_EQ(PROTOCOL_BINARY_CMD_SCAN,
+                  response->message.header.response.opcode);
+        const uint16_t status = response->message.header.response.status;
+        if (status != PROTOCOL_BINARY_RESPONSE_SUCCESS) {
+            return status;
+        }
+
+        EXPECT_EQ(sizeof(response->message.body),
+                  response->message.header.response.extlen);
+        cursor = ntohll(response->message.body.cursor);
+
+        const uint8_t* body = receive.data() + sizeof(response->bytes);
+        const size_t bodylen = response->message.header.response.bodylen -
+                               sizeof(response->message.body);
+        size_t offset = 0;
+        while (offset < bodylen) {
+            Entry entry;
+            memset(&entry, 0, sizeof(entry));
+            uint16_t nkey;
+            if (metadata) {
+                protocol_binary_scan_entry raw;
+                EXPECT_LE(offset + sizeof(raw), bodylen);
+                if (offset + sizeof(raw) > bodylen) {
+                    break;
+                }
+                memcpy(&raw, body + offset, sizeof(raw));
+                offset += sizeof(raw);
+                nkey = ntohs(raw.keylen);
+                entry.datatype = raw.datatype;
+                entry.flags = ntohl(raw.flags);
+                entry.exptime = ntohl(raw.exptime);
+                entry.valuelen = ntohl(raw.valuelen);
+                entry.cas = ntohll(raw.cas);
+            } else {
+                EXPECT_LE(offset + sizeof(nkey), bodylen);
+                if (offset + sizeof(nkey) > bodylen) {
+                    break;
+                }
+                memcpy(&nkey, body + offset, sizeof(nkey));
+                offset += sizeof(nkey);
+                nkey = ntohs(nkey);
+            }
+            EXPECT_LE(offset + nkey, bodylen);
+            keys[std::string(reinterpret_cast<const char*>(body) + offset,
+                             nkey)] = entry;
+            offset += nkey;
+        }
+
+        return status;
+    }
+
+    /**
+     * Run a scan to completion and return the number of requests used
+     */
+    size_t scanAll(uint32_t count, const std::string& prefix, bool metadata,
+                   std::map<std::string, Entry>& keys) {
+        uint64_t cursor = 0;
+        size_t requests = 0;
+        do {
+            EXPECT_EQ(PROTOCOL_BINARY_RESPONSE_SUCCESS,
+                      scan(cursor, count, prefix, metadata, keys));
+            ++requests;
+        } while (cursor != 0 && !::testing::Test::HasFailure());
+        return requests;
+    }
+
+    std::vector<uint8_t> receive;
+};
+
+TEST_F(ScanTest, AllKeys) {
+    std::vector<std::string> stored;
+    for (int ii = 0; ii < 200; ++ii) {
+        stored.push_back("ScanTest_all_" + std::to_string(ii));
+        store_object(stored.back().c_str(), "value");
+    }
+
+    std::map<std::string, Entry> keys;
+    EXPECT_LT(1, scanAll(50, "", false, keys));
+    for (const auto& key : stored) {
+        EXPECT_NE(keys.end(), keys.find(key)) << key;
+        delete_object(key.c_str());
+    }
+}
+
+TEST_F(ScanTest, Prefix) {
+    store_object("ScanTest_prefix_a", "value");
+    store_object("ScanTest_prefix_b", "value");
+    store_object("ScanTest_other", "value");
+
+    std::map<std::string, Entry> keys;
+    scanAll(10, "ScanTest_prefix_", false, keys);
+    EXPECT_EQ(2, keys.size());
+    EXPECT_NE(keys.end(), keys.find("ScanTest_prefix_a"));
+    EXPECT_NE(keys.end(), keys.find("ScanTest_prefix_b"));
+
+    delete_object("ScanTest_prefix_a");
+    delete_object("ScanTest_prefix_b");
+    delete_object("ScanTest_other");
+}
+
+TEST_F(ScanTest, Metadata) {
+    store_object_with_flags("ScanTest_metadata", "value", 0xcafe);
+
+    std::map<std::string, Entry> keys;
+    scanAll(10, "ScanTest_metadata", true, keys);
+    ASSERT_EQ(1, keys.size());
+    const auto& entry = keys["ScanTest_metadata"];
+    EXPECT_EQ(0xcafe, entry.flags);
+    EXPECT_EQ(0, entry.exptime);
+    EXPECT_EQ(5, entry.valuelen);
+    EXPECT_NE(0, entry.cas);
+
+    delete_object("ScanTest_metadata");
+}
+
+TEST_F(ScanTest, NotFoundAfterDelete) {
+    store_object("ScanTest_deleted", "value");
+    delete_object("ScanTest_deleted");
+
+    std::map<std::string, Entry> keys;
+    scanAll(10, "ScanTest_deleted", false, keys);
+    EXPECT_TRUE(keys.empty());
+}
+
+TEST_F(ScanTest, WouldBlock) {
+    store_object("ScanTest_ewb", "value");
+    ewouldblock_engine_configure(ENGINE_EWOULDBLOCK, EWBEngineMode::First,
+                                 /*unused*/0);
+
+    std::map<std::string, Entry> keys;
+    scanAll(10, "ScanTest_ewb", false, keys);
+    EXPECT_EQ(1, keys.size());
+
+    ewouldblock_engine_disable();
+    delete_object("ScanTest_ewb");
+}
+
+class ScanPerfTest : public ScanTest {
+protected:
+    virtual void SetUp() override {
+        ScanTest::SetUp();
+        for (size_t ii = 0; ii < 10000; ++ii) {
+            stored.push_back("ScanPerfTest_" + std::to_string(ii));
+            store_object(stored.back().c_str(), "value");
+        }
+    }
+
+    virtual void TearDown() override {
+        for (const auto& key : stored) {
+            delete_object(key.c_str());
+        }
+        ScanTest::TearDown();
+    }
+
+    /**
+     * Scan all of the keys with batches of the given size and record the
+     * time per key for the test
+     */
+    void measure(uint32_t count, bool metadata) {
+        std::map<std::string, Entry> keys;
+        ::measure(stored.size(), [this, count, metadata, &keys]() {
+            scanAll(count, "ScanPerfTest_", metadata, keys);
+        });
+        EXPECT_EQ(stored.size(), keys.size());
+    }
+
+    std::vector<std::string> stored;
+};
+
+TEST_F(ScanPerfTest, Keys_10000x100) {
+    measure(100, false);
+}
+
+TEST_F(ScanPerfTest, Keys_10000x1000) {
+    measure(1000, false);
+}
+
+TEST_F(ScanPerfTest, Metadata_10000x1000) {
+    measure(1000, true);
+}
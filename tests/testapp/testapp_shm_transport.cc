@@ -0,0 +1,420 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Tests for the shared memory transport (SHM_CONNECT and "shm_ring_size").
+ *
+ * The server is started with a Unix domain socket (see UnixSocketTest)
+ * and small rings, so that the values used by the tests wrap around the
+ * rings and fill them up. The functional tests negotiate the transport
+ * on the socket and run the commands through the rings, and
+ * ShmTransportPerfTest compares the transport with the Unix domain
+ * socket it was negotiated on.
+ *
+ * Properties recorded by the perf tests:
+ * - us_per_op: Wall clock time per operation.
+ */
+
+#include "testapp_unix_socket.h"
+#include "testapp_binprot.h"
+
+#include "daemon/shm_ring.h"
+
+#include <vector>
+
+#if !defined(WIN32) && defined(HAVE_SHM_TRANSPORT)
+#include <poll.h>
+
+static const size_t ring_size = 4096;
+
+/**
+ * The client side of the shared memory transport
+ */
+class ShmClient {
+public:
+    ShmClient()
+        : sock(INVALID_SOCKET),
+          serverDoorbell(-1),
+          clientDoorbell(-1) {
+    }
+
+    ~ShmClient() {
+        if (region) {
+            // Tell the server we're done
+            ShmRing requests = region->getRequestRing();
+            requests.close();
+            shm_ring_doorbell(serverDoorbell);
+            close(serverDoorbell);
+            close(clientDoorbell);
+        }
+    }
+
+    /**
+     * Send SHM_CONNECT on the socket and set up the transport from the
+     * descriptors in the response
+     */
+    void connect(SOCKET socket) {
+        sock = socket;
+        char buffer[1024];
+        const size_t len = mcbp_raw_command(buffer, sizeof(buffer),
+                                            PROTOCOL_BINARY_CMD_SHM_CONNECT,
+                                            NULL, 0, NULL, 0);
+        ASSERT_EQ(ssize_t(len), ::send(sock, buffer, len, 0));
+
+        union {
+            protocol_binary_response_no_extras response;
+            char bytes[sizeof(protocol_binary_response_no_extras)];
+        } receive;
+        struct iovec iov;
+        iov.iov_base = receive.bytes;
+        iov.iov_len = sizeof(receive.bytes);
+        union {
+            struct cmsghdr align;
+            char buf[CMSG_SPACE(3 * sizeof(int))];
+        } control;
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+
+        ASSERT_EQ(ssize_t(sizeof(receive.bytes)), recvmsg(sock, &msg, 0));
+        auto& header = receive.response.message.header.response;
+        header.status = ntohs(header.status);
+        mcbp_validate_response_header(&receive.response,
+                                      PROTOCOL_BINARY_CMD_SHM_CONNECT,
+                                      PROTOCOL_BINARY_RESPONSE_SUCCESS);
+
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        ASSERT_NE(nullptr, cmsg);
+        ASSERT_EQ(SCM_RIGHTS, cmsg->cmsg_type);
+        ASSERT_EQ(CMSG_LEN(3 * sizeof(int)), cmsg->cmsg_len);
+        int fds[3];
+        memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+        serverDoorbell = fds[1];
+        clientDoorbell = fds[2];
+        region = ShmRegion::attach(fds[0]);
+        ASSERT_EQ(ring_size, region->getRingSize());
+    }
+
+    /** Write all of the data to the request ring */
+    void send(const void* data, size_t nbytes) {
+        ShmRing requests = region->getRequestRing();
+        const char* ptr = static_cast<const char*>(data);
+        while (nbytes > 0) {
+            const size_t nw = requests.write(ptr, nbytes);
+            if (nw == 0) {
+                shm_drain_doorbell(clientDoorbell);
+                if (requests.prepareToWaitForSpace()) {
+                    ASSERT_TRUE(wait());
+                }
+                continue;
+            }
+            ptr += nw;
+            nbytes -= nw;
+            if (requests.wakeConsumer()) {
+                shm_ring_doorbell(serverDoorbell);
+            }
+        }
+    }
+
+    /**
+     * Read the next response from the response ring (with the header
+     * converted to host byte order like safe_recv_packet)
+     */
+    bool recvPacket(std::vector<char>& packet) {
+        packet.resize(sizeof(protocol_binary_response_header));
+        if (!recv(packet.data(), packet.size())) {
+            return false;
+        }
+        auto* response =
+            reinterpret_cast<protocol_binary_response_header*>(packet.data());
+        response->response.keylen = ntohs(response->response.keylen);
+        response->response.status = ntohs(response->response.status);
+        response->response.bodylen = ntohl(response->response.bodylen);
+
+        const size_t bodylen = response->response.bodylen;
+        packet.resize(sizeof(protocol_binary_response_header) + bodylen);
+        return recv(packet.data() + sizeof(protocol_binary_response_header),
+                    bodylen);
+    }
+
+    /** Has the server closed the response ring? */
+    bool isClosed() {
+        ShmRing responses = region->getResponseRing();
+        return responses.isClosed() && responses.used() == 0;
+    }
+
+protected:
+    bool recv(char* dest, size_t nbytes) {
+        ShmRing responses = region->getResponseRing();
+        while (nbytes > 0) {
+            const size_t nr = responses.read(dest, nbytes);
+            if (nr == 0) {
+                if (responses.isClosed()) {
+                    return false;
+                }
+                shm_drain_doorbell(clientDoorbell);
+                if (responses.prepareToWaitForData() && !wait()) {
+                    return false;
+                }
+                continue;
+            }
+            dest += nr;
+            nbytes -= nr;
+            if (responses.wakeProducer()) {
+                shm_ring_doorbell(serverDoorbell);
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Wait for the server to ring our doorbell
+     *
+     * @return false if the server went away
+     */
+    bool wait() {
+        struct pollfd fds[2];
+        fds[0].fd = clientDoorbell;
+        fds[0].events = POLLIN;
+        fds[1].fd = sock;
+        fds[1].events = POLLIN;
+        int ret;
+        do {
+            ret = poll(fds, 2, 60000);
+        } while (ret == -1 && errno == EINTR);
+        EXPECT_LT(0, ret) << "Timed out waiting for the server";
+        return ret > 0 && (fds[1].revents == 0 || fds[0].revents != 0);
+    }
+
+    SOCKET sock;
+    int serverDoorbell;
+    int clientDoorbell;
+    std::unique_ptr<ShmRegion> region;
+};
+
+class ShmTransportTest : public UnixSocketTest {
+public:
+    static void SetUpTestCase() {
+        startServer([](cJSON* cfg) {
+            cJSON_AddNumberToObject(cfg, "shm_ring_size", ring_size);
+        });
+    }
+
+protected:
+    void SetUp() override {
+        UnixSocketTest::SetUp();
+        shm.connect(sock);
+    }
+
+    void store(const std::string& key, const std::string& value) {
+        std::vector<char> command(1024 + key.size() + value.size());
+        const size_t len = mcbp_storage_command(command.data(), command.size(),
+                                                PROTOCOL_BINARY_CMD_SET,
+                                                key.data(), key.size(),
+                                                value.data(), value.size(),
+                                                0, 0);
+        shm.send(command.data(), len);
+        ASSERT_TRUE(shm.recvPacket(packet));
+        validate(PROTOCOL_BINARY_CMD_SET, PROTOCOL_BINARY_RESPONSE_SUCCESS);
+    }
+
+    void sendGet(const std::string& key) {
+        char command[1024];
+        const size_t len = mcbp_raw_command(command, sizeof(command),
+                                            PROTOCOL_BINARY_CMD_GET,
+                                            key.data(), key.size(), NULL, 0);
+        shm.send(command, len);
+    }
+
+    void validateGet(const std::string& value) {
+        ASSERT_TRUE(shm.recvPacket(packet));
+        validate(PROTOCOL_BINARY_CMD_GET, PROTOCOL_BINARY_RESPONSE_SUCCESS);
+        auto* response =
+            reinterpret_cast<protocol_binary_response_get*>(packet.data());
+        const size_t offset = sizeof(response->bytes);
+        EXPECT_EQ(value, std::string(packet.data() + offset,
+                                     packet.size() - offset));
+    }
+
+    void validate(uint8_t cmd, uint16_t status) {
+        mcbp_validate_response_header(
+            reinterpret_cast<protocol_binary_response_no_extras*>(
+                packet.data()), cmd, status);
+    }
+
+    ShmClient shm;
+    std::vector<char> packet;
+};
+
+TEST_F(ShmTransportTest, GetSet) {
+    const std::string key("ShmTransportTest_GetSet");
+    store(key, "value");
+    sendGet(key);
+    validateGet("value");
+}
+
+TEST_F(ShmTransportTest, Pipelined) {
+    // Each batch of requests fits in the request ring, but the responses
+    // don't fit in the response ring so the server has to wait for us
+    const std::string key("ShmTransportTest_Pipelined");
+    const std::string value(100, 'x');
+    store(key, value);
+
+    for (int batch = 0; batch < 20; ++batch) {
+        for (size_t ii = 0; ii < 50; ++ii) {
+            sendGet(key);
+        }
+        for (size_t ii = 0; ii < 50; ++ii) {
+            validateGet(value);
+        }
+    }
+}
+
+TEST_F(ShmTransportTest, ValueLargerThanRing) {
+    const std::string key("ShmTransportTest_ValueLargerThanRing");
+    std::string value(ring_size * 10, 'x');
+    for (size_t ii = 0; ii < value.size(); ++ii) {
+        value[ii] = char('a' + ii % 26);
+    }
+    store(key, value);
+    sendGet(key);
+    validateGet(value);
+}
+
+TEST_F(ShmTransportTest, Noop) {
+    char command[1024];
+    const size_t len = mcbp_raw_command(command, sizeof(command),
+                                        PROTOCOL_BINARY_CMD_NOOP,
+                                        NULL, 0, NULL, 0);
+    shm.send(command, len);
+    ASSERT_TRUE(shm.recvPacket(packet));
+    validate(PROTOCOL_BINARY_CMD_NOOP, PROTOCOL_BINARY_RESPONSE_SUCCESS);
+}
+
+TEST_F(ShmTransportTest, QuitClosesTheRings) {
+    char command[1024];
+    const size_t len = mcbp_raw_command(command, sizeof(command),
+                                        PROTOCOL_BINARY_CMD_QUIT,
+                                        NULL, 0, NULL, 0);
+    shm.send(command, len);
+    ASSERT_TRUE(shm.recvPacket(packet));
+    validate(PROTOCOL_BINARY_CMD_QUIT, PROTOCOL_BINARY_RESPONSE_SUCCESS);
+
+    // The server closes the response ring and the socket
+    EXPECT_FALSE(shm.recvPacket(packet));
+    EXPECT_TRUE(shm.isClosed());
+    char byte;
+    EXPECT_EQ(0, ::recv(sock, &byte, 1, 0));
+}
+
+TEST_F(ShmTransportTest, NotSupportedOnTcp) {
+    union {
+        protocol_binary_request_no_extras request;
+        protocol_binary_response_no_extras response;
+        char bytes[1024];
+    } buffer;
+    const size_t len = mcbp_raw_command(buffer.bytes, sizeof(buffer.bytes),
+                                        PROTOCOL_BINARY_CMD_SHM_CONNECT,
+                                        NULL, 0, NULL, 0);
+    const SOCKET unix_sock = sock;
+    sock = tcp_sock;
+    safe_send(buffer.bytes, len, false);
+    ASSERT_TRUE(safe_recv_packet(buffer.bytes, sizeof(buffer.bytes)));
+    mcbp_validate_response_header(&buffer.response,
+                                  PROTOCOL_BINARY_CMD_SHM_CONNECT,
+                                  PROTOCOL_BINARY_RESPONSE_NOT_SUPPORTED);
+    sock = unix_sock;
+}
+
+class ShmTransportPerfTest : public ShmTransportTest {
+protected:
+    /**
+     * Run the gets over the shared memory transport, or over another
+     * connection to the Unix domain socket
+     */
+    void run(bool shared_memory, size_t iterations, size_t pipeline) {
+        const std::string key("ShmTransportPerfTest");
+        store(key, "value");
+
+        if (shared_memory) {
+            measure(iterations * pipeline, [this, &key, iterations,
+                                            pipeline]() {
+                for (size_t ii = 0; ii < iterations; ++ii) {
+                    for (size_t jj = 0; jj < pipeline; ++jj) {
+                        sendGet(key);
+                    }
+                    for (size_t jj = 0; jj < pipeline; ++jj) {
+                        validateGet("value");
+                    }
+                }
+            });
+            return;
+        }
+
+        const SOCKET shm_sock = sock;
+        sock = connect_to_unix_socket();
+        ASSERT_NE(INVALID_SOCKET, sock);
+
+        char command[1024];
+        const size_t len = mcbp_raw_command(command, sizeof(command),
+                                            PROTOCOL_BINARY_CMD_GET,
+                                            key.data(), key.size(), NULL, 0);
+        std::vector<char> send;
+        for (size_t ii = 0; ii < pipeline; ++ii) {
+            send.insert(send.end(), command, command + len);
+        }
+        union {
+            protocol_binary_response_no_extras response;
+            char bytes[1024];
+        } receive;
+        measure(iterations * pipeline, [&]() {
+            for (size_t ii = 0; ii < iterations; ++ii) {
+                safe_send(send.data(), send.size(), false);
+                for (size_t jj = 0; jj < pipeline; ++jj) {
+                    ASSERT_TRUE(safe_recv_packet(receive.bytes,
+                                                 sizeof(receive.bytes)));
+                    mcbp_validate_response_header(
+                        &receive.response, PROTOCOL_BINARY_CMD_GET,
+                        PROTOCOL_BINARY_RESPONSE_SUCCESS);
+                }
+            }
+        });
+
+        closesocket(sock);
+        sock = shm_sock;
+    }
+};
+
+TEST_F(ShmTransportPerfTest, SmallGet_10k_Shm) {
+    run(true, 10000, 1);
+}
+
+TEST_F(ShmTransportPerfTest, SmallGet_10k_Unix) {
+    run(false, 10000, 1);
+}
+
+TEST_F(ShmTransportPerfTest, PipelinedGet_100x30_Shm) {
+    run(true, 100, 30);
+}
+
+TEST_F(ShmTransportPerfTest, PipelinedGet_100x30_Unix) {
+    run(false, 100, 30);
+}
+#endif
@@ -0,0 +1,147 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Tests for the per-connection output limits ("max_pending_bytes" and
+ * "max_pinned_items") and "slow_reader_timeout".
+ */
+
+#include "testapp.h"
+#include "testapp_binprot.h"
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+static const int slow_reader_timeout = 1;
+
+class SlowReaderTest : public TestappTest {
+public:
+    static void SetUpTestCase() {
+        memcached_cfg.reset(generate_config(0));
+        cJSON_AddNumberToObject(memcached_cfg.get(), "slow_reader_timeout",
+                                slow_reader_timeout);
+        cJSON_AddNumberToObject(memcached_cfg.get(), "max_pending_bytes",
+                                1);
+        cJSON_AddNumberToObject(memcached_cfg.get(), "max_pinned_items", 1);
+
+        start_memcached_server(memcached_cfg.get());
+
+        if (HasFailure()) {
+            server_pid = reinterpret_cast<pid_t>(-1);
+        } else {
+            CreateTestBucket();
+        }
+
+        ASSERT_NE(reinterpret_cast<pid_t>(-1), server_pid);
+    }
+
+protected:
+    void storeLargeObject(const std::string& key, size_t size) {
+        std::vector<char> value(size, 'x');
+        std::vector<char> buffer(size + 1024);
+        const size_t len = mcbp_storage_command(buffer.data(), buffer.size(),
+                                                PROTOCOL_BINARY_CMD_SET,
+                                                key.data(), key.size(),
+                                                value.data(), value.size(),
+                                                0, 0);
+        safe_send(buffer.data(), len, false);
+
+        union {
+            protocol_binary_response_no_extras response;
+            char bytes[1024];
+        } receive;
+        ASSERT_TRUE(safe_recv_packet(receive.bytes, sizeof(receive.bytes)));
+        mcbp_validate_response_header(&receive.response,
+                                      PROTOCOL_BINARY_CMD_SET,
+                                      PROTOCOL_BINARY_RESPONSE_SUCCESS);
+    }
+};
+
+TEST_F(SlowReaderTest, DisconnectSlowReader) {
+    const std::string key("SlowReaderTest");
+    const size_t size = 512 * 1024;
+    storeLargeObject(key, size);
+
+    // Request far more data than fits in the socket buffers, and don't
+    // read any of it
+    const SOCKET main_sock = sock;
+    sock = connect_to_server_plain(port);
+    ASSERT_NE(INVALID_SOCKET, sock);
+
+    char buffer[1024];
+    const size_t len = mcbp_raw_command(buffer, sizeof(buffer),
+                                        PROTOCOL_BINARY_CMD_GET,
+                                        key.data(), key.size(), NULL, 0);
+    const int count = 64;
+    for (int ii = 0; ii < count; ++ii) {
+        safe_send(buffer, len, false);
+    }
+
+    std::this_thread::sleep_for(
+        std::chrono::seconds(slow_reader_timeout * 3));
+
+    // The server should have given up on us, so we should hit EOF long
+    // before we've received all of the responses
+    std::vector<char> data(64 * 1024);
+    size_t total = 0;
+    ssize_t nr;
+    while ((nr = recv(sock, data.data(), data.size(), 0)) > 0) {
+        total += size_t(nr);
+    }
+    EXPECT_LT(total, count * size);
+
+    closesocket(sock);
+    sock = main_sock;
+    delete_object(key.c_str());
+}
+
+TEST_F(SlowReaderTest, UnorderedExecutionWithinLimits) {
+    const std::string key("SlowReaderTest");
+    store_object(key.c_str(), "value");
+
+    // With both limits set to 1 the connection has to stop reading
+    // after every parked command, but all of them should complete
+    set_unordered_execution_feature(true);
+    ewouldblock_engine_configure(ENGINE_EWOULDBLOCK,
+                                 EWBEngineMode::RandomDelay, 1000);
+
+    char buffer[1024];
+    const size_t len = mcbp_raw_command(buffer, sizeof(buffer),
+                                        PROTOCOL_BINARY_CMD_GET,
+                                        key.data(), key.size(), NULL, 0);
+    std::vector<char> send;
+    for (int ii = 0; ii < 16; ++ii) {
+        send.insert(send.end(), buffer, buffer + len);
+    }
+    safe_send(send.data(), send.size(), false);
+
+    union {
+        protocol_binary_response_no_extras response;
+        char bytes[1024];
+    } receive;
+    for (int ii = 0; ii < 16; ++ii) {
+        ASSERT_TRUE(safe_recv_packet(receive.bytes, sizeof(receive.bytes)));
+        mcbp_validate_response_header(&receive.response,
+                                      PROTOCOL_BINARY_CMD_GET,
+                                      PROTOCOL_BINARY_RESPONSE_SUCCESS);
+    }
+
+    ewouldblock_engine_disable();
+    set_unordered_execution_feature(false);
+    delete_object(key.c_str());
+}
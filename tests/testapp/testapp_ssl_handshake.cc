@@ -0,0 +1,225 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Tests for the SSL handshake: session resumption through the shared
+ * server context ("ssl_session_cache_size" in the configuration) and the
+ * handshake running on the executor pool ("ssl_handshake_offload").
+ *
+ * The connections are set up with their own client context (outside the
+ * SSL connection used by the other tests) so that the session from one
+ * connection may be offered when the next one connects.
+ */
+
+#include "testapp.h"
+#include "testapp_binprot.h"
+
+#include <memcached/openssl.h>
+
+class SslHandshakeTest : public TestappTest {
+protected:
+    void SetUp() override {
+        TestappTest::SetUp();
+        ctx = SSL_CTX_new(SSLv23_client_method());
+        ASSERT_NE(nullptr, ctx);
+#ifdef SSL_OP_NO_TLSv1_3
+        // The TLS 1.3 tickets are sent after the handshake, so stay with
+        // TLS 1.2 to get the session when the handshake completes
+        SSL_CTX_set_options(ctx, SSL_OP_NO_TLSv1_3);
+#endif
+    }
+
+    void TearDown() override {
+        if (session != nullptr) {
+            SSL_SESSION_free(session);
+        }
+        SSL_CTX_free(ctx);
+        TestappTest::TearDown();
+    }
+
+    /**
+     * Connect to the SSL port and run the handshake, offering the
+     * session from the previous connection (if any). The session from
+     * this connection replace it.
+     *
+     * @param reused set to true if the server resumed the session
+     */
+    void handshake(bool& reused) {
+        const std::string host = "127.0.0.1:" + std::to_string(ssl_port);
+        BIO* bio = BIO_new_ssl_connect(ctx);
+        ASSERT_NE(nullptr, bio);
+        BIO_set_conn_hostname(bio, host.c_str());
+        SSL* ssl = nullptr;
+        BIO_get_ssl(bio, &ssl);
+        ASSERT_NE(nullptr, ssl);
+        if (session != nullptr) {
+            SSL_set_session(ssl, session);
+            SSL_SESSION_free(session);
+            session = nullptr;
+        }
+
+        ASSERT_GT(BIO_do_connect(bio), 0);
+        ASSERT_GT(BIO_do_handshake(bio), 0);
+        reused = SSL_session_reused(ssl) != 0;
+        session = SSL_get1_session(ssl);
+
+        // The session can't be resumed unless it is shut down cleanly
+        SSL_shutdown(ssl);
+        BIO_free_all(bio);
+    }
+
+    uint64_t getStat(const char* name) {
+        return extract_single_stat(request_stats(), name);
+    }
+
+    /**
+     * Update the configuration of the server. The settings which aren't
+     * in the configuration keep their current value, so the tests must
+     * restore the default value before they remove the entry.
+     */
+    void setConfig(const char* name, cJSON* value) {
+        cJSON_DeleteItemFromObject(memcached_cfg.get(), name);
+        cJSON_AddItemToObject(memcached_cfg.get(), name, value);
+        reconfigure();
+    }
+
+    void restoreConfig(const char* name, cJSON* value) {
+        setConfig(name, value);
+        cJSON_DeleteItemFromObject(memcached_cfg.get(), name);
+    }
+
+    SSL_CTX* ctx = nullptr;
+    SSL_SESSION* session = nullptr;
+};
+
+TEST_F(SslHandshakeTest, SessionIsResumed) {
+    const auto handshakes = getStat("ssl_handshakes");
+    const auto resumptions = getStat("ssl_resumptions");
+
+    bool reused;
+    handshake(reused);
+    EXPECT_FALSE(reused);
+    handshake(reused);
+    EXPECT_TRUE(reused);
+    handshake(reused);
+    EXPECT_TRUE(reused);
+
+    EXPECT_EQ(handshakes + 1, getStat("ssl_handshakes"));
+    EXPECT_EQ(resumptions + 2, getStat("ssl_resumptions"));
+}
+
+TEST_F(SslHandshakeTest, DisabledSessionCache) {
+    setConfig("ssl_session_cache_size", cJSON_CreateNumber(0));
+
+    bool reused;
+    handshake(reused);
+    EXPECT_FALSE(reused);
+    handshake(reused);
+    EXPECT_FALSE(reused);
+
+    restoreConfig("ssl_session_cache_size", cJSON_CreateNumber(20480));
+}
+
+TEST_F(SslHandshakeTest, ChangedCipherListInvalidatesSessions) {
+    bool reused;
+    handshake(reused);
+    handshake(reused);
+    EXPECT_TRUE(reused);
+
+    // The new context doesn't know about the sessions from the old one
+    setConfig("ssl_cipher_list", cJSON_CreateString("HIGH"));
+    handshake(reused);
+    EXPECT_FALSE(reused);
+    handshake(reused);
+    EXPECT_TRUE(reused);
+
+    restoreConfig("ssl_cipher_list", cJSON_CreateString(""));
+}
+
+TEST_F(SslHandshakeTest, InlineHandshake) {
+    setConfig("ssl_handshake_offload", cJSON_CreateFalse());
+
+    const auto handshakes = getStat("ssl_handshakes");
+    bool reused;
+    handshake(reused);
+    EXPECT_FALSE(reused);
+    handshake(reused);
+    EXPECT_TRUE(reused);
+    EXPECT_EQ(handshakes + 1, getStat("ssl_handshakes"));
+
+    restoreConfig("ssl_handshake_offload", cJSON_CreateTrue());
+}
+
+TEST_F(SslHandshakeTest, HandshakeHistograms) {
+    bool reused;
+    handshake(reused);
+    handshake(reused);
+
+    const std::string group("ssl_handshake");
+    std::vector<char> buffer(64 * 1024);
+    const size_t len = mcbp_raw_command(buffer.data(), buffer.size(),
+                                        PROTOCOL_BINARY_CMD_STAT,
+                                        group.data(), group.size(),
+                                        NULL, 0);
+    safe_send(buffer.data(), len, false);
+    ASSERT_TRUE(safe_recv_packet(buffer.data(), buffer.size()));
+    auto* response =
+        reinterpret_cast<protocol_binary_response_no_extras*>(buffer.data());
+    mcbp_validate_response_header(response, PROTOCOL_BINARY_CMD_STAT,
+                                  PROTOCOL_BINARY_RESPONSE_SUCCESS);
+    const auto& header = response->message.header.response;
+    const char* value = buffer.data() + sizeof(*response) + header.extlen +
+                        ntohs(header.keylen);
+    const size_t vallen = ntohl(header.bodylen) - header.extlen -
+                          ntohs(header.keylen);
+    unique_cJSON_ptr json(cJSON_Parse(std::string(value, vallen).c_str()));
+    ASSERT_NE(nullptr, json.get());
+    EXPECT_NE(nullptr, cJSON_GetObjectItem(json.get(), "full"));
+    EXPECT_NE(nullptr, cJSON_GetObjectItem(json.get(), "resumed"));
+
+    // Read the terminating packet
+    ASSERT_TRUE(safe_recv_packet(buffer.data(), buffer.size()));
+}
+
+TEST_F(SslHandshakeTest, CloseDuringHandshake) {
+    // Send the ClientHello and close the connection while the server
+    // is running the handshake, so that the connection is closed while
+    // it is queued in the pending io list of the worker thread.
+    for (int ii = 0; ii < 100; ++ii) {
+        SSL* ssl = SSL_new(ctx);
+        ASSERT_NE(nullptr, ssl);
+        BIO* rbio = BIO_new(BIO_s_mem());
+        BIO* wbio = BIO_new(BIO_s_mem());
+        SSL_set_bio(ssl, rbio, wbio);
+        ASSERT_EQ(-1, SSL_connect(ssl));
+
+        char* hello;
+        const long len = BIO_get_mem_data(wbio, &hello);
+        ASSERT_GT(len, 0);
+
+        SOCKET sfd = connect_to_server_plain(ssl_port);
+        ASSERT_NE(INVALID_SOCKET, sfd);
+        EXPECT_EQ(len, ::send(sfd, hello, len, 0));
+        closesocket(sfd);
+        SSL_free(ssl);
+    }
+
+    // The server should still be serving the clients
+    bool reused;
+    handshake(reused);
+    EXPECT_FALSE(reused);
+}
@@ -0,0 +1,234 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Performance tests for sending responses over TLS.
+ *
+ * The server coalesces the iovecs of a response into full TLS records
+ * (instead of one record per iovec), which reduces the number of bytes
+ * on the wire and the number of encryptions per operation for small
+ * responses. Run for both the plain and the SSL transport so that the
+ * numbers may be compared.
+ *
+ * Test groups:
+ * - SmallGet: Run a GET of a small document 10,000 times over a single
+ *             connection.
+ * - PipelinedGet: Send 100 GETs before reading any of the responses (so
+ *                 that the responses are sent together), repeated 100 times.
+ * - LargeGet: Run a GET of a 512kB document 100 times.
+ *
+ * Properties recorded:
+ * - us_per_op: Wall clock time per operation.
+ * - wire_bytes_per_op: The number of bytes received per operation
+ *                      (including the TLS records). SSL only.
+ * - records_per_op: The number of TLS records written by the server per
+ *                   operation. SSL only.
+ * - server_cpu_us_per_op: The CPU time used by the memcached process per
+ *                         operation. Only when the server runs as a
+ *                         separate process on Linux.
+ */
+
+#include "testapp.h"
+#include "testapp_binprot.h"
+
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <vector>
+
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+class TlsPerfTest : public McdTestappTest {
+protected:
+    /**
+     * Get the CPU time (in microseconds) used by the server process so
+     * far, or -1 if it isn't available
+     */
+    static double getServerCpuUsec() {
+#ifdef __linux__
+        if (server_pid == pid_t(-1)) {
+            return -1;
+        }
+        std::ifstream file("/proc/" + std::to_string(server_pid) + "/stat");
+        std::string content((std::istreambuf_iterator<char>(file)),
+                            std::istreambuf_iterator<char>());
+        // The command name may contain spaces, so start after it
+        const auto pos = content.rfind(')');
+        if (pos == std::string::npos) {
+            return -1;
+        }
+        std::istringstream fields(content.substr(pos + 2));
+        // state is field 3, utime and stime are field 14 and 15
+        std::string field;
+        for (int ii = 3; ii < 14; ++ii) {
+            fields >> field;
+        }
+        unsigned long long utime = 0, stime = 0;
+        fields >> utime >> stime;
+        return double(utime + stime) * 1000000 / sysconf(_SC_CLK_TCK);
+#else
+        return -1;
+#endif
+    }
+
+    /**
+     * Get the number of TLS records the server has written on the SSL
+     * connection. The stats are fetched over a plain connection so that
+     * the stats responses don't add to the count.
+     */
+    static uint64_t getRecordsWritten() {
+        const std::string suffix = ":" + std::to_string(get_ssl_local_port());
+        auto& conn = connectionMap.getConnection(Protocol::Memcached, false);
+        conn.reconnect();
+        const auto stats = conn.stats("connections");
+        for (auto* entry = stats->child; entry != nullptr; entry = entry->next) {
+            if (entry->type != cJSON_String) {
+                continue;
+            }
+            unique_cJSON_ptr json(cJSON_Parse(entry->valuestring));
+            if (json.get() == nullptr) {
+                continue;
+            }
+            auto* peer = cJSON_GetObjectItem(json.get(), "peername");
+            if (peer == nullptr || peer->type != cJSON_String) {
+                continue;
+            }
+            const std::string peername(peer->valuestring);
+            if (peername.size() <= suffix.size() ||
+                peername.compare(peername.size() - suffix.size(),
+                                 suffix.size(), suffix) != 0) {
+                continue;
+            }
+            auto* ssl = cJSON_GetObjectItem(json.get(), "ssl");
+            auto* records = ssl == nullptr ? nullptr :
+                            cJSON_GetObjectItem(ssl, "records_written");
+            if (records != nullptr && records->type == cJSON_Number) {
+                return uint64_t(records->valuedouble);
+            }
+        }
+        ADD_FAILURE() << "Failed to locate the SSL connection in "
+                      << "stats connections";
+        return 0;
+    }
+
+    /**
+     * Run the function (which performs ops operations) and record the
+     * properties for the test (us_per_op is recorded by ::measure).
+     * Returns the number of TLS records written per operation (0 for
+     * the plain transport).
+     */
+    template <typename Function>
+    double measure(size_t ops, Function function) {
+        const bool ssl = GetParam() == Transport::SSL;
+        const auto records_start = ssl ? getRecordsWritten() : 0;
+        const auto wire_start = get_ssl_bytes_received();
+        const auto cpu_start = getServerCpuUsec();
+
+        ::measure(ops, function);
+
+        const auto cpu_end = getServerCpuUsec();
+        const auto wire_end = get_ssl_bytes_received();
+        const auto records_end = ssl ? getRecordsWritten() : 0;
+
+        const double records = double(records_end - records_start) / ops;
+        if (ssl) {
+            RecordProperty("wire_bytes_per_op",
+                           std::to_string(double(wire_end - wire_start) /
+                                          ops));
+            RecordProperty("records_per_op", std::to_string(records));
+        }
+        if (cpu_start >= 0 && cpu_end >= 0) {
+            RecordProperty("server_cpu_us_per_op",
+                           std::to_string((cpu_end - cpu_start) / ops));
+        }
+        return records;
+    }
+
+    void runGets(const std::string& key, size_t iterations,
+                 size_t pipeline, const std::string& value) {
+        std::vector<char> command(1024);
+        const size_t len = mcbp_raw_command(command.data(), command.size(),
+                                            PROTOCOL_BINARY_CMD_GET,
+                                            key.data(), key.size(), NULL, 0);
+        std::vector<char> send;
+        for (size_t ii = 0; ii < pipeline; ++ii) {
+            send.insert(send.end(), command.data(), command.data() + len);
+        }
+
+        std::vector<char> receive(value.size() + 1024);
+        auto* response =
+            reinterpret_cast<protocol_binary_response_no_extras*>(receive.data());
+        for (size_t ii = 0; ii < iterations; ++ii) {
+            safe_send(send.data(), send.size(), false);
+            for (size_t jj = 0; jj < pipeline; ++jj) {
+                ASSERT_TRUE(safe_recv_packet(receive.data(), receive.size()));
+                mcbp_validate_response_header(response,
+                                              PROTOCOL_BINARY_CMD_GET,
+                                              PROTOCOL_BINARY_RESPONSE_SUCCESS);
+            }
+        }
+
+        // Verify that the content survived being split into records
+        const auto* val = receive.data() + sizeof(*response) +
+                          response->message.header.response.extlen;
+        ASSERT_EQ(value, std::string(val, value.size()));
+    }
+};
+
+INSTANTIATE_TEST_CASE_P(TlsTransport,
+                        TlsPerfTest,
+                        ::testing::Values(Transport::Plain, Transport::SSL),
+                        ::testing::PrintToStringParamName());
+
+TEST_P(TlsPerfTest, SmallGet_10k) {
+    const std::string key("TlsPerfTest_SmallGet");
+    const std::string value("value");
+    store_object(key.c_str(), value.c_str());
+    const auto records = measure(10000, [this, &key, &value]() {
+        runGets(key, 10000, 1, value);
+    });
+    if (GetParam() == Transport::SSL) {
+        // The header, key and value of each response go in a single record
+        EXPECT_EQ(1.0, records);
+    }
+    delete_object(key.c_str());
+}
+
+TEST_P(TlsPerfTest, PipelinedGet_100x100) {
+    const std::string key("TlsPerfTest_PipelinedGet");
+    const std::string value("value");
+    store_object(key.c_str(), value.c_str());
+    measure(10000, [this, &key, &value]() {
+        runGets(key, 100, 100, value);
+    });
+    delete_object(key.c_str());
+}
+
+TEST_P(TlsPerfTest, LargeGet_100) {
+    const std::string key("TlsPerfTest_LargeGet");
+    std::string value(512 * 1024, 'x');
+    for (size_t ii = 0; ii < value.size(); ii += 4096) {
+        value[ii] = char('a' + (ii / 4096) % 26);
+    }
+    store_object(key.c_str(), value.c_str());
+    measure(100, [this, &key, &value]() {
+        runGets(key, 100, 1, value);
+    });
+    delete_object(key.c_str());
+}
@@ -0,0 +1,160 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Tests for Unix domain socket listeners ("path" and "permissions" in
+ * the "interfaces" entries).
+ *
+ * The server is started with an extra interface listening on a Unix
+ * domain socket in the current directory. The functional tests run
+ * the usual MCBP commands over it, and UnixSocketPerfTest compares it
+ * with loopback TCP.
+ *
+ * Properties recorded by the perf tests:
+ * - us_per_op: Wall clock time per operation.
+ */
+
+#include "testapp_unix_socket.h"
+#include "testapp_binprot.h"
+
+#include <vector>
+
+#ifndef WIN32
+std::string UnixSocketTest::unix_path;
+
+TEST_F(UnixSocketTest, SocketPermissions) {
+    struct stat st;
+    ASSERT_EQ(0, lstat(unix_path.c_str(), &st));
+    EXPECT_TRUE(S_ISSOCK(st.st_mode));
+    EXPECT_EQ(0660, st.st_mode & 0777);
+}
+
+TEST_F(UnixSocketTest, GetSet) {
+    const std::string key("UnixSocketTest_GetSet");
+    store_object(key.c_str(), "value");
+    validate_object(key.c_str(), "value");
+    delete_object(key.c_str());
+}
+
+TEST_F(UnixSocketTest, SaslAndSelectBucket) {
+    ASSERT_EQ(PROTOCOL_BINARY_RESPONSE_SUCCESS,
+              sasl_auth("_admin", "password"));
+
+    union {
+        protocol_binary_request_no_extras request;
+        protocol_binary_response_no_extras response;
+        char bytes[1024];
+    } buffer;
+    const size_t len = mcbp_raw_command(buffer.bytes, sizeof(buffer.bytes),
+                                        PROTOCOL_BINARY_CMD_SELECT_BUCKET,
+                                        "default", strlen("default"),
+                                        NULL, 0);
+    safe_send(buffer.bytes, len, false);
+    ASSERT_TRUE(safe_recv_packet(buffer.bytes, sizeof(buffer.bytes)));
+    mcbp_validate_response_header(&buffer.response,
+                                  PROTOCOL_BINARY_CMD_SELECT_BUCKET,
+                                  PROTOCOL_BINARY_RESPONSE_SUCCESS);
+
+    const std::string key("UnixSocketTest_SaslAndSelectBucket");
+    store_object(key.c_str(), "value");
+    validate_object(key.c_str(), "value");
+    delete_object(key.c_str());
+}
+
+TEST_F(UnixSocketTest, Hello) {
+    // TCPNODELAY is accepted (and ignored) for Unix domain sockets
+    set_datatype_feature(true);
+    set_mutation_seqno_feature(true);
+    set_unordered_execution_feature(true);
+
+    const std::string key("UnixSocketTest_Hello");
+    store_object(key.c_str(), "value");
+    validate_object(key.c_str(), "value");
+    delete_object(key.c_str());
+}
+
+TEST_F(UnixSocketTest, ConnectionStats) {
+    auto stats = request_stats();
+    const std::string key = "curr_conns_on_unix_" + unix_path;
+    // The listen socket and this connection
+    EXPECT_LE(2, extract_single_stat(stats, key.c_str()));
+}
+
+class UnixSocketPerfTest : public UnixSocketTest {
+protected:
+    void runGets(const std::string& key, size_t iterations, size_t pipeline) {
+        char command[1024];
+        const size_t len = mcbp_raw_command(command, sizeof(command),
+                                            PROTOCOL_BINARY_CMD_GET,
+                                            key.data(), key.size(), NULL, 0);
+        std::vector<char> send;
+        for (size_t ii = 0; ii < pipeline; ++ii) {
+            send.insert(send.end(), command, command + len);
+        }
+
+        union {
+            protocol_binary_response_no_extras response;
+            char bytes[1024];
+        } receive;
+        for (size_t ii = 0; ii < iterations; ++ii) {
+            safe_send(send.data(), send.size(), false);
+            for (size_t jj = 0; jj < pipeline; ++jj) {
+                ASSERT_TRUE(safe_recv_packet(receive.bytes,
+                                             sizeof(receive.bytes)));
+                mcbp_validate_response_header(&receive.response,
+                                              PROTOCOL_BINARY_CMD_GET,
+                                              PROTOCOL_BINARY_RESPONSE_SUCCESS);
+            }
+        }
+    }
+
+    /**
+     * Run the gets over the Unix domain socket, or over loopback TCP
+     */
+    void run(bool tcp, size_t iterations, size_t pipeline) {
+        const std::string key("UnixSocketPerfTest");
+        store_object(key.c_str(), "value");
+
+        const SOCKET unix_sock = sock;
+        if (tcp) {
+            sock = tcp_sock;
+        }
+        measure(iterations * pipeline, [this, &key, iterations, pipeline]() {
+            runGets(key, iterations, pipeline);
+        });
+        sock = unix_sock;
+
+        delete_object(key.c_str());
+    }
+};
+
+TEST_F(UnixSocketPerfTest, SmallGet_10k_Unix) {
+    run(false, 10000, 1);
+}
+
+TEST_F(UnixSocketPerfTest, SmallGet_10k_Tcp) {
+    run(true, 10000, 1);
+}
+
+TEST_F(UnixSocketPerfTest, PipelinedGet_100x100_Unix) {
+    run(false, 100, 100);
+}
+
+TEST_F(UnixSocketPerfTest, PipelinedGet_100x100_Tcp) {
+    run(true, 100, 100);
+}
+#endif
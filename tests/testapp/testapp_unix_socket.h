@@ -0,0 +1,113 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+#pragma once
+
+#include "testapp.h"
+
+#include <functional>
+#include <string>
+
+#ifndef WIN32
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/**
+ * Runs the server with an extra interface listening on a Unix domain
+ * socket in the current directory, and runs the tests over a connection
+ * to it (the global sock). The TCP connection is kept in tcp_sock.
+ */
+class UnixSocketTest : public TestappTest {
+public:
+    static void SetUpTestCase() {
+        startServer([](cJSON*) {});
+    }
+
+    /**
+     * Start the server with the extra interface
+     *
+     * @param configure called to make further changes to the
+     *                  configuration before the server is started
+     */
+    static void startServer(std::function<void(cJSON*)> configure) {
+        unix_path = "memcached_unix." + std::to_string(getpid()) + ".sock";
+        memcached_cfg.reset(generate_config(0));
+
+        cJSON* obj = cJSON_CreateObject();
+        cJSON_AddStringToObject(obj, "path", unix_path.c_str());
+        cJSON_AddStringToObject(obj, "permissions", "0660");
+        cJSON_AddNumberToObject(obj, "maxconn", MAX_CONNECTIONS);
+        cJSON_AddNumberToObject(obj, "backlog", BACKLOG);
+        cJSON_AddStringToObject(obj, "protocol", "memcached");
+        cJSON_AddItemToArray(cJSON_GetObjectItem(memcached_cfg.get(),
+                                                 "interfaces"), obj);
+        configure(memcached_cfg.get());
+
+        start_memcached_server(memcached_cfg.get());
+        if (HasFailure()) {
+            server_pid = reinterpret_cast<pid_t>(-1);
+        } else {
+            CreateTestBucket();
+        }
+    }
+
+    static void TearDownTestCase() {
+        TestappTest::TearDownTestCase();
+        // The server removes the socket when it shuts down
+        struct stat st;
+        EXPECT_EQ(-1, lstat(unix_path.c_str(), &st));
+    }
+
+protected:
+    void SetUp() override {
+        TestappTest::SetUp();
+        tcp_sock = sock;
+        sock = connect_to_unix_socket();
+        ASSERT_NE(INVALID_SOCKET, sock);
+    }
+
+    void TearDown() override {
+        closesocket(sock);
+        sock = tcp_sock;
+        TestappTest::TearDown();
+    }
+
+    static SOCKET connect_to_unix_socket() {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, unix_path.c_str(), sizeof(addr.sun_path) - 1);
+
+        SOCKET ret = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (ret == INVALID_SOCKET) {
+            ADD_FAILURE() << "Failed to create socket: " << strerror(errno);
+            return INVALID_SOCKET;
+        }
+        if (connect(ret, reinterpret_cast<struct sockaddr*>(&addr),
+                    sizeof(addr)) == SOCKET_ERROR) {
+            ADD_FAILURE() << "Failed to connect to " << unix_path << ": "
+                          << strerror(errno);
+            closesocket(ret);
+            return INVALID_SOCKET;
+        }
+        return ret;
+    }
+
+    static std::string unix_path;
+    SOCKET tcp_sock;
+};
+#endif
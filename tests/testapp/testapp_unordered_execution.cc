@@ -0,0 +1,271 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Tests for connections using unordered execution (the client enabled
+ * PROTOCOL_BINARY_FEATURE_UNORDERED_EXECUTION through HELLO).
+ *
+ * The ewouldblock_engine is configured to delay each command by a random
+ * time, so that the commands on a connection complete out of order when
+ * the feature is enabled.
+ *
+ * Performance test groups (run with and without the feature enabled):
+ * - Pipeline: Send 16 GETs before reading any of the responses, and
+ *             record the time until each of the responses arrive.
+ *             Repeated 500 times, and the 50th and 99th percentile is
+ *             recorded as the properties "p50_us" and "p99_us" in the
+ *             test result.
+ */
+
+#include "testapp.h"
+#include "testapp_binprot.h"
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+/**
+ * Send a GET for the key for each of the opaques, followed by a NOOP,
+ * and return the opaques in the order the responses arrived. The NOOP
+ * must be the last response as it waits for all of the commands before
+ * it to complete.
+ */
+static std::vector<uint32_t> pipeline_get(const std::string& key,
+                                          uint32_t count) {
+    std::vector<char> send;
+    for (uint32_t ii = 0; ii < count; ++ii) {
+        char buffer[1024];
+        const size_t len = mcbp_raw_command(buffer, sizeof(buffer),
+                                            PROTOCOL_BINARY_CMD_GET,
+                                            key.data(), key.size(), NULL, 0);
+        auto* req = reinterpret_cast<protocol_binary_request_header*>(buffer);
+        req->request.opaque = ii;
+        send.insert(send.end(), buffer, buffer + len);
+    }
+
+    char noop[1024];
+    const size_t nooplen = mcbp_raw_command(noop, sizeof(noop),
+                                            PROTOCOL_BINARY_CMD_NOOP,
+                                            NULL, 0, NULL, 0);
+    send.insert(send.end(), noop, noop + nooplen);
+    safe_send(send.data(), send.size(), false);
+
+    union {
+        protocol_binary_response_no_extras response;
+        char bytes[1024];
+    } receive;
+    std::vector<uint32_t> ret;
+    for (uint32_t ii = 0; ii < count; ++ii) {
+        EXPECT_TRUE(safe_recv_packet(receive.bytes, sizeof(receive.bytes)));
+        mcbp_validate_response_header(&receive.response,
+                                      PROTOCOL_BINARY_CMD_GET,
+                                      PROTOCOL_BINARY_RESPONSE_SUCCESS);
+        ret.push_back(receive.response.message.header.response.opaque);
+    }
+
+    EXPECT_TRUE(safe_recv_packet(receive.bytes, sizeof(receive.bytes)));
+    mcbp_validate_response_header(&receive.response,
+                                  PROTOCOL_BINARY_CMD_NOOP,
+                                  PROTOCOL_BINARY_RESPONSE_SUCCESS);
+    return ret;
+}
+
+class UnorderedExecutionTest : public TestappTest {
+};
+
+TEST_F(UnorderedExecutionTest, ResponsesInOrderWithoutFeature) {
+    const std::string key("UnorderedExecutionTest");
+    store_object(key.c_str(), "value");
+
+    ewouldblock_engine_configure(ENGINE_EWOULDBLOCK,
+                                 EWBEngineMode::RandomDelay, 1000);
+    auto opaques = pipeline_get(key, 32);
+    for (uint32_t ii = 0; ii < opaques.size(); ++ii) {
+        EXPECT_EQ(ii, opaques[ii]);
+    }
+
+    ewouldblock_engine_disable();
+    delete_object(key.c_str());
+}
+
+TEST_F(UnorderedExecutionTest, ResponsesMatchedByOpaque) {
+    const std::string key("UnorderedExecutionTest");
+    store_object(key.c_str(), "value");
+
+    set_unordered_execution_feature(true);
+    ewouldblock_engine_configure(ENGINE_EWOULDBLOCK,
+                                 EWBEngineMode::RandomDelay, 10000);
+    auto opaques = pipeline_get(key, 32);
+
+    // Every command gets exactly one response, but not necessarily in
+    // the order they were sent
+    std::sort(opaques.begin(), opaques.end());
+    ASSERT_EQ(32u, opaques.size());
+    for (uint32_t ii = 0; ii < opaques.size(); ++ii) {
+        EXPECT_EQ(ii, opaques[ii]);
+    }
+
+    ewouldblock_engine_disable();
+    delete_object(key.c_str());
+}
+
+TEST_F(UnorderedExecutionTest, DisableFeature) {
+    const std::string key("UnorderedExecutionTest");
+    store_object(key.c_str(), "value");
+
+    set_unordered_execution_feature(true);
+    set_unordered_execution_feature(false);
+    ewouldblock_engine_configure(ENGINE_EWOULDBLOCK,
+                                 EWBEngineMode::RandomDelay, 1000);
+    auto opaques = pipeline_get(key, 32);
+    for (uint32_t ii = 0; ii < opaques.size(); ++ii) {
+        EXPECT_EQ(ii, opaques[ii]);
+    }
+
+    ewouldblock_engine_disable();
+    delete_object(key.c_str());
+}
+
+TEST_F(UnorderedExecutionTest, StoreResumedWhileParked) {
+    // Each SET is suspended (in allocate and store) and parked while
+    // the following ones execute, so it has to locate its packet again
+    // when it is resumed
+    set_unordered_execution_feature(true);
+    ewouldblock_engine_configure(ENGINE_EWOULDBLOCK,
+                                 EWBEngineMode::RandomDelay, 10000);
+
+    std::vector<char> send;
+    for (uint32_t ii = 0; ii < 16; ++ii) {
+        const std::string key = "UnorderedExecutionTest_" + std::to_string(ii);
+        const std::string value = "value" + std::to_string(ii);
+        char buffer[1024];
+        const size_t len = mcbp_storage_command(buffer, sizeof(buffer),
+                                                PROTOCOL_BINARY_CMD_SET,
+                                                key.data(), key.size(),
+                                                value.data(), value.size(),
+                                                0, 0);
+        auto* req = reinterpret_cast<protocol_binary_request_header*>(buffer);
+        req->request.opaque = ii;
+        send.insert(send.end(), buffer, buffer + len);
+    }
+    safe_send(send.data(), send.size(), false);
+
+    union {
+        protocol_binary_response_no_extras response;
+        char bytes[1024];
+    } receive;
+    for (uint32_t ii = 0; ii < 16; ++ii) {
+        ASSERT_TRUE(safe_recv_packet(receive.bytes, sizeof(receive.bytes)));
+        mcbp_validate_response_header(&receive.response,
+                                      PROTOCOL_BINARY_CMD_SET,
+                                      PROTOCOL_BINARY_RESPONSE_SUCCESS);
+    }
+
+    ewouldblock_engine_disable();
+    for (uint32_t ii = 0; ii < 16; ++ii) {
+        const std::string key = "UnorderedExecutionTest_" + std::to_string(ii);
+        validate_object(key.c_str(), "value" + std::to_string(ii));
+        delete_object(key.c_str());
+    }
+}
+
+TEST_F(UnorderedExecutionTest, CloseWithParkedCommands) {
+    const std::string key("UnorderedExecutionTest");
+    store_object(key.c_str(), "value");
+
+    // Disconnect while the engine still holds the cookies for the
+    // commands. The server must wait for the notifications before it
+    // releases the connection.
+    const SOCKET main_sock = sock;
+    sock = connect_to_server_plain(port);
+    ASSERT_NE(INVALID_SOCKET, sock);
+    set_unordered_execution_feature(true);
+    ewouldblock_engine_configure(ENGINE_EWOULDBLOCK,
+                                 EWBEngineMode::RandomDelay, 100000);
+
+    char buffer[1024];
+    const size_t len = mcbp_raw_command(buffer, sizeof(buffer),
+                                        PROTOCOL_BINARY_CMD_GET,
+                                        key.data(), key.size(), NULL, 0);
+    for (int ii = 0; ii < 16; ++ii) {
+        safe_send(buffer, len, false);
+    }
+    closesocket(sock);
+    sock = main_sock;
+
+    // The server should still be operational
+    validate_object(key.c_str(), "value");
+    delete_object(key.c_str());
+}
+
+class UnorderedExecutionPerfTest : public TestappTest {
+protected:
+    void runPipeline(int iterations) {
+        const std::string key("UnorderedExecutionPerfTest");
+        store_object(key.c_str(), "value");
+        ewouldblock_engine_configure(ENGINE_EWOULDBLOCK,
+                                     EWBEngineMode::RandomDelay, 1000);
+
+        char buffer[1024];
+        const size_t len = mcbp_raw_command(buffer, sizeof(buffer),
+                                            PROTOCOL_BINARY_CMD_GET,
+                                            key.data(), key.size(), NULL, 0);
+        std::vector<char> send;
+        for (int ii = 0; ii < 16; ++ii) {
+            send.insert(send.end(), buffer, buffer + len);
+        }
+
+        union {
+            protocol_binary_response_no_extras response;
+            char bytes[1024];
+        } receive;
+        std::vector<std::chrono::microseconds> latency;
+        latency.reserve(iterations * 16);
+
+        for (int ii = 0; ii < iterations; ++ii) {
+            const auto start = std::chrono::steady_clock::now();
+            safe_send(send.data(), send.size(), false);
+            for (int jj = 0; jj < 16; ++jj) {
+                ASSERT_TRUE(safe_recv_packet(receive.bytes,
+                                             sizeof(receive.bytes)));
+                mcbp_validate_response_header(&receive.response,
+                                              PROTOCOL_BINARY_CMD_GET,
+                                              PROTOCOL_BINARY_RESPONSE_SUCCESS);
+                latency.push_back(
+                    std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now() - start));
+            }
+        }
+
+        std::sort(latency.begin(), latency.end());
+        RecordProperty("p50_us", int(latency[latency.size() / 2].count()));
+        RecordProperty("p99_us",
+                       int(latency[latency.size() * 99 / 100].count()));
+
+        ewouldblock_engine_disable();
+        delete_object(key.c_str());
+    }
+};
+
+TEST_F(UnorderedExecutionPerfTest, Ordered_Pipeline16x500) {
+    runPipeline(500);
+}
+
+TEST_F(UnorderedExecutionPerfTest, Unordered_Pipeline16x500) {
+    set_unordered_execution_feature(true);
+    runPipeline(500);
+}
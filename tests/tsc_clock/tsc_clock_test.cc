@@ -0,0 +1,138 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2016 Couchbase, Inc.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Tests for the clock used for timing the commands. The tests pass with
+ * either of the clock sources; the one in use is recorded as the
+ * property "source".
+ *
+ * Benchmark (TscClockPerfTest): Read the clock 10M times and record the
+ * cost of each read as the property "ns_per_call", for both gethrtime()
+ * and tsc_clock_now().
+ */
+#include <daemon/tsc_clock.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+class TscClockTest : public ::testing::Test {
+protected:
+    static void SetUpTestCase() {
+        std::string reason;
+        if (!tsc_clock_init(reason)) {
+            std::cerr << "Using gethrtime(): " << reason << std::endl;
+        }
+    }
+
+    void SetUp() override {
+        RecordProperty("source", tsc_clock_get_source());
+    }
+};
+
+TEST_F(TscClockTest, Source) {
+    const std::string source = tsc_clock_get_source();
+    if (tsc_clock_params.enabled) {
+        EXPECT_EQ("tsc", source);
+        EXPECT_LE(100000000u, tsc_clock_params.frequency);
+    } else {
+        EXPECT_EQ("gethrtime", source);
+    }
+}
+
+TEST_F(TscClockTest, Monotonic) {
+    hrtime_t prev = tsc_clock_now();
+    for (int ii = 0; ii < 1000000; ++ii) {
+        const hrtime_t now = tsc_clock_now();
+        ASSERT_LE(prev, now);
+        prev = now;
+    }
+}
+
+TEST_F(TscClockTest, MonotonicBetweenThreads) {
+    // A timestamp taken in one thread is compared with the time in
+    // another thread (possibly on another CPU) when it is handed over
+    std::vector<std::thread> threads;
+    std::atomic<hrtime_t> last(tsc_clock_now());
+    std::atomic<bool> backwards(false);
+    for (int ii = 0; ii < 4; ++ii) {
+        threads.emplace_back([&last, &backwards]() {
+            for (int jj = 0; jj < 100000; ++jj) {
+                const hrtime_t prev = last.load();
+                const hrtime_t now = tsc_clock_now();
+                if (now < prev) {
+                    backwards = true;
+                }
+                hrtime_t expected = prev;
+                last.compare_exchange_strong(expected, now);
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    EXPECT_FALSE(backwards.load());
+}
+
+TEST_F(TscClockTest, MatchesGethrtime) {
+    const hrtime_t start_ns = gethrtime();
+    const hrtime_t start = tsc_clock_now();
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    const hrtime_t elapsed = tsc_clock_now() - start;
+    const hrtime_t elapsed_ns = gethrtime() - start_ns;
+
+    // Within 5%. The two clocks aren't read at the same time, and the
+    // thread may be preempted between the reads on a loaded machine.
+    EXPECT_LE(elapsed_ns - elapsed_ns / 20, elapsed);
+    EXPECT_GE(elapsed_ns + elapsed_ns / 20, elapsed);
+}
+
+class TscClockPerfTest : public ::testing::Test {
+protected:
+    static void SetUpTestCase() {
+        std::string reason;
+        tsc_clock_init(reason);
+    }
+
+    template <typename Clock>
+    void run(Clock clock) {
+        const int iterations = 10000000;
+        hrtime_t sum = 0;
+        const auto start = std::chrono::steady_clock::now();
+        for (int ii = 0; ii < iterations; ++ii) {
+            sum += clock();
+        }
+        const auto elapsed = std::chrono::duration_cast<
+            std::chrono::nanoseconds>(std::chrono::steady_clock::now() -
+                                      start);
+        EXPECT_NE(0u, sum);
+        RecordProperty("source", tsc_clock_get_source());
+        RecordProperty("ns_per_call",
+                       std::to_string(double(elapsed.count()) / iterations));
+    }
+};
+
+TEST_F(TscClockPerfTest, Gethrtime_10M) {
+    run([]() { return gethrtime(); });
+}
+
+TEST_F(TscClockPerfTest, TscClockNow_10M) {
+    run([]() { return tsc_clock_now(); });
+}
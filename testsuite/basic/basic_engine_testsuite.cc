@@ -23,6 +23,7 @@
 #include "basic_engine_testsuite.h"
 
 #include <iostream>
+#include <map>
 #include <vector>
 #include <sstream>
 
@@ -959,6 +960,380 @@ static enum test_result test_bucket_destroy_interleaved(engine_test_t *test) {
     return SUCCESS;
 }
 
+static void store_scan_key(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1,
+                           const std::string& key, uint32_t flags,
+                           rel_time_t exptime) {
+    item *test_item = NULL;
+    uint64_t cas = 0;
+    cb_assert(h1->allocate(h, NULL, &test_item, key.data(), key.size(), 5,
+                           flags, exptime,
+                           PROTOCOL_BINARY_RAW_BYTES) == ENGINE_SUCCESS);
+    cb_assert(h1->store(h, NULL, test_item, &cas, OPERATION_SET,
+                        0) == ENGINE_SUCCESS);
+    h1->release(h, NULL, test_item);
+}
+
+struct scan_result {
+    uint32_t flags;
+    uint32_t nbytes;
+    uint64_t cas;
+    size_t visits;
+};
+
+static void scan_test_callback(const item_info* info, void* ctx) {
+    auto* keys = static_cast<std::map<std::string, scan_result>*>(ctx);
+    cb_assert(info->nvalue == 0);
+    std::string key(static_cast<const char*>(info->key), info->nkey);
+    auto& result = (*keys)[key];
+    result.flags = info->flags;
+    result.nbytes = info->nbytes;
+    result.cas = info->cas;
+    result.visits++;
+}
+
+/* Run a scan to completion and return the number of batches */
+static size_t scan_all(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1,
+                       const std::string& prefix, uint32_t count,
+                       std::map<std::string, scan_result>& keys) {
+    uint64_t cursor = 0;
+    size_t batches = 0;
+    do {
+        cb_assert(h1->scan(h, NULL, &cursor, prefix.data(),
+                           uint16_t(prefix.size()), count,
+                           scan_test_callback, &keys) == ENGINE_SUCCESS);
+        ++batches;
+    } while (cursor != 0);
+    return batches;
+}
+
+/*
+ * Make sure that a scan visits all of the keys, in more than one batch
+ */
+static enum test_result scan_test(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    const int nkeys = 1000;
+    for (int ii = 0; ii < nkeys; ++ii) {
+        store_scan_key(h, h1, "scan_test_" + std::to_string(ii), ii, 0);
+    }
+
+    std::map<std::string, scan_result> keys;
+    cb_assert(scan_all(h, h1, "", 100, keys) > 1);
+    for (int ii = 0; ii < nkeys; ++ii) {
+        auto iter = keys.find("scan_test_" + std::to_string(ii));
+        cb_assert(iter != keys.end());
+        assert_equal(uint32_t(ii), iter->second.flags);
+        assert_equal(5u, iter->second.nbytes);
+        cb_assert(iter->second.cas != 0);
+    }
+    return SUCCESS;
+}
+
+/*
+ * Make sure that a scan only visits the keys starting with the prefix
+ */
+static enum test_result scan_prefix_test(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    for (int ii = 0; ii < 100; ++ii) {
+        store_scan_key(h, h1, "scan_prefix_a_" + std::to_string(ii), 0, 0);
+        store_scan_key(h, h1, "scan_prefix_b_" + std::to_string(ii), 0, 0);
+    }
+
+    std::map<std::string, scan_result> keys;
+    scan_all(h, h1, "scan_prefix_a_", 10, keys);
+    assert_equal(size_t(100), keys.size());
+    for (const auto& entry : keys) {
+        cb_assert(entry.first.compare(0, 14, "scan_prefix_a_") == 0);
+    }
+    return SUCCESS;
+}
+
+/*
+ * Make sure that a scan skips the items which are expired or flushed
+ */
+static enum test_result scan_expiry_test(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    store_scan_key(h, h1, "scan_expiry_expires", 0, 10);
+    store_scan_key(h, h1, "scan_expiry_stays", 0, 0);
+    test_harness.time_travel(11);
+
+    std::map<std::string, scan_result> keys;
+    scan_all(h, h1, "scan_expiry_", 10, keys);
+    assert_equal(size_t(1), keys.size());
+    cb_assert(keys.find("scan_expiry_stays") != keys.end());
+
+    cb_assert(h1->flush(h, NULL, 0) == ENGINE_SUCCESS);
+    keys.clear();
+    scan_all(h, h1, "scan_expiry_", 10, keys);
+    assert_equal(size_t(0), keys.size());
+    return SUCCESS;
+}
+
+/*
+ * Make sure that the keys which exist for the entire scan are visited
+ * even if the hash table grows in the middle of the scan
+ */
+static enum test_result scan_expand_test(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    const int nkeys = 1000;
+    for (int ii = 0; ii < nkeys; ++ii) {
+        store_scan_key(h, h1, "scan_expand_" + std::to_string(ii), 0, 0);
+    }
+
+    std::map<std::string, scan_result> keys;
+    uint64_t cursor = 0;
+    for (int ii = 0; ii < 3; ++ii) {
+        cb_assert(h1->scan(h, NULL, &cursor, "scan_expand_", 12, 100,
+                           scan_test_callback, &keys) == ENGINE_SUCCESS);
+    }
+    cb_assert(cursor != 0);
+
+    /* The table starts with 64k buckets and grows at 1.5 items per bucket */
+    for (int ii = 0; ii < 100000; ++ii) {
+        store_scan_key(h, h1, "scan_grow_" + std::to_string(ii), 0, 0);
+    }
+
+    while (cursor != 0) {
+        cb_assert(h1->scan(h, NULL, &cursor, "scan_expand_", 12, 100,
+                           scan_test_callback, &keys) == ENGINE_SUCCESS);
+    }
+
+    for (int ii = 0; ii < nkeys; ++ii) {
+        cb_assert(keys.find("scan_expand_" + std::to_string(ii)) != keys.end());
+    }
+    return SUCCESS;
+}
+
+/*
+ * Make sure that store_multi stores all of the items (in more than one
+ * chunk), and reports the status of each of them
+ */
+static enum test_result store_multi_test(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    const size_t nitems = 200;
+    std::vector<item*> items(nitems);
+    std::vector<ENGINE_ERROR_CODE> results(nitems, ENGINE_FAILED);
+
+    for (size_t ii = 0; ii < nitems; ++ii) {
+        const std::string key = "store_multi_" + std::to_string(ii);
+        cb_assert(h1->allocate(h, NULL, &items[ii], key.data(), key.size(), 1,
+                               0, 0,
+                               PROTOCOL_BINARY_RAW_BYTES) == ENGINE_SUCCESS);
+    }
+
+    cb_assert(h1->store_multi(h, NULL, items.data(), nitems, OPERATION_SET,
+                              results.data(), 0) == ENGINE_SUCCESS);
+    for (size_t ii = 0; ii < nitems; ++ii) {
+        assert_equal(ENGINE_SUCCESS, results[ii]);
+        h1->release(h, NULL, items[ii]);
+
+        const std::string key = "store_multi_" + std::to_string(ii);
+        item *check_item = NULL;
+        cb_assert(h1->get(h, NULL, &check_item, key.data(), int(key.size()),
+                          0) == ENGINE_SUCCESS);
+        h1->release(h, NULL, check_item);
+    }
+
+    /* ADD fails for the keys which exist */
+    cb_assert(h1->allocate(h, NULL, &items[0], "store_multi_0", 13, 1, 0, 0,
+                           PROTOCOL_BINARY_RAW_BYTES) == ENGINE_SUCCESS);
+    cb_assert(h1->store_multi(h, NULL, items.data(), 1, OPERATION_ADD,
+                              results.data(), 0) == ENGINE_SUCCESS);
+    assert_equal(ENGINE_NOT_STORED, results[0]);
+    h1->release(h, NULL, items[0]);
+    return SUCCESS;
+}
+
+static std::map<std::string, std::string> lease_stats;
+
+static void lease_stats_callback(const char *key, const uint16_t klen,
+                                 const char *val, const uint32_t vlen,
+                                 const void *cookie) {
+    lease_stats[std::string(key, klen)] = std::string(val, vlen);
+}
+
+static uint64_t get_lease_stat(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1,
+                               const char *name) {
+    lease_stats.clear();
+    cb_assert(h1->get_stats(h, NULL, NULL, 0,
+                            lease_stats_callback) == ENGINE_SUCCESS);
+    cb_assert(lease_stats.find(name) != lease_stats.end());
+    return std::stoull(lease_stats[name]);
+}
+
+static ENGINE_ERROR_CODE lease_refill(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1,
+                                      const char *key, uint64_t lease,
+                                      ENGINE_STORE_OPERATION operation) {
+    item *test_item = NULL;
+    uint64_t cas = 0;
+    ENGINE_ERROR_CODE ret;
+    cb_assert(h1->allocate(h, NULL, &test_item, key, strlen(key), 5, 0, 0,
+                           PROTOCOL_BINARY_RAW_BYTES) == ENGINE_SUCCESS);
+    h1->item_set_cas(h, NULL, test_item, lease);
+    ret = h1->store(h, NULL, test_item, &cas, operation, 0);
+    h1->release(h, NULL, test_item);
+    return ret;
+}
+
+/*
+ * Make sure that only the first miss gets a lease, and that the holder of
+ * the lease can refill the key with it
+ */
+static enum test_result lease_test(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    const char *key = "lease_test_key";
+    item *test_item = NULL;
+    uint64_t lease = 0;
+    uint64_t other = 0;
+    bool stale = true;
+
+    cb_assert(h1->get_lease(h, NULL, &test_item, key, (int)strlen(key), 0,
+                            &lease, &stale) == ENGINE_KEY_ENOENT);
+    cb_assert(lease != 0);
+    cb_assert(!stale);
+
+    /* Everyone else has to wait for the refill */
+    cb_assert(h1->get_lease(h, NULL, &test_item, key, (int)strlen(key), 0,
+                            &other, &stale) == ENGINE_TMPFAIL);
+    assert_equal(uint64_t(0), other);
+
+    /* The lease isn't a value */
+    cb_assert(h1->get(h, NULL, &test_item, key, (int)strlen(key),
+                      0) == ENGINE_KEY_ENOENT);
+    assert_equal(ENGINE_NOT_STORED,
+                 lease_refill(h, h1, key, 0, OPERATION_REPLACE));
+    assert_equal(ENGINE_KEY_EEXISTS,
+                 lease_refill(h, h1, key, lease + 1, OPERATION_CAS));
+
+    assert_equal(ENGINE_SUCCESS,
+                 lease_refill(h, h1, key, lease, OPERATION_CAS));
+    cb_assert(h1->get_lease(h, NULL, &test_item, key, (int)strlen(key), 0,
+                            &other, &stale) == ENGINE_SUCCESS);
+    cb_assert(!stale);
+    assert_equal(uint64_t(0), other);
+    h1->release(h, NULL, test_item);
+
+    assert_equal(uint64_t(1), get_lease_stat(h, h1, "leases_issued"));
+    assert_equal(uint64_t(1), get_lease_stat(h, h1, "lease_refills_avoided"));
+    return SUCCESS;
+}
+
+/*
+ * Make sure that a delete or a store without the token invalidates the
+ * lease
+ */
+static enum test_result lease_invalidate_test(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    const char *key = "lease_invalidate_key";
+    item *test_item = NULL;
+    uint64_t lease = 0;
+    uint64_t cas = 0;
+    mutation_descr_t mut_info;
+    bool stale;
+
+    cb_assert(h1->get_lease(h, NULL, &test_item, key, (int)strlen(key), 0,
+                            &lease, &stale) == ENGINE_KEY_ENOENT);
+    cb_assert(h1->remove(h, NULL, key, strlen(key), &cas, 0,
+                         &mut_info) == ENGINE_KEY_ENOENT);
+    assert_equal(ENGINE_KEY_ENOENT,
+                 lease_refill(h, h1, key, lease, OPERATION_CAS));
+
+    cb_assert(h1->get_lease(h, NULL, &test_item, key, (int)strlen(key), 0,
+                            &lease, &stale) == ENGINE_KEY_ENOENT);
+    assert_equal(ENGINE_SUCCESS, lease_refill(h, h1, key, 0, OPERATION_ADD));
+    assert_equal(ENGINE_KEY_EEXISTS,
+                 lease_refill(h, h1, key, lease, OPERATION_CAS));
+    return SUCCESS;
+}
+
+/*
+ * Make sure that another client gets a lease if the holder of the lease
+ * doesn't refill the key in time
+ */
+static enum test_result lease_expiry_test(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    const char *key = "lease_expiry_key";
+    item *test_item = NULL;
+    uint64_t lease = 0;
+    uint64_t other = 0;
+    bool stale;
+
+    cb_assert(h1->get_lease(h, NULL, &test_item, key, (int)strlen(key), 0,
+                            &lease, &stale) == ENGINE_KEY_ENOENT);
+    test_harness.time_travel(6);
+    cb_assert(h1->get_lease(h, NULL, &test_item, key, (int)strlen(key), 0,
+                            &other, &stale) == ENGINE_TMPFAIL);
+    test_harness.time_travel(6);
+    cb_assert(h1->get_lease(h, NULL, &test_item, key, (int)strlen(key), 0,
+                            &other, &stale) == ENGINE_KEY_ENOENT);
+    cb_assert(other != 0 && other != lease);
+    assert_equal(ENGINE_KEY_EEXISTS,
+                 lease_refill(h, h1, key, lease, OPERATION_CAS));
+    assert_equal(ENGINE_SUCCESS,
+                 lease_refill(h, h1, key, other, OPERATION_CAS));
+    return SUCCESS;
+}
+
+/*
+ * Make sure that the expired value is served to the other clients while
+ * the key is refilled (within the grace period)
+ */
+static enum test_result lease_stale_test(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    const char *key = "lease_stale_key";
+    item *test_item = NULL;
+    item_info info;
+    uint64_t lease = 0;
+    uint64_t other = 0;
+    uint64_t cas = 0;
+    bool stale = true;
+
+    cb_assert(h1->allocate(h, NULL, &test_item, key, strlen(key), 5, 0xcafe,
+                           10, PROTOCOL_BINARY_RAW_BYTES) == ENGINE_SUCCESS);
+    memset(&info, 0, sizeof(info));
+    info.nvalue = 1;
+    cb_assert(h1->get_item_info(h, NULL, test_item, &info));
+    memcpy(info.value[0].iov_base, "stale", 5);
+    cb_assert(h1->store(h, NULL, test_item, &cas, OPERATION_SET,
+                        0) == ENGINE_SUCCESS);
+    h1->release(h, NULL, test_item);
+    test_harness.time_travel(11);
+
+    cb_assert(h1->get_lease(h, NULL, &test_item, key, (int)strlen(key), 0,
+                            &lease, &stale) == ENGINE_KEY_ENOENT);
+    cb_assert(lease != 0);
+
+    cb_assert(h1->get_lease(h, NULL, &test_item, key, (int)strlen(key), 0,
+                            &other, &stale) == ENGINE_SUCCESS);
+    cb_assert(stale);
+    assert_equal(uint64_t(0), other);
+    memset(&info, 0, sizeof(info));
+    info.nvalue = 1;
+    cb_assert(h1->get_item_info(h, NULL, test_item, &info));
+    assert_equal(uint32_t(0xcafe), info.flags);
+    assert_equal(5u, info.nbytes);
+    cb_assert(memcmp(info.value[0].iov_base, "stale", 5) == 0);
+    h1->release(h, NULL, test_item);
+
+    /* Only GET_LEASE serves stale values */
+    cb_assert(h1->get(h, NULL, &test_item, key, (int)strlen(key),
+                      0) == ENGINE_KEY_ENOENT);
+
+    assert_equal(ENGINE_SUCCESS,
+                 lease_refill(h, h1, key, lease, OPERATION_CAS));
+    cb_assert(h1->get_lease(h, NULL, &test_item, key, (int)strlen(key), 0,
+                            &other, &stale) == ENGINE_SUCCESS);
+    cb_assert(!stale);
+    h1->release(h, NULL, test_item);
+
+    assert_equal(uint64_t(1), get_lease_stat(h, h1, "leases_issued"));
+    assert_equal(uint64_t(1), get_lease_stat(h, h1, "lease_stale_hits"));
+    assert_equal(uint64_t(1), get_lease_stat(h, h1, "lease_refills_avoided"));
+    return SUCCESS;
+}
+
+/*
+ * The lease token is the CAS of the lease, so leases need CAS
+ */
+static enum test_result lease_no_cas_test(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    item *test_item = NULL;
+    uint64_t lease = 0;
+    bool stale;
+    cb_assert(h1->get_lease(h, NULL, &test_item, "lease_no_cas", 12, 0,
+                            &lease, &stale) == ENGINE_ENOTSUP);
+    return SUCCESS;
+}
+
 MEMCACHED_PUBLIC_API
 engine_test_t* get_tests(void) {
     static engine_test_t tests[]  = {
@@ -994,6 +1369,16 @@ engine_test_t* get_tests(void) {
         TEST_CASE("Get And Touch", gat_test, NULL, NULL, NULL, NULL, NULL),
         TEST_CASE("Get And Touch Quiet", gatq_test, NULL, NULL, NULL, NULL, NULL),
         TEST_CASE("Test datatype", test_datatype, NULL, NULL, NULL, NULL, NULL),
+        TEST_CASE("scan test", scan_test, NULL, NULL, NULL, NULL, NULL),
+        TEST_CASE("scan prefix test", scan_prefix_test, NULL, NULL, NULL, NULL, NULL),
+        TEST_CASE("scan expiry test", scan_expiry_test, NULL, NULL, NULL, NULL, NULL),
+        TEST_CASE("scan expand test", scan_expand_test, NULL, NULL, NULL, NULL, NULL),
+        TEST_CASE("store multi test", store_multi_test, NULL, NULL, NULL, NULL, NULL),
+        TEST_CASE("lease test", lease_test, NULL, NULL, NULL, NULL, NULL),
+        TEST_CASE("lease invalidate test", lease_invalidate_test, NULL, NULL, NULL, NULL, NULL),
+        TEST_CASE("lease expiry test", lease_expiry_test, NULL, NULL, NULL, NULL, NULL),
+        TEST_CASE("lease stale test", lease_stale_test, NULL, NULL, "lease_grace=60", NULL, NULL),
+        TEST_CASE("lease without cas test", lease_no_cas_test, NULL, NULL, "use_cas=false", NULL, NULL),
         TEST_CASE_V2("Bucket destroy", test_n_bucket_destroy, NULL, NULL, NULL, NULL, NULL),
         TEST_CASE_V2("Bucket destroy interleaved", test_bucket_destroy_interleaved, NULL, NULL, NULL, NULL, NULL),
         TEST_CASE(NULL, NULL, NULL, NULL, NULL, NULL, NULL)
@@ -166,7 +166,13 @@ static const std::map<uint8_t, std::string> commandmap {
     {PROTOCOL_BINARY_CMD_GET_CMD_TIMER,"GET_CMD_TIMER"},
     {PROTOCOL_BINARY_CMD_SET_CTRL_TOKEN,"SET_CTRL_TOKEN"},
     {PROTOCOL_BINARY_CMD_GET_CTRL_TOKEN,"GET_CTRL_TOKEN"},
-    {PROTOCOL_BINARY_CMD_INIT_COMPLETE,"INIT_COMPLETE"}
+    {PROTOCOL_BINARY_CMD_INIT_COMPLETE,"INIT_COMPLETE"},
+    {PROTOCOL_BINARY_CMD_SHM_CONNECT,"SHM_CONNECT"},
+    {PROTOCOL_BINARY_CMD_GET_MULTI,"GET_MULTI"},
+    {PROTOCOL_BINARY_CMD_SCAN,"SCAN"},
+    {PROTOCOL_BINARY_CMD_BULK_STORE,"BULK_STORE"},
+    {PROTOCOL_BINARY_CMD_BULK_STOREQ,"BULK_STOREQ"},
+    {PROTOCOL_BINARY_CMD_GET_LEASE,"GET_LEASE"}
 };
 
 const char *memcached_opcode_2_text(uint8_t opcode) {